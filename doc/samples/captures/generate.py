@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+"""
+Generates the SML replay captures used by the native benchmark environment.
+
+The telegrams mirror the layout of the meters listed below (message order,
+OBIS registers, value widths, units and scalers) and are framed exactly like
+on the optical interface: escape sequences, fill bytes and X.25 CRCs.
+
+The captures of the other protocols go to protocols/: SML as hexadecimal
+text and IEC 62056-21 (D0) telegrams as sent by a meter on its own (Q3D
+layout) and as read out in mode C (MT174 layout, identification at 300
+baud, data block with BCC at the offered 9600 baud).
+
+Usage: python3 generate.py [output directory]
+"""
+
+import os
+import random
+import struct
+import sys
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc ^ 0xFFFF
+
+
+def tl(type_nibble, length):
+    # length includes the TL bytes themselves for everything but lists
+    if type_nibble != 0x7:
+        n = 1
+        while length + n > (1 << (4 * n)) - 1:
+            n += 1
+        length += n
+    else:
+        n = 1
+        while length > (1 << (4 * n)) - 1:
+            n += 1
+    out = []
+    for i in range(n):
+        nibble = (length >> (4 * (n - 1 - i))) & 0x0F
+        more = 0x80 if i < n - 1 else 0x00
+        out.append(more | ((type_nibble << 4) if i == 0 else 0) | nibble)
+    return bytes(out)
+
+
+def octets(data):
+    return tl(0x0, len(data)) + bytes(data)
+
+
+def unsigned(value, width):
+    return tl(0x6, width) + value.to_bytes(width, 'big')
+
+
+def integer(value, width):
+    return tl(0x5, width) + value.to_bytes(width, 'big', signed=True)
+
+
+def boolean(value):
+    return bytes([0x42, 0x01 if value else 0x00])
+
+
+def lst(*items):
+    return tl(0x7, len(items)) + b''.join(items)
+
+
+NONE = b'\x01'
+
+
+def sec_index(seconds):
+    return lst(unsigned(1, 1), unsigned(seconds, 4))
+
+
+def message(transaction_id, tag, body):
+    content = lst(octets(transaction_id), unsigned(0, 1), unsigned(0, 1),
+                  lst(unsigned(tag, 2), body))
+    # list header says six elements: re-encode with crc and end of message
+    head = tl(0x7, 6)
+    content = head + content[1:]
+    crc = crc16(content)
+    return content + bytes([0x63, crc & 0xFF, crc >> 8]) + b'\x00'
+
+
+def open_response(file_id, server_id):
+    return lst(NONE, NONE, octets(file_id), octets(server_id), NONE, NONE)
+
+
+def close_response():
+    return lst(NONE)
+
+
+def entry(obis, value, unit=None, scaler=None, status=None, val_time=None):
+    return lst(octets(obis),
+               status if status is not None else NONE,
+               val_time if val_time is not None else NONE,
+               unsigned(unit, 1) if unit is not None else NONE,
+               integer(scaler, 1) if scaler is not None else NONE,
+               value,
+               NONE)
+
+
+def get_list_response(server_id, list_name, seconds, entries):
+    return lst(NONE, octets(server_id), octets(list_name), sec_index(seconds),
+               lst(*entries), NONE, NONE)
+
+
+def escape(payload):
+    # The message goes in blocks of four bytes, only blocks of four 0x1B are
+    # sent twice
+    blocks = [payload[i:i + 4] for i in range(0, len(payload), 4)]
+    return b''.join(block * 2 if block == b'\x1b' * 4 else block for block in blocks)
+
+
+def frame(messages):
+    payload = escape(b''.join(messages))
+    fill = (4 - len(payload) % 4) % 4
+    data = b'\x1b\x1b\x1b\x1b\x01\x01\x01\x01' + payload + b'\x00' * fill
+    data += b'\x1b\x1b\x1b\x1b\x1a' + bytes([fill])
+    crc = crc16(data)
+    return data + bytes([crc & 0xFF, crc >> 8])
+
+
+def obis(a, b, c, d, e, f=255):
+    return bytes([a, b, c, d, e, f])
+
+
+def ed300l(n, seconds, energy_in, energy_out, power):
+    server_id = bytes([0x06, 0x45, 0x4D, 0x48, 0x01, 0x00, 0x27, 0x81, 0x5A, 0x0C])
+    file_id = struct.pack('>I', 0x00A3C400 + n)
+    entries = [
+        entry(obis(129, 129, 199, 130, 3), octets(b'EMH')),
+        entry(obis(1, 0, 0, 0, 9), octets(server_id)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy_in, 8), unit=30, scaler=-1,
+              status=unsigned(0x0182, 2)),
+        entry(obis(1, 0, 2, 8, 0), unsigned(energy_out, 8), unit=30, scaler=-1,
+              status=unsigned(0x0182, 2)),
+        entry(obis(1, 0, 1, 8, 1), unsigned(0, 8), unit=30, scaler=-1),
+        entry(obis(1, 0, 2, 8, 1), unsigned(energy_out, 8), unit=30, scaler=-1),
+        entry(obis(1, 0, 1, 8, 2), unsigned(energy_in, 8), unit=30, scaler=-1),
+        entry(obis(1, 0, 2, 8, 2), unsigned(0, 8), unit=30, scaler=-1),
+        entry(obis(1, 0, 16, 7, 0), integer(power, 4), unit=27, scaler=-1),
+        entry(obis(129, 129, 199, 130, 5), octets(bytes(range(0x40, 0x70)))),
+    ]
+    return frame([
+        message(file_id + b'\x01', 0x0101, open_response(file_id, server_id)),
+        message(file_id + b'\x02', 0x0701,
+                get_list_response(server_id, obis(1, 0, 98, 11, 255, 255)[:6],
+                                  seconds, entries)),
+        message(file_id + b'\x03', 0x0201, close_response()),
+    ])
+
+
+def mt175(n, seconds, energy_in, energy_out, powers):
+    server_id = bytes([0x09, 0x01, 0x49, 0x53, 0x4B, 0x00, 0x04, 0x7A, 0x5E, 0x98, 0x01])
+    file_id = struct.pack('>I', 0x0011A000 + n)
+    entries = [
+        entry(obis(129, 129, 199, 130, 3), octets(b'ISK')),
+        entry(obis(1, 0, 0, 0, 9), octets(server_id)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy_in, 5), unit=30, scaler=-1,
+              status=unsigned(0x00040104, 4)),
+        entry(obis(1, 0, 2, 8, 0), unsigned(energy_out, 5), unit=30, scaler=-1),
+        entry(obis(1, 0, 16, 7, 0), integer(sum(powers), 3), unit=27, scaler=0),
+        entry(obis(1, 0, 36, 7, 0), integer(powers[0], 3), unit=27, scaler=0),
+        entry(obis(1, 0, 56, 7, 0), integer(powers[1], 3), unit=27, scaler=0),
+        entry(obis(1, 0, 76, 7, 0), integer(powers[2], 3), unit=27, scaler=0),
+        entry(obis(1, 0, 96, 50, 1, 1), octets(b'\x1b\x1b\x1b\x1bISK')),
+        entry(obis(1, 0, 96, 90, 2, 1), boolean(n % 2 == 0)),
+    ]
+    return frame([
+        message(file_id + b'\x00', 0x0101, open_response(file_id, server_id)),
+        message(file_id + b'\x01', 0x0701,
+                get_list_response(server_id, obis(1, 0, 98, 11, 255, 255)[:6],
+                                  seconds, entries)),
+        message(file_id + b'\x02', 0x0201, close_response()),
+    ])
+
+
+def sml_text(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append(' '.join('%02X' % b for b in data[i:i + 16]))
+    return ('\r\n'.join(lines) + '\r\n\r\n').encode('ascii')
+
+
+def q3d(n, energy_in, powers):
+    lines = [
+        '1-0:0.0.0*255(1ESY1160123456)',
+        '1-0:1.8.0*255(%015.7f*kWh)' % (energy_in / 1e7),
+        '1-0:2.8.0*255(%015.7f*kWh)' % 0,
+        '1-0:21.7.255*255(%09.2f*W)' % powers[0],
+        '1-0:41.7.255*255(%09.2f*W)' % powers[1],
+        '1-0:61.7.255*255(%09.2f*W)' % powers[2],
+        '1-0:1.7.255*255(%09.2f*W)' % sum(powers),
+        '1-0:96.5.5*255(82)',
+        '0-0:96.1.255*255(1ESY1160123456)',
+    ]
+    return ('/ESY5Q3DA1004 V3.04\r\n\r\n' + ''.join(l + '\r\n' for l in lines) + '!\r\n').encode('ascii')
+
+
+def bcc(data):
+    check = 0
+    for b in data:
+        check ^= b
+    return check
+
+
+def mt174(n, energy_t1, energy_t2, energy_out):
+    lines = [
+        '0.0.0(%08d)' % 12345678,
+        '0.9.1(%06d)' % (120000 + n),
+        '0.9.2(%06d)' % 231017,
+        '1.8.0(%011.3f*kWh)' % ((energy_t1 + energy_t2) / 1000),
+        '1.8.1(%011.3f*kWh)' % (energy_t1 / 1000),
+        '1.8.2(%011.3f*kWh)' % (energy_t2 / 1000),
+        '2.8.0(%011.3f*kWh)' % (energy_out / 1000),
+        'C.1.0(%08d)' % 12345678,
+        'F.F(0000000)',
+    ]
+    block = (''.join(l + '\r\n' for l in lines) + '!\r\n').encode('ascii') + b'\x03'
+    return b'/ISk5MT174-0001\r\n' + b'\x02' + block + bytes([bcc(block)])
+
+
+def noise(rng, length):
+    return bytes(rng.choice([0x00, 0xFF, 0x1B, rng.randrange(256)]) for _ in range(length))
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    rng = random.Random(4711)
+
+    ed = []
+    for n in range(16):
+        ed.append(ed300l(n, 3600 + 2 * n, 35462459 + 3 * n, 132, 4512 + 17 * (n % 5)))
+
+    mt = []
+    for n in range(16):
+        mt.append(mt175(n, 90000 + n, 1234567 + n, 89, [230 + n, -15 - n, 118]))
+
+    captures = {
+        'ed300l.bin': b''.join(ed),
+        'mt175.bin': b''.join(mt),
+        'ed300l_noise.bin': b''.join(noise(rng, rng.randrange(4, 64)) + f for f in ed),
+    }
+
+    corrupt = []
+    for i, f in enumerate(ed):
+        if i % 4 == 1:
+            f = bytearray(f)
+            f[rng.randrange(12, len(f) - 12)] ^= 1 << rng.randrange(8)
+            f = bytes(f)
+        corrupt.append(f)
+    captures['ed300l_corrupt.bin'] = b''.join(corrupt)
+
+    truncated = []
+    for i, f in enumerate(ed):
+        if i % 4 == 2:
+            f = f[:rng.randrange(16, len(f) - 8)]
+        truncated.append(f)
+    captures['ed300l_truncated.bin'] = b''.join(truncated)
+
+    protocols = {
+        # The same telegrams as ed300l_corrupt.bin
+        'ed300l_text.txt': b''.join(sml_text(f) for f in corrupt),
+    }
+
+    telegrams = []
+    for n in range(16):
+        t = q3d(n, 123456789012 + 2500 * n, [123.45 + n, 45.67, 78.9])
+        if n == 9:
+            # Broken off by the next telegram
+            t = t[:len(t) // 2]
+        telegrams.append(t)
+    protocols['q3d_d0.txt'] = b''.join(telegrams)
+
+    readouts = []
+    for n in range(8):
+        t = bytearray(mt174(n, 10000000 + 7 * n, 2345678 + 3 * n, 123456))
+        if n == 5:
+            t[-1] ^= 0x01
+        readouts.append(bytes(t))
+    protocols['mt174_mode_c.txt'] = b''.join(readouts)
+
+    for directory, files in ((out, captures), (os.path.join(out, 'protocols'), protocols)):
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        for name, data in files.items():
+            with open(os.path.join(directory, name), 'wb') as fp:
+                fp.write(data)
+            print('%-24s %6d bytes' % (os.path.relpath(os.path.join(directory, name), out), len(data)))
+
+
+if __name__ == '__main__':
+    main()
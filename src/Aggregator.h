@@ -0,0 +1,254 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+
+const uint8_t AGGREGATOR_SIZE = 16; // OBIS codes tracked per sensor
+
+// Numeric values of one OBIS code over the current window
+struct Aggregate
+{
+    uint8_t obis[OBIS_LENGTH];
+    int8_t scaler;
+    uint8_t unit;
+    bool carried;   // [last] is the value of the previous window
+    bool summarized; // Published with a part of a summary that is not complete yet
+    uint32_t count; // Readings in the current window, 0 if none
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    int64_t first;  // Start of the delta
+    int64_t last;
+
+    // Cumulative registers (C.8.x, e.g. 1-0:1.8.0 and 1-0:2.8.0) are given
+    // as their last value and how much they advanced
+    bool is_counter() const
+    {
+        return this->obis[3] == 8;
+    }
+};
+
+// Summarizes the numeric readings of a sensor per OBIS code over windows of
+// [window] seconds instead of publishing every telegram: min, max, mean and
+// last value, or the delta of cumulative registers. Memory is fixed, OBIS
+// codes beyond AGGREGATOR_SIZE are counted and left out.
+class Aggregator
+{
+public:
+    explicit Aggregator(uint16_t window) : window(window)
+    {
+        memset(this->aggregates, 0, sizeof(this->aggregates));
+    }
+
+    void add(const SmlReading &reading)
+    {
+        if (!reading.is_numeric())
+        {
+            return;
+        }
+        Aggregate *aggregate = this->find(reading.obis);
+        if (aggregate == NULL)
+        {
+            this->untracked++;
+            return;
+        }
+        int64_t value = reading.value;
+        bool changed = aggregate->scaler != reading.scaler || aggregate->unit != reading.unit;
+        if (aggregate->count == 0 || changed)
+        {
+            // Deltas continue from the previous window, so nothing between
+            // two windows is lost. A changed scaler starts over rather than
+            // mixing magnitudes.
+            aggregate->first = aggregate->carried && !changed ? aggregate->last : value;
+            aggregate->scaler = reading.scaler;
+            aggregate->unit = reading.unit;
+            aggregate->count = 0;
+            aggregate->min = value;
+            aggregate->max = value;
+            aggregate->sum = 0;
+        }
+        aggregate->min = value < aggregate->min ? value : aggregate->min;
+        aggregate->max = value > aggregate->max ? value : aggregate->max;
+        aggregate->sum += value;
+        aggregate->last = value;
+        aggregate->count++;
+        if (!this->has_readings)
+        {
+            this->from = reading.time;
+            this->has_readings = true;
+        }
+        this->to = reading.time;
+    }
+
+    // Marks the end of a telegram received at [now] (milliseconds), the
+    // first one opens the window
+    void end_telegram(unsigned long now)
+    {
+        if (this->telegrams == 0)
+        {
+            this->opened_at = now;
+        }
+        this->telegrams++;
+    }
+
+    // Whether the window is over and its summary can be published
+    bool due(unsigned long now) const
+    {
+        return this->telegrams > 0 && now - this->opened_at >= this->window * 1000UL;
+    }
+
+    // Starts the next window, OBIS codes keep their slots
+    void reset()
+    {
+        for (uint8_t i = 0; i < this->used; i++)
+        {
+            Aggregate &aggregate = this->aggregates[i];
+            if (aggregate.summarized)
+            {
+                // Already in its next window
+                aggregate.summarized = false;
+                continue;
+            }
+            aggregate.carried = aggregate.carried || aggregate.count > 0;
+            aggregate.count = 0;
+        }
+        this->telegrams = 0;
+        this->has_readings = false;
+        this->from = 0;
+        this->to = 0;
+    }
+
+    // Starts the next window of the OBIS code at [index] once it was
+    // published with a part of a summary, while the window of the others
+    // goes on until the rest could be published
+    void summarized(uint8_t index)
+    {
+        Aggregate &aggregate = this->aggregates[index];
+        aggregate.carried = aggregate.carried || aggregate.count > 0;
+        aggregate.count = 0;
+        aggregate.summarized = true;
+    }
+
+    // Slots of OBIS codes, those without readings in this window have a
+    // count of 0
+    uint8_t size() const
+    {
+        return this->used;
+    }
+
+    const Aggregate &get(uint8_t index) const
+    {
+        return this->aggregates[index];
+    }
+
+    uint32_t get_telegrams() const
+    {
+        return this->telegrams;
+    }
+
+    // Meter time of the first and the last reading of the window
+    uint32_t get_from() const
+    {
+        return this->from;
+    }
+
+    uint32_t get_to() const
+    {
+        return this->to;
+    }
+
+    // Readings of OBIS codes that did not fit
+    unsigned long get_untracked() const
+    {
+        return this->untracked;
+    }
+
+private:
+    uint16_t window;
+    Aggregate aggregates[AGGREGATOR_SIZE];
+    uint8_t used = 0;
+    uint32_t telegrams = 0;
+    bool has_readings = false;
+    uint32_t from = 0;
+    uint32_t to = 0;
+    unsigned long opened_at = 0;
+    unsigned long untracked = 0;
+
+    Aggregate *find(const uint8_t *obis)
+    {
+        for (uint8_t i = 0; i < this->used; i++)
+        {
+            if (memcmp(this->aggregates[i].obis, obis, OBIS_LENGTH) == 0)
+            {
+                return &this->aggregates[i];
+            }
+        }
+        if (this->used == AGGREGATOR_SIZE)
+        {
+            return NULL;
+        }
+        Aggregate *aggregate = &this->aggregates[this->used++];
+        memcpy(aggregate->obis, obis, OBIS_LENGTH);
+        return aggregate;
+    }
+};
+
+// Raw [value] * 10^[scaler] as a decimal number, returns the length or 0
+inline size_t sml_format_raw(int64_t value, int8_t scaler, char *out, size_t size)
+{
+    return value < 0 ? sml_format_scaled(0 - (uint64_t)value, true, scaler, out, size)
+                     : sml_format_scaled((uint64_t)value, false, scaler, out, size);
+}
+
+// One entry of the summary document, [unit] may be NULL:
+//   {"obis":"1-0:16.7.0*255","min":1.5,"max":9.5,"mean":4.25,"last":2.0,"unit":"W"}
+//   {"obis":"1-0:1.8.0*255","last":1234.5,"delta":0.5,"unit":"Wh"}
+// The mean has one decimal more than the values. Returns the length, 0 if it
+// does not fit.
+inline size_t format_aggregate(const Aggregate &aggregate, const char *unit, char *out, size_t size)
+{
+    char obis[24];
+    char numbers[4][24];
+    sml_format_obis(aggregate.obis, '*', obis, sizeof(obis));
+    int n;
+    if (aggregate.is_counter())
+    {
+        sml_format_raw(aggregate.last, aggregate.scaler, numbers[0], sizeof(numbers[0]));
+        sml_format_raw(aggregate.last - aggregate.first, aggregate.scaler, numbers[1], sizeof(numbers[1]));
+        n = snprintf(out, size, "{\"obis\":\"%s\",\"last\":%s,\"delta\":%s", obis, numbers[0], numbers[1]);
+    }
+    else
+    {
+        // Rounded half away from zero
+        int64_t mean = aggregate.sum * 10 / aggregate.count;
+        int64_t remainder = aggregate.sum * 10 % aggregate.count;
+        if (2 * (remainder < 0 ? -remainder : remainder) >= aggregate.count)
+        {
+            mean += remainder < 0 ? -1 : 1;
+        }
+        sml_format_raw(aggregate.min, aggregate.scaler, numbers[0], sizeof(numbers[0]));
+        sml_format_raw(aggregate.max, aggregate.scaler, numbers[1], sizeof(numbers[1]));
+        sml_format_raw(mean, aggregate.scaler - 1, numbers[2], sizeof(numbers[2]));
+        sml_format_raw(aggregate.last, aggregate.scaler, numbers[3], sizeof(numbers[3]));
+        n = snprintf(out, size, "{\"obis\":\"%s\",\"min\":%s,\"max\":%s,\"mean\":%s,\"last\":%s", obis, numbers[0],
+                     numbers[1], numbers[2], numbers[3]);
+    }
+    if (n < 0 || (size_t)n >= size)
+    {
+        return 0;
+    }
+    size_t len = n;
+    n = unit != NULL ? snprintf(out + len, size - len, ",\"unit\":\"%s\"}", unit) : snprintf(out + len, size - len, "}");
+    if (n < 0 || (size_t)n >= size - len)
+    {
+        return 0;
+    }
+    return len + n;
+}
+
+#endif
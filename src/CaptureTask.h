@@ -0,0 +1,94 @@
+#ifndef CAPTURE_TASK_H
+#define CAPTURE_TASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Sensor.h"
+#include "TelegramChannel.h"
+
+const uint8_t CAPTURE_TASK_CORE = 0;       // The loop, MQTT and the web interface run on core 1
+const uint8_t CAPTURE_TASK_PRIORITY = 2;   // Above the loop task
+const uint32_t CAPTURE_TASK_STACK = 4096;  // Bytes
+const uint32_t CAPTURE_TASK_PERIOD = 10;   // ms between turns, 96 bytes at 9600 baud
+
+// Reads a sensor in a FreeRTOS task of its own, pinned to the core the
+// loop does not run on, so that WiFi, MQTT and the web interface never
+// hold up reading. The listeners of the sensor run in the task as well and
+// copy the readings of a message into the channel, where the loop takes
+// them from. A complete message is only processed once the channel has a
+// free slot, until then it waits in the sensor and its overrun policy
+// applies.
+class CaptureTask
+{
+public:
+    explicit CaptureTask(Sensor *sensor) : sensor(sensor)
+    {
+        this->sensor->channel = &this->channel;
+    }
+
+    ~CaptureTask()
+    {
+        this->sensor->channel = NULL;
+    }
+
+    // One turn on [sensor], returns whether a message was processed
+    static bool turn(Sensor *sensor)
+    {
+        if (sensor->capture(SIZE_MAX) && sensor->channel->claim() != NULL)
+        {
+            sensor->process();
+            return true;
+        }
+        return false;
+    }
+
+    TelegramChannel channel;
+
+#ifdef ESP32
+    bool start()
+    {
+        if (xTaskCreatePinnedToCore(run, this->sensor->config->name, CAPTURE_TASK_STACK, this,
+                                    CAPTURE_TASK_PRIORITY, NULL, CAPTURE_TASK_CORE) != pdPASS)
+        {
+            this->stopped = true;
+            return false;
+        }
+        return true;
+    }
+
+    // Returns once the task has left the sensor alone
+    void stop()
+    {
+        this->stopping = true;
+        while (!this->stopped)
+        {
+            delay(1);
+        }
+    }
+#endif
+
+private:
+    Sensor *sensor;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> stopped{false};
+
+#ifdef ESP32
+    static void run(void *parameter)
+    {
+        CaptureTask *task = (CaptureTask *)parameter;
+        while (!task->stopping)
+        {
+            // Messages waiting in the sensor go on right away
+            if (!turn(task->sensor))
+            {
+                vTaskDelay(pdMS_TO_TICKS(CAPTURE_TASK_PERIOD));
+            }
+        }
+        task->stopped = true;
+        vTaskDelete(NULL);
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef CHANGE_FILTER_H
+#define CHANGE_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SmlCrc.h"
+
+const uint8_t CHANGE_FILTER_SIZE = 16; // OBIS codes tracked per sensor
+
+// Deadband of a single OBIS code. A value is only published again once it
+// differs from the last published one by at least one of the thresholds.
+class DeadbandConfig
+{
+public:
+    const uint8_t obis[OBIS_LENGTH];
+    const uint32_t absolute; // In units of the scaled value, e.g. W for 1-0:16.7.0
+    const uint16_t relative; // In per mille of the last published value
+};
+
+// Suppresses readings that did not change (or stayed within their deadband)
+// since they were last published. Every value is published again after
+// [heartbeat] seconds of silence. Tracks a fixed number of OBIS codes,
+// readings beyond that are always published.
+class ChangeFilter
+{
+public:
+    ChangeFilter(const DeadbandConfig *deadbands, size_t num_deadbands, uint16_t heartbeat)
+        : deadbands(deadbands), num_deadbands(num_deadbands), heartbeat(heartbeat)
+    {
+        memset(this->entries, 0, sizeof(this->entries));
+    }
+
+    // Returns true if the reading has to be published and records it as
+    // published at [now] (milliseconds)
+    bool filter(const SmlReading &reading, unsigned long now)
+    {
+        int64_t value = this->comparable(reading);
+        Entry *entry = this->find(reading.obis);
+        if (entry == NULL)
+        {
+            return true;
+        }
+        if (entry->used && entry->scaler == reading.scaler &&
+            (this->heartbeat == 0 || (now - entry->published_at) < (this->heartbeat * 1000UL)) &&
+            !this->exceeds_deadband(reading, entry->value, value))
+        {
+            this->suppressed++;
+            return false;
+        }
+        entry->used = true;
+        entry->scaler = reading.scaler;
+        entry->value = value;
+        entry->published_at = now;
+        return true;
+    }
+
+    // Forget a reading that could not be published after all
+    void invalidate(const SmlReading &reading)
+    {
+        Entry *entry = this->find(reading.obis);
+        if (entry != NULL)
+        {
+            entry->used = false;
+        }
+    }
+
+    // Forget everything, e.g. after a whole telegram could not be published
+    void invalidate()
+    {
+        for (uint8_t i = 0; i < CHANGE_FILTER_SIZE; i++)
+        {
+            this->entries[i].used = false;
+        }
+    }
+
+    unsigned long get_suppressed() const
+    {
+        return this->suppressed;
+    }
+
+private:
+    struct Entry
+    {
+        uint8_t obis[OBIS_LENGTH];
+        bool assigned;
+        bool used;
+        int8_t scaler;
+        int64_t value;
+        unsigned long published_at;
+    };
+
+    const DeadbandConfig *deadbands;
+    size_t num_deadbands;
+    uint16_t heartbeat;
+    Entry entries[CHANGE_FILTER_SIZE];
+    unsigned long suppressed = 0;
+
+    // Finds the slot of an OBIS code, assigning a free one if needed
+    Entry *find(const uint8_t *obis)
+    {
+        for (uint8_t i = 0; i < CHANGE_FILTER_SIZE; i++)
+        {
+            Entry &entry = this->entries[i];
+            if (!entry.assigned)
+            {
+                memcpy(entry.obis, obis, OBIS_LENGTH);
+                entry.assigned = true;
+                return &entry;
+            }
+            if (memcmp(entry.obis, obis, OBIS_LENGTH) == 0)
+            {
+                return &entry;
+            }
+        }
+        return NULL;
+    }
+
+    // Numbers compare by value, octet strings by their checksum
+    int64_t comparable(const SmlReading &reading)
+    {
+        if (reading.type == SML_READING_OCTET_STRING)
+        {
+            return sml_crc16_update(SML_CRC16_INIT, reading.octets, reading.octets_len);
+        }
+        return reading.value;
+    }
+
+    bool exceeds_deadband(const SmlReading &reading, int64_t last, int64_t value)
+    {
+        if (value == last)
+        {
+            return false;
+        }
+        if (!reading.is_numeric())
+        {
+            return true;
+        }
+        const DeadbandConfig *deadband = NULL;
+        for (size_t i = 0; i < this->num_deadbands; i++)
+        {
+            if (memcmp(this->deadbands[i].obis, reading.obis, OBIS_LENGTH) == 0)
+            {
+                deadband = &this->deadbands[i];
+                break;
+            }
+        }
+        if (deadband == NULL)
+        {
+            return true;
+        }
+
+        uint64_t diff = (reading.type == SML_READING_UNSIGNED)
+                            ? ((uint64_t)value > (uint64_t)last ? (uint64_t)value - (uint64_t)last
+                                                                : (uint64_t)last - (uint64_t)value)
+                            : (value > last ? (uint64_t)(value - last) : (uint64_t)(last - value));
+        if (deadband->absolute > 0)
+        {
+            // Bring the threshold to the raw resolution of the value
+            uint64_t threshold = deadband->absolute;
+            int8_t scaler = reading.scaler;
+            for (; scaler < 0 && threshold <= diff; scaler++)
+            {
+                // Saturates, once above diff it only has to stay there
+                threshold = threshold > UINT64_MAX / 10 ? UINT64_MAX : threshold * 10;
+            }
+            for (; scaler > 0 && threshold > 0; scaler--)
+            {
+                threshold /= 10;
+            }
+            if (diff >= threshold)
+            {
+                return true;
+            }
+        }
+        if (deadband->relative > 0)
+        {
+            uint64_t magnitude = (reading.type == SML_READING_UNSIGNED || last >= 0) ? (uint64_t)last
+                                                                                     : (uint64_t)-last;
+            // diff * 1000 >= magnitude * relative, rounded up without
+            // overflowing for large counters
+            uint64_t quotient = magnitude / 1000;
+            uint64_t remainder = magnitude % 1000;
+            if (quotient <= (UINT64_MAX - UINT16_MAX) / deadband->relative &&
+                diff >= quotient * deadband->relative + (remainder * deadband->relative + 999) / 1000)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
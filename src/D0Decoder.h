@@ -0,0 +1,601 @@
+#ifndef D0_DECODER_H
+#define D0_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "ObisFilter.h"
+#include "SmlFraming.h"
+#include "SmlStreamDecoder.h"
+#include "TelegramDecoder.h"
+
+// IEC 62056-21 ("D0") telegrams:
+//   /ESY5Q3DA1004 V3.04 CR LF
+//   [STX] 1-0:1.8.0*255(00012345.6789*kWh) CR LF ... ! CR LF [ETX BCC]
+// The data block is framed by STX and ETX and followed by the XOR of
+// everything in between (BCC) when the meter has been asked for it (modes A
+// to C), meters sending on their own (mode D) leave both out.
+const uint8_t D0_MAX_READINGS = SML_STREAM_MAX_READINGS;
+const uint8_t D0_MAX_ID = 24;    // Characters of a data set address
+const uint8_t D0_MAX_VALUE = 32; // Characters of a value with its unit, longer ones are dropped
+const uint8_t D0_MAX_OCTETS = 16; // Values that are not numbers, e.g. serial numbers
+const uint8_t D0_MAX_IDENTIFICATION = 32;
+const size_t D0_MAX_LENGTH = SML_MAX_FRAME_LENGTH;
+const uint32_t D0_PUSH_BAUD_RATE = 9600;
+const uint32_t D0_REQUEST_BAUD_RATE = 300;
+const uint8_t D0_REQUEST_INTERVAL = 10;  // Seconds between requests if the sensor has no interval
+const uint8_t D0_RESPONSE_TIMEOUT = 60;  // Seconds from the request to the end of the readout
+const char D0_REQUEST[] = "/?!\r\n";
+const uint8_t D0_STX = 0x02;
+const uint8_t D0_ETX = 0x03;
+const uint8_t D0_ACK = 0x06;
+
+// Unit of a D0 value as a DLMS unit code and the power of ten of its prefix
+struct D0Unit
+{
+    const char *text;
+    uint8_t unit;
+    int8_t scaler;
+};
+
+const D0Unit D0_UNITS[] = {
+    {"Wh", 30, 0}, {"kWh", 30, 3}, {"MWh", 30, 6}, {"W", 27, 0}, {"kW", 27, 3}, {"MW", 27, 6},
+    {"varh", 32, 0}, {"kvarh", 32, 3}, {"var", 29, 0}, {"kvar", 29, 3}, {"VAh", 31, 0}, {"kVAh", 31, 3},
+    {"VA", 28, 0}, {"kVA", 28, 3}, {"V", 35, 0}, {"A", 33, 0}, {"Hz", 44, 0}, {"m3", 13, 0}};
+
+// Decodes D0 telegrams into the same readings as SML. Numbers become
+// integers with a scaler, units with a prefix are normalized (12.5*kWh is
+// 12500 Wh), other values are kept as octet strings. In modes A and C the
+// decoder also asks for the telegrams: it sends the request at 300 baud and,
+// in mode C, acknowledges the speed offered in the identification and
+// switches to it for the readout. What is sent is handed to the link as it
+// takes it, one byte per poll with a software serial, so a loop never waits
+// for more than one character at 300 baud.
+class D0Decoder : public TelegramDecoder
+{
+public:
+    // Entries not accepted by [filter] are not stored, NULL accepts all
+    D0Decoder(Protocol protocol, const ObisFilter *filter = NULL, uint8_t request_interval = D0_REQUEST_INTERVAL)
+        : protocol(protocol), filter(filter), request_interval(request_interval)
+    {
+        for (uint8_t i = 0; i < D0_MAX_READINGS; i++)
+        {
+            this->readings[i].obis = this->obis_store[i];
+            this->readings[i].octets = this->octets_store[i];
+        }
+    }
+
+    void begin(TelegramLink &link)
+    {
+        this->baud = this->requests() ? D0_REQUEST_BAUD_RATE : D0_PUSH_BAUD_RATE;
+        link.set_line(this->baud, LINE_7E1);
+    }
+
+    void poll(TelegramLink &link, unsigned long now)
+    {
+        if (!this->requests())
+        {
+            return;
+        }
+        if (this->exchange != EXCHANGE_IDLE &&
+            (this->finished || now - this->requested_at > D0_RESPONSE_TIMEOUT * 1000UL))
+        {
+            // Back to the request speed for the next one
+            if (!this->finished)
+            {
+                this->reset();
+            }
+            this->set_baud(link, D0_REQUEST_BAUD_RATE);
+            this->exchange = EXCHANGE_IDLE;
+            this->exchange_at = now;
+            this->outgoing_len = 0;
+            return;
+        }
+        if (this->outgoing_sent < this->outgoing_len)
+        {
+            // The exchange goes on once all of it has been handed over
+            this->outgoing_sent += link.send(this->outgoing + this->outgoing_sent,
+                                             this->outgoing_len - this->outgoing_sent);
+            this->exchange_at = now;
+            return;
+        }
+        switch (this->exchange)
+        {
+        case EXCHANGE_IDLE:
+            if (this->requested_at == 0 || now - this->exchange_at >= this->request_interval * 1000UL)
+            {
+                this->reset();
+                this->identified = false;
+                this->finished = false;
+                this->queue((const uint8_t *)D0_REQUEST, sizeof(D0_REQUEST) - 1);
+                this->exchange = EXCHANGE_REQUESTED;
+                this->requested_at = now > 0 ? now : 1;
+                this->exchange_at = now;
+            }
+            break;
+        case EXCHANGE_REQUESTED:
+            if (this->identified)
+            {
+                uint32_t offered = baud_rate(this->identification[3]);
+                if (this->protocol == PROTOCOL_D0_MODE_C && offered > 0)
+                {
+                    // Data readout at the offered speed
+                    uint8_t ack[] = {D0_ACK, '0', (uint8_t)this->identification[3], '0', '\r', '\n'};
+                    this->queue(ack, sizeof(ack));
+                    this->exchange = EXCHANGE_SWITCHING;
+                    this->exchange_at = now;
+                    this->next_baud = offered;
+                }
+                else
+                {
+                    this->exchange = EXCHANGE_READOUT;
+                }
+            }
+            break;
+        case EXCHANGE_SWITCHING:
+            // Once the acknowledgement has left at 10 bits per character,
+            // counted from handing over its last byte
+            if (now - this->exchange_at >= 6 * 10 * 1000UL / this->baud + 20)
+            {
+                this->set_baud(link, this->next_baud);
+                this->exchange = EXCHANGE_READOUT;
+            }
+            break;
+        case EXCHANGE_READOUT:
+            break;
+        }
+    }
+
+    bool requests() const
+    {
+        return this->protocol != PROTOCOL_D0;
+    }
+
+    void reset()
+    {
+        this->state = WAIT_FOR_START;
+    }
+
+    size_t feed(const uint8_t *data, size_t len, TelegramEvent &event)
+    {
+        event = TELEGRAM_NONE;
+        size_t i = 0;
+        if (this->state == WAIT_FOR_START)
+        {
+            const uint8_t *start = (const uint8_t *)memchr(data, '/', len);
+            if (start == NULL)
+            {
+                return len;
+            }
+            this->start();
+            event = TELEGRAM_STARTED;
+            return start - data + 1;
+        }
+        while (i < len && event == TELEGRAM_NONE)
+        {
+            uint8_t c = data[i];
+            if (++this->length > D0_MAX_LENGTH)
+            {
+                event = TELEGRAM_OVERFLOW;
+                this->end();
+                return i;
+            }
+            if (this->checked && this->state != CHECKSUM)
+            {
+                this->bcc ^= c;
+            }
+            switch (this->state)
+            {
+            case IDENTIFICATION:
+                if (c == '\n')
+                {
+                    this->identification[this->identification_len] = '\0';
+                    this->identified = true;
+                    this->state = WAIT_FOR_DATA;
+                }
+                else if (c != '\r' && this->identification_len < D0_MAX_IDENTIFICATION)
+                {
+                    this->identification[this->identification_len++] = c;
+                }
+                break;
+            case WAIT_FOR_DATA:
+                if (c == D0_STX)
+                {
+                    this->checked = true;
+                    this->bcc = 0;
+                    this->state = DATA;
+                }
+                else if (c != '\r' && c != '\n')
+                {
+                    this->state = DATA;
+                    this->data(c, event);
+                }
+                break;
+            case DATA:
+                if (c == '/' && !this->checked)
+                {
+                    // Another telegram starts before this one ended
+                    event = TELEGRAM_ABORTED;
+                    this->end();
+                    return i;
+                }
+                this->data(c, event);
+                break;
+            case END:
+                if (c == D0_ETX)
+                {
+                    this->state = CHECKSUM;
+                }
+                break;
+            case CHECKSUM:
+                event = c == this->bcc ? TELEGRAM_COMPLETE : TELEGRAM_CHECKSUM_ERROR;
+                this->end();
+                break;
+            default:
+                break;
+            }
+            i++;
+        }
+        return i;
+    }
+
+    const SmlReading *get_readings() const
+    {
+        return this->readings;
+    }
+
+    uint8_t get_count() const
+    {
+        return this->count;
+    }
+
+    // Data sets that did not fit into the store or had too long values
+    uint8_t get_dropped() const
+    {
+        return this->dropped;
+    }
+
+    // Identification of the last telegram, without the leading '/'
+    const char *get_identification() const
+    {
+        return this->identification;
+    }
+
+    // Speed announced by the character after the manufacturer in mode C, 0
+    // if there is none
+    static uint32_t baud_rate(char c)
+    {
+        return c >= '0' && c <= '6' ? 300UL << (c - '0') : 0;
+    }
+
+    // Data set addresses as A-B:C.D.E*F, C.D.E*F or C.D.E, where C may be a
+    // letter (C, F, L and P stand for 96 to 99) and E defaults to 0. Without
+    // A-B: it is 1-0: for electricity and 0-0: for the abstract 96 to 99.
+    static bool parse_address(const char *text, uint8_t *obis)
+    {
+        uint8_t numbers[6];
+        char separators[6];
+        uint8_t n = 0;
+        const char *p = text;
+        while (*p != '\0')
+        {
+            if (n == 6 || !parse_group(p, numbers[n]))
+            {
+                return false;
+            }
+            separators[n++] = *p;
+            if (*p != '\0')
+            {
+                p++;
+            }
+        }
+        uint8_t c = 0;
+        obis[0] = 1;
+        obis[1] = 0;
+        if (n >= 2 && separators[0] == '-' && separators[1] == ':')
+        {
+            obis[0] = numbers[0];
+            obis[1] = numbers[1];
+            c = 2;
+        }
+        if (n - c < 2 || separators[c] != '.')
+        {
+            return false;
+        }
+        if (c == 0 && numbers[0] >= 96 && numbers[0] <= 99)
+        {
+            obis[0] = 0;
+        }
+        obis[2] = numbers[c];
+        obis[3] = numbers[c + 1];
+        obis[4] = 0;
+        obis[5] = 255;
+        uint8_t rest = c + 2;
+        if (rest < n && separators[rest - 1] == '.')
+        {
+            obis[4] = numbers[rest++];
+        }
+        if (rest < n && (separators[rest - 1] == '*' || separators[rest - 1] == '&'))
+        {
+            obis[5] = numbers[rest++];
+        }
+        return rest == n;
+    }
+
+private:
+    enum ParseState
+    {
+        WAIT_FOR_START,
+        IDENTIFICATION,
+        WAIT_FOR_DATA,
+        DATA,
+        END,     // After '!', up to ETX
+        CHECKSUM // BCC
+    };
+
+    enum Exchange
+    {
+        EXCHANGE_IDLE,
+        EXCHANGE_REQUESTED,
+        EXCHANGE_SWITCHING, // Acknowledged, the speed changes once it has been sent
+        EXCHANGE_READOUT
+    };
+
+    Protocol protocol;
+    const ObisFilter *filter;
+    uint8_t request_interval;
+
+    ParseState state = WAIT_FOR_START;
+    size_t length = 0;
+    bool checked = false; // Framed by STX and ETX with a BCC
+    uint8_t bcc = 0;
+    char identification[D0_MAX_IDENTIFICATION + 1] = {};
+    uint8_t identification_len = 0;
+    char id[D0_MAX_ID + 1];
+    uint8_t id_len = 0;
+    char value[D0_MAX_VALUE + 1];
+    uint8_t value_len = 0;
+    bool in_value = false;
+    bool grouped = false; // The address already had its value
+
+    Exchange exchange = EXCHANGE_IDLE;
+    bool identified = false;
+    bool finished = false;
+    uint32_t baud = D0_REQUEST_BAUD_RATE;
+    uint32_t next_baud = D0_REQUEST_BAUD_RATE;
+    unsigned long requested_at = 0; // 0 before the first request
+    unsigned long exchange_at = 0;
+    uint8_t outgoing[6]; // Request or acknowledgement being sent
+    uint8_t outgoing_len = 0;
+    uint8_t outgoing_sent = 0;
+
+    SmlReading readings[D0_MAX_READINGS];
+    uint8_t obis_store[D0_MAX_READINGS][OBIS_LENGTH];
+    uint8_t octets_store[D0_MAX_READINGS][D0_MAX_OCTETS];
+    uint8_t count = 0;
+    uint8_t dropped = 0;
+
+    void start()
+    {
+        this->state = IDENTIFICATION;
+        this->length = 1;
+        this->checked = false;
+        this->identification_len = 0;
+        this->id_len = 0;
+        this->value_len = 0;
+        this->in_value = false;
+        this->grouped = false;
+        this->count = 0;
+        this->dropped = 0;
+    }
+
+    void end()
+    {
+        this->state = WAIT_FOR_START;
+        this->finished = true;
+    }
+
+    // Sends [data] from the next polls on
+    void queue(const uint8_t *data, uint8_t len)
+    {
+        memcpy(this->outgoing, data, len);
+        this->outgoing_len = len;
+        this->outgoing_sent = 0;
+    }
+
+    void set_baud(TelegramLink &link, uint32_t baud)
+    {
+        if (baud != this->baud)
+        {
+            this->baud = baud;
+            link.set_line(baud, LINE_7E1);
+        }
+    }
+
+    // One character of the data block
+    void data(uint8_t c, TelegramEvent &event)
+    {
+        if (this->in_value)
+        {
+            if (c == ')')
+            {
+                this->in_value = false;
+                if (!this->grouped && this->id_len > 0)
+                {
+                    // Further values of the same address (e.g. the time of a
+                    // maximum) are left out
+                    this->add();
+                }
+                this->grouped = true;
+            }
+            else if (c == '\r' || c == '\n')
+            {
+                this->in_value = false;
+                this->id_len = 0;
+                this->grouped = false;
+            }
+            else if (this->value_len <= D0_MAX_VALUE)
+            {
+                this->value[this->value_len++] = c;
+            }
+            return;
+        }
+        if (c == '(')
+        {
+            this->in_value = true;
+            this->value_len = 0;
+        }
+        else if (c == '\r' || c == '\n')
+        {
+            this->id_len = 0;
+            this->grouped = false;
+        }
+        else if (c == '!' && this->id_len == 0)
+        {
+            if (this->checked)
+            {
+                this->state = END;
+            }
+            else
+            {
+                event = TELEGRAM_COMPLETE;
+                this->end();
+            }
+        }
+        else
+        {
+            if (this->grouped)
+            {
+                this->id_len = 0;
+                this->grouped = false;
+            }
+            if (this->id_len < D0_MAX_ID)
+            {
+                this->id[this->id_len++] = c;
+            }
+        }
+    }
+
+    // Stores the data set just read
+    void add()
+    {
+        this->id[this->id_len] = '\0';
+        uint8_t obis[OBIS_LENGTH];
+        if (!parse_address(this->id, obis) || (this->filter != NULL && !this->filter->accepts(obis)))
+        {
+            return;
+        }
+        if (this->count == D0_MAX_READINGS || this->value_len > D0_MAX_VALUE || this->value_len == 0)
+        {
+            this->dropped += this->value_len > 0 ? 1 : 0;
+            return;
+        }
+        SmlReading &reading = this->readings[this->count];
+        memcpy(this->obis_store[this->count], obis, OBIS_LENGTH);
+        reading.time = 0;
+        reading.unit = 0;
+        reading.scaler = 0;
+        reading.value = 0;
+        reading.octets_len = 0;
+        if (this->parse_value(reading))
+        {
+            reading.type = SML_READING_INTEGER;
+        }
+        else if (this->value_len <= D0_MAX_OCTETS)
+        {
+            reading.type = SML_READING_OCTET_STRING;
+            memcpy(this->octets_store[this->count], this->value, this->value_len);
+            reading.octets_len = this->value_len;
+        }
+        else
+        {
+            this->dropped++;
+            return;
+        }
+        this->count++;
+    }
+
+    // A decimal number with an optional unit, e.g. 00012345.6789*kWh
+    bool parse_value(SmlReading &reading) const
+    {
+        uint8_t i = 0;
+        bool negative = false;
+        if (this->value[0] == '-' || this->value[0] == '+')
+        {
+            negative = this->value[0] == '-';
+            i++;
+        }
+        int64_t number = 0;
+        uint8_t digits = 0;
+        int8_t decimals = -1;
+        for (; i < this->value_len && this->value[i] != '*'; i++)
+        {
+            char c = this->value[i];
+            if (c == '.' && decimals < 0)
+            {
+                decimals = 0;
+            }
+            else if (c >= '0' && c <= '9' && digits < 18)
+            {
+                number = number * 10 + (c - '0');
+                digits++;
+                decimals += decimals >= 0 ? 1 : 0;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        if (digits == 0)
+        {
+            return false;
+        }
+        reading.value = negative ? -number : number;
+        reading.scaler = decimals > 0 ? -decimals : 0;
+        if (i < this->value_len)
+        {
+            const char *unit = this->value + i + 1;
+            uint8_t unit_len = this->value_len - i - 1;
+            for (size_t u = 0; u < sizeof(D0_UNITS) / sizeof(D0_UNITS[0]); u++)
+            {
+                if (strlen(D0_UNITS[u].text) == unit_len && memcmp(D0_UNITS[u].text, unit, unit_len) == 0)
+                {
+                    reading.unit = D0_UNITS[u].unit;
+                    reading.scaler += D0_UNITS[u].scaler;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    // One number of an address, letters stand for 96 to 99
+    static bool parse_group(const char *&p, uint8_t &number)
+    {
+        const char letters[] = "CFLP";
+        const char *letter = *p != '\0' ? strchr(letters, *p) : NULL;
+        if (letter != NULL)
+        {
+            number = 96 + (letter - letters);
+            p++;
+            return true;
+        }
+        if (*p < '0' || *p > '9')
+        {
+            return false;
+        }
+        unsigned int n = 0;
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            n = n * 10 + (*p - '0');
+            if (n > 255)
+            {
+                return false;
+            }
+        }
+        number = n;
+        return *p == '\0' || *p == '-' || *p == ':' || *p == '.' || *p == '*' || *p == '&';
+    }
+};
+
+#endif
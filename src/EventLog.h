@@ -0,0 +1,293 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <Arduino.h>
+#ifndef ESP8266
+#include <atomic>
+#endif
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) (*(const void *const *)(addr))
+#endif
+#ifndef snprintf_P
+#define snprintf_P snprintf
+#endif
+
+// Events kept in RAM, a power of two, 0 leaves LOG_EVENT out of the build
+#ifndef EVENT_LOG_SIZE
+#define EVENT_LOG_SIZE 64
+#endif
+
+const size_t EVENT_LOG_LINE = 96; // Longest rendered event
+
+// What happened, rendered with the formats below
+enum EventId : uint16_t
+{
+    EVENT_STATE_WAIT_FOR_START_SEQUENCE,
+    EVENT_STATE_READ_MESSAGE,
+    EVENT_STATE_READ_CHECKSUM,
+    EVENT_STATE_READ_TELEGRAM,
+    EVENT_READ_TIMEOUT,
+    EVENT_START_SEQUENCE,
+    EVENT_NO_BUFFER,
+    EVENT_BUFFER_OVERFLOW,
+    EVENT_END_SEQUENCE,
+    EVENT_UNEXPECTED_START,
+    EVENT_INVALID_ESCAPE,
+    EVENT_MESSAGE_READ,
+    EVENT_OVERRUN_DROP_NEWEST,
+    EVENT_OVERRUN_DROP_OLDEST,
+    EVENT_MESSAGE_PROCESSED,
+    EVENT_MESSAGE_TOO_SHORT,
+    EVENT_CHECKSUM_MISMATCH,
+    EVENT_TELEGRAM_STARTED,
+    EVENT_TELEGRAM_READ,
+    EVENT_TELEGRAM_UNDECODABLE,
+    EVENT_TELEGRAM_TOO_LONG,
+    EVENT_TELEGRAM_BROKEN,
+    EVENT_FORWARDED,
+    EVENT_COUNT
+};
+
+// One format per event, taking the value of the event as unsigned long
+static const char EVENT_FORMAT_0[] PROGMEM = "state WAIT_FOR_START_SEQUENCE";
+static const char EVENT_FORMAT_1[] PROGMEM = "state READ_MESSAGE";
+static const char EVENT_FORMAT_2[] PROGMEM = "state READ_CHECKSUM";
+static const char EVENT_FORMAT_3[] PROGMEM = "state READ_TELEGRAM";
+static const char EVENT_FORMAT_4[] PROGMEM = "no message within %lu seconds, starting over";
+static const char EVENT_FORMAT_5[] PROGMEM = "start sequence found";
+static const char EVENT_FORMAT_6[] PROGMEM = "no frame buffer free, skipping message";
+static const char EVENT_FORMAT_7[] PROGMEM = "message longer than %lu bytes, starting over";
+static const char EVENT_FORMAT_8[] PROGMEM = "end sequence found";
+static const char EVENT_FORMAT_9[] PROGMEM = "unexpected start sequence, starting over";
+static const char EVENT_FORMAT_10[] PROGMEM = "invalid escape sequence, starting over";
+static const char EVENT_FORMAT_11[] PROGMEM = "message of %lu bytes read";
+static const char EVENT_FORMAT_12[] PROGMEM = "previous message not processed yet, dropping this one";
+static const char EVENT_FORMAT_13[] PROGMEM = "previous message not processed yet, dropping it";
+static const char EVENT_FORMAT_14[] PROGMEM = "processing a message of %lu bytes";
+static const char EVENT_FORMAT_15[] PROGMEM = "message of %lu bytes too short, dropping it";
+static const char EVENT_FORMAT_16[] PROGMEM = "checksum mismatch, dropping message";
+static const char EVENT_FORMAT_17[] PROGMEM = "start of a telegram found";
+static const char EVENT_FORMAT_18[] PROGMEM = "telegram has been read";
+static const char EVENT_FORMAT_19[] PROGMEM = "message could not be decoded, dropping it";
+static const char EVENT_FORMAT_20[] PROGMEM = "message is too long, starting over";
+static const char EVENT_FORMAT_21[] PROGMEM = "telegram broken off, starting over";
+static const char EVENT_FORMAT_22[] PROGMEM = "forwarded a message of %lu bytes";
+
+static const char *const EVENT_FORMATS[EVENT_COUNT] PROGMEM = {
+    EVENT_FORMAT_0, EVENT_FORMAT_1, EVENT_FORMAT_2, EVENT_FORMAT_3, EVENT_FORMAT_4, EVENT_FORMAT_5,
+    EVENT_FORMAT_6, EVENT_FORMAT_7, EVENT_FORMAT_8, EVENT_FORMAT_9, EVENT_FORMAT_10, EVENT_FORMAT_11,
+    EVENT_FORMAT_12, EVENT_FORMAT_13, EVENT_FORMAT_14, EVENT_FORMAT_15, EVENT_FORMAT_16, EVENT_FORMAT_17,
+    EVENT_FORMAT_18, EVENT_FORMAT_19, EVENT_FORMAT_20, EVENT_FORMAT_21, EVENT_FORMAT_22};
+
+// Whether [id] is part of reading every message rather than something that
+// went wrong
+inline bool event_is_routine(uint16_t id)
+{
+    switch (id)
+    {
+    case EVENT_STATE_WAIT_FOR_START_SEQUENCE:
+    case EVENT_STATE_READ_MESSAGE:
+    case EVENT_STATE_READ_CHECKSUM:
+    case EVENT_STATE_READ_TELEGRAM:
+    case EVENT_START_SEQUENCE:
+    case EVENT_END_SEQUENCE:
+    case EVENT_MESSAGE_READ:
+    case EVENT_MESSAGE_PROCESSED:
+    case EVENT_TELEGRAM_STARTED:
+    case EVENT_TELEGRAM_READ:
+    case EVENT_FORWARDED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// An event as copied out of the log
+struct LogEvent
+{
+    uint32_t index;      // Counts all events recorded since boot
+    uint32_t time;       // micros() when it was recorded
+    const char *subject; // Name of the sensor, has to outlive the event
+    uint16_t id;
+    uint32_t value;
+};
+
+#ifdef ESP8266
+// One core and no tasks, events are recorded and read by the loop alone
+template <typename T>
+class EventField
+{
+public:
+    T get() const { return this->value; }
+    void set(T value) { this->value = value; }
+    T increment() { return this->value++; }
+
+private:
+    volatile T value = T();
+};
+inline void event_log_fence_release() { __asm__ __volatile__("" ::: "memory"); }
+inline void event_log_fence_acquire() { __asm__ __volatile__("" ::: "memory"); }
+#else
+// Capture tasks on the other core record as well
+template <typename T>
+class EventField
+{
+public:
+    T get() const { return this->value.load(std::memory_order_relaxed); }
+    void set(T value) { this->value.store(value, std::memory_order_relaxed); }
+    T increment() { return this->value.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    std::atomic<T> value{T()};
+};
+inline void event_log_fence_release() { std::atomic_thread_fence(std::memory_order_release); }
+inline void event_log_fence_acquire() { std::atomic_thread_fence(std::memory_order_acquire); }
+#endif
+
+// Ring of the last [N] events. Recording one takes a slot and stores four
+// words, nothing is formatted or written out on the way: events are
+// rendered later, by readers with cursors of their own. The oldest events
+// are overwritten when nobody read them in time, readers count those as
+// lost. Every slot carries the index of its event plus one, 0 while it is
+// written, so a reader can tell an event that was overwritten or is still
+// being written from one it can render.
+template <size_t N>
+class EventRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "EventRing needs a power of two of slots");
+
+public:
+    void record(EventId id, const char *subject = NULL, uint32_t value = 0)
+    {
+        uint32_t index = this->head.increment();
+        Slot &slot = this->slots[index & (N - 1)];
+        slot.sequence.set(0);
+        event_log_fence_release();
+        slot.time.set(micros());
+        slot.subject.set(subject);
+        slot.id.set(id);
+        slot.value.set(value);
+        event_log_fence_release();
+        slot.sequence.set(index + 1);
+    }
+
+    // Events recorded since boot
+    uint32_t recorded() const
+    {
+        return this->head.get();
+    }
+
+    // Copies the event at [index] into [event], false if it was overwritten
+    // or is not complete yet
+    bool read(uint32_t index, LogEvent &event) const
+    {
+        const Slot &slot = this->slots[index & (N - 1)];
+        if (slot.sequence.get() != index + 1)
+        {
+            return false;
+        }
+        event_log_fence_acquire();
+        event.index = index;
+        event.time = slot.time.get();
+        event.subject = slot.subject.get();
+        event.id = slot.id.get();
+        event.value = slot.value.get();
+        event_log_fence_acquire();
+        return slot.sequence.get() == index + 1;
+    }
+
+    // Events from [cursor] on, at most [max] of them, oldest first. Moves
+    // [cursor] past the events given to [f] and adds those that were lost
+    // to [lost]. An event still being written ends the turn.
+    template <typename F>
+    size_t drain(uint32_t &cursor, uint32_t &lost, size_t max, F f) const
+    {
+        size_t count = 0;
+        uint32_t head = this->head.get();
+        if (head - cursor > N)
+        {
+            lost += head - cursor - N;
+            cursor = head - N;
+        }
+        while (cursor != head && count < max)
+        {
+            LogEvent event;
+            if (this->read(cursor, event))
+            {
+                if (!f(event))
+                {
+                    break;
+                }
+                count++;
+            }
+            else if (this->slots[cursor & (N - 1)].sequence.get() == 0)
+            {
+                break;
+            }
+            else
+            {
+                lost++;
+            }
+            cursor++;
+        }
+        return count;
+    }
+
+private:
+    struct Slot
+    {
+        EventField<uint32_t> sequence;
+        EventField<uint32_t> time;
+        EventField<const char *> subject;
+        EventField<uint16_t> id;
+        EventField<uint32_t> value;
+    };
+
+    EventField<uint32_t> head;
+    Slot slots[N];
+};
+
+// "[seconds.micros] subject: message", the time wraps after 71 minutes
+inline size_t render_event(const LogEvent &event, char *out, size_t size)
+{
+    int len = snprintf(out, size, "[%5lu.%06lu] %s: ", (unsigned long)(event.time / 1000000),
+                       (unsigned long)(event.time % 1000000), event.subject != NULL ? event.subject : "-");
+    if (len < 0 || (size_t)len >= size)
+    {
+        return size > 0 ? size - 1 : 0;
+    }
+    if (event.id < EVENT_COUNT)
+    {
+        const char *format = (const char *)pgm_read_ptr(&EVENT_FORMATS[event.id]);
+        int more = snprintf_P(out + len, size - len, format, (unsigned long)event.value);
+        len += more < 0 ? 0 : more;
+    }
+    else
+    {
+        len += snprintf(out + len, size - len, "event %u (%lu)", event.id, (unsigned long)event.value);
+    }
+    return (size_t)len < size ? (size_t)len : size - 1;
+}
+
+#if EVENT_LOG_SIZE > 0
+typedef EventRing<EVENT_LOG_SIZE> EventLog;
+
+// The log of the device, shared by all sensors
+inline EventLog &event_log()
+{
+    static EventLog events;
+    return events;
+}
+
+#define LOG_EVENT(...) event_log().record(__VA_ARGS__)
+#else
+#define LOG_EVENT(...)
+#endif
+
+#endif
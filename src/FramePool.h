@@ -0,0 +1,209 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include "SmlFraming.h"
+
+const size_t FRAME_POOL_BLOCK = 64;         // Buffers are made of runs of these
+const size_t FRAME_POOL_FIRST_LENGTH = 512; // Lent until the first message has been read
+
+// What a sensor gets when the pool has no room for its message
+enum FramePoolFallback
+{
+    FRAME_POOL_DROP,    // Nothing, the message is skipped
+    FRAME_POOL_ALLOCATE // A buffer from the heap, which the pool keeps for the next time it is full
+};
+
+// Message buffers shared by the sensors, lent from the start of a message
+// until it has been processed. All of them are cut from one block of
+// memory, [size] bytes for each sensor attached, which is only allocated
+// once a sensor borrows a buffer and resized while none is lent. Each
+// buffer is as long as the longest message seen so far plus a quarter
+// (FRAME_POOL_FIRST_LENGTH until the first one has been read, messages not
+// fitting into it make the next buffers longer), so the memory needed
+// follows the messages being read at the same time rather than the
+// number of sensors.
+class FramePool
+{
+public:
+    FramePool(size_t size, FramePoolFallback fallback)
+        : size(size), fallback(fallback)
+    {
+    }
+
+    ~FramePool()
+    {
+        delete[] this->memory;
+        delete[] this->used;
+        delete[] this->spare;
+    }
+
+    // A sensor borrowing from the pool has been set up or deleted
+    void attach()
+    {
+        this->sensors++;
+    }
+
+    void detach()
+    {
+        this->sensors--;
+        this->fit();
+    }
+
+    // Returns a buffer and its [length], NULL if there is none
+    uint8_t *borrow(size_t &length)
+    {
+        this->fit();
+        size_t wanted = (this->buffer_length() + FRAME_POOL_BLOCK - 1) / FRAME_POOL_BLOCK;
+        // First fit
+        size_t run = 0;
+        for (size_t i = 0; i < this->blocks; i++)
+        {
+            run = this->used[i] ? 0 : run + 1;
+            if (run == wanted)
+            {
+                size_t first = i + 1 - wanted;
+                memset(this->used + first, 1, wanted);
+                this->in_use += wanted;
+                if (this->in_use > this->peak)
+                {
+                    this->peak = this->in_use;
+                }
+                length = wanted * FRAME_POOL_BLOCK;
+                return this->memory + first * FRAME_POOL_BLOCK;
+            }
+        }
+        if (this->fallback == FRAME_POOL_ALLOCATE && !this->spare_lent)
+        {
+            if (this->spare_size < wanted * FRAME_POOL_BLOCK)
+            {
+                delete[] this->spare;
+                this->spare_size = 0;
+                this->spare = new (std::nothrow) uint8_t[wanted * FRAME_POOL_BLOCK];
+                if (this->spare == NULL)
+                {
+                    return NULL;
+                }
+                this->spare_size = wanted * FRAME_POOL_BLOCK;
+                this->allocations++;
+            }
+            this->spare_lent = true;
+            length = this->spare_size;
+            return this->spare;
+        }
+        return NULL;
+    }
+
+    // Takes back a buffer of borrow()
+    void release(uint8_t *buffer, size_t length)
+    {
+        if (buffer == this->spare)
+        {
+            this->spare_lent = false;
+            return;
+        }
+        size_t first = (buffer - this->memory) / FRAME_POOL_BLOCK;
+        memset(this->used + first, 0, length / FRAME_POOL_BLOCK);
+        this->in_use -= length / FRAME_POOL_BLOCK;
+    }
+
+    // A message of [length] bytes has been read, or one did not fit into
+    // [length] bytes
+    void observe(size_t length)
+    {
+        if (length > this->max_length)
+        {
+            this->max_length = length < SML_MAX_FRAME_LENGTH ? length : SML_MAX_FRAME_LENGTH;
+        }
+    }
+
+    // Length of the buffers lent next
+    size_t buffer_length() const
+    {
+        if (this->max_length == 0)
+        {
+            return FRAME_POOL_FIRST_LENGTH;
+        }
+        size_t length = this->max_length + this->max_length / 4;
+        return length < SML_MAX_FRAME_LENGTH ? length : SML_MAX_FRAME_LENGTH;
+    }
+
+    // Bytes allocated for the sensors attached
+    size_t get_size() const
+    {
+        return this->blocks * FRAME_POOL_BLOCK;
+    }
+
+    // Most bytes lent at the same time
+    size_t get_peak() const
+    {
+        return this->peak * FRAME_POOL_BLOCK;
+    }
+
+    size_t get_max_length() const
+    {
+        return this->max_length;
+    }
+
+    // Buffers taken from the heap because the pool had no room
+    unsigned long get_allocations() const
+    {
+        return this->allocations;
+    }
+
+private:
+    size_t size; // Per sensor
+    uint8_t *memory = NULL;
+    uint8_t *used = NULL; // 1 for every block lent
+    size_t blocks = 0;
+    size_t in_use = 0;
+    size_t peak = 0;
+    size_t max_length = 0;
+    uint8_t sensors = 0;
+    uint8_t *spare = NULL; // From the heap, lent when the pool is full
+    size_t spare_size = 0;
+    bool spare_lent = false;
+    unsigned long allocations = 0;
+    FramePoolFallback fallback;
+
+    // Sizes the memory for the sensors attached, while nothing is lent
+    void fit()
+    {
+        size_t blocks = this->sensors * (this->size / FRAME_POOL_BLOCK);
+        if (this->in_use > 0 || blocks == this->blocks)
+        {
+            return;
+        }
+        delete[] this->memory;
+        delete[] this->used;
+        this->memory = NULL;
+        this->used = NULL;
+        this->blocks = 0;
+        if (blocks > 0)
+        {
+            this->memory = new (std::nothrow) uint8_t[blocks * FRAME_POOL_BLOCK];
+            this->used = new (std::nothrow) uint8_t[blocks];
+            if (this->memory == NULL || this->used == NULL)
+            {
+                delete[] this->memory;
+                delete[] this->used;
+                this->memory = NULL;
+                this->used = NULL;
+                return;
+            }
+            memset(this->used, 0, blocks);
+            this->blocks = blocks;
+        }
+        if (this->sensors == 0 && !this->spare_lent)
+        {
+            delete[] this->spare;
+            this->spare = NULL;
+            this->spare_size = 0;
+        }
+    }
+};
+
+#endif
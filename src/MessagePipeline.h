@@ -0,0 +1,171 @@
+#ifndef MESSAGE_PIPELINE_H
+#define MESSAGE_PIPELINE_H
+
+#include "config.h"
+#include "debug.h"
+#include "Sensor.h"
+#include "SmlDecoder.h"
+#include "MqttPublisher.h"
+
+// micros() as the clock of MessagePipeline on the device
+struct MicrosClock
+{
+    static const unsigned long TICKS_PER_US = 1;
+
+    static unsigned long now()
+    {
+        return micros();
+    }
+};
+
+// What the listeners of the sensors do with a message or a telegram: decode
+// it, keep the snapshot and the aggregator of the sensor up to date and
+// publish the readings, or queue them while WiFi is down. Shared by the
+// firmware and the native replay, which times the stages with a clock of
+// its own, as micros() is line time there.
+template <typename Clock>
+class MessagePipeline
+{
+public:
+    // [connected] tells whether WiFi is up
+    MessagePipeline(MqttPublisher &publisher, const bool &connected) : publisher(publisher), connected(connected) {}
+
+    // Stages of the last message or telegram in ticks of [Clock]: decoding
+    // without publishing, publishing, and freeing what libsml allocated
+    unsigned long parse_ticks = 0;
+    unsigned long publish_ticks = 0;
+    unsigned long free_ticks = 0;
+    bool valid = false; // Whether the last message could be decoded
+
+    void process_message(byte *buffer, size_t len, Sensor *sensor)
+    {
+        this->parse_ticks = 0;
+        this->publish_ticks = 0;
+        this->free_ticks = 0;
+        // Forwarded as received, the backend decodes it
+        if (sensor->config->publish_mode == PUBLISH_RAW)
+        {
+            unsigned long started = Clock::now();
+            this->publisher.publishFrame(sensor, buffer, len);
+            this->publish_ticks = Clock::now() - started;
+            this->valid = true;
+            return;
+        }
+#ifdef USE_OBIS_TABLE
+        ObisFilterPair<ObisFilter, decltype(OBIS_TABLE)> filter(sensor->config->obis_filter, OBIS_TABLE);
+#else
+        const ObisFilter &filter = sensor->config->obis_filter;
+#endif
+        unsigned long started = Clock::now();
+        this->begin_telegram(sensor);
+#ifdef USE_LIBSML_PARSER
+        sml_file *file = sml_file_parse(buffer + 8, len - 16);
+
+        DEBUG_SML_FILE(file);
+
+        sml_file_readings(file, filter, [this, sensor](const SmlReading &reading) {
+            this->process_reading(reading, sensor);
+        });
+        this->valid = file->messages_len > 0;
+        // A message that could not be decoded keeps the previous snapshot
+        this->end_telegram(sensor, this->valid);
+        unsigned long decoded = Clock::now();
+
+        // free the malloc'd memory
+        sml_file_free(file);
+#else
+        // Decode in place, without building a tree on the heap
+        this->valid = SmlDecoder::decode(buffer + 8, len - 16, filter, [this, sensor](const SmlReading &reading) {
+            DEBUG_SML_READING(reading);
+            this->process_reading(reading, sensor);
+        });
+        this->end_telegram(sensor, this->valid);
+        unsigned long decoded = Clock::now();
+#endif
+        this->parse_ticks = decoded - started - this->publish_ticks;
+        this->free_ticks = Clock::now() - decoded;
+        sensor->metrics.parse.observe(this->parse_ticks / Clock::TICKS_PER_US);
+    }
+
+    // Telegrams decoded while they arrived, by streaming sensors, the other
+    // protocols and the capture tasks of the ESP32
+    void process_readings(const SmlReading *readings, size_t count, Sensor *sensor, bool valid = true)
+    {
+        this->parse_ticks = 0;
+        this->publish_ticks = 0;
+        this->free_ticks = 0;
+        this->valid = valid;
+        this->begin_telegram(sensor);
+        for (size_t i = 0; i < count; i++)
+        {
+#ifdef USE_OBIS_TABLE
+            // The stream decoder only knows the sensor's own filter
+            if (!OBIS_TABLE.accepts(readings[i].obis))
+            {
+                continue;
+            }
+#endif
+            DEBUG_SML_READING(readings[i]);
+            this->process_reading(readings[i], sensor);
+        }
+        this->end_telegram(sensor, valid);
+    }
+
+private:
+    MqttPublisher &publisher;
+    const bool &connected;
+
+    void process_reading(const SmlReading &reading, Sensor *sensor)
+    {
+        if (sensor->snapshot != NULL && (!sensor->config->numeric_only || reading.is_numeric()))
+        {
+            sensor->snapshot->add(reading, reading.unit ? dlms_get_unit(reading.unit) : NULL);
+        }
+        if (sensor->aggregator != NULL)
+        {
+            // Published as a summary once the window is over
+            sensor->aggregator->add(reading);
+            return;
+        }
+        unsigned long started = Clock::now();
+        if (this->connected)
+        {
+            this->publisher.publish(sensor, reading);
+        }
+        else
+        {
+            this->publisher.enqueue(sensor, reading);
+        }
+        this->publish_ticks += Clock::now() - started;
+    }
+
+    // Starts a telegram of [sensor] for the publisher and the snapshot
+    void begin_telegram(Sensor *sensor)
+    {
+        this->publisher.begin_telegram();
+        if (sensor->snapshot != NULL)
+        {
+            sensor->snapshot->begin();
+        }
+    }
+
+    void end_telegram(Sensor *sensor, bool valid)
+    {
+        unsigned long started = Clock::now();
+        if (sensor->snapshot != NULL && valid)
+        {
+            sensor->snapshot->commit(millis());
+        }
+        if (sensor->aggregator != NULL && valid)
+        {
+            sensor->aggregator->end_telegram(millis());
+        }
+        if (this->connected)
+        {
+            this->publisher.end_telegram(sensor);
+        }
+        this->publish_ticks += Clock::now() - started;
+    }
+};
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "SmlFormat.h"
+
+// Upper bounds of the histogram buckets in microseconds, with their
+// Prometheus labels in seconds. Values above the last bound go to +Inf.
+const uint8_t HISTOGRAM_BOUNDS = 11;
+static const uint32_t HISTOGRAM_BOUNDS_US[HISTOGRAM_BOUNDS] = {250,   500,   1000,   2500,   5000,   10000,
+                                                               25000, 50000, 100000, 250000, 1000000};
+static const char *const HISTOGRAM_LABELS[HISTOGRAM_BOUNDS + 1] = {
+    "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "1", "+Inf"};
+
+// Durations in fixed buckets, recording one takes a few comparisons
+class Histogram
+{
+public:
+    uint32_t counts[HISTOGRAM_BOUNDS + 1]; // Not cumulative
+    uint64_t sum_us;
+
+    void observe(uint32_t us)
+    {
+        uint8_t i = 0;
+        while (i < HISTOGRAM_BOUNDS && us > HISTOGRAM_BOUNDS_US[i])
+        {
+            i++;
+        }
+        this->counts[i]++;
+        this->sum_us += us;
+    }
+
+    uint32_t count() const
+    {
+        uint32_t n = 0;
+        for (uint8_t i = 0; i <= HISTOGRAM_BOUNDS; i++)
+        {
+            n += this->counts[i];
+        }
+        return n;
+    }
+};
+
+// Counters of a sensor, only ever incremented. Plain data, zeroed by its
+// owner.
+struct SensorMetrics
+{
+    uint32_t bytes_read;
+    uint32_t frames_started;   // Start sequence found
+    uint32_t frames_completed; // Read up to the checksum
+    uint32_t timeouts;         // No message within READ_TIMEOUT
+    uint32_t buffer_overflows; // Message too long for the buffer
+    uint32_t crc_errors;
+    uint32_t throttled;        // Dropped because of the interval
+    uint32_t rx_overflows;     // Bytes lost by the capture
+    uint32_t budget_exhausted; // Turns of the scheduler ended with bytes left
+    uint32_t no_buffer;        // Skipped for lack of a frame buffer
+    uint32_t overruns;         // Dropped because the previous one was not processed yet
+    Histogram frame_to_publish; // From the checksum to the readings being handed over
+    Histogram parse;            // Decoding, without the time spent publishing
+};
+
+struct SensorCounter
+{
+    const char *name;
+    const char *help;
+    uint32_t SensorMetrics::*field;
+};
+
+static const SensorCounter SENSOR_COUNTERS[] = {
+    {"smlreader_bytes_read_total", "Bytes received by the sensor", &SensorMetrics::bytes_read},
+    {"smlreader_frames_started_total", "SML start sequences found", &SensorMetrics::frames_started},
+    {"smlreader_frames_completed_total", "SML messages read completely", &SensorMetrics::frames_completed},
+    {"smlreader_timeouts_total", "Resets after no message within the read timeout", &SensorMetrics::timeouts},
+    {"smlreader_buffer_overflows_total", "Messages dropped for exceeding the buffer", &SensorMetrics::buffer_overflows},
+    {"smlreader_crc_errors_total", "Messages dropped for a checksum mismatch", &SensorMetrics::crc_errors},
+    {"smlreader_throttled_total", "Messages dropped because of the interval", &SensorMetrics::throttled},
+    {"smlreader_rx_overflows_total", "Times the receive buffer lost bytes", &SensorMetrics::rx_overflows},
+    {"smlreader_budget_exhausted_total", "Capture turns ended by the byte budget with bytes left", &SensorMetrics::budget_exhausted},
+    {"smlreader_no_buffer_total", "Messages skipped for lack of a free frame buffer", &SensorMetrics::no_buffer},
+    {"smlreader_overruns_total", "Messages dropped because the previous one was not processed yet", &SensorMetrics::overruns},
+};
+
+struct SensorHistogram
+{
+    const char *name;
+    const char *help;
+    Histogram SensorMetrics::*field;
+};
+
+static const SensorHistogram SENSOR_HISTOGRAMS[] = {
+    {"smlreader_frame_to_publish_seconds", "Time from the end of a message until its readings are published",
+     &SensorMetrics::frame_to_publish},
+    {"smlreader_parse_seconds", "Time spent decoding a message", &SensorMetrics::parse},
+};
+
+// Device wide figures, taken when they are reported
+struct DeviceMetrics
+{
+    uint32_t uptime;         // Seconds
+    uint32_t free_heap;
+    uint32_t max_free_block;
+    uint8_t fragmentation;   // Percent
+    uint32_t publishes;
+    uint32_t publish_failures;
+    uint32_t connect_attempts;
+    uint32_t connect_failures;
+    uint32_t frame_pool_size;   // Bytes, see FramePool
+    uint32_t frame_pool_peak;   // Most bytes lent at the same time
+    uint32_t frame_max_length;  // Longest message read into the pool
+    uint32_t frame_allocations; // Buffers taken from the heap for lack of room in the pool
+};
+
+// Writes the Prometheus text format through a small buffer, which is handed
+// to [flush] whenever it is full, so a page of any size can be served
+// without holding it in RAM
+class PrometheusWriter
+{
+public:
+    typedef void (*Flush)(const char *data, size_t len, void *context);
+
+    PrometheusWriter(char *buffer, size_t size, Flush flush, void *context)
+        : buffer(buffer), size(size), flush(flush), context(context)
+    {
+    }
+
+    void header(const char *name, const char *type, const char *help)
+    {
+        this->append("# HELP ");
+        this->append(name);
+        this->append(" ");
+        this->append(help);
+        this->append("\n# TYPE ");
+        this->append(name);
+        this->append(" ");
+        this->append(type);
+        this->append("\n");
+    }
+
+    // name[suffix]{sensor="<sensor>",le="<le>"} value, labels are optional
+    void sample(const char *name, const char *suffix, const char *sensor, const char *le, uint64_t value,
+                int8_t scaler = 0)
+    {
+        this->append(name);
+        if (suffix != NULL)
+        {
+            this->append(suffix);
+        }
+        if (sensor != NULL || le != NULL)
+        {
+            this->append("{");
+            if (sensor != NULL)
+            {
+                this->append("sensor=\"");
+                this->append_escaped(sensor);
+                this->append(le != NULL ? "\"," : "\"");
+            }
+            if (le != NULL)
+            {
+                this->append("le=\"");
+                this->append(le);
+                this->append("\"");
+            }
+            this->append("}");
+        }
+        char number[24];
+        sml_format_scaled(value, false, scaler, number, sizeof(number));
+        this->append(" ");
+        this->append(number);
+        this->append("\n");
+    }
+
+    // Cumulative buckets, sum and count of a histogram
+    void histogram(const char *name, const char *sensor, const Histogram &histogram)
+    {
+        uint64_t cumulative = 0;
+        for (uint8_t i = 0; i <= HISTOGRAM_BOUNDS; i++)
+        {
+            cumulative += histogram.counts[i];
+            this->sample(name, "_bucket", sensor, HISTOGRAM_LABELS[i], cumulative);
+        }
+        this->sample(name, "_sum", sensor, NULL, histogram.sum_us, -6);
+        this->sample(name, "_count", sensor, NULL, cumulative);
+    }
+
+    // Hands over what is left
+    void finish()
+    {
+        if (this->position > 0)
+        {
+            this->flush(this->buffer, this->position, this->context);
+            this->position = 0;
+        }
+    }
+
+private:
+    char *buffer;
+    size_t size;
+    size_t position = 0;
+    Flush flush;
+    void *context;
+
+    void append(const char *s)
+    {
+        size_t len = strlen(s);
+        while (len > 0)
+        {
+            if (this->position == this->size)
+            {
+                this->finish();
+            }
+            size_t n = len < this->size - this->position ? len : this->size - this->position;
+            memcpy(this->buffer + this->position, s, n);
+            this->position += n;
+            s += n;
+            len -= n;
+        }
+    }
+
+    void append_escaped(const char *s)
+    {
+        char c[3] = {'\\', 0, 0};
+        for (; *s; s++)
+        {
+            bool escape = *s == '"' || *s == '\\';
+            c[1] = *s;
+            this->append(escape ? c : c + 1);
+        }
+    }
+};
+
+// The whole metrics page: device figures, then every counter and histogram
+// for all sensors
+inline void write_metrics(PrometheusWriter &writer, const DeviceMetrics &device, const SensorMetrics *const *sensors,
+                          const char *const *names, uint8_t count)
+{
+    writer.header("smlreader_uptime_seconds", "gauge", "Seconds since the last restart");
+    writer.sample("smlreader_uptime_seconds", NULL, NULL, NULL, device.uptime);
+    writer.header("smlreader_heap_free_bytes", "gauge", "Free heap");
+    writer.sample("smlreader_heap_free_bytes", NULL, NULL, NULL, device.free_heap);
+    writer.header("smlreader_heap_max_block_bytes", "gauge", "Largest allocatable block of the heap");
+    writer.sample("smlreader_heap_max_block_bytes", NULL, NULL, NULL, device.max_free_block);
+    writer.header("smlreader_heap_fragmentation_percent", "gauge", "Fragmentation of the free heap");
+    writer.sample("smlreader_heap_fragmentation_percent", NULL, NULL, NULL, device.fragmentation);
+    writer.header("smlreader_mqtt_publishes_total", "counter", "MQTT messages published");
+    writer.sample("smlreader_mqtt_publishes_total", NULL, NULL, NULL, device.publishes);
+    writer.header("smlreader_mqtt_publish_failures_total", "counter", "MQTT messages that could not be published");
+    writer.sample("smlreader_mqtt_publish_failures_total", NULL, NULL, NULL, device.publish_failures);
+    writer.header("smlreader_mqtt_connect_attempts_total", "counter", "Attempts to connect to the MQTT broker");
+    writer.sample("smlreader_mqtt_connect_attempts_total", NULL, NULL, NULL, device.connect_attempts);
+    writer.header("smlreader_mqtt_connect_failures_total", "counter", "Failed attempts to connect to the MQTT broker");
+    writer.sample("smlreader_mqtt_connect_failures_total", NULL, NULL, NULL, device.connect_failures);
+    writer.header("smlreader_frame_pool_bytes", "gauge", "Memory shared by the sensors for their messages");
+    writer.sample("smlreader_frame_pool_bytes", NULL, NULL, NULL, device.frame_pool_size);
+    writer.header("smlreader_frame_pool_peak_bytes", "gauge", "Most memory of the frame pool lent at the same time");
+    writer.sample("smlreader_frame_pool_peak_bytes", NULL, NULL, NULL, device.frame_pool_peak);
+    writer.header("smlreader_frame_max_length_bytes", "gauge", "Longest message read into the frame pool");
+    writer.sample("smlreader_frame_max_length_bytes", NULL, NULL, NULL, device.frame_max_length);
+    writer.header("smlreader_frame_allocations_total", "counter", "Frame buffers taken from the heap because the pool was full");
+    writer.sample("smlreader_frame_allocations_total", NULL, NULL, NULL, device.frame_allocations);
+
+    for (size_t c = 0; c < sizeof(SENSOR_COUNTERS) / sizeof(SENSOR_COUNTERS[0]); c++)
+    {
+        writer.header(SENSOR_COUNTERS[c].name, "counter", SENSOR_COUNTERS[c].help);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            writer.sample(SENSOR_COUNTERS[c].name, NULL, names[i], NULL, sensors[i]->*SENSOR_COUNTERS[c].field);
+        }
+    }
+    for (size_t h = 0; h < sizeof(SENSOR_HISTOGRAMS) / sizeof(SENSOR_HISTOGRAMS[0]); h++)
+    {
+        writer.header(SENSOR_HISTOGRAMS[h].name, "histogram", SENSOR_HISTOGRAMS[h].help);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            writer.histogram(SENSOR_HISTOGRAMS[h].name, names[i], sensors[i]->*SENSOR_HISTOGRAMS[h].field);
+        }
+    }
+    writer.finish();
+}
+
+// Counters of a sensor and its histograms as bucket counts (not cumulative,
+// bounds as in HISTOGRAM_BOUNDS_US) for the MQTT stats topic. Returns the
+// length, 0 if it does not fit.
+inline size_t write_stats_json(char *out, size_t size, const SensorMetrics &metrics)
+{
+    size_t len = 0;
+    for (size_t c = 0; c < sizeof(SENSOR_COUNTERS) / sizeof(SENSOR_COUNTERS[0]); c++)
+    {
+        // smlreader_bytes_read_total -> bytes_read
+        const char *name = SENSOR_COUNTERS[c].name + strlen("smlreader_");
+        int n = snprintf(out + len, size - len, "%c\"%.*s\":%lu", c == 0 ? '{' : ',',
+                         (int)(strlen(name) - strlen("_total")), name,
+                         (unsigned long)(metrics.*SENSOR_COUNTERS[c].field));
+        if (n < 0 || (size_t)n >= size - len)
+        {
+            return 0;
+        }
+        len += n;
+    }
+    for (size_t h = 0; h < sizeof(SENSOR_HISTOGRAMS) / sizeof(SENSOR_HISTOGRAMS[0]); h++)
+    {
+        // smlreader_parse_seconds -> parse_us
+        const char *name = SENSOR_HISTOGRAMS[h].name + strlen("smlreader_");
+        const Histogram &histogram = metrics.*SENSOR_HISTOGRAMS[h].field;
+        char sum[24];
+        sml_format_scaled(histogram.sum_us, false, 0, sum, sizeof(sum));
+        int n = snprintf(out + len, size - len, ",\"%.*s_us\":{\"sum\":%s,\"buckets\":[",
+                         (int)(strlen(name) - strlen("_seconds")), name, sum);
+        for (uint8_t i = 0; n >= 0 && (size_t)n < size - len && i <= HISTOGRAM_BOUNDS; i++)
+        {
+            len += n;
+            n = snprintf(out + len, size - len, i < HISTOGRAM_BOUNDS ? "%lu," : "%lu]}",
+                         (unsigned long)histogram.counts[i]);
+        }
+        if (n < 0 || (size_t)n >= size - len)
+        {
+            return 0;
+        }
+        len += n;
+    }
+    if (len + 2 > size)
+    {
+        return 0;
+    }
+    out[len++] = '}';
+    out[len] = '\0';
+    return len;
+}
+
+#endif
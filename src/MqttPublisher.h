@@ -5,7 +5,29 @@
 #include "debug.h"
 #include "MQTT.h"
 #include <string.h>
-#include <sml/sml_file.h>
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+#include "SmlJson.h"
+#include "Metrics.h"
+#include "Aggregator.h"
+#include "RawFrame.h"
+
+const size_t JSON_BUFFER_SIZE = 1024;
+const int MQTT_BUFFER_SIZE = JSON_BUFFER_SIZE + 256; // Room for the topic and the packet header
+const int MQTT_READ_BUFFER_SIZE = 64;  // Nothing is subscribed, only acknowledgements arrive
+const size_t TOPIC_BUFFER_SIZE = 256;
+const uint8_t BACKFILL_BATCH_SIZE = 16;    // Queued readings published at once
+const uint16_t BACKFILL_INTERVAL = 250;    // Milliseconds between two batches of a sensor
+const unsigned long RECONNECT_MIN_DELAY = 1000;    // Milliseconds, doubled after every failed attempt
+const unsigned long RECONNECT_MAX_DELAY = 120000;
+// Milliseconds the lookup, the TCP connect and waiting for the broker's
+// answer may each take, well under the second between two telegrams. The
+// ESP32 core only takes whole seconds, its sensors are read by tasks anyway.
+#ifdef ESP32
+const uint32_t MQTT_CONNECT_TIMEOUT = 1000;
+#else
+const uint32_t MQTT_CONNECT_TIMEOUT = 250;
+#endif
 
 struct MqttConfig
 {
@@ -23,131 +45,612 @@ public:
   {
     DEBUG("Setting up MQTT publisher.");
     config = _config;
-    uint8_t lastCharOfTopic = strlen(config.topic) - 1;
-    baseTopic = String(config.topic) + (lastCharOfTopic >= 0 && config.topic[lastCharOfTopic] == '/' ? "" : "/");
+    size_t len = strlen(config.topic);
+    memcpy(baseTopic, config.topic, len);
+    if (len == 0 || config.topic[len - 1] != '/')
+    {
+      baseTopic[len++] = '/';
+    }
+    baseTopic[len] = '\0';
+    topicSensor = NULL;
 
+#ifdef ESP32
+    net.setTimeout(MQTT_CONNECT_TIMEOUT / 1000);
+#else
+    net.setTimeout(MQTT_CONNECT_TIMEOUT);
+#endif
+    client.setTimeout(MQTT_CONNECT_TIMEOUT);
     client.begin(config.server, atoi(config.port), net);
+    configured = true;
+  }
+
+  // Has to be called after sensors were deleted, their addresses may be
+  // reused by new ones
+  void sensorsChanged()
+  {
+    topicSensor = NULL;
   }
 
+  // Requests a connection attempt with the next loop(), skipping the backoff
   void connect()
   {
+    reconnectDelay = 0;
+    reconnectWait = 0;
+  }
+
+  // Connections are only ever established from here, at most one attempt
+  // per call, with exponential backoff and jitter between failed attempts
+  void loop()
+  {
+    if (client.connected())
+    {
+      client.loop();
+      return;
+    }
+    if (!configured || millis() - lastConnectAttempt < reconnectWait)
+    {
+      return;
+    }
+
     DEBUG("Establishing MQTT client connection.");
+    connectAttempts++;
+    unsigned long started = micros();
     client.connect("SMLReader", config.username, config.password);
+    blockedMicros += micros() - started;
+    lastConnectAttempt = millis();
+
     if (client.connected())
     {
+      reconnectDelay = 0;
+      reconnectWait = 0;
       char message[64];
-      snprintf(message, 64, "Hello from %08X, running SMLReader version %s.", ESP.getChipId(), VERSION);
+      snprintf(message, 64, "Hello from %08X, running SMLReader version %s.", chipId(), VERSION);
       info(message);
+      return;
     }
+    connectFailures++;
+    reconnectDelay = reconnectDelay == 0 ? RECONNECT_MIN_DELAY : 2 * reconnectDelay;
+    if (reconnectDelay > RECONNECT_MAX_DELAY)
+    {
+      reconnectDelay = RECONNECT_MAX_DELAY;
+    }
+    // Half of the delay plus a random share of the other half, so that
+    // several readers do not hit a recovering broker at the same time
+    reconnectWait = reconnectDelay / 2 + random(reconnectDelay / 2 + 1);
+    DEBUG("Connection to MQTT broker failed, retrying in %lu ms.", reconnectWait);
   }
 
-  void loop()
+  unsigned long getConnectAttempts() const
+  {
+    return connectAttempts;
+  }
+
+  unsigned long getConnectFailures() const
+  {
+    return connectFailures;
+  }
+
+  // Time spent waiting for connection attempts
+  unsigned long getBlockedMillis() const
+  {
+    return (unsigned long)(blockedMicros / 1000);
+  }
+
+  // Fills in the publishing figures of [device]
+  void getMetrics(DeviceMetrics &device) const
   {
-    client.loop();
+    device.publishes = publishes;
+    device.publish_failures = publishFailures;
+    device.connect_attempts = connectAttempts;
+    device.connect_failures = connectFailures;
+  }
+
+  // Publishes the device figures to <topic>/stats and the counters of
+  // every sensor to <topic>/sensor/<name>/stats
+  void publishStats(const DeviceMetrics &device, Sensor *const *sensors, uint8_t count)
+  {
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "%sstats", baseTopic);
+    int len = snprintf(jsonBuffer, sizeof(jsonBuffer),
+                       "{\"uptime\":%lu,\"heap_free\":%lu,\"heap_max_block\":%lu,\"heap_fragmentation\":%u,"
+                       "\"publishes\":%lu,\"publish_failures\":%lu,\"connect_attempts\":%lu,\"connect_failures\":%lu,"
+                       "\"frame_pool\":%lu,\"frame_pool_peak\":%lu,\"frame_max_length\":%lu,\"frame_allocations\":%lu}",
+                       (unsigned long)device.uptime, (unsigned long)device.free_heap,
+                       (unsigned long)device.max_free_block, device.fragmentation, (unsigned long)device.publishes,
+                       (unsigned long)device.publish_failures, (unsigned long)device.connect_attempts,
+                       (unsigned long)device.connect_failures, (unsigned long)device.frame_pool_size,
+                       (unsigned long)device.frame_pool_peak, (unsigned long)device.frame_max_length,
+                       (unsigned long)device.frame_allocations);
+    if (!publish(topic, jsonBuffer, len))
+    {
+      return;
+    }
+    for (uint8_t i = 0; i < count; i++)
+    {
+      size_t written = write_stats_json(jsonBuffer, sizeof(jsonBuffer), sensors[i]->metrics);
+      if (written > 0)
+      {
+        publishSensorTopic(sensors[i], "stats", jsonBuffer, written);
+      }
+    }
   }
 
   void debug(const char *message)
   {
-    publish(baseTopic + "debug", message);
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "%sdebug", baseTopic);
+    publish(topic, message);
   }
 
   void info(const char *message)
   {
-    publish(baseTopic + "info", message);
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "%sinfo", baseTopic);
+    publish(topic, message);
   }
 
-  void publish(Sensor *sensor, sml_file *file)
+#if EVENT_LOG_SIZE > 0
+  // Events recorded since the last call that are not routine (see
+  // event_is_routine()) as text lines to <topic>log, as many messages as it
+  // takes. Events that were overwritten before they could be published are
+  // reported as lost. What could not be published is sent again next time.
+  void publishEvents()
   {
+    if (event_log().recorded() == eventCursor)
+    {
+      return;
+    }
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic), "%slog", baseTopic);
+    size_t len = 0;
+    bool published = true;
+    // The cursor only moves on past events that reached the broker
+    uint32_t cursor = eventCursor;
+    uint32_t lost = eventsLost;
+    event_log().drain(cursor, lost, EVENT_LOG_SIZE, [this, &len, &published, &topic, &cursor, &lost](const LogEvent &event) {
+      if (event_is_routine(event.id))
+      {
+        return true;
+      }
+      // Room for a line about lost events and the event
+      if (sizeof(jsonBuffer) - len < 2 * EVENT_LOG_LINE)
+      {
+        published = publish(topic, jsonBuffer, len);
+        if (!published)
+        {
+          return false;
+        }
+        // Everything before [event] is out
+        len = 0;
+        eventCursor = cursor;
+        eventsLost = lost;
+      }
+      if (lost > 0)
+      {
+        len += snprintf(jsonBuffer + len, sizeof(jsonBuffer) - len, "%lu events lost\n", (unsigned long)lost);
+        lost = 0;
+      }
+      len += render_event(event, jsonBuffer + len, sizeof(jsonBuffer) - len);
+      jsonBuffer[len++] = '\n';
+      return true;
+    });
+    if (published && (len == 0 || publish(topic, jsonBuffer, len)))
+    {
+      eventCursor = cursor;
+      eventsLost = lost;
+    }
+  }
+#endif
+
+  // Telegrams of sensors publishing JSON are collected between these two
+  void begin_telegram()
+  {
+    json.reset();
+  }
 
-    for (int i = 0; i < file->messages_len; i++)
+  void end_telegram(Sensor *sensor)
+  {
+    if (sensor->config->publish_mode == PUBLISH_JSON && !json.empty())
+    {
+      publishJson(sensor);
+    }
+  }
+
+  void publish(Sensor *sensor, const SmlReading &reading)
+  {
+    if (!accept(sensor, reading))
     {
-        sml_message *message = file->messages[i];
-        if (*message->message_body->tag == SML_MESSAGE_GET_LIST_RESPONSE)
+      return;
+    }
+    if (sensor->config->publish_mode == PUBLISH_JSON)
+    {
+      if (!client.connected())
+      {
+        store(sensor, reading);
+        return;
+      }
+      const char *unit = reading.unit ? dlms_get_unit(reading.unit) : NULL;
+      if (!json.add(reading, unit))
+      {
+        // Telegram does not fit into a single document, send what we have
+        if (!json.empty())
+        {
+          publishJson(sensor);
+          json.reset();
+        }
+        if (!json.add(reading, unit))
         {
-            sml_list *entry;
-            sml_get_list_response *body;
-            body = (sml_get_list_response *)message->message_body->data;
-            for (entry = body->val_list; entry != NULL; entry = entry->next)
-            {
-                if (!entry->value)
-                {   // do not crash on null value
-                    continue;
-                }
-
-                char obisIdentifier[32];
-                char buffer[255];
-
-                sprintf(obisIdentifier, "%d-%d:%d.%d.%d/%d",
-                        entry->obj_name->str[0], entry->obj_name->str[1],
-                        entry->obj_name->str[2], entry->obj_name->str[3],
-                        entry->obj_name->str[4], entry->obj_name->str[5]);
-
-                String entryTopic = baseTopic + "sensor/" + (sensor->config->name) + "/obis/" + obisIdentifier + "/";
-                
-                if (((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_INTEGER) ||
-                         ((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_UNSIGNED))
-                {
-                    double value = sml_value_to_double(entry->value);
-                    int scaler = (entry->scaler) ? *entry->scaler : 0;
-                    int prec = -scaler;
-                    if (prec < 0)
-                        prec = 0;
-                    value = value * pow(10, scaler);
-                    sprintf(buffer, "%.*f", prec, value);
-                    publish(entryTopic + "value", buffer);
-                }
-                else if (!sensor->config->numeric_only) {
-                  if (entry->value->type == SML_TYPE_OCTET_STRING)
-                  {
-                      char *value;
-                      sml_value_to_strhex(entry->value, &value, true);
-                      publish(entryTopic + "value", value);
-                      free(value);
-                  }
-                  else if (entry->value->type == SML_TYPE_BOOLEAN)
-                  {
-                      publish(entryTopic + "value",  entry->value->data.boolean ? "true" : "false");
-                  }
-                }
-            }
+          DEBUG("Reading does not fit into a JSON document.");
         }
+      }
+      return;
+    }
+
+    // <baseTopic>sensor/<name>/obis/<obis id>/value
+    static const char OBIS_TOPIC[] = "obis/";
+    static const char VALUE_TOPIC[] = "/value";
+    char *end = sensorTopic(sensor);
+    size_t available = topic + sizeof(topic) - end;
+    if (available <= sizeof(OBIS_TOPIC) + sizeof(VALUE_TOPIC))
+    {
+      DEBUG("MQTT topic is too long.");
+      return;
+    }
+    memcpy(end, OBIS_TOPIC, sizeof(OBIS_TOPIC) - 1);
+    end += sizeof(OBIS_TOPIC) - 1;
+    size_t len = sml_format_obis(reading.obis, '/', end, available - (sizeof(OBIS_TOPIC) - 1) - (sizeof(VALUE_TOPIC) - 1));
+    if (len == 0)
+    {
+      DEBUG("MQTT topic is too long.");
+      return;
+    }
+    memcpy(end + len, VALUE_TOPIC, sizeof(VALUE_TOPIC));
+
+    char buffer[255];
+    bool published = false;
+    if (reading.is_numeric())
+    {
+      sml_format_value(reading, buffer, sizeof(buffer));
+      published = publish(topic, buffer);
+    }
+    else if (reading.type == SML_READING_OCTET_STRING)
+    {
+      sml_octets_to_hex(reading.octets, reading.octets_len, buffer, sizeof(buffer));
+      published = publish(topic, buffer);
+    }
+    else if (reading.type == SML_READING_BOOLEAN)
+    {
+      published = publish(topic, reading.value ? "true" : "false");
+    }
+
+    if (!published)
+    {
+      store(sensor, reading);
     }
   }
 
+  // Forwards a message of a PUBLISH_RAW sensor as received to
+  // <topic>/sensor/<name>/raw, behind the header of RawFrame.h. The packet
+  // is written to the connection directly, so the message goes from the
+  // frame buffer to the network stack instead of being copied into the
+  // client's buffer, which would have to hold the longest message. Raw
+  // messages are not queued while there is no connection, the backend
+  // sees the gap in the sequence numbers. Writing past the client bypasses
+  // the state lwmqtt keeps of the connection, so a failed write closes the
+  // socket itself.
+  bool publishFrame(Sensor *sensor, const byte *frame, size_t len)
+  {
+    if (!client.connected())
+    {
+      DEBUG("Not connected to MQTT broker, unable to forward message %lu of sensor %s.",
+            (unsigned long)sensor->sequence, sensor->config->name);
+      publishFailures++;
+      return false;
+    }
+    static const char RAW_TOPIC[] = "raw";
+    char *end = sensorTopic(sensor);
+    if ((size_t)(topic + sizeof(topic) - end) < sizeof(RAW_TOPIC) || len > 0xFFFF)
+    {
+      DEBUG("MQTT topic or message is too long.");
+      return false;
+    }
+    memcpy(end, RAW_TOPIC, sizeof(RAW_TOPIC));
+    size_t topicLength = end - topic + sizeof(RAW_TOPIC) - 1;
+
+    RawFrameHeader header;
+    header.name = sensor->config->name;
+    header.name_length = (uint8_t)strlen(sensor->config->name);
+    header.device_id = chipId();
+    header.sequence = sensor->sequence;
+    header.captured_at = millis() - (micros() - sensor->get_message_completed_at()) / 1000;
+    header.frame_length = (uint16_t)len;
+
+    // Fixed header of a PUBLISH at QoS 0 with the remaining length, the
+    // topic and the header of the message
+    byte head[1 + 4 + 2 + TOPIC_BUFFER_SIZE + RAW_FRAME_FIXED_LENGTH + SENSOR_NAME_LENGTH];
+    size_t n = 0;
+    head[n++] = 0x30;
+    size_t remaining = 2 + topicLength + raw_frame_header_length(header.name_length) + len;
+    do
+    {
+      head[n] = remaining % 128;
+      remaining /= 128;
+      head[n++] |= remaining > 0 ? 0x80 : 0;
+    } while (remaining > 0);
+    head[n++] = topicLength >> 8;
+    head[n++] = topicLength & 0xFF;
+    memcpy(head + n, topic, topicLength);
+    n += topicLength;
+    n += raw_frame_write_header(header, head + n, sizeof(head) - n);
+
+    LOG_EVENT(EVENT_FORWARDED, sensor->config->name, len);
+    // A packet written in part leaves the broker inside it, the socket is
+    // closed so that client.connected() fails and loop() connects again
+    if (net.write(head, n) != n || net.write(frame, len) != len)
+    {
+      DEBUG("Short write forwarding message %lu of sensor %s, closing the connection.",
+            (unsigned long)sensor->sequence, sensor->config->name);
+      net.stop();
+      publishFailures++;
+      return false;
+    }
+    publishes++;
+    return true;
+  }
+
+  // Keeps a reading for later while there is no connection
+  void enqueue(Sensor *sensor, const SmlReading &reading)
+  {
+    if (accept(sensor, reading))
+    {
+      store(sensor, reading);
+    }
+  }
+
+  // Publishes queued readings of a sensor in rate limited batches to
+  // <topic>/sensor/<name>/backfill, one JSON document per message
+  void drain(Sensor *sensor)
+  {
+    ReadingQueue *queue = sensor->queue;
+    unsigned long now = millis();
+    if (queue == NULL || !client.connected() || now - queue->last_drain < BACKFILL_INTERVAL || queue->empty())
+    {
+      return;
+    }
+    queue->last_drain = now;
+
+    QueuedReading batch[BACKFILL_BATCH_SIZE];
+    size_t count = queue->peek(batch, BACKFILL_BATCH_SIZE);
+    size_t done = 0;
+    uint32_t uptime = now / 1000;
+    while (done < count)
+    {
+      const QueuedReading &first = batch[done];
+      json.reset((first.flags & QUEUED_PREVIOUS_BOOT) ? -1 : (long)(uptime - first.queued_at));
+      size_t end = done;
+      for (; end < count && batch[end].time == first.time && batch[end].queued_at == first.queued_at; end++)
+      {
+        SmlReading reading;
+        batch[end].to_reading(reading);
+        if (!json.add(reading, reading.unit ? dlms_get_unit(reading.unit) : NULL))
+        {
+          break;
+        }
+      }
+      if (end == done)
+      {
+        // Cannot be published at all
+        end++;
+      }
+      else if (!publishDocument(sensor, "backfill"))
+      {
+        break;
+      }
+      done = end;
+    }
+    queue->pop(done);
+  }
+
+  // Publishes the summary of an aggregating sensor to
+  // <topic>/sensor/<name>/summary once its window is over, split into several
+  // documents if needed. If that fails, the window goes on for the OBIS codes
+  // not published yet.
+  void summarize(Sensor *sensor)
+  {
+    Aggregator *aggregator = sensor->aggregator;
+    if (aggregator == NULL || !client.connected() || !aggregator->due(millis()))
+    {
+      return;
+    }
+    // {"from":..,"to":..,"telegrams":..,"values":[..]}
+    char head[80];
+    int headLength = snprintf(head, sizeof(head), "{\"from\":%lu,\"to\":%lu,\"telegrams\":%lu,\"values\":[",
+                              (unsigned long)aggregator->get_from(), (unsigned long)aggregator->get_to(),
+                              (unsigned long)aggregator->get_telegrams());
+    size_t len = 0;
+    uint8_t first = 0; // Of the OBIS codes in the document
+    for (uint8_t i = 0; i < aggregator->size(); i++)
+    {
+      const Aggregate &aggregate = aggregator->get(i);
+      if (aggregate.count == 0 || aggregate.summarized)
+      {
+        continue;
+      }
+      char entry[192];
+      size_t entryLength = format_aggregate(aggregate, aggregate.unit ? dlms_get_unit(aggregate.unit) : NULL,
+                                            entry, sizeof(entry));
+      if (entryLength == 0)
+      {
+        DEBUG("Summary of an OBIS code is too long.");
+        continue;
+      }
+      // Room for the separator, the closing "]}" and the terminator
+      if (len > 0 && len + entryLength + 4 > sizeof(jsonBuffer))
+      {
+        if (!publishSummary(sensor, len))
+        {
+          return;
+        }
+        // Not to be published again if a later part fails
+        for (uint8_t j = first; j < i; j++)
+        {
+          if (aggregator->get(j).count > 0 && !aggregator->get(j).summarized)
+          {
+            aggregator->summarized(j);
+          }
+        }
+        len = 0;
+      }
+      if (len == 0)
+      {
+        memcpy(jsonBuffer, head, headLength);
+        len = headLength;
+        first = i;
+      }
+      else
+      {
+        jsonBuffer[len++] = ',';
+      }
+      memcpy(jsonBuffer + len, entry, entryLength);
+      len += entryLength;
+    }
+    if (len > 0 && !publishSummary(sensor, len))
+    {
+      return;
+    }
+    aggregator->reset();
+  }
+
 private:
   MqttConfig config;
   WiFiClient net;
-  MQTTClient client = MQTTClient(512);
-  String baseTopic;
+  MQTTClient client = MQTTClient(MQTT_READ_BUFFER_SIZE, MQTT_BUFFER_SIZE);
+  char baseTopic[sizeof(MqttConfig::topic) + 1] = "";
+  // Topics are built in place behind the "<baseTopic>sensor/<name>/" prefix
+  // of the sensor published last
+  char topic[TOPIC_BUFFER_SIZE];
+  size_t topicPrefixLength = 0;
+  Sensor *topicSensor = NULL;
+  char jsonBuffer[JSON_BUFFER_SIZE];
+  SmlJsonWriter json = SmlJsonWriter(jsonBuffer, sizeof(jsonBuffer));
+
+  bool configured = false;
+  unsigned long lastConnectAttempt = 0;
+  unsigned long reconnectDelay = 0;
+  unsigned long reconnectWait = 0;
+  unsigned long connectAttempts = 0;
+  unsigned long connectFailures = 0;
+  uint64_t blockedMicros = 0;
+  unsigned long publishes = 0;
+  unsigned long publishFailures = 0;
+#if EVENT_LOG_SIZE > 0
+  uint32_t eventCursor = 0;
+  uint32_t eventsLost = 0;
+#endif
 
-  void publish(const String &topic, const String &payload)
+  static uint32_t chipId()
   {
-    publish(topic.c_str(), payload.c_str());
+#ifdef ESP32
+    // Last three bytes of the MAC, as getChipId() on the ESP8266
+    uint64_t mac = ESP.getEfuseMac();
+    return ((mac >> 24) & 0xFF) << 16 | ((mac >> 32) & 0xFF) << 8 | ((mac >> 40) & 0xFF);
+#else
+    return ESP.getChipId();
+#endif
   }
-  void publish(String &topic, const char *payload)
+
+  // Returns the end of the sensor's topic prefix
+  char *sensorTopic(Sensor *sensor)
   {
-    publish(topic.c_str(), payload);
+    if (topicSensor != sensor)
+    {
+      int len = snprintf(topic, sizeof(topic), "%ssensor/%s/", baseTopic, sensor->config->name);
+      topicPrefixLength = (len < 0 || (size_t)len >= sizeof(topic)) ? sizeof(topic) - 1 : len;
+      topicSensor = sensor;
+    }
+    return topic + topicPrefixLength;
   }
-  void publish(const char *topic, const String &payload)
+
+  // Applies the per sensor filters
+  bool accept(Sensor *sensor, const SmlReading &reading)
   {
-    publish(topic, payload.c_str());
+    if (!reading.is_numeric() && sensor->config->numeric_only)
+    {
+      return false;
+    }
+    return sensor->change_filter == NULL || sensor->change_filter->filter(reading, millis());
   }
-  void publish(const char *topic, const char *payload)
+
+  // A reading that could not be published is queued if possible, or tried
+  // again with the next message otherwise
+  void store(Sensor *sensor, const SmlReading &reading)
   {
-    if (!client.connected())
+    if (sensor->queue != NULL && sensor->queue->push(reading, millis() / 1000))
+    {
+      return;
+    }
+    if (sensor->change_filter != NULL)
+    {
+      sensor->change_filter->invalidate(reading);
+    }
+  }
+
+  // Closes the summary document of [len] bytes in jsonBuffer and publishes it
+  bool publishSummary(Sensor *sensor, size_t len)
+  {
+    jsonBuffer[len++] = ']';
+    jsonBuffer[len++] = '}';
+    jsonBuffer[len] = '\0';
+    return publishSensorTopic(sensor, "summary", jsonBuffer, len);
+  }
+
+  void publishJson(Sensor *sensor)
+  {
+    if (!publishDocument(sensor, "json") && sensor->change_filter != NULL)
+    {
+      sensor->change_filter->invalidate();
+    }
+  }
+
+  // Publishes the JSON document to <topic>/sensor/<name>/<suffix>
+  bool publishDocument(Sensor *sensor, const char *suffix)
+  {
+    size_t len = json.finish();
+    return publishSensorTopic(sensor, suffix, json.get_buffer(), len);
+  }
+
+  bool publishSensorTopic(Sensor *sensor, const char *suffix, const char *payload, size_t payloadLength)
+  {
+    char *end = sensorTopic(sensor);
+    size_t len = strlen(suffix);
+    if ((size_t)(topic + sizeof(topic) - end) <= len)
     {
-      connect();
+      DEBUG("MQTT topic is too long.");
+      return false;
     }
+    memcpy(end, suffix, len + 1);
+    return publish(topic, payload, payloadLength);
+  }
+
+  bool publish(const char *topic, const char *payload)
+  {
+    return publish(topic, payload, strlen(payload));
+  }
+  bool publish(const char *topic, const char *payload, size_t len)
+  {
     if (!client.connected())
     {
-      // Something failed
-      DEBUG("Connection to MQTT broker failed.");
-      DEBUG("Unable to publish a message to '%s'.", topic);
-      return;
+      DEBUG("Not connected to MQTT broker, unable to publish a message to '%s'.", topic);
+      publishFailures++;
+      return false;
+    }
+    if (!client.publish(topic, payload, (int)len))
+    {
+      publishFailures++;
+      return false;
     }
-    DEBUG("Publishing message to '%s':", topic);
-    DEBUG("%s\n", payload);
-    client.publish(topic, payload);
+    publishes++;
+    return true;
   }
 };
 
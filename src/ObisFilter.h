@@ -0,0 +1,225 @@
+#ifndef OBIS_FILTER_H
+#define OBIS_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+
+const uint8_t OBIS_FILTER_SIZE = 8; // OBIS codes per sensor
+
+enum ObisFilterMode
+{
+    OBIS_FILTER_NONE,  // Everything is decoded
+    OBIS_FILTER_ALLOW, // Only the listed codes are decoded
+    OBIS_FILTER_DENY   // Everything but the listed codes is decoded
+};
+
+// Decides by the OBIS code alone whether an entry is decoded at all,
+// unwanted entries are skipped without looking at their values. Plain data,
+// as it is part of SensorConfig.
+class ObisFilter
+{
+public:
+    ObisFilterMode mode;
+    uint8_t count;
+    uint8_t codes[OBIS_FILTER_SIZE][OBIS_LENGTH];
+
+    bool accepts(const uint8_t *obis) const
+    {
+        if (this->mode == OBIS_FILTER_NONE)
+        {
+            return true;
+        }
+        bool listed = false;
+        for (uint8_t i = 0; i < this->count && !listed; i++)
+        {
+            listed = memcmp(this->codes[i], obis, OBIS_LENGTH) == 0;
+        }
+        return listed == (this->mode == OBIS_FILTER_ALLOW);
+    }
+
+    // Takes comma or space separated codes as A-B:C.D.E*F, where A-B:
+    // defaults to 1-0: and *F to *255. Returns false if a code is malformed
+    // or there are too many, the filter is left unchanged then.
+    bool parse(const char *text)
+    {
+        // Unused entries are zeroed, configurations are compared as a whole
+        uint8_t parsed[OBIS_FILTER_SIZE][OBIS_LENGTH] = {};
+        uint8_t n = 0;
+        const char *p = text;
+        while (true)
+        {
+            while (*p == ',' || *p == ' ')
+            {
+                p++;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            if (n == OBIS_FILTER_SIZE || !parse_code(p, parsed[n]))
+            {
+                return false;
+            }
+            n++;
+        }
+        memcpy(this->codes, parsed, sizeof(parsed));
+        this->count = n;
+        return true;
+    }
+
+    // Comma separated codes as A-B:C.D.E*F, returns the length written
+    size_t format(char *out, size_t size) const
+    {
+        size_t len = 0;
+        if (size > 0)
+        {
+            out[0] = '\0';
+        }
+        for (uint8_t i = 0; i < this->count; i++)
+        {
+            if (i > 0)
+            {
+                if (len + 2 >= size)
+                {
+                    break;
+                }
+                out[len++] = ',';
+                out[len++] = ' ';
+                out[len] = '\0';
+            }
+            size_t written = sml_format_obis(this->codes[i], '*', out + len, size - len);
+            if (written == 0)
+            {
+                out[len - (i > 0 ? 2 : 0)] = '\0';
+                return len - (i > 0 ? 2 : 0);
+            }
+            len += written;
+        }
+        return len;
+    }
+
+private:
+    static bool parse_number(const char *&p, uint8_t &value)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            return false;
+        }
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        p = end;
+        value = (uint8_t)n;
+        return n <= 255;
+    }
+
+    static bool parse_code(const char *&p, uint8_t *obis)
+    {
+        obis[0] = 1;
+        obis[1] = 0;
+        obis[5] = 255;
+        uint8_t first;
+        if (!parse_number(p, first))
+        {
+            return false;
+        }
+        uint8_t *c = obis + 2;
+        if (*p == '-')
+        {
+            obis[0] = first;
+            p++;
+            if (!parse_number(p, obis[1]) || *p++ != ':' || !parse_number(p, c[0]))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            c[0] = first;
+        }
+        if (*p++ != '.' || !parse_number(p, c[1]) || *p++ != '.' || !parse_number(p, c[2]))
+        {
+            return false;
+        }
+        if (*p == '*' || *p == '/')
+        {
+            p++;
+            if (!parse_number(p, obis[5]))
+            {
+                return false;
+            }
+        }
+        return *p == '\0' || *p == ',' || *p == ' ';
+    }
+};
+
+// OBIS code A-B:C.D.E*F as a single comparable number
+constexpr uint64_t obis_code(uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e, uint8_t f)
+{
+    return ((uint64_t)a << 40) | ((uint64_t)b << 32) | ((uint64_t)c << 24) | ((uint64_t)d << 16) |
+           ((uint64_t)e << 8) | f;
+}
+
+inline uint64_t obis_code(const uint8_t *obis)
+{
+    return obis_code(obis[0], obis[1], obis[2], obis[3], obis[4], obis[5]);
+}
+
+constexpr bool obis_table_sorted(const uint64_t *codes, size_t n)
+{
+    return n < 2 || (codes[0] < codes[1] && obis_table_sorted(codes + 1, n - 1));
+}
+
+// Set of OBIS codes fixed at build time: a sorted table in flash, searched
+// by bisection
+template <size_t N>
+class ObisTable
+{
+public:
+    constexpr explicit ObisTable(const uint64_t (&codes)[N]) : codes(codes) {}
+
+    bool accepts(const uint8_t *obis) const
+    {
+        uint64_t code = obis_code(obis);
+        size_t low = 0;
+        size_t high = N;
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+            if (this->codes[middle] < code)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low < N && this->codes[low] == code;
+    }
+
+private:
+    const uint64_t *codes;
+};
+
+// Accepts what both filters accept
+template <typename First, typename Second>
+class ObisFilterPair
+{
+public:
+    ObisFilterPair(const First &first, const Second &second) : first(first), second(second) {}
+
+    bool accepts(const uint8_t *obis) const
+    {
+        return this->first.accepts(obis) && this->second.accepts(obis);
+    }
+
+private:
+    const First &first;
+    const Second &second;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef RAW_FRAME_H
+#define RAW_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Header in front of an SML message forwarded as it was received
+// (PUBLISH_RAW), all numbers big endian:
+//
+//   version         1  RAW_FRAME_VERSION
+//   name length     1  n
+//   name            n  of the sensor, not terminated
+//   device id       4  chip id of the reader
+//   sequence        4  messages of the sensor handed over since boot
+//   captured at     4  milliseconds since boot when the message was read
+//   frame length    2  bytes following the header
+//
+// The frame follows with start sequence, escaping, trailer and CRC, so a
+// backend can check it and decode it with any SML library. A gap in the
+// sequence numbers is a message that got lost on the way, a smaller one
+// means the reader restarted.
+const uint8_t RAW_FRAME_VERSION = 1;
+const size_t RAW_FRAME_FIXED_LENGTH = 16; // Without the name
+const size_t RAW_FRAME_MAX_NAME = 255;
+
+struct RawFrameHeader
+{
+    const char *name; // Not terminated, points into the message
+    uint8_t name_length;
+    uint32_t device_id;
+    uint32_t sequence;
+    uint32_t captured_at;
+    uint16_t frame_length;
+};
+
+inline uint8_t *raw_frame_put(uint8_t *out, uint32_t value, uint8_t bytes)
+{
+    while (bytes--)
+    {
+        *out++ = (uint8_t)(value >> (8 * bytes));
+    }
+    return out;
+}
+
+inline uint32_t raw_frame_get(const uint8_t *in, uint8_t bytes)
+{
+    uint32_t value = 0;
+    while (bytes--)
+    {
+        value = (value << 8) | *in++;
+    }
+    return value;
+}
+
+inline size_t raw_frame_header_length(size_t name_length)
+{
+    return RAW_FRAME_FIXED_LENGTH + name_length;
+}
+
+// Writes the header of [header] into [out], returns its length or 0 if it
+// does not fit into [size] bytes
+inline size_t raw_frame_write_header(const RawFrameHeader &header, uint8_t *out, size_t size)
+{
+    size_t len = raw_frame_header_length(header.name_length);
+    if (len > size)
+    {
+        return 0;
+    }
+    *out++ = RAW_FRAME_VERSION;
+    *out++ = header.name_length;
+    memcpy(out, header.name, header.name_length);
+    out += header.name_length;
+    out = raw_frame_put(out, header.device_id, 4);
+    out = raw_frame_put(out, header.sequence, 4);
+    out = raw_frame_put(out, header.captured_at, 4);
+    raw_frame_put(out, header.frame_length, 2);
+    return len;
+}
+
+// Reads the header of a forwarded message, returns its length or 0 if the
+// message is not a complete one of this version
+inline size_t raw_frame_read_header(const uint8_t *in, size_t len, RawFrameHeader &header)
+{
+    if (len < RAW_FRAME_FIXED_LENGTH || in[0] != RAW_FRAME_VERSION)
+    {
+        return 0;
+    }
+    size_t header_length = raw_frame_header_length(in[1]);
+    if (len < header_length)
+    {
+        return 0;
+    }
+    header.name_length = in[1];
+    header.name = (const char *)in + 2;
+    const uint8_t *numbers = in + 2 + header.name_length;
+    header.device_id = raw_frame_get(numbers, 4);
+    header.sequence = raw_frame_get(numbers + 4, 4);
+    header.captured_at = raw_frame_get(numbers + 8, 4);
+    header.frame_length = (uint16_t)raw_frame_get(numbers + 12, 2);
+    return len - header_length == header.frame_length ? header_length : 0;
+}
+
+#endif
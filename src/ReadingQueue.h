@@ -0,0 +1,201 @@
+#ifndef READING_QUEUE_H
+#define READING_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SpillFile.h"
+
+const uint8_t QUEUED_PREVIOUS_BOOT = 0x01; // Queued before the last restart, the age is unknown
+
+// Compact copy of a numeric or boolean reading, also the record layout of
+// the spill file
+struct QueuedReading
+{
+    int64_t value;
+    uint32_t time;      // Meter time of the reading (SmlReading::time)
+    uint32_t queued_at; // Uptime in seconds when it was queued
+    uint8_t obis[OBIS_LENGTH];
+    uint8_t type;
+    int8_t scaler;
+    uint8_t unit;
+    uint8_t flags;
+
+    void to_reading(SmlReading &reading) const
+    {
+        reading.obis = this->obis;
+        reading.type = (SmlReadingType)this->type;
+        reading.value = this->value;
+        reading.scaler = this->scaler;
+        reading.unit = this->unit;
+        reading.octets = NULL;
+        reading.octets_len = 0;
+        reading.time = this->time;
+    }
+};
+
+// Bounded FIFO of the readings a sensor could not publish. Once the RAM ring
+// is full, its older half goes to the spill file (if any) until that reaches
+// its limit, then the oldest readings are dropped. Readings are handed out
+// oldest first, the spill file before the ring.
+class ReadingQueue
+{
+public:
+    ReadingQueue(size_t capacity, SpillFile *spill = NULL, size_t spill_limit = 0)
+        : capacity(capacity), spill(spill), spill_limit(spill_limit)
+    {
+        this->records = new QueuedReading[capacity];
+        if (this->spill != NULL)
+        {
+            // Whatever is left from before the restart gets drained first
+            this->spill_boot_size = this->spill->size();
+            if (this->spill_boot_size % sizeof(QueuedReading) != 0)
+            {
+                this->spill->clear();
+                this->spill_boot_size = 0;
+            }
+        }
+    }
+
+    ~ReadingQueue()
+    {
+        delete[] this->records;
+        delete this->spill;
+    }
+
+    // Octet strings are not queued
+    bool push(const SmlReading &reading, uint32_t uptime)
+    {
+        if (!reading.is_numeric() && reading.type != SML_READING_BOOLEAN)
+        {
+            return false;
+        }
+        if (this->count == this->capacity && !this->spill_half())
+        {
+            this->head = (this->head + 1) % this->capacity;
+            this->count--;
+            this->dropped++;
+        }
+        QueuedReading &record = this->records[(this->head + this->count) % this->capacity];
+        record.value = reading.value;
+        record.time = reading.time;
+        record.queued_at = uptime;
+        memcpy(record.obis, reading.obis, OBIS_LENGTH);
+        record.type = reading.type;
+        record.scaler = reading.scaler;
+        record.unit = reading.unit;
+        record.flags = 0;
+        this->count++;
+        this->pushed++;
+        return true;
+    }
+
+    // Copies up to [max] of the oldest readings without removing them
+    size_t peek(QueuedReading *out, size_t max)
+    {
+        size_t spilled = this->spilled();
+        this->peeked_spill = spilled > 0;
+        if (this->peeked_spill)
+        {
+            size_t n = spilled < max ? spilled : max;
+            n = this->spill->read(this->spill_offset, out, n * sizeof(QueuedReading)) / sizeof(QueuedReading);
+            for (size_t i = 0; i < n; i++)
+            {
+                if (this->spill_offset + i * sizeof(QueuedReading) < this->spill_boot_size)
+                {
+                    out[i].flags |= QUEUED_PREVIOUS_BOOT;
+                }
+            }
+            return n;
+        }
+        size_t n = this->count < max ? this->count : max;
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = this->records[(this->head + i) % this->capacity];
+        }
+        return n;
+    }
+
+    // Removes readings returned by the last peek()
+    void pop(size_t n)
+    {
+        if (this->peeked_spill)
+        {
+            this->spill_offset += n * sizeof(QueuedReading);
+            if (this->spill_offset >= this->spill->size())
+            {
+                this->spill->clear();
+                this->spill_offset = 0;
+                this->spill_boot_size = 0;
+            }
+            return;
+        }
+        n = n < this->count ? n : this->count;
+        this->head = (this->head + n) % this->capacity;
+        this->count -= n;
+    }
+
+    size_t size()
+    {
+        return this->count + this->spilled();
+    }
+
+    bool empty()
+    {
+        return this->size() == 0;
+    }
+
+    unsigned long get_pushed() const
+    {
+        return this->pushed;
+    }
+
+    unsigned long get_dropped() const
+    {
+        return this->dropped;
+    }
+
+    // Rate limiting of the drain, in milliseconds
+    unsigned long last_drain = 0;
+
+private:
+    QueuedReading *records;
+    size_t capacity;
+    size_t head = 0;
+    size_t count = 0;
+    unsigned long pushed = 0;
+    unsigned long dropped = 0;
+
+    SpillFile *spill;
+    size_t spill_limit;
+    size_t spill_offset = 0;
+    size_t spill_boot_size = 0;
+    bool peeked_spill = false;
+
+    size_t spilled()
+    {
+        return this->spill != NULL ? (this->spill->size() - this->spill_offset) / sizeof(QueuedReading) : 0;
+    }
+
+    // Moves the older half of the ring to the spill file
+    bool spill_half()
+    {
+        size_t n = this->capacity / 2 > 0 ? this->capacity / 2 : 1;
+        if (this->spill == NULL || this->spill->size() + n * sizeof(QueuedReading) > this->spill_limit)
+        {
+            return false;
+        }
+        size_t first = this->capacity - this->head < n ? this->capacity - this->head : n;
+        if (!this->spill->append(&this->records[this->head], first * sizeof(QueuedReading)) ||
+            (first < n && !this->spill->append(&this->records[0], (n - first) * sizeof(QueuedReading))))
+        {
+            return false;
+        }
+        this->head = (this->head + n) % this->capacity;
+        this->count -= n;
+        return true;
+    }
+};
+
+#endif
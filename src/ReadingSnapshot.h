@@ -0,0 +1,165 @@
+#ifndef READING_SNAPSHOT_H
+#define READING_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SmlJson.h"
+
+// Latest readings of a sensor as a JSON document (see SmlJson.h), for
+// clients polling the web server. A telegram is written into the back
+// buffer while it is decoded and only becomes the served document once it
+// is complete, so requests neither wait for the sensor nor see half a
+// telegram, and the document is handed out as it is, without copying or
+// formatting it again.
+class ReadingSnapshot
+{
+public:
+    // The buffers are only taken on the first request(), until then the
+    // sensor keeps no readings
+    explicit ReadingSnapshot(size_t size) : size(size)
+    {
+        this->buffers[0] = this->buffers[1] = NULL;
+        this->lengths[0] = this->lengths[1] = 0;
+    }
+
+    ~ReadingSnapshot()
+    {
+        delete[] this->buffers[0];
+        delete[] this->buffers[1];
+    }
+
+    // Called for every request of the document, allocates the buffers the
+    // first time. The readings are there from the next telegram on.
+    void request()
+    {
+        if (this->buffers[0] != NULL)
+        {
+            return;
+        }
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            this->buffers[i] = new char[this->size];
+            this->buffers[i][0] = '\0';
+        }
+    }
+
+    // Starts writing the next telegram into the back buffer
+    void begin()
+    {
+        this->writing = this->buffers[0] != NULL;
+        if (this->writing)
+        {
+            this->writer = SmlJsonWriter(this->buffers[1 - this->front], this->size);
+            this->writer.reset();
+        }
+    }
+
+    // Readings not fitting into the document are left out
+    void add(const SmlReading &reading, const char *unit)
+    {
+        if (this->writing && !this->writer.add(reading, unit))
+        {
+            this->truncated++;
+        }
+    }
+
+    // Makes the telegram written since begin() the served document, [now]
+    // in milliseconds
+    void commit(unsigned long now)
+    {
+        if (!this->writing)
+        {
+            return;
+        }
+        this->writing = false;
+        uint8_t back = 1 - this->front;
+        this->lengths[back] = this->writer.finish();
+        this->updated_at = now;
+        this->front = back;
+        this->commits++;
+    }
+
+    // The served document, empty if the telegram had no readings
+    const char *get_document(size_t &len) const
+    {
+        uint8_t front = this->front;
+        len = this->lengths[front];
+        return this->buffers[front];
+    }
+
+    // Milliseconds since the last commit, -1 if there was none yet
+    long get_age(unsigned long now) const
+    {
+        return this->commits > 0 ? (long)(now - this->updated_at) : -1;
+    }
+
+    // Readings left out because the document was full
+    unsigned long get_truncated() const
+    {
+        return this->truncated;
+    }
+
+private:
+    char *buffers[2];
+    size_t lengths[2];
+    size_t size;
+    volatile uint8_t front = 0;
+    bool writing = false; // Between begin() and commit() with buffers
+    unsigned long updated_at = 0;
+    unsigned long commits = 0;
+    unsigned long truncated = 0;
+    SmlJsonWriter writer = SmlJsonWriter(NULL, 0);
+};
+
+// Writes {"sensors":[{"name":"1","age":2,"time":..,"values":[..]},..]} by
+// handing its parts to [send] (const char *data, size_t len), where the
+// documents of the snapshots are passed on as they are. Sensors without a
+// snapshot or telegram yet have an age of null. Returns the length, so it
+// can be run with a send that only counts first to get the content length.
+template <typename Send>
+size_t write_readings(const ReadingSnapshot *const *snapshots, const char *const *names, uint8_t count,
+                      unsigned long now, Send send)
+{
+    size_t total = 0;
+    char head[112];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        size_t len = snprintf(head, sizeof(head), "%s{\"name\":\"", i == 0 ? "{\"sensors\":[" : ",");
+        for (const char *c = names[i]; *c && len + 40 < sizeof(head); c++)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                head[len++] = '\\';
+            }
+            head[len++] = *c;
+        }
+        long age = snapshots[i] != NULL ? snapshots[i]->get_age(now) : -1;
+        size_t document_len = 0;
+        const char *document = age >= 0 ? snapshots[i]->get_document(document_len) : NULL;
+        if (age < 0)
+        {
+            len += snprintf(head + len, sizeof(head) - len, "\",\"age\":null}");
+        }
+        else
+        {
+            len += snprintf(head + len, sizeof(head) - len, "\",\"age\":%ld,%s", age / 1000,
+                            document_len > 0 ? "" : "\"values\":[]}");
+        }
+        send(head, len);
+        total += len;
+        if (document_len > 0)
+        {
+            // Without its opening brace, which is part of the head
+            send(document + 1, document_len - 1);
+            total += document_len - 1;
+        }
+    }
+    const char *tail = count > 0 ? "]}" : "{\"sensors\":[]}";
+    send(tail, strlen(tail));
+    return total + strlen(tail);
+}
+
+#endif
@@ -1,14 +1,30 @@
 #ifndef SENSOR_H
 #define SENSOR_H
 
-#include<SoftwareSerial.h>
 #include <jled.h>
 #include "debug.h"
+#include "EventLog.h"
+#include "SerialCapture.h"
+#include "SmlCrc.h"
+#include "SmlFraming.h"
+#include "SmlFrameDecoder.h"
+#include "SmlTextDecoder.h"
+#include "D0Decoder.h"
+#include "ChangeFilter.h"
+#include "ReadingQueue.h"
+#include "ObisFilter.h"
+#include "Metrics.h"
+#include "ReadingSnapshot.h"
+#include "Aggregator.h"
+#include "FramePool.h"
+
+class TelegramChannel; // See TelegramChannel.h
 
 // SML constants
 const byte START_SEQUENCE[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
 const byte END_SEQUENCE[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x1A};
-const size_t BUFFER_SIZE = 3840; // Max datagram duration 400ms at 9600 Baud
+const size_t BUFFER_SIZE = SML_MAX_FRAME_LENGTH;
+const size_t RX_CHUNK_SIZE = 64; // Bytes taken from the capture at once
 const uint8_t READ_TIMEOUT = 30;
 
 // States
@@ -17,35 +33,118 @@ enum State
     INIT,
     WAIT_FOR_START_SEQUENCE,
     READ_MESSAGE,
-    PROCESS_MESSAGE,
-    READ_CHECKSUM
+    READ_CHECKSUM,
+    READ_TELEGRAM // Decoded while it arrives, see TelegramDecoder
+};
+
+// How the readings of a sensor are published
+enum PublishMode
+{
+    PUBLISH_VALUES, // One topic per OBIS code
+    PUBLISH_JSON,   // One JSON document per telegram
+    PUBLISH_RAW     // The message as received, decoded by the backend (see RawFrame.h)
+};
+
+// Which message is dropped when one has been read completely while the
+// previous one still waits to be processed
+enum OverrunPolicy
+{
+    OVERRUN_DROP_OLDEST, // The waiting one, so the latest readings get published
+    OVERRUN_DROP_NEWEST  // The one just read
+};
+
+// A message read completely, waiting for Sensor::process()
+struct PendingFrame
+{
+    byte *buffer;               // NULL if none is waiting
+    size_t size;                // Of the buffer
+    size_t length;              // Of the message
+    unsigned long completed_at; // micros()
 };
 
+const uint8_t SENSOR_NAME_LENGTH = 16; // Including the terminator
+
+// Plain data, so it can be stored as it is (see SensorConfigStore.h)
 class SensorConfig
 {
 public:
-    const uint8_t pin;
-    const char *name;
-    const bool numeric_only;
-    const bool status_led_enabled;
-    const bool status_led_inverted;
-    const uint8_t status_led_pin;
-    const uint8_t interval;
+    uint8_t pin;
+    char name[SENSOR_NAME_LENGTH];
+    bool numeric_only;
+    bool status_led_enabled;
+    bool status_led_inverted;
+    uint8_t status_led_pin;
+    uint8_t interval;
+    bool streaming;
+    bool changes_only;
+    uint16_t heartbeat;
+    PublishMode publish_mode;
+    uint16_t offline_queue;
+    CaptureType capture;
+    ObisFilter obis_filter;
+    uint16_t aggregation; // Seconds summarized into one message, 0 publishes every message
+    Protocol protocol;
+    int8_t tx_pin; // Sends the requests of PROTOCOL_D0_MODE_A and _C, -1 for none
+    OverrunPolicy overrun;
 };
 
 class Sensor
 {
 public:
     const SensorConfig *config;
-    Sensor(const SensorConfig *config, void (*callback)(byte *buffer, size_t len,  Sensor *sensor))
+    // All owned by the sensor
+    ChangeFilter *change_filter = NULL; // Set up for sensors publishing changes only
+    ReadingQueue *queue = NULL;         // Readings waiting for the MQTT connection
+    ReadingSnapshot *snapshot = NULL;   // Latest readings for /api/readings
+    Aggregator *aggregator = NULL;      // Set up for sensors with an aggregation window
+    SensorMetrics metrics;              // Counters for the metrics page and the stats topic
+    TelegramChannel *channel = NULL;    // Not owned, set while the sensor is read by a task of its own
+    uint32_t sequence = 0;              // Messages handed to the listeners, numbers raw messages
+    // Buffered SML sensors borrow their message buffers from [frame_pool],
+    // without one they keep their own: the second one of BUFFER_SIZE bytes is
+    // only allocated (and then kept) once a message starts while the
+    // previous one still waits to be processed. [callback] gets their messages
+    // unescaped, with start sequence and trailer (at least 16 bytes), or as
+    // received with PUBLISH_RAW.
+    Sensor(const SensorConfig *config, void (*callback)(byte *buffer, size_t len,  Sensor *sensor),
+           void (*readings_callback)(const SmlReading *readings, size_t count, Sensor *sensor) = NULL,
+           FramePool *frame_pool = NULL)
     {
         this->config = config;
+        memset(&this->metrics, 0, sizeof(this->metrics));
         DEBUG("Initializing sensor %s...", this->config->name);
         this->callback = callback;
-        this->serial = new SoftwareSerial();
-        this->serial->begin(9600, SWSERIAL_8N1, this->config->pin, -1, false);
-        this->serial->enableTx(false);
-        this->serial->enableRx(true);
+        this->readings_callback = readings_callback;
+        if (this->config->protocol != PROTOCOL_SML || this->config->streaming)
+        {
+            // Telegrams are decoded while they arrive, nothing is buffered
+            this->telegram_decoder = this->create_decoder();
+        }
+        else if (frame_pool != NULL)
+        {
+            this->frame_pool = frame_pool;
+            this->frame_pool->attach();
+        }
+        else
+        {
+            // The one being read, see borrow_buffer() for the second
+            this->own_buffers[0] = new byte[BUFFER_SIZE];
+        }
+        int8_t tx_pin = this->config->protocol == PROTOCOL_D0_MODE_A || this->config->protocol == PROTOCOL_D0_MODE_C
+                            ? this->config->tx_pin
+                            : -1;
+        if (this->config->capture == CAPTURE_HARDWARE_SERIAL)
+        {
+            this->input = new HardwareSerialCapture(this->config->pin, tx_pin);
+        }
+        else
+        {
+            this->input = new SoftwareSerialCapture(this->config->pin, tx_pin);
+        }
+        if (this->telegram_decoder != NULL)
+        {
+            this->telegram_decoder->begin(*this->input);
+        }
         DEBUG("Initialized sensor %s.", this->config->name);
 
         if (this->config->status_led_enabled) {
@@ -58,35 +157,164 @@ public:
         this->init_state();
     }
 
-    void loop()
+    ~Sensor()
+    {
+        delete this->change_filter;
+        delete this->queue;
+        delete this->snapshot;
+        delete this->aggregator;
+        delete this->input;
+        this->release_buffer();
+        this->give_back(this->pending.buffer, this->pending.size);
+        if (this->frame_pool != NULL)
+        {
+            this->frame_pool->detach();
+        }
+        delete[] this->own_buffers[0];
+        delete[] this->own_buffers[1];
+        delete this->telegram_decoder;
+        delete this->status_led;
+    }
+
+    // Messages dropped because of a checksum mismatch
+    unsigned long get_crc_errors() const
+    {
+        return this->metrics.crc_errors;
+    }
+
+    // Times the capture lost bytes because they were not picked up in time
+    unsigned long get_rx_overflows() const
+    {
+        return this->metrics.rx_overflows;
+    }
+
+    // When the message handed to the listeners was read completely
+    unsigned long get_message_completed_at() const
     {
-        this->run_current_state();
+        return this->message_completed_at;
+    }
+
+    // Bytes received but not processed yet
+    size_t available()
+    {
+        return (this->rx_length - this->rx_position) + this->input->available();
+    }
+
+    // Runs the state machine on at most [budget] bytes of the capture.
+    // Complete messages are kept for process() while reading goes on with
+    // another buffer, complete telegrams of a TelegramDecoder stop it until
+    // they have been processed. Returns whether one is waiting.
+    bool capture(size_t budget)
+    {
+        this->budget = budget;
+        while (!this->telegram_ready)
+        {
+            this->run_current_state();
+            if (!this->input_pending())
+            {
+                break;
+            }
+        }
+        if (this->budget == 0 && this->input->available() > 0)
+        {
+            this->metrics.budget_exhausted++;
+        }
         yield();
         if (this->config->status_led_enabled) {
             this->status_led->Update();
             yield();
         }
+        return this->ready();
+    }
+
+    // A complete message waits for process()
+    bool ready() const
+    {
+        return this->pending.buffer != NULL || this->telegram_ready;
+    }
+
+    // Decodes and hands over the waiting message
+    void process()
+    {
+        if (this->pending.buffer != NULL)
+        {
+            this->process_message(this->pending);
+            this->give_back(this->pending.buffer, this->pending.size);
+            this->pending.buffer = NULL;
+        }
+        else if (this->telegram_ready)
+        {
+            this->telegram_ready = false;
+            this->hand_over_readings();
+        }
+    }
+
+    // Capture and processing in one go, for a single sensor
+    void loop()
+    {
+        if (this->capture(SIZE_MAX))
+        {
+            this->process();
+        }
     }
 
 private:
-    SoftwareSerial *serial;
-    byte buffer[BUFFER_SIZE];
+    SerialCapture *input;
+    byte rx_chunk[RX_CHUNK_SIZE];
+    size_t rx_position = 0;
+    size_t rx_length = 0;
+    size_t budget = 0; // Bytes left to take from the capture in this turn
+    byte *buffer = NULL;
+    size_t buffer_size = 0;
+    FramePool *frame_pool = NULL; // Lends the buffer from the start sequence until processed
+    byte *own_buffers[2] = {NULL, NULL}; // Without a frame pool
+    PendingFrame pending = {NULL, 0, 0, 0};
     size_t position = 0;
     unsigned long last_state_reset = 0;
     unsigned long last_callback_call = 0;
     uint8_t bytes_until_checksum = 0;
     uint8_t loop_counter = 0;
+    unsigned long frame_completed_at = 0; // micros()
+    unsigned long message_completed_at = 0; // micros(), of the message being handed over
     State state = INIT;
+    SmlStartMatcher start_matcher;
+    SmlEscapeScanner scanner;
     void (*callback)(byte *buffer, size_t len, Sensor *sensor) = NULL;
-    JLed *status_led;
+    void (*readings_callback)(const SmlReading *readings, size_t count, Sensor *sensor) = NULL;
+    JLed *status_led = NULL;
+
+    // Streaming mode and protocols other than SML binary
+    TelegramDecoder *telegram_decoder = NULL;
+    bool telegram_ready = false; // Readings of a complete telegram wait for process()
+
+    TelegramDecoder *create_decoder()
+    {
+        const ObisFilter *filter = &this->config->obis_filter;
+        switch (this->config->protocol)
+        {
+        case PROTOCOL_SML_TEXT:
+            return new SmlTextDecoder(filter);
+        case PROTOCOL_D0:
+        case PROTOCOL_D0_MODE_A:
+        case PROTOCOL_D0_MODE_C:
+            // The meter is asked once per interval
+            return new D0Decoder(this->config->protocol, filter,
+                                 this->config->interval > 0 ? this->config->interval : D0_REQUEST_INTERVAL);
+        default:
+            return new SmlFrameDecoder(filter);
+        }
+    }
 
     void run_current_state()
     {
         if (this->state != INIT)
         {
-            if ((millis() - this->last_state_reset) > (READ_TIMEOUT * 1000))
+            // Requested telegrams time out with their exchange
+            bool requested = this->telegram_decoder != NULL && this->telegram_decoder->requests();
+            if (!requested && (millis() - this->last_state_reset) > (READ_TIMEOUT * 1000))
             {
-                DEBUG("Did not receive an SML message within %d seconds, starting over.", READ_TIMEOUT);
+                LOG_EVENT(EVENT_READ_TIMEOUT, this->config->name, READ_TIMEOUT);
+                this->metrics.timeouts++;
                 this->reset_state();
             }
             switch (this->state)
@@ -97,26 +325,49 @@ private:
             case READ_MESSAGE:
                 this->read_message();
                 break;
-            case PROCESS_MESSAGE:
-                this->process_message();
-                break;
             case READ_CHECKSUM:
                 this->read_checksum();
                 break;
+            case READ_TELEGRAM:
+                this->read_telegram();
+                break;
             default:
                 break;
             }
         }
     }
 
-    // Wrappers for sensor access
-    int data_available()
+    // Whether the state machine can make progress within the budget
+    bool input_pending()
+    {
+        return this->rx_position < this->rx_length || (this->budget > 0 && this->input->available() > 0);
+    }
+
+    // Sensor access, bytes are taken from the capture a chunk at a time
+    bool data_available()
     {
-        return this->serial->available();
+        if (this->rx_position < this->rx_length)
+        {
+            return true;
+        }
+        if (this->rx_length > 0)
+        {
+            // Once per chunk rather than once per byte
+            yield();
+        }
+        this->rx_length = this->input->read(this->rx_chunk, this->budget < sizeof(this->rx_chunk) ? this->budget : sizeof(this->rx_chunk));
+        this->rx_position = 0;
+        this->budget -= this->rx_length;
+        this->metrics.bytes_read += this->rx_length;
+        if (this->input->overflow())
+        {
+            this->metrics.rx_overflows++;
+        }
+        return this->rx_length > 0;
     }
-    int data_read()
+    byte data_read()
     {
-        return this->serial->read();
+        return this->rx_chunk[this->rx_position++];
     }
 
 
@@ -125,22 +376,28 @@ private:
     {
         if (new_state == WAIT_FOR_START_SEQUENCE)
         {
-            DEBUG("State of sensor %s is 'WAIT_FOR_START_SEQUENCE'.", this->config->name);
+            LOG_EVENT(EVENT_STATE_WAIT_FOR_START_SEQUENCE, this->config->name);
+            this->release_buffer();
             this->last_state_reset = millis();
             this->position = 0;
+            this->start_matcher.reset();
         }
         else if (new_state == READ_MESSAGE)
         {
-            DEBUG("State of sensor %s is 'READ_MESSAGE'.", this->config->name);
+            LOG_EVENT(EVENT_STATE_READ_MESSAGE, this->config->name);
+            this->scanner.reset();
         }
         else if (new_state == READ_CHECKSUM)
         {
-            DEBUG("State of sensor %s is 'READ_CHECKSUM'.", this->config->name);
+            LOG_EVENT(EVENT_STATE_READ_CHECKSUM, this->config->name);
             this->bytes_until_checksum = 3;
         }
-        else if (new_state == PROCESS_MESSAGE)
+        else if (new_state == READ_TELEGRAM)
         {
-            DEBUG("State of sensor %s is 'PROCESS_MESSAGE'.", this->config->name);
+            LOG_EVENT(EVENT_STATE_READ_TELEGRAM, this->config->name);
+            this->last_state_reset = millis();
+            this->telegram_decoder->reset();
+            this->telegram_ready = false;
         };
         this->state = new_state;
     }
@@ -148,17 +405,58 @@ private:
     // Initialize state machine
     void init_state()
     {
-        this->set_state(WAIT_FOR_START_SEQUENCE);
+        this->set_state(this->telegram_decoder != NULL ? READ_TELEGRAM : WAIT_FOR_START_SEQUENCE);
     }
 
     // Start over and wait for the start sequence
-    void reset_state(const char *message = NULL)
+    void reset_state()
+    {
+        this->init_state();
+    }
+
+    void reset_state(EventId event, uint32_t value = 0)
+    {
+        LOG_EVENT(event, this->config->name, value);
+        this->init_state();
+    }
+
+    // Pooled buffers are only held while a message is read and processed, a
+    // second one is only taken while a message is pending
+    bool borrow_buffer()
     {
-        if (message != NULL && strlen(message) > 0)
+        if (this->buffer != NULL)
         {
-            DEBUG(message);
+            return true;
+        }
+        if (this->frame_pool != NULL)
+        {
+            this->buffer = this->frame_pool->borrow(this->buffer_size);
+        }
+        else if (this->own_buffers[0] != NULL)
+        {
+            uint8_t free = this->pending.buffer == this->own_buffers[0] ? 1 : 0;
+            if (this->own_buffers[free] == NULL)
+            {
+                this->own_buffers[free] = new (std::nothrow) byte[BUFFER_SIZE];
+            }
+            this->buffer = this->own_buffers[free];
+            this->buffer_size = BUFFER_SIZE;
+        }
+        return this->buffer != NULL;
+    }
+
+    void give_back(byte *buffer, size_t size)
+    {
+        if (this->frame_pool != NULL && buffer != NULL)
+        {
+            this->frame_pool->release(buffer, size);
         }
-        this->init_state();
+    }
+
+    void release_buffer()
+    {
+        this->give_back(this->buffer, this->buffer_size);
+        this->buffer = NULL;
     }
 
     // Wait for the start_sequence to appear
@@ -166,14 +464,20 @@ private:
     {
         while (this->data_available())
         {
-            this->buffer[this->position] = this->data_read();
-            yield();
-
-            this->position = (this->buffer[this->position] == START_SEQUENCE[this->position]) ? (this->position + 1) : 0;
-            if (this->position == sizeof(START_SEQUENCE))
+            this->rx_position += this->start_matcher.scan(this->rx_chunk + this->rx_position, this->rx_length - this->rx_position);
+            if (this->start_matcher.found())
             {
                 // Start sequence has been found
-                DEBUG("Start sequence found.");
+                LOG_EVENT(EVENT_START_SEQUENCE, this->config->name);
+                this->metrics.frames_started++;
+                if (!this->borrow_buffer())
+                {
+                    this->metrics.no_buffer++;
+                    this->reset_state(EVENT_NO_BUFFER);
+                    return;
+                }
+                memcpy(this->buffer, START_SEQUENCE, sizeof(START_SEQUENCE));
+                this->position = sizeof(START_SEQUENCE);
                 if (this->config->status_led_enabled) {
                     this->status_led->Blink(50,50).Repeat(3);
                 }
@@ -183,74 +487,237 @@ private:
         }
     }
 
-    // Read the rest of the message
+    // Read the rest of the message. Received bytes are copied to the buffer
+    // as they are, up to the end sequence found by following the escape
+    // sequences.
     void read_message()
     {
         while (this->data_available())
         {
-            // Check whether the buffer is still big enough to hold the number of fill bytes (1 byte) and the checksum (2 bytes)
-            if ((this->position + 3) == BUFFER_SIZE)
+            // Keep room for the number of fill bytes (1 byte) and the checksum (2 bytes)
+            size_t space = this->buffer_size - 3 - this->position;
+            if (space == 0)
             {
-                this->reset_state("Buffer will overflow, starting over.");
+                this->metrics.buffer_overflows++;
+                if (this->frame_pool != NULL)
+                {
+                    // Longer than any message so far, by how much is unknown
+                    this->frame_pool->observe(2 * this->buffer_size);
+                }
+                this->reset_state(EVENT_BUFFER_OVERFLOW, this->buffer_size);
                 return;
             }
-            this->buffer[this->position++] = this->data_read();
-            yield();
+            const byte *data = this->rx_chunk + this->rx_position;
+            size_t len = this->rx_length - this->rx_position;
+            SmlScanResult result;
+            len = this->scanner.scan(data, len < space ? len : space, result);
+            memcpy(this->buffer + this->position, data, len);
+            this->position += len;
+            this->rx_position += len;
 
-            // Check for end sequence
-            int last_index_of_end_seq = sizeof(END_SEQUENCE) - 1;
-            for (int i = 0; i <= last_index_of_end_seq; i++)
+            if (result != SML_SCAN_MORE)
             {
-                if (END_SEQUENCE[last_index_of_end_seq - i] != this->buffer[this->position - (i + 1)])
-                {
-                    break;
-                }
-                if (i == last_index_of_end_seq)
-                {
-                    DEBUG("End sequence found.");
-                    this->set_state(READ_CHECKSUM);
-                    return;
-                }
+                this->end_message(result);
+                return;
             }
         }
     }
 
+    // Continue with the checksum or start over
+    void end_message(SmlScanResult result)
+    {
+        if (result == SML_SCAN_END)
+        {
+            LOG_EVENT(EVENT_END_SEQUENCE, this->config->name);
+            this->set_state(READ_CHECKSUM);
+        }
+        else if (result == SML_SCAN_RESTART)
+        {
+            // A new message starts before the current one ended
+            this->reset_state(EVENT_UNEXPECTED_START);
+            this->start_matcher.reset(SML_START_LENGTH);
+        }
+        else
+        {
+            this->reset_state(EVENT_INVALID_ESCAPE);
+        }
+    }
+
     // Read the number of fillbytes and the checksum
     void read_checksum()
     {
         while (this->bytes_until_checksum > 0 && this->data_available())
         {
-            this->buffer[this->position++] = this->data_read();
+            this->buffer[this->position] = this->data_read();
+            this->position++;
             this->bytes_until_checksum--;
-            yield();
         }
 
         if (this->bytes_until_checksum == 0)
         {
-            DEBUG("Message has been read.");
-            DEBUG_DUMP_BUFFER(this->buffer, this->position);
-            this->set_state(PROCESS_MESSAGE);
+            LOG_EVENT(EVENT_MESSAGE_READ, this->config->name, this->position);
+            this->metrics.frames_completed++;
+            this->frame_completed_at = micros();
+            if (this->frame_pool != NULL)
+            {
+                this->frame_pool->observe(this->position);
+            }
+            this->queue_message();
+            this->reset_state();
+        }
+    }
+
+    // Keeps the message for process(), reading goes on with another buffer
+    void queue_message()
+    {
+        if (this->pending.buffer != NULL)
+        {
+            this->metrics.overruns++;
+            if (this->config->overrun == OVERRUN_DROP_NEWEST)
+            {
+                LOG_EVENT(EVENT_OVERRUN_DROP_NEWEST, this->config->name);
+                return;
+            }
+            LOG_EVENT(EVENT_OVERRUN_DROP_OLDEST, this->config->name);
+            this->give_back(this->pending.buffer, this->pending.size);
         }
+        this->pending.buffer = this->buffer;
+        this->pending.size = this->buffer_size;
+        this->pending.length = this->position;
+        this->pending.completed_at = this->frame_completed_at;
+        this->buffer = NULL;
     }
 
-    void process_message()
+    void process_message(const PendingFrame &frame)
     {
-        DEBUG("Message is being processed.");
+        LOG_EVENT(EVENT_MESSAGE_PROCESSED, this->config->name, frame.length);
+        DEBUG_DUMP_BUFFER(frame.buffer, frame.length);
+
+        // Listeners take the payload between the start sequence and the trailer
+        if (frame.length < SML_START_LENGTH + SML_TRAILER_LENGTH)
+        {
+            LOG_EVENT(EVENT_MESSAGE_TOO_SHORT, this->config->name, frame.length);
+            return;
+        }
+        if (!sml_crc16_check(frame.buffer, frame.length))
+        {
+            this->metrics.crc_errors++;
+            LOG_EVENT(EVENT_CHECKSUM_MISMATCH, this->config->name);
+            return;
+        }
+        // The checksum covers the escaped payload, which raw messages keep
+        size_t length = frame.length;
+        if (this->config->publish_mode != PUBLISH_RAW)
+        {
+            length = sml_unescape(frame.buffer, frame.length);
+        }
 
         // Call listener
         if (this->callback != NULL)
         {
-            if (this->config->interval == 0
+            // Aggregating sensors take every message
+            if (this->config->interval == 0 || this->config->aggregation > 0
                 || ((millis() - this->last_callback_call) > (this->config->interval * 1000))) {
                 
                 this->last_callback_call = millis();
-                this->callback(this->buffer, this->position, this);
+                this->sequence++;
+                this->message_completed_at = frame.completed_at;
+                this->callback(frame.buffer, length, this);
+                this->metrics.frame_to_publish.observe(micros() - frame.completed_at);
+            }
+            else
+            {
+                this->metrics.throttled++;
             }
 
         }
+    }
 
-        // Start over
-        this->reset_state();
+    // Decode telegrams while they arrive, one event at a time
+    void read_telegram()
+    {
+        if (this->telegram_ready)
+        {
+            // The readings are valid until the decoder is fed again
+            return;
+        }
+        this->telegram_decoder->poll(*this->input, millis());
+        while (this->data_available())
+        {
+            TelegramEvent event;
+            this->rx_position += this->telegram_decoder->feed(this->rx_chunk + this->rx_position,
+                                                              this->rx_length - this->rx_position, event);
+            if (event != TELEGRAM_NONE)
+            {
+                this->telegram_event(event);
+                return;
+            }
+        }
+    }
+
+    void telegram_event(TelegramEvent event)
+    {
+        switch (event)
+        {
+        case TELEGRAM_STARTED:
+            LOG_EVENT(EVENT_TELEGRAM_STARTED, this->config->name);
+            this->metrics.frames_started++;
+            if (this->config->status_led_enabled) {
+                this->status_led->Blink(50,50).Repeat(3);
+            }
+            return;
+        case TELEGRAM_COMPLETE:
+            LOG_EVENT(EVENT_TELEGRAM_READ, this->config->name);
+            this->telegram_received();
+            this->telegram_ready = this->readings_callback != NULL;
+            break;
+        case TELEGRAM_CHECKSUM_ERROR:
+            this->telegram_received();
+            this->metrics.crc_errors++;
+            LOG_EVENT(EVENT_CHECKSUM_MISMATCH, this->config->name);
+            break;
+        case TELEGRAM_UNDECODABLE:
+            this->telegram_received();
+            LOG_EVENT(EVENT_TELEGRAM_UNDECODABLE, this->config->name);
+            break;
+        case TELEGRAM_OVERFLOW:
+            this->metrics.buffer_overflows++;
+            LOG_EVENT(EVENT_TELEGRAM_TOO_LONG, this->config->name);
+            break;
+        default:
+            LOG_EVENT(EVENT_TELEGRAM_BROKEN, this->config->name);
+            break;
+        }
+        // The decoder waits for the next telegram by itself
+        this->last_state_reset = millis();
+    }
+
+    void telegram_received()
+    {
+        this->metrics.frames_completed++;
+        this->frame_completed_at = micros();
+    }
+
+    void hand_over_readings()
+    {
+        if (this->readings_callback != NULL)
+        {
+            // Aggregating sensors take every message, requested telegrams
+            // are paced by the interval already
+            if (this->config->interval == 0 || this->config->aggregation > 0 || this->telegram_decoder->requests()
+                || ((millis() - this->last_callback_call) > (this->config->interval * 1000))) {
+
+                this->last_callback_call = millis();
+                this->sequence++;
+                this->message_completed_at = this->frame_completed_at;
+                this->readings_callback(this->telegram_decoder->get_readings(), this->telegram_decoder->get_count(), this);
+                this->metrics.frame_to_publish.observe(micros() - this->frame_completed_at);
+            }
+            else
+            {
+                this->metrics.throttled++;
+            }
+        }
     }
 };
 
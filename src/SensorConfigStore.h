@@ -0,0 +1,142 @@
+#ifndef SENSOR_CONFIG_STORE_H
+#define SENSOR_CONFIG_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "Sensor.h"
+#include "SmlCrc.h"
+#ifdef ARDUINO
+#include <LittleFS.h>
+#endif
+
+const uint8_t MAX_SENSORS = 6;
+const uint32_t SENSOR_CONFIG_MAGIC = 0x43534D53; // "SMSC"
+// Has to be increased with every change of SensorConfig
+const uint16_t SENSOR_CONFIG_VERSION = 5;
+
+// Sensor configurations as written by the web interface: this header
+// followed by the SensorConfig records as they are in memory, so loading
+// them takes a single read and no parsing.
+struct SensorConfigHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint8_t count;
+    uint8_t reserved;
+    uint16_t crc; // CRC16 of the records
+};
+
+// The file is replaced as a whole, a blob that does not match this build
+// or fails its checksum is ignored
+class SensorConfigStore
+{
+public:
+    explicit SensorConfigStore(const char *path)
+    {
+        snprintf(this->path, sizeof(this->path), "%s", path);
+    }
+
+    // Returns the number of configurations read, 0 if there is no valid blob
+    uint8_t load(SensorConfig *configs, uint8_t max)
+    {
+        SensorConfigHeader header;
+        uint8_t count = 0;
+#ifdef ARDUINO
+        File file = LittleFS.open(this->path, "r");
+        if (!file)
+        {
+            return 0;
+        }
+        if (file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && this->valid(header, max) &&
+            file.read((uint8_t *)configs, header.count * sizeof(SensorConfig)) == header.count * sizeof(SensorConfig))
+        {
+            count = header.count;
+        }
+        file.close();
+#else
+        FILE *file = fopen(this->path, "rb");
+        if (file == NULL)
+        {
+            return 0;
+        }
+        if (fread(&header, 1, sizeof(header), file) == sizeof(header) && this->valid(header, max) &&
+            fread(configs, sizeof(SensorConfig), header.count, file) == header.count)
+        {
+            count = header.count;
+        }
+        fclose(file);
+#endif
+        if (count == 0 || sml_crc16_final(sml_crc16_update(SML_CRC16_INIT, (const uint8_t *)configs,
+                                                           count * sizeof(SensorConfig))) != header.crc)
+        {
+            return 0;
+        }
+        for (uint8_t i = 0; i < count; i++)
+        {
+            configs[i].name[SENSOR_NAME_LENGTH - 1] = '\0';
+        }
+        return count;
+    }
+
+    bool save(const SensorConfig *configs, uint8_t count)
+    {
+        SensorConfigHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = SENSOR_CONFIG_MAGIC;
+        header.version = SENSOR_CONFIG_VERSION;
+        header.record_size = sizeof(SensorConfig);
+        header.count = count;
+        header.crc = sml_crc16_final(sml_crc16_update(SML_CRC16_INIT, (const uint8_t *)configs,
+                                                      count * sizeof(SensorConfig)));
+
+        // Written next to the old one first, so a power loss keeps either
+        char temp[sizeof(this->path) + 4];
+        snprintf(temp, sizeof(temp), "%s.new", this->path);
+        size_t written = 0;
+#ifdef ARDUINO
+        File file = LittleFS.open(temp, "w");
+        if (!file)
+        {
+            return false;
+        }
+        written = file.write((const uint8_t *)&header, sizeof(header));
+        written += file.write((const uint8_t *)configs, count * sizeof(SensorConfig));
+        file.close();
+        if (written != sizeof(header) + count * sizeof(SensorConfig))
+        {
+            LittleFS.remove(temp);
+            return false;
+        }
+        LittleFS.remove(this->path);
+        return LittleFS.rename(temp, this->path);
+#else
+        FILE *file = fopen(temp, "wb");
+        if (file == NULL)
+        {
+            return false;
+        }
+        written = fwrite(&header, 1, sizeof(header), file);
+        written += fwrite(configs, 1, count * sizeof(SensorConfig), file);
+        fclose(file);
+        if (written != sizeof(header) + count * sizeof(SensorConfig))
+        {
+            remove(temp);
+            return false;
+        }
+        return rename(temp, this->path) == 0;
+#endif
+    }
+
+private:
+    char path[32];
+
+    bool valid(const SensorConfigHeader &header, uint8_t max)
+    {
+        return header.magic == SENSOR_CONFIG_MAGIC && header.version == SENSOR_CONFIG_VERSION &&
+               header.record_size == sizeof(SensorConfig) && header.count > 0 && header.count <= max;
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef SENSOR_SCHEDULER_H
+#define SENSOR_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Sensor.h"
+#include "SensorConfigStore.h"
+
+const size_t CAPTURE_BUDGET = 2 * RX_CHUNK_SIZE; // Bytes a sensor takes per turn
+
+// Sensors waiting with a complete message, oldest first. Every sensor holds
+// at most one message, so MAX_SENSORS entries always suffice.
+class SensorWorkQueue
+{
+public:
+    bool push(uint8_t index)
+    {
+        if (this->length == MAX_SENSORS)
+        {
+            return false;
+        }
+        this->entries[(this->head + this->length) % MAX_SENSORS] = index;
+        this->length++;
+        return true;
+    }
+
+    bool pop(uint8_t &index)
+    {
+        if (this->length == 0)
+        {
+            return false;
+        }
+        index = this->entries[this->head];
+        this->head = (this->head + 1) % MAX_SENSORS;
+        this->length--;
+        return true;
+    }
+
+    void clear()
+    {
+        this->head = 0;
+        this->length = 0;
+    }
+
+    uint8_t size() const
+    {
+        return this->length;
+    }
+
+private:
+    uint8_t entries[MAX_SENSORS];
+    uint8_t head = 0;
+    uint8_t length = 0;
+};
+
+// Runs the sensors in two stages: capture takes at most CAPTURE_BUDGET
+// bytes from every sensor per pass, starting with a different one each
+// time, and queues the sensors with a complete message. Decoding and
+// publishing those happens in process(), one message at a time with a
+// capture pass after each, so the receive buffers of the other sensors
+// are emptied in between. Other slow work of the loop (web interface, MQTT)
+// should be followed by a capture pass as well.
+class SensorScheduler
+{
+public:
+    // After the sensors were set up again, the queue is filled anew by the
+    // next capture pass
+    void set_sensors(Sensor *const *sensors, uint8_t count)
+    {
+        this->sensors = sensors;
+        this->count = count;
+        this->next = 0;
+        this->queue.clear();
+        for (uint8_t i = 0; i < MAX_SENSORS; i++)
+        {
+            this->queued[i] = false;
+        }
+    }
+
+    void capture()
+    {
+        for (uint8_t n = 0; n < this->count; n++)
+        {
+            uint8_t i = (this->next + n) % this->count;
+            // Queued sensors go on reading into another buffer
+            if (this->sensors[i]->capture(CAPTURE_BUDGET) && !this->queued[i])
+            {
+                this->queued[i] = this->queue.push(i);
+            }
+        }
+        if (this->count > 0)
+        {
+            this->next = (this->next + 1) % this->count;
+        }
+    }
+
+    // Processes the messages waiting when called, returns how many
+    uint8_t process()
+    {
+        uint8_t processed = 0;
+        uint8_t i = 0;
+        for (uint8_t n = this->queue.size(); n > 0 && this->queue.pop(i); n--)
+        {
+            this->queued[i] = false;
+            this->sensors[i]->process();
+            processed++;
+            this->capture();
+        }
+        return processed;
+    }
+
+    // Messages waiting to be processed
+    uint8_t pending() const
+    {
+        return this->queue.size();
+    }
+
+private:
+    Sensor *const *sensors = NULL;
+    uint8_t count = 0;
+    uint8_t next = 0; // Sensor captured first in the next pass
+    SensorWorkQueue queue;
+    bool queued[MAX_SENSORS] = {};
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef SENSOR_SETTINGS_H
+#define SENSOR_SETTINGS_H
+
+#include <IotWebConf.h>
+#include <IotWebConfUsing.h>
+#include "Sensor.h"
+
+const uint8_t OBIS_CODES_LENGTH = 160; // OBIS_FILTER_SIZE codes as A-B:C.D.E*F
+// Highest GPIO of the board, and the limits of the pin fields to match.
+// GPIO 34 to 39 of the ESP32 are inputs only.
+#ifdef ESP32
+const uint8_t GPIO_PIN_MAX = 39;
+const uint8_t GPIO_OUTPUT_PIN_MAX = 33;
+static const char PIN_LIMITS[] = "min='0' max='39'";
+static const char OUTPUT_PIN_LIMITS[] = "min='0' max='33'";
+static const char TX_PIN_LIMITS[] = "min='-1' max='33'";
+#else
+const uint8_t GPIO_PIN_MAX = 16;
+const uint8_t GPIO_OUTPUT_PIN_MAX = 16;
+static const char PIN_LIMITS[] = "min='0' max='16'";
+static const char OUTPUT_PIN_LIMITS[] = "min='0' max='16'";
+static const char TX_PIN_LIMITS[] = "min='-1' max='16'";
+#endif
+const uint16_t AGGREGATION_MAX = 3600; // Seconds, as offered by the form
+static const char OBIS_MODE_VALUES[][2] = {"0", "1", "2"}; // ObisFilterMode
+static const char OBIS_MODE_NAMES[][16] = {"All", "Only these", "All but these"};
+static const char PROTOCOL_VALUES[][2] = {"0", "1", "2", "3", "4"}; // Protocol
+static const char PROTOCOL_NAMES[][24] = {"SML", "SML as text", "D0 (sent by the meter)", "D0 mode A", "D0 mode C"};
+static const char OVERRUN_VALUES[][2] = {"0", "1"}; // OverrunPolicy
+static const char OVERRUN_NAMES[][24] = {"Drop the older one", "Drop the newer one"};
+
+// Form of one sensor slot in the web interface. The fields only serve
+// editing: sensors are set up from the binary SensorConfigStore, which
+// the form is filled from at boot and written back to when it is saved.
+class SensorSettings
+{
+public:
+    explicit SensorSettings(uint8_t index)
+        : group(group_id, group_label),
+          enabled_param("Enabled", enabled_id, enabled, sizeof(enabled), false),
+          pin_param("GPIO pin", pin_id, pin, sizeof(pin), "4", NULL, PIN_LIMITS),
+          name_param("Name (used in the MQTT topic)", name_id, name, sizeof(name), NULL),
+          protocol_param("Protocol", protocol_id, protocol, sizeof(protocol), (const char *)PROTOCOL_VALUES,
+                         (const char *)PROTOCOL_NAMES, sizeof(PROTOCOL_VALUES) / sizeof(PROTOCOL_VALUES[0]),
+                         sizeof(PROTOCOL_NAMES[0]), "0"),
+          tx_pin_param("GPIO pin sending requests (D0 modes A and C, -1 for none)", tx_pin_id, tx_pin, sizeof(tx_pin),
+                       "-1", NULL, TX_PIN_LIMITS),
+          overrun_param("Message read before the previous one was published", overrun_id, overrun, sizeof(overrun),
+                        (const char *)OVERRUN_VALUES, (const char *)OVERRUN_NAMES,
+                        sizeof(OVERRUN_VALUES) / sizeof(OVERRUN_VALUES[0]), sizeof(OVERRUN_NAMES[0]), "0"),
+          numeric_only_param("Numeric values only", numeric_only_id, numeric_only, sizeof(numeric_only), false),
+          led_enabled_param("Status LED", led_enabled_id, led_enabled, sizeof(led_enabled), false),
+          led_inverted_param("Status LED inverted", led_inverted_id, led_inverted, sizeof(led_inverted), true),
+          led_pin_param("Status LED GPIO pin", led_pin_id, led_pin, sizeof(led_pin), "2", NULL,
+                        OUTPUT_PIN_LIMITS),
+          interval_param("Interval (seconds, 0 publishes every message)", interval_id, interval, sizeof(interval), "0",
+                         NULL, "min='0' max='255'"),
+          aggregation_param("Aggregation window (seconds, 0 publishes every message)", aggregation_id, aggregation,
+                            sizeof(aggregation), "0", NULL, "min='0' max='3600'"),
+          obis_mode_param("Decoded OBIS codes", obis_mode_id, obis_mode, sizeof(obis_mode), (const char *)OBIS_MODE_VALUES,
+                          (const char *)OBIS_MODE_NAMES, sizeof(OBIS_MODE_VALUES) / sizeof(OBIS_MODE_VALUES[0]),
+                          sizeof(OBIS_MODE_NAMES[0]), "0"),
+          obis_codes_param("OBIS codes (e.g. 1.8.0, 2.8.0, 16.7.0)", obis_codes_id, obis_codes, sizeof(obis_codes),
+                           NULL)
+    {
+        snprintf(this->group_id, sizeof(this->group_id), "s%u", index);
+        snprintf(this->group_label, sizeof(this->group_label), "Sensor %u", index + 1);
+        snprintf(this->enabled_id, sizeof(this->enabled_id), "s%uon", index);
+        snprintf(this->pin_id, sizeof(this->pin_id), "s%upin", index);
+        snprintf(this->name_id, sizeof(this->name_id), "s%uname", index);
+        snprintf(this->protocol_id, sizeof(this->protocol_id), "s%uproto", index);
+        snprintf(this->tx_pin_id, sizeof(this->tx_pin_id), "s%utx", index);
+        snprintf(this->overrun_id, sizeof(this->overrun_id), "s%uovr", index);
+        snprintf(this->numeric_only_id, sizeof(this->numeric_only_id), "s%unum", index);
+        snprintf(this->led_enabled_id, sizeof(this->led_enabled_id), "s%uled", index);
+        snprintf(this->led_inverted_id, sizeof(this->led_inverted_id), "s%uinv", index);
+        snprintf(this->led_pin_id, sizeof(this->led_pin_id), "s%uledpin", index);
+        snprintf(this->interval_id, sizeof(this->interval_id), "s%uint", index);
+        snprintf(this->aggregation_id, sizeof(this->aggregation_id), "s%uagg", index);
+        snprintf(this->obis_mode_id, sizeof(this->obis_mode_id), "s%uobm", index);
+        snprintf(this->obis_codes_id, sizeof(this->obis_codes_id), "s%uobis", index);
+
+        this->group.addItem(&this->enabled_param);
+        this->group.addItem(&this->pin_param);
+        this->group.addItem(&this->name_param);
+        this->group.addItem(&this->protocol_param);
+        this->group.addItem(&this->tx_pin_param);
+        this->group.addItem(&this->overrun_param);
+        this->group.addItem(&this->numeric_only_param);
+        this->group.addItem(&this->led_enabled_param);
+        this->group.addItem(&this->led_inverted_param);
+        this->group.addItem(&this->led_pin_param);
+        this->group.addItem(&this->interval_param);
+        this->group.addItem(&this->aggregation_param);
+        this->group.addItem(&this->obis_mode_param);
+        this->group.addItem(&this->obis_codes_param);
+    }
+
+    iotwebconf::ParameterGroup *get_group()
+    {
+        return &this->group;
+    }
+
+    // Shows [config], or an empty slot for NULL
+    void show(const SensorConfig *config)
+    {
+        set_checked(this->enabled, config != NULL);
+        if (config == NULL)
+        {
+            return;
+        }
+        snprintf(this->pin, sizeof(this->pin), "%u", config->pin);
+        snprintf(this->name, sizeof(this->name), "%s", config->name);
+        snprintf(this->protocol, sizeof(this->protocol), "%u", config->protocol);
+        snprintf(this->tx_pin, sizeof(this->tx_pin), "%d", config->tx_pin);
+        snprintf(this->overrun, sizeof(this->overrun), "%u", config->overrun);
+        set_checked(this->numeric_only, config->numeric_only);
+        set_checked(this->led_enabled, config->status_led_enabled);
+        set_checked(this->led_inverted, config->status_led_inverted);
+        snprintf(this->led_pin, sizeof(this->led_pin), "%u", config->status_led_pin);
+        snprintf(this->interval, sizeof(this->interval), "%u", config->interval);
+        snprintf(this->aggregation, sizeof(this->aggregation), "%u", config->aggregation);
+        snprintf(this->obis_mode, sizeof(this->obis_mode), "%u", config->obis_filter.mode);
+        config->obis_filter.format(this->obis_codes, sizeof(this->obis_codes));
+    }
+
+    // Applies the form to [config], settings not in the form are kept.
+    // Returns false for a disabled slot.
+    bool apply(SensorConfig &config)
+    {
+        if (!this->enabled_param.isChecked())
+        {
+            return false;
+        }
+        // Numbers that are malformed or out of range keep the previous value
+        long number;
+        if (parse_number(this->pin, 0, GPIO_PIN_MAX, number))
+        {
+            config.pin = (uint8_t)number;
+        }
+        snprintf(config.name, sizeof(config.name), "%s", this->name);
+        if (parse_number(this->protocol, PROTOCOL_SML, PROTOCOL_D0_MODE_C, number))
+        {
+            config.protocol = (Protocol)number;
+        }
+        if (parse_number(this->tx_pin, -1, GPIO_OUTPUT_PIN_MAX, number))
+        {
+            config.tx_pin = (int8_t)number;
+        }
+        if (parse_number(this->overrun, OVERRUN_DROP_OLDEST, OVERRUN_DROP_NEWEST, number))
+        {
+            config.overrun = (OverrunPolicy)number;
+        }
+        config.numeric_only = this->numeric_only_param.isChecked();
+        config.status_led_enabled = this->led_enabled_param.isChecked();
+        config.status_led_inverted = this->led_inverted_param.isChecked();
+        if (parse_number(this->led_pin, 0, GPIO_OUTPUT_PIN_MAX, number))
+        {
+            config.status_led_pin = (uint8_t)number;
+        }
+        if (parse_number(this->interval, 0, UINT8_MAX, number))
+        {
+            config.interval = (uint8_t)number;
+        }
+        if (parse_number(this->aggregation, 0, AGGREGATION_MAX, number))
+        {
+            config.aggregation = (uint16_t)number;
+        }
+        // Malformed codes keep the previous filter
+        ObisFilter filter;
+        memcpy(&filter, &config.obis_filter, sizeof(ObisFilter));
+        bool valid = parse_number(this->obis_mode, OBIS_FILTER_NONE, OBIS_FILTER_DENY, number);
+        filter.mode = (ObisFilterMode)number;
+        if (!valid || !filter.parse(this->obis_codes))
+        {
+            DEBUG("Invalid OBIS codes '%s' for sensor %s.", this->obis_codes, config.name);
+        }
+        else
+        {
+            memcpy(&config.obis_filter, &filter, sizeof(ObisFilter));
+        }
+        return true;
+    }
+
+private:
+    static const uint8_t CHECKBOX_LENGTH = 9; // "selected"
+
+    char group_id[4];
+    char group_label[12];
+    char enabled_id[8];
+    char pin_id[8];
+    char name_id[8];
+    char protocol_id[10];
+    char tx_pin_id[8];
+    char overrun_id[8];
+    char numeric_only_id[8];
+    char led_enabled_id[8];
+    char led_inverted_id[8];
+    char led_pin_id[10];
+    char interval_id[8];
+    char aggregation_id[8];
+    char obis_mode_id[8];
+    char obis_codes_id[8];
+
+    char enabled[CHECKBOX_LENGTH];
+    char pin[4];
+    char name[SENSOR_NAME_LENGTH];
+    char protocol[2];
+    char tx_pin[4];
+    char overrun[2];
+    char numeric_only[CHECKBOX_LENGTH];
+    char led_enabled[CHECKBOX_LENGTH];
+    char led_inverted[CHECKBOX_LENGTH];
+    char led_pin[4];
+    char interval[4];
+    char aggregation[6];
+    char obis_mode[2];
+    char obis_codes[OBIS_CODES_LENGTH];
+
+    iotwebconf::ParameterGroup group;
+    iotwebconf::CheckboxParameter enabled_param;
+    iotwebconf::NumberParameter pin_param;
+    iotwebconf::TextParameter name_param;
+    iotwebconf::SelectParameter protocol_param;
+    iotwebconf::NumberParameter tx_pin_param;
+    iotwebconf::SelectParameter overrun_param;
+    iotwebconf::CheckboxParameter numeric_only_param;
+    iotwebconf::CheckboxParameter led_enabled_param;
+    iotwebconf::CheckboxParameter led_inverted_param;
+    iotwebconf::NumberParameter led_pin_param;
+    iotwebconf::NumberParameter interval_param;
+    iotwebconf::NumberParameter aggregation_param;
+    iotwebconf::SelectParameter obis_mode_param;
+    iotwebconf::TextParameter obis_codes_param;
+
+    static void set_checked(char *value, bool checked)
+    {
+        strncpy(value, checked ? "selected" : "", CHECKBOX_LENGTH);
+    }
+
+    // Returns whether [value] is a whole number in [min, max]
+    static bool parse_number(const char *value, long min, long max, long &number)
+    {
+        char *end;
+        number = strtol(value, &end, 10);
+        return end != value && *end == '\0' && number >= min && number <= max;
+    }
+};
+
+#endif
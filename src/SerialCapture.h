@@ -0,0 +1,154 @@
+#ifndef SERIAL_CAPTURE_H
+#define SERIAL_CAPTURE_H
+
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include "TelegramDecoder.h"
+
+const uint32_t CAPTURE_BAUD_RATE = 9600;
+const size_t HARDWARE_RX_BUFFER_SIZE = 1024; // About one second at 9600 baud
+
+// Where the bytes of a sensor come from
+enum CaptureType
+{
+    CAPTURE_SOFTWARE_SERIAL, // Bit-banged, any pin
+    CAPTURE_HARDWARE_SERIAL  // UART, see HardwareSerialCapture for the pins
+};
+
+// Receiving side of a sensor. Bytes are collected in the background (by
+// the pin change interrupt or the UART) and handed out in bulk. Sending
+// and changing the speed are there for meters that have to be asked.
+class SerialCapture : public TelegramLink
+{
+public:
+    virtual ~SerialCapture() {}
+
+    virtual int available() = 0;
+
+    // Moves up to [len] received bytes to [buffer], returns how many
+    virtual size_t read(byte *buffer, size_t len) = 0;
+
+    // Whether bytes were lost since the last call
+    virtual bool overflow() = 0;
+};
+
+class SoftwareSerialCapture : public SerialCapture
+{
+public:
+    // Sends on [tx_pin] unless it is -1
+    explicit SoftwareSerialCapture(uint8_t pin, int8_t tx_pin = -1) : pin(pin), tx_pin(tx_pin)
+    {
+        this->set_line(CAPTURE_BAUD_RATE, LINE_8N1);
+    }
+
+    void set_line(uint32_t baud, LineFormat format)
+    {
+        this->serial.end();
+        this->serial.begin(baud, format == LINE_7E1 ? SWSERIAL_7E1 : SWSERIAL_8N1, this->pin, this->tx_pin, false);
+        this->serial.enableTx(this->tx_pin >= 0);
+        this->serial.enableRx(true);
+    }
+
+    // Bit-banged while the loop waits, so only one byte per call: about
+    // 33 ms at 300 baud
+    size_t send(const uint8_t *data, size_t len)
+    {
+        return this->tx_pin >= 0 && len > 0 ? this->serial.write(data, 1) : 0;
+    }
+
+    int available()
+    {
+        return this->serial.available();
+    }
+
+    size_t read(byte *buffer, size_t len)
+    {
+        return this->serial.read(buffer, len);
+    }
+
+    bool overflow()
+    {
+        return this->serial.overflow();
+    }
+
+private:
+    SoftwareSerial serial;
+    uint8_t pin;
+    int8_t tx_pin;
+};
+
+// The ESP8266 receives on UART0, at GPIO3 (RX) or, with the pins swapped,
+// at GPIO13 (D7), and sends at GPIO1 (TX) or GPIO15 (D8). The serial console
+// shares UART0, so SERIAL_DEBUG has to be off. The ESP32 receives on UART1
+// at any pin and sends at [tx_pin].
+class HardwareSerialCapture : public SerialCapture
+{
+public:
+    explicit HardwareSerialCapture(uint8_t pin, int8_t tx_pin = -1)
+#ifdef ESP32
+        : serial(Serial1),
+#else
+        : serial(Serial),
+#endif
+          pin(pin), tx_pin(tx_pin)
+    {
+        // The FIFO has to be set up before the UART is started
+        this->serial.setRxBufferSize(HARDWARE_RX_BUFFER_SIZE);
+        this->set_line(CAPTURE_BAUD_RATE, LINE_8N1);
+    }
+
+    ~HardwareSerialCapture()
+    {
+        this->serial.end();
+    }
+
+    void set_line(uint32_t baud, LineFormat format)
+    {
+        SerialConfig config = format == LINE_7E1 ? SERIAL_7E1 : SERIAL_8N1;
+#ifdef ESP32
+        this->serial.begin(baud, config, this->pin, this->tx_pin);
+#else
+        this->serial.begin(baud, config);
+        if (this->pin == 13)
+        {
+            this->serial.swap();
+        }
+#endif
+    }
+
+    // Queued, the UART sends in the background
+    size_t send(const uint8_t *data, size_t len)
+    {
+        return this->serial.write(data, len);
+    }
+
+    int available()
+    {
+        return this->serial.available();
+    }
+
+    size_t read(byte *buffer, size_t len)
+    {
+#ifdef ESP32
+        return this->serial.read(buffer, len);
+#else
+        return this->serial.read((char *)buffer, len);
+#endif
+    }
+
+    bool overflow()
+    {
+#ifdef ESP32
+        return false; // Not reported by the core
+#else
+        return this->serial.hasOverrun();
+#endif
+    }
+
+private:
+    HardwareSerial &serial;
+    uint8_t pin;
+    int8_t tx_pin;
+};
+
+#endif
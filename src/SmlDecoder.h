@@ -0,0 +1,410 @@
+#ifndef SML_DECODER_H
+#define SML_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// SML type-length field
+const uint8_t SML_TL_ANOTHER = 0x80;
+const uint8_t SML_TL_TYPE = 0x70;
+const uint8_t SML_TL_LENGTH = 0x0F;
+const uint8_t SML_TL_OCTET_STRING = 0x00;
+const uint8_t SML_TL_BOOLEAN = 0x40;
+const uint8_t SML_TL_INTEGER = 0x50;
+const uint8_t SML_TL_UNSIGNED = 0x60;
+const uint8_t SML_TL_LIST = 0x70;
+const uint8_t SML_TL_OPTIONAL_SKIPPED = 0x01;
+const uint8_t SML_END_OF_MESSAGE = 0x00;
+
+// SML message body tags
+const uint32_t SML_TAG_OPEN_RESPONSE = 0x00000101;
+const uint32_t SML_TAG_CLOSE_RESPONSE = 0x00000201;
+const uint32_t SML_TAG_GET_LIST_RESPONSE = 0x00000701;
+
+const uint8_t OBIS_LENGTH = 6;
+const uint8_t SML_MAX_DEPTH = 8; // Deepest nesting of lists accepted when skipping
+
+enum SmlReadingType
+{
+    SML_READING_INTEGER,
+    SML_READING_UNSIGNED,
+    SML_READING_BOOLEAN,
+    SML_READING_OCTET_STRING,
+    SML_READING_UNSUPPORTED
+};
+
+// A single entry of a GetListResponse value list. Pointers refer to the
+// decoded buffer and are only valid during the callback.
+struct SmlReading
+{
+    const uint8_t *obis;
+    SmlReadingType type;
+    int64_t value; // Raw value, to be read as uint64_t for SML_READING_UNSIGNED
+    int8_t scaler;
+    uint8_t unit;  // DLMS unit code, 0 if not present
+    const uint8_t *octets;
+    size_t octets_len;
+    uint32_t time; // actSensorTime of the list (secIndex or timestamp), 0 if not present
+
+    bool is_numeric() const
+    {
+        return this->type == SML_READING_INTEGER || this->type == SML_READING_UNSIGNED;
+    }
+
+    double to_double() const
+    {
+        return this->type == SML_READING_UNSIGNED ? (double)(uint64_t)this->value : (double)this->value;
+    }
+};
+
+// Default filter of SmlDecoder, its checks compile away
+struct SmlAcceptAll
+{
+    bool accepts(const uint8_t *) const
+    {
+        return true;
+    }
+};
+
+// Walks an SML file (the bytes between the start and the end escape
+// sequence) in place and yields every GetListResponse entry to a callback.
+// Nothing is allocated, the tree libsml would build is never materialized.
+// Entries whose OBIS code is not accepted by the filter (see ObisFilter.h)
+// are skipped without decoding their values.
+class SmlDecoder
+{
+public:
+    template <typename Callback>
+    static bool decode(const uint8_t *buffer, size_t len, Callback callback)
+    {
+        return decode(buffer, len, SmlAcceptAll(), callback);
+    }
+
+    template <typename Filter, typename Callback>
+    static bool decode(const uint8_t *buffer, size_t len, const Filter &filter, Callback callback)
+    {
+        SmlDecoder decoder(buffer, len);
+        while (decoder.position < decoder.len)
+        {
+            if (decoder.buffer[decoder.position] == SML_END_OF_MESSAGE)
+            {
+                // Fill bytes
+                decoder.position++;
+                continue;
+            }
+            if (!decoder.decode_message(filter, callback))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    const uint8_t *buffer;
+    size_t len;
+    size_t position = 0;
+
+    SmlDecoder(const uint8_t *buffer, size_t len) : buffer(buffer), len(len) {}
+
+    // Reads a type-length field, the returned length excludes the TL bytes
+    // for everything but lists, where it is the number of elements
+    bool read_tl(uint8_t &type, size_t &length)
+    {
+        if (this->position >= this->len)
+        {
+            return false;
+        }
+        uint8_t tl = this->buffer[this->position++];
+        type = tl & SML_TL_TYPE;
+        length = tl & SML_TL_LENGTH;
+        uint8_t tl_bytes = 1;
+        while (tl & SML_TL_ANOTHER)
+        {
+            if (this->position >= this->len || tl_bytes == 4)
+            {
+                return false;
+            }
+            tl = this->buffer[this->position++];
+            length = (length << 4) | (tl & SML_TL_LENGTH);
+            tl_bytes++;
+        }
+        if (type != SML_TL_LIST)
+        {
+            if (length < tl_bytes)
+            {
+                return false;
+            }
+            length -= tl_bytes;
+            if (length > this->len - this->position)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool expect_list(size_t elements)
+    {
+        uint8_t type = 0;
+        size_t length = 0;
+        return this->read_tl(type, length) && type == SML_TL_LIST && length == elements;
+    }
+
+    bool skip(uint8_t depth = 0)
+    {
+        uint8_t type;
+        size_t length;
+        if (!this->read_tl(type, length))
+        {
+            return false;
+        }
+        if (type == SML_TL_LIST)
+        {
+            if (depth == SML_MAX_DEPTH)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < length; i++)
+            {
+                if (!this->skip(depth + 1))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        this->position += length;
+        return true;
+    }
+
+    bool is_skipped()
+    {
+        if (this->position < this->len && this->buffer[this->position] == SML_TL_OPTIONAL_SKIPPED)
+        {
+            this->position++;
+            return true;
+        }
+        return false;
+    }
+
+    // Integer or unsigned of 1 to 8 bytes, big endian
+    bool read_number(uint8_t &type, int64_t &value)
+    {
+        size_t length;
+        if (!this->read_tl(type, length) ||
+            (type != SML_TL_INTEGER && type != SML_TL_UNSIGNED) ||
+            length == 0 || length > 8)
+        {
+            return false;
+        }
+        const uint8_t *p = this->buffer + this->position;
+        uint64_t raw = (type == SML_TL_INTEGER && (p[0] & 0x80)) ? ~(uint64_t)0 : 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            raw = (raw << 8) | p[i];
+        }
+        value = (int64_t)raw;
+        this->position += length;
+        return true;
+    }
+
+    bool read_octets(const uint8_t *&octets, size_t &octets_len)
+    {
+        uint8_t type;
+        if (!this->read_tl(type, octets_len) || type != SML_TL_OCTET_STRING)
+        {
+            return false;
+        }
+        octets = this->buffer + this->position;
+        this->position += octets_len;
+        return true;
+    }
+
+    // SML_Time is a choice of secIndex (1) or timestamp (2)
+    bool read_time(uint32_t &time)
+    {
+        time = 0;
+        if (this->is_skipped())
+        {
+            return true;
+        }
+        uint8_t type;
+        int64_t value;
+        if (!this->expect_list(2) || !this->read_number(type, value))
+        {
+            return false;
+        }
+        if (value != 1 && value != 2)
+        {
+            // Local timestamps and other extensions are not used
+            return this->skip();
+        }
+        if (!this->read_number(type, value))
+        {
+            return false;
+        }
+        time = (uint32_t)value;
+        return true;
+    }
+
+    template <typename Filter, typename Callback>
+    bool decode_message(const Filter &filter, Callback &callback)
+    {
+        uint8_t type;
+        int64_t tag;
+        // transactionId, groupNo, abortOnError, messageBody, crc16, endOfSmlMsg
+        if (!this->expect_list(6) || !this->skip() || !this->skip() || !this->skip() ||
+            !this->expect_list(2) || !this->read_number(type, tag))
+        {
+            return false;
+        }
+        if (tag == SML_TAG_GET_LIST_RESPONSE)
+        {
+            if (!this->decode_get_list_response(filter, callback))
+            {
+                return false;
+            }
+        }
+        else if (!this->skip())
+        {
+            return false;
+        }
+        if (!this->skip())
+        {
+            return false;
+        }
+        if (this->position < this->len && this->buffer[this->position] == SML_END_OF_MESSAGE)
+        {
+            this->position++;
+        }
+        return true;
+    }
+
+    template <typename Filter, typename Callback>
+    bool decode_get_list_response(const Filter &filter, Callback &callback)
+    {
+        SmlReading reading;
+        uint8_t type;
+        size_t entries;
+        // clientId, serverId, listName, actSensorTime, valList, listSignature, actGatewayTime
+        if (!this->expect_list(7) || !this->skip() || !this->skip() || !this->skip() ||
+            !this->read_time(reading.time) ||
+            !this->read_tl(type, entries) || type != SML_TL_LIST)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < entries; i++)
+        {
+            if (!this->decode_list_entry(reading, filter, callback))
+            {
+                return false;
+            }
+        }
+        return this->skip() && this->skip();
+    }
+
+    template <typename Filter, typename Callback>
+    bool decode_list_entry(SmlReading &reading, const Filter &filter, Callback &callback)
+    {
+        const uint8_t *obis;
+        size_t obis_len;
+        uint8_t type;
+        int64_t number;
+        // objName, status, valTime, unit, scaler, value, valueSignature
+        if (!this->expect_list(7) || !this->read_octets(obis, obis_len))
+        {
+            return false;
+        }
+        if (obis_len != OBIS_LENGTH || !filter.accepts(obis))
+        {
+            // Unwanted, the remaining six fields are passed over unread
+            for (uint8_t i = 0; i < 6; i++)
+            {
+                if (!this->skip())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (!this->skip() || !this->skip())
+        {
+            return false;
+        }
+        reading.obis = obis;
+        reading.unit = 0;
+        reading.scaler = 0;
+        if (!this->is_skipped())
+        {
+            if (!this->read_number(type, number))
+            {
+                return false;
+            }
+            reading.unit = (uint8_t)number;
+        }
+        if (!this->is_skipped())
+        {
+            if (!this->read_number(type, number))
+            {
+                return false;
+            }
+            reading.scaler = (int8_t)number;
+        }
+
+        bool has_value = !this->is_skipped();
+        if (has_value)
+        {
+            if (!this->decode_value(reading))
+            {
+                return false;
+            }
+        }
+        if (!this->skip())
+        {
+            return false;
+        }
+        if (has_value && reading.type != SML_READING_UNSUPPORTED)
+        {
+            callback(reading);
+        }
+        return true;
+    }
+
+    bool decode_value(SmlReading &reading)
+    {
+        if (this->position >= this->len)
+        {
+            return false;
+        }
+        uint8_t type = this->buffer[this->position] & SML_TL_TYPE;
+        size_t length;
+        reading.value = 0;
+        reading.octets = NULL;
+        reading.octets_len = 0;
+        switch (type)
+        {
+        case SML_TL_INTEGER:
+        case SML_TL_UNSIGNED:
+            reading.type = (type == SML_TL_INTEGER) ? SML_READING_INTEGER : SML_READING_UNSIGNED;
+            return this->read_number(type, reading.value);
+        case SML_TL_OCTET_STRING:
+            reading.type = SML_READING_OCTET_STRING;
+            return this->read_octets(reading.octets, reading.octets_len);
+        case SML_TL_BOOLEAN:
+            if (!this->read_tl(type, length) || length != 1)
+            {
+                return false;
+            }
+            reading.type = SML_READING_BOOLEAN;
+            reading.value = this->buffer[this->position++] ? 1 : 0;
+            return true;
+        default:
+            // Lists (e.g. SML_TupelEntry) are not published
+            reading.type = SML_READING_UNSUPPORTED;
+            return this->skip();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SML_FILE_READINGS_H
+#define SML_FILE_READINGS_H
+
+#include <sml/sml_file.h>
+#include <sml/sml_value.h>
+#include "SmlDecoder.h"
+
+// Yields the GetListResponse entries of a file parsed by libsml as the same
+// readings SmlDecoder produces, so both parsers share one consumer path.
+// libsml has parsed everything by now, the filter only spares the consumer.
+template <typename Filter, typename Callback>
+void sml_file_readings(sml_file *file, const Filter &filter, Callback callback)
+{
+    for (int i = 0; i < file->messages_len; i++)
+    {
+        sml_message *message = file->messages[i];
+        if (*message->message_body->tag != SML_MESSAGE_GET_LIST_RESPONSE)
+        {
+            continue;
+        }
+        sml_get_list_response *body = (sml_get_list_response *)message->message_body->data;
+        SmlReading reading;
+        reading.time = (body->act_sensor_time && body->act_sensor_time->data.sec_index)
+                           ? *body->act_sensor_time->data.sec_index
+                           : 0;
+        for (sml_list *entry = body->val_list; entry != NULL; entry = entry->next)
+        {
+            if (!entry->value || !entry->obj_name || entry->obj_name->len != OBIS_LENGTH ||
+                !filter.accepts(entry->obj_name->str))
+            { // do not crash on null value
+                continue;
+            }
+            sml_value *value = entry->value;
+            reading.obis = entry->obj_name->str;
+            reading.scaler = (entry->scaler) ? *entry->scaler : 0;
+            reading.unit = (entry->unit) ? *entry->unit : 0;
+            reading.value = 0;
+            reading.octets = NULL;
+            reading.octets_len = 0;
+            switch (value->type & SML_TYPE_FIELD)
+            {
+            case SML_TYPE_INTEGER:
+                reading.type = SML_READING_INTEGER;
+                switch (value->type & SML_LENGTH_FIELD)
+                {
+                case SML_TYPE_NUMBER_8:
+                    reading.value = *value->data.int8;
+                    break;
+                case SML_TYPE_NUMBER_16:
+                    reading.value = *value->data.int16;
+                    break;
+                case SML_TYPE_NUMBER_32:
+                    reading.value = *value->data.int32;
+                    break;
+                default:
+                    reading.value = *value->data.int64;
+                    break;
+                }
+                break;
+            case SML_TYPE_UNSIGNED:
+                reading.type = SML_READING_UNSIGNED;
+                switch (value->type & SML_LENGTH_FIELD)
+                {
+                case SML_TYPE_NUMBER_8:
+                    reading.value = *value->data.uint8;
+                    break;
+                case SML_TYPE_NUMBER_16:
+                    reading.value = *value->data.uint16;
+                    break;
+                case SML_TYPE_NUMBER_32:
+                    reading.value = *value->data.uint32;
+                    break;
+                default:
+                    reading.value = (int64_t)*value->data.uint64;
+                    break;
+                }
+                break;
+            case SML_TYPE_BOOLEAN:
+                reading.type = SML_READING_BOOLEAN;
+                reading.value = *value->data.boolean ? 1 : 0;
+                break;
+            case SML_TYPE_OCTET_STRING:
+                reading.type = SML_READING_OCTET_STRING;
+                reading.octets = value->data.bytes->str;
+                reading.octets_len = value->data.bytes->len;
+                break;
+            default:
+                continue;
+            }
+            callback(reading);
+        }
+    }
+}
+
+template <typename Callback>
+void sml_file_readings(sml_file *file, Callback callback)
+{
+    sml_file_readings(file, SmlAcceptAll(), callback);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef SML_FORMAT_H
+#define SML_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SmlDecoder.h"
+
+// Formats octets as space separated hex bytes into a fixed buffer,
+// truncating if it is too small. Returns the length written.
+inline size_t sml_octets_to_hex(const uint8_t *octets, size_t len, char *out, size_t size)
+{
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    size_t pos = 0;
+    if (size == 0)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (pos + (i > 0 ? 3 : 2) >= size)
+        {
+            break;
+        }
+        if (i > 0)
+        {
+            out[pos++] = ' ';
+        }
+        out[pos++] = HEX_DIGITS[octets[i] >> 4];
+        out[pos++] = HEX_DIGITS[octets[i] & 0x0F];
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+// Number of decimal digits, 32 bit division is much cheaper on the ESP8266
+inline uint8_t sml_decimal_digits(uint64_t value)
+{
+    uint8_t digits = 1;
+    if (value > 0xFFFFFFFF)
+    {
+        for (; value >= 10 && value > 0xFFFFFFFF; value /= 10)
+        {
+            digits++;
+        }
+    }
+    for (uint32_t small = (uint32_t)value; small >= 10; small /= 10)
+    {
+        digits++;
+    }
+    return digits;
+}
+
+// Writes the digits of [value] ending right before [end]
+inline void sml_write_digits(uint64_t value, char *end)
+{
+    while (value > 0xFFFFFFFF)
+    {
+        *--end = '0' + (char)(value % 10);
+        value /= 10;
+    }
+    uint32_t small = (uint32_t)value;
+    do
+    {
+        *--end = '0' + (char)(small % 10);
+        small /= 10;
+    } while (small);
+}
+
+// Formats the decimal representation of [magnitude] * 10^[scaler] with
+// exactly -[scaler] decimals, like "%.*f" would for the scaled double but
+// without floating point. Returns the length written, or 0 if it does not
+// fit (out is empty then).
+inline size_t sml_format_scaled(uint64_t magnitude, bool negative, int8_t scaler, char *out, size_t size)
+{
+    uint8_t digits = sml_decimal_digits(magnitude);
+    uint8_t decimals = scaler < 0 ? (uint8_t)-scaler : 0;
+    uint8_t zeros = (scaler > 0 && magnitude != 0) ? (uint8_t)scaler : 0;
+    uint8_t integral = digits > decimals ? digits - decimals : 1;
+    size_t len = (negative ? 1 : 0) + integral + zeros + (decimals ? decimals + 1 : 0);
+    if (size == 0 || len >= size)
+    {
+        if (size > 0)
+        {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+
+    char *p = out;
+    if (negative)
+    {
+        *p++ = '-';
+    }
+    // Leading zeros for values below 1, the digits go right aligned
+    size_t padded = integral + decimals;
+    memset(p, '0', padded);
+    sml_write_digits(magnitude, p + padded);
+    if (decimals)
+    {
+        memmove(p + integral + 1, p + integral, decimals);
+        p[integral] = '.';
+        p += padded + 1;
+    }
+    else
+    {
+        p += padded;
+    }
+    memset(p, '0', zeros);
+    p += zeros;
+    *p = '\0';
+    return len;
+}
+
+// Scaled value of a numeric reading, see sml_format_scaled
+inline size_t sml_format_value(const SmlReading &reading, char *out, size_t size)
+{
+    if (reading.type == SML_READING_INTEGER && reading.value < 0)
+    {
+        return sml_format_scaled(0 - (uint64_t)reading.value, true, reading.scaler, out, size);
+    }
+    return sml_format_scaled((uint64_t)reading.value, false, reading.scaler, out, size);
+}
+
+// Formats an OBIS code as A-B:C.D.E followed by [separator] and F, returns
+// the length written or 0 if it does not fit
+inline size_t sml_format_obis(const uint8_t *obis, char separator, char *out, size_t size)
+{
+    static const char SEPARATORS[] = {'-', ':', '.', '.', 0};
+    char *p = out;
+    if (size < 6 * 4)
+    {
+        if (size > 0)
+        {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    for (uint8_t i = 0; i < OBIS_LENGTH; i++)
+    {
+        uint8_t digits = obis[i] >= 100 ? 3 : (obis[i] >= 10 ? 2 : 1);
+        sml_write_digits(obis[i], p + digits);
+        p += digits;
+        if (i < OBIS_LENGTH - 1)
+        {
+            *p++ = i < 4 ? SEPARATORS[i] : separator;
+        }
+    }
+    *p = '\0';
+    return p - out;
+}
+
+#endif
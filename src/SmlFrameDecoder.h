@@ -0,0 +1,187 @@
+#ifndef SML_FRAME_DECODER_H
+#define SML_FRAME_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SmlCrc.h"
+#include "SmlFraming.h"
+#include "SmlStreamDecoder.h"
+#include "TelegramDecoder.h"
+
+// SML binary while it arrives: follows the framing, hashes the message and
+// hands the unescaped payload to SmlStreamDecoder, so only the start
+// sequence matcher, the CRC and the trailer are held.
+class SmlFrameDecoder : public TelegramDecoder
+{
+public:
+    // Entries not accepted by [filter] are not stored, NULL accepts all
+    explicit SmlFrameDecoder(const ObisFilter *filter = NULL)
+    {
+        this->decoder.set_filter(filter);
+    }
+
+    void reset()
+    {
+        this->state = WAIT_FOR_START;
+        this->start_matcher.reset();
+    }
+
+    size_t feed(const uint8_t *data, size_t len, TelegramEvent &event)
+    {
+        event = TELEGRAM_NONE;
+        if (len == 0)
+        {
+            return 0;
+        }
+        switch (this->state)
+        {
+        case WAIT_FOR_START:
+        {
+            size_t n = this->start_matcher.scan(data, len);
+            if (this->start_matcher.found())
+            {
+                this->start();
+                event = TELEGRAM_STARTED;
+            }
+            return n;
+        }
+        case MESSAGE:
+        {
+            size_t space = SML_MAX_FRAME_LENGTH - 1 - this->length;
+            SmlScanResult result;
+            size_t n = this->scanner.scan(data, len < space ? len : space, result);
+            this->length += n;
+            this->crc = sml_crc16_update(this->crc, data, n);
+            // The byte ending an escape sequence is no payload
+            this->feed_payload(data, result == SML_SCAN_MORE ? n : n - 1);
+            if (result == SML_SCAN_END)
+            {
+                this->state = TRAILER;
+                this->trailer_length = 0;
+            }
+            else if (result == SML_SCAN_RESTART)
+            {
+                // A new message starts before the current one ended
+                event = TELEGRAM_ABORTED;
+                this->reset();
+                this->start_matcher.reset(SML_START_LENGTH);
+            }
+            else if (result == SML_SCAN_INVALID)
+            {
+                event = TELEGRAM_ABORTED;
+                this->reset();
+            }
+            else if (this->length == SML_MAX_FRAME_LENGTH - 1)
+            {
+                event = TELEGRAM_OVERFLOW;
+                this->reset();
+            }
+            return n;
+        }
+        case TRAILER:
+        {
+            size_t n = 0;
+            while (n < len && this->trailer_length < sizeof(this->trailer))
+            {
+                this->trailer[this->trailer_length++] = data[n++];
+            }
+            if (this->trailer_length == sizeof(this->trailer))
+            {
+                event = this->finish();
+                this->reset();
+            }
+            return n;
+        }
+        }
+        return 0;
+    }
+
+    const SmlReading *get_readings() const
+    {
+        return this->decoder.get_readings();
+    }
+
+    uint8_t get_count() const
+    {
+        return this->decoder.get_count();
+    }
+
+private:
+    enum FrameState
+    {
+        WAIT_FOR_START,
+        MESSAGE,
+        TRAILER // Number of fill bytes and checksum
+    };
+
+    FrameState state = WAIT_FOR_START;
+    SmlStartMatcher start_matcher;
+    SmlEscapeScanner scanner;
+    SmlStreamDecoder decoder;
+    uint16_t crc = SML_CRC16_INIT;
+    uint8_t escape_count = 0; // 0x1B held back from the decoder
+    uint8_t payload_offset = 0; // Of the next payload byte within its block of four
+    size_t length = 0;
+    uint8_t trailer[3];
+    uint8_t trailer_length = 0;
+
+    // The start sequence has already been read
+    void start()
+    {
+        this->crc = SML_CRC16_INIT;
+        for (uint8_t i = 0; i < SML_START_LENGTH; i++)
+        {
+            this->crc = sml_crc16_update(this->crc, i < 4 ? SML_ESCAPE : SML_START);
+        }
+        this->decoder.reset();
+        this->scanner.reset();
+        this->escape_count = 0;
+        this->payload_offset = 0;
+        this->length = SML_START_LENGTH;
+        this->state = MESSAGE;
+    }
+
+    // Hand payload bytes to the decoder while resolving escape sequences.
+    // Up to four 0x1B are held back until it is clear whether they start
+    // the end sequence or escaped payload.
+    void feed_payload(const uint8_t *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            uint8_t offset = this->payload_offset;
+            this->payload_offset = (offset + 1) & 3;
+            // Only 0x1B from the beginning of a block can be an escape
+            if (data[i] == SML_ESCAPE && offset == (this->escape_count & 3))
+            {
+                if (++this->escape_count == 8)
+                {
+                    // Escaped 0x1B 0x1B 0x1B 0x1B within the payload
+                    for (uint8_t j = 0; j < 4; j++)
+                    {
+                        this->decoder.feed(SML_ESCAPE);
+                    }
+                    this->escape_count = 0;
+                }
+                continue;
+            }
+            for (; this->escape_count > 0; this->escape_count--)
+            {
+                this->decoder.feed(SML_ESCAPE);
+            }
+            this->decoder.feed(data[i]);
+        }
+    }
+
+    // Validate the message, the number of fill bytes is covered by the checksum
+    TelegramEvent finish()
+    {
+        uint16_t crc = sml_crc16_final(sml_crc16_update(this->crc, this->trailer[0]));
+        if (crc != (this->trailer[1] | (this->trailer[2] << 8)))
+        {
+            return TELEGRAM_CHECKSUM_ERROR;
+        }
+        return this->decoder.finish() ? TELEGRAM_COMPLETE : TELEGRAM_UNDECODABLE;
+    }
+};
+
+#endif
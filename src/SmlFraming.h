@@ -0,0 +1,230 @@
+#ifndef SML_FRAMING_H
+#define SML_FRAMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// SML transport layer (version 1):
+//   1B1B1B1B 01010101 <payload> <fill bytes> 1B1B1B1B 1A <fill count> <CRC>
+// The message goes in blocks of four bytes. A block of four 0x1B within the
+// payload is sent twice, so the receiver has to follow the escape sequences
+// to tell payload from the end of the message.
+const uint8_t SML_ESCAPE = 0x1B;
+const uint8_t SML_START = 0x01;
+const uint8_t SML_END = 0x1A;
+const uint8_t SML_START_LENGTH = 8;
+const uint8_t SML_TRAILER_LENGTH = 8; // End sequence, fill count and CRC
+const size_t SML_MAX_FRAME_LENGTH = 3840; // Max datagram duration 400ms at 9600 Baud
+
+enum SmlScanResult
+{
+    SML_SCAN_MORE,    // Everything consumed, the message goes on
+    SML_SCAN_END,     // The end sequence has been consumed
+    SML_SCAN_RESTART, // A start sequence within the message, a new one has started
+    SML_SCAN_INVALID  // Unknown escape sequence
+};
+
+// Finds the start sequence in a stream of bytes. This is the KMP automaton
+// of 1B1B1B1B 01010101: a 0x1B never throws away a partial match entirely,
+// so e.g. five 0x1B followed by 01010101 are still recognized. Bytes that
+// cannot begin a match are skipped with memchr.
+class SmlStartMatcher
+{
+public:
+    void reset(uint8_t matched = 0)
+    {
+        this->matched = matched;
+    }
+
+    // Consumes bytes until the start sequence is complete, returns how many
+    size_t scan(const uint8_t *data, size_t len)
+    {
+        size_t i = 0;
+        while (i < len && !this->found())
+        {
+            if (this->matched == 0)
+            {
+                const uint8_t *next = (const uint8_t *)memchr(data + i, SML_ESCAPE, len - i);
+                if (next == NULL)
+                {
+                    return len;
+                }
+                i = next - data;
+            }
+            this->matched = advance(this->matched, data[i++]);
+        }
+        return i;
+    }
+
+    bool found() const
+    {
+        return this->matched == SML_START_LENGTH;
+    }
+
+    // Consumes one byte, returns whether the start sequence is complete
+    bool feed(uint8_t b)
+    {
+        this->matched = advance(this->matched, b);
+        return this->found();
+    }
+
+    // Whether no part of the start sequence has been seen
+    bool idle() const
+    {
+        return this->matched == 0;
+    }
+
+private:
+    uint8_t matched = 0;
+
+    static uint8_t advance(uint8_t matched, uint8_t b)
+    {
+        if (b == SML_ESCAPE)
+        {
+            // The last four 0x1B, or the first one of a new attempt
+            return matched < 4 ? matched + 1 : (matched == 4 ? 4 : 1);
+        }
+        return (b == SML_START && matched >= 4) ? matched + 1 : 0;
+    }
+};
+
+// Follows the escape sequences of a message from behind its start sequence
+// up to its end sequence. The message is sent in blocks of four bytes, and
+// only a block of four 0x1B is an escape: 0x1B elsewhere are payload. A
+// start sequence is recognized anywhere, so that a message starting in the
+// middle of a broken one is not missed. Runs without 0x1B are skipped with
+// memchr.
+class SmlEscapeScanner
+{
+public:
+    void reset()
+    {
+        this->escape_count = 0;
+        this->offset = 0;
+        this->start_matcher.reset();
+    }
+
+    // Consumes bytes until the message ends or turns out to be broken,
+    // [result] tells which. SML_SCAN_RESTART comes with the start sequence
+    // of the new message consumed.
+    size_t scan(const uint8_t *data, size_t len, SmlScanResult &result)
+    {
+        size_t i = 0;
+        result = SML_SCAN_MORE;
+        while (i < len)
+        {
+            if (this->escape_count == 0 && this->start_matcher.idle())
+            {
+                const uint8_t *next = (const uint8_t *)memchr(data + i, SML_ESCAPE, len - i);
+                if (next == NULL)
+                {
+                    this->offset = (this->offset + (len - i)) & 3;
+                    return len;
+                }
+                this->offset = (this->offset + (next - data - i)) & 3;
+                i = next - data;
+            }
+            uint8_t b = data[i++];
+            uint8_t offset = this->offset;
+            this->offset = (offset + 1) & 3;
+            if (this->start_matcher.feed(b))
+            {
+                result = SML_SCAN_RESTART;
+                return i;
+            }
+            if (this->escape_count < 4)
+            {
+                // Counts 0x1B from the beginning of a block only
+                this->escape_count = (b == SML_ESCAPE && offset == this->escape_count) ? this->escape_count + 1 : 0;
+            }
+            else if (this->escape_count == 4)
+            {
+                if (b == SML_ESCAPE)
+                {
+                    // Escaped 1B1B1B1B within the payload
+                    this->escape_count++;
+                }
+                else if (b == SML_START)
+                {
+                    // 01010101 has to follow
+                    this->escape_count = 8;
+                }
+                else
+                {
+                    this->escape_count = 0;
+                    result = b == SML_END ? SML_SCAN_END : SML_SCAN_INVALID;
+                    return i;
+                }
+            }
+            else if (this->escape_count == 8 && b == SML_START)
+            {
+                // Until the start matcher has all of it
+            }
+            else if (this->escape_count < 8 && b == SML_ESCAPE)
+            {
+                if (this->escape_count == 7)
+                {
+                    // The escaped 1B1B1B1B cannot begin a start sequence
+                    this->escape_count = 0;
+                    this->start_matcher.reset();
+                }
+                else
+                {
+                    this->escape_count++;
+                }
+            }
+            else
+            {
+                this->escape_count = 0;
+                result = SML_SCAN_INVALID;
+                return i;
+            }
+        }
+        return i;
+    }
+
+private:
+    uint8_t escape_count = 0; // 0x1B of the current block, up to 4, 5 to 7 for an escaped block, 8 for a start
+    uint8_t offset = 0;       // Of the next byte within its block
+    SmlStartMatcher start_matcher;
+};
+
+// Removes the escaping from the payload of a complete message in place and
+// returns its new length. The start sequence and the trailer are kept.
+inline size_t sml_unescape(uint8_t *frame, size_t len)
+{
+    if (len < SML_START_LENGTH + SML_TRAILER_LENGTH)
+    {
+        return len;
+    }
+    uint8_t *end = frame + len - SML_TRAILER_LENGTH;
+    uint8_t *read = frame + SML_START_LENGTH;
+    uint8_t *write = read;
+    while (read < end)
+    {
+        // Only a block of 0x1B can be an escape, blocks count from the start
+        // sequence
+        const uint8_t *next = (const uint8_t *)memchr(read, SML_ESCAPE, end - read);
+        uint8_t *block = next != NULL ? frame + ((next - frame + 3) & ~(size_t)3) : end;
+        size_t plain = (block < end ? block : end) - read;
+        memmove(write, read, plain);
+        read += plain;
+        write += plain;
+
+        size_t run = 0;
+        while (run < 8 && read + run < end && read[run] == SML_ESCAPE)
+        {
+            run++;
+        }
+        // Eight 0x1B stand for four, anything else is payload
+        size_t keep = run == 8 ? 4 : (end - read < 4 ? end - read : 4);
+        memmove(write, read, keep);
+        read += run == 8 ? 8 : keep;
+        write += keep;
+    }
+    memmove(write, end, SML_TRAILER_LENGTH);
+    return write + SML_TRAILER_LENGTH - frame;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef SML_JSON_H
+#define SML_JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+
+// Serializes the readings of a telegram into a compact JSON document in a
+// caller provided buffer:
+//   {"time":1234,"values":[{"obis":"1-0:1.8.0*255","value":1234.5,"unit":"Wh"},...]}
+// Documents of readings published late carry their age in seconds as well.
+// Nothing is allocated. An entry that does not fit is left out completely
+// and reported, so the caller can publish what it has and start over.
+class SmlJsonWriter
+{
+public:
+    SmlJsonWriter(char *buffer, size_t size) : buffer(buffer), size(size) {}
+
+    void reset(long age = -1)
+    {
+        this->age = age;
+        this->position = 0;
+        this->count = 0;
+        this->buffer[0] = '\0';
+    }
+
+    // Appends a reading, [unit] may be NULL
+    bool add(const SmlReading &reading, const char *unit)
+    {
+        size_t start = this->position;
+        this->overflow = false;
+        if (this->count == 0)
+        {
+            this->append("{\"time\":");
+            this->append_formatted(sml_format_scaled(reading.time, false, 0, this->end(), this->available()));
+            if (this->age >= 0)
+            {
+                this->append(",\"age\":");
+                this->append_formatted(sml_format_scaled(this->age, false, 0, this->end(), this->available()));
+            }
+            this->append(",\"values\":[");
+        }
+        else
+        {
+            this->append(",");
+        }
+        this->append("{\"obis\":\"");
+        this->append_formatted(sml_format_obis(reading.obis, '*', this->end(), this->available()));
+        this->append("\",\"value\":");
+        switch (reading.type)
+        {
+        case SML_READING_INTEGER:
+        case SML_READING_UNSIGNED:
+            this->append_formatted(sml_format_value(reading, this->end(), this->available()));
+            break;
+        case SML_READING_BOOLEAN:
+            this->append(reading.value ? "true" : "false");
+            break;
+        default:
+            this->append("\"");
+            if (this->position + reading.octets_len * 3 < this->capacity())
+            {
+                this->position += sml_octets_to_hex(reading.octets, reading.octets_len,
+                                                    this->buffer + this->position, this->capacity() - this->position);
+            }
+            else
+            {
+                this->overflow = true;
+            }
+            this->append("\"");
+            break;
+        }
+        if (unit != NULL)
+        {
+            this->append(",\"unit\":\"");
+            this->append_escaped(unit);
+            this->append("\"");
+        }
+        this->append("}");
+
+        if (this->overflow)
+        {
+            this->position = start;
+            this->buffer[start] = '\0';
+            return false;
+        }
+        this->count++;
+        return true;
+    }
+
+    // Closes the document, returns its length
+    size_t finish()
+    {
+        if (this->count > 0)
+        {
+            // Room for this is kept free by capacity()
+            this->buffer[this->position++] = ']';
+            this->buffer[this->position++] = '}';
+            this->buffer[this->position] = '\0';
+        }
+        return this->position;
+    }
+
+    bool empty() const
+    {
+        return this->count == 0;
+    }
+
+    const char *get_buffer() const
+    {
+        return this->buffer;
+    }
+
+private:
+    char *buffer;
+    size_t size;
+    size_t position = 0;
+    uint8_t count = 0;
+    long age = -1;
+    bool overflow = false;
+
+    // Keeps space for the closing "]}" and the terminator
+    size_t capacity() const
+    {
+        return this->size > 3 ? this->size - 3 : 0;
+    }
+
+    void append(const char *s)
+    {
+        while (*s)
+        {
+            if (this->position >= this->capacity())
+            {
+                this->overflow = true;
+                return;
+            }
+            this->buffer[this->position++] = *s++;
+        }
+        this->buffer[this->position] = '\0';
+    }
+
+    void append_escaped(const char *s)
+    {
+        char c[2] = {0, 0};
+        for (; *s; s++)
+        {
+            if (*s == '"' || *s == '\\')
+            {
+                this->append("\\");
+            }
+            c[0] = *s;
+            this->append(c);
+        }
+    }
+
+    char *end()
+    {
+        return this->buffer + this->position;
+    }
+
+    // Space left for a formatter, including its terminator
+    size_t available() const
+    {
+        return this->position < this->capacity() ? this->capacity() - this->position + 1 : 0;
+    }
+
+    // Formatters write nothing if the result does not fit
+    void append_formatted(size_t written)
+    {
+        if (written == 0)
+        {
+            this->overflow = true;
+        }
+        this->position += written;
+    }
+};
+
+#endif
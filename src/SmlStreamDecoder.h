@@ -0,0 +1,483 @@
+#ifndef SML_STREAM_DECODER_H
+#define SML_STREAM_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "ObisFilter.h"
+
+const uint8_t SML_STREAM_MAX_READINGS = 24;
+// Bytes of the octet strings of a telegram, shared by its readings: room for
+// the public key of a meter (48 bytes) next to the usual short ones
+const uint16_t SML_STREAM_OCTETS_SIZE = 384;
+
+// Push counterpart of SmlDecoder: takes the unescaped payload of a frame one
+// byte at a time and keeps the readings of the GetListResponse entries in a
+// small fixed store until the frame is complete. Only the TL field and the
+// value being read are held, the frame itself is never buffered.
+class SmlStreamDecoder
+{
+public:
+    // Entries not accepted by [filter] are not stored, NULL accepts all
+    void set_filter(const ObisFilter *filter)
+    {
+        this->filter = filter;
+    }
+
+    void reset()
+    {
+        this->state = TL_FIRST;
+        this->depth = 0;
+        this->tag = 0;
+        this->time = 0;
+        this->count = 0;
+        this->octets_used = 0;
+        this->dropped = 0;
+        this->failed = false;
+    }
+
+    // Returns false once the stream turned out to be malformed
+    bool feed(uint8_t b)
+    {
+        if (this->failed)
+        {
+            return false;
+        }
+        switch (this->state)
+        {
+        case TL_FIRST:
+            if (b == SML_END_OF_MESSAGE)
+            {
+                // Fill bytes and endOfSmlMsg
+                if (this->depth > 0)
+                {
+                    this->element_done();
+                }
+                return !this->failed;
+            }
+            this->type = b & SML_TL_TYPE;
+            this->length = b & SML_TL_LENGTH;
+            this->tl_bytes = 1;
+            if (b & SML_TL_ANOTHER)
+            {
+                this->state = TL_MORE;
+            }
+            else
+            {
+                this->begin_token();
+            }
+            break;
+        case TL_MORE:
+            if (++this->tl_bytes > 4)
+            {
+                return this->fail();
+            }
+            this->length = (this->length << 4) | (b & SML_TL_LENGTH);
+            if (!(b & SML_TL_ANOTHER))
+            {
+                this->begin_token();
+            }
+            break;
+        case VALUE:
+            if (this->value_len < sizeof(this->value))
+            {
+                this->value[this->value_len] = b;
+            }
+            // Octet strings go straight behind those already kept, where they
+            // stay if they turn out to be a reading
+            if (this->octets_used + this->value_len < SML_STREAM_OCTETS_SIZE)
+            {
+                this->octets[this->octets_used + this->value_len] = b;
+            }
+            this->value_len++;
+            if (--this->remaining == 0)
+            {
+                this->scalar_done();
+            }
+            break;
+        }
+        return !this->failed;
+    }
+
+    // Called once the end sequence has been seen, true if the payload was
+    // complete and well formed
+    bool finish()
+    {
+        return !this->failed && this->depth == 0 && this->state == TL_FIRST;
+    }
+
+    const SmlReading *get_readings() const
+    {
+        return this->readings;
+    }
+
+    uint8_t get_count() const
+    {
+        return this->count;
+    }
+
+    // Entries that did not fit into the store
+    uint8_t get_dropped() const
+    {
+        return this->dropped;
+    }
+
+private:
+    enum TokenState
+    {
+        TL_FIRST,
+        TL_MORE,
+        VALUE
+    };
+
+    // What an open list represents
+    enum Role
+    {
+        MESSAGE,
+        MESSAGE_BODY,
+        GET_LIST_RESPONSE,
+        SENSOR_TIME,
+        VAL_LIST,
+        LIST_ENTRY,
+        OTHER
+    };
+
+    struct OpenList
+    {
+        Role role;
+        uint16_t size;
+        uint16_t index;
+    };
+
+    const ObisFilter *filter = NULL;
+    TokenState state = TL_FIRST;
+    uint8_t type = 0;
+    uint16_t length = 0;
+    uint8_t tl_bytes = 0;
+    uint16_t remaining = 0;
+    uint8_t value[8]; // Numbers and OBIS codes, octet strings are kept below
+    uint16_t value_len = 0;
+
+    OpenList lists[SML_MAX_DEPTH];
+    uint8_t depth = 0;
+
+    uint32_t tag = 0;
+    uint8_t time_choice = 0;
+    uint32_t time = 0;
+
+    // Entry being decoded
+    SmlReading entry;
+    bool entry_has_obis = false;
+    bool entry_has_value = false;
+
+    SmlReading readings[SML_STREAM_MAX_READINGS];
+    uint8_t obis_store[SML_STREAM_MAX_READINGS][OBIS_LENGTH];
+    uint8_t octets[SML_STREAM_OCTETS_SIZE];
+    uint16_t octets_used = 0;
+    uint8_t count = 0;
+    uint8_t dropped = 0;
+    bool failed = false;
+
+    bool fail()
+    {
+        this->failed = true;
+        return false;
+    }
+
+    void begin_token()
+    {
+        this->state = TL_FIRST;
+        if (this->type == SML_TL_LIST)
+        {
+            this->open_list();
+            return;
+        }
+        if (this->length < this->tl_bytes)
+        {
+            this->fail();
+            return;
+        }
+        this->remaining = this->length - this->tl_bytes;
+        this->value_len = 0;
+        if (this->remaining == 0)
+        {
+            this->scalar_done();
+        }
+        else
+        {
+            this->state = VALUE;
+        }
+    }
+
+    Role child_role()
+    {
+        if (this->depth == 0)
+        {
+            return MESSAGE;
+        }
+        const OpenList &parent = this->lists[this->depth - 1];
+        switch (parent.role)
+        {
+        case MESSAGE:
+            return parent.index == 3 ? MESSAGE_BODY : OTHER;
+        case MESSAGE_BODY:
+            return (parent.index == 1 && this->tag == SML_TAG_GET_LIST_RESPONSE) ? GET_LIST_RESPONSE : OTHER;
+        case GET_LIST_RESPONSE:
+            return parent.index == 3 ? SENSOR_TIME : (parent.index == 4 ? VAL_LIST : OTHER);
+        case VAL_LIST:
+            return LIST_ENTRY;
+        default:
+            return OTHER;
+        }
+    }
+
+    void open_list()
+    {
+        Role role = this->child_role();
+        if (this->depth == SML_MAX_DEPTH || (role == MESSAGE && this->length != 6) ||
+            (role == LIST_ENTRY && this->length != 7))
+        {
+            this->fail();
+            return;
+        }
+        if (role == MESSAGE)
+        {
+            this->tag = 0;
+        }
+        else if (role == GET_LIST_RESPONSE)
+        {
+            this->time = 0;
+        }
+        else if (role == SENSOR_TIME)
+        {
+            this->time_choice = 0;
+        }
+        else if (role == LIST_ENTRY)
+        {
+            this->entry_has_obis = false;
+            this->entry_has_value = false;
+            this->entry.unit = 0;
+            this->entry.scaler = 0;
+        }
+        else if (this->depth > 0 && this->lists[this->depth - 1].role == LIST_ENTRY &&
+                 this->lists[this->depth - 1].index == 5)
+        {
+            // Structured values are not published
+            this->entry.type = SML_READING_UNSUPPORTED;
+            this->entry_has_value = true;
+        }
+
+        OpenList &list = this->lists[this->depth++];
+        list.role = role;
+        list.size = this->length;
+        list.index = 0;
+        if (list.size == 0)
+        {
+            this->close_list();
+        }
+    }
+
+    void close_list()
+    {
+        const OpenList &list = this->lists[--this->depth];
+        if (list.role == LIST_ENTRY)
+        {
+            this->store_entry();
+        }
+        if (this->depth > 0)
+        {
+            this->element_done();
+        }
+    }
+
+    void element_done()
+    {
+        OpenList &list = this->lists[this->depth - 1];
+        if (++list.index == list.size)
+        {
+            this->close_list();
+        }
+    }
+
+    bool number(int64_t &result)
+    {
+        if ((this->type != SML_TL_INTEGER && this->type != SML_TL_UNSIGNED) ||
+            this->value_len == 0 || this->value_len > 8)
+        {
+            return false;
+        }
+        uint64_t raw = (this->type == SML_TL_INTEGER && (this->value[0] & 0x80)) ? ~(uint64_t)0 : 0;
+        for (uint16_t i = 0; i < this->value_len; i++)
+        {
+            raw = (raw << 8) | this->value[i];
+        }
+        result = (int64_t)raw;
+        return true;
+    }
+
+    void scalar_done()
+    {
+        this->state = TL_FIRST;
+        if (this->depth == 0)
+        {
+            this->fail();
+            return;
+        }
+        const OpenList &list = this->lists[this->depth - 1];
+        bool skipped = this->type == SML_TL_OCTET_STRING && this->value_len == 0;
+        int64_t n;
+        switch (list.role)
+        {
+        case MESSAGE_BODY:
+            if (list.index == 0)
+            {
+                if (!this->number(n))
+                {
+                    this->fail();
+                    return;
+                }
+                this->tag = (uint32_t)n;
+            }
+            break;
+        case SENSOR_TIME:
+            if (this->number(n))
+            {
+                if (list.index == 0)
+                {
+                    this->time_choice = (uint8_t)n;
+                }
+                else if (this->time_choice == 1 || this->time_choice == 2)
+                {
+                    this->time = (uint32_t)n;
+                }
+            }
+            break;
+        case LIST_ENTRY:
+            this->entry_field(list.index, skipped);
+            break;
+        default:
+            break;
+        }
+        if (!this->failed)
+        {
+            this->element_done();
+        }
+    }
+
+    void entry_field(uint16_t index, bool skipped)
+    {
+        int64_t n;
+        switch (index)
+        {
+        case 0: // objName
+            this->entry_has_obis = this->type == SML_TL_OCTET_STRING && this->value_len == OBIS_LENGTH &&
+                                   (this->filter == NULL || this->filter->accepts(this->value));
+            if (this->entry_has_obis)
+            {
+                memcpy(this->obis_store[this->count < SML_STREAM_MAX_READINGS ? this->count : 0],
+                       this->value, OBIS_LENGTH);
+            }
+            break;
+        case 3: // unit
+            if (!skipped)
+            {
+                if (!this->number(n))
+                {
+                    this->fail();
+                    return;
+                }
+                this->entry.unit = (uint8_t)n;
+            }
+            break;
+        case 4: // scaler
+            if (!skipped)
+            {
+                if (!this->number(n))
+                {
+                    this->fail();
+                    return;
+                }
+                this->entry.scaler = (int8_t)n;
+            }
+            break;
+        case 5: // value
+            this->value_field(skipped);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void value_field(bool skipped)
+    {
+        this->entry.value = 0;
+        this->entry.octets_len = 0;
+        if (skipped || !this->entry_has_obis)
+        {
+            // Unwanted entries are dropped without decoding the value
+            return;
+        }
+        this->entry_has_value = true;
+        switch (this->type)
+        {
+        case SML_TL_INTEGER:
+        case SML_TL_UNSIGNED:
+            this->entry.type = (this->type == SML_TL_INTEGER) ? SML_READING_INTEGER : SML_READING_UNSIGNED;
+            if (!this->number(this->entry.value))
+            {
+                this->fail();
+            }
+            break;
+        case SML_TL_BOOLEAN:
+            if (this->value_len != 1)
+            {
+                this->fail();
+                return;
+            }
+            this->entry.type = SML_READING_BOOLEAN;
+            this->entry.value = this->value[0] ? 1 : 0;
+            break;
+        case SML_TL_OCTET_STRING:
+            if (this->octets_used + this->value_len > SML_STREAM_OCTETS_SIZE)
+            {
+                // No room left for it in this telegram
+                this->entry.type = SML_READING_UNSUPPORTED;
+                this->dropped++;
+                break;
+            }
+            this->entry.type = SML_READING_OCTET_STRING;
+            this->entry.octets = this->octets + this->octets_used;
+            this->entry.octets_len = this->value_len;
+            this->octets_used += this->value_len;
+            break;
+        default:
+            this->entry.type = SML_READING_UNSUPPORTED;
+            break;
+        }
+    }
+
+    void store_entry()
+    {
+        if (!this->entry_has_obis || !this->entry_has_value || this->entry.type == SML_READING_UNSUPPORTED)
+        {
+            return;
+        }
+        if (this->count == SML_STREAM_MAX_READINGS)
+        {
+            this->dropped++;
+            return;
+        }
+        SmlReading &reading = this->readings[this->count];
+        reading = this->entry;
+        reading.obis = this->obis_store[this->count];
+        reading.time = this->time;
+        if (reading.type != SML_READING_OCTET_STRING)
+        {
+            reading.octets = NULL;
+        }
+        this->count++;
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SML_TEXT_DECODER_H
+#define SML_TEXT_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SmlFrameDecoder.h"
+
+// SML sent as hexadecimal text ("SML in Textform"), e.g.
+//   1B 1B 1B 1B 01 01 01 01 76 05 ...
+// Pairs of hex digits are turned into bytes and handed to SmlFrameDecoder,
+// anything else (spaces, line breaks) separates them.
+class SmlTextDecoder : public TelegramDecoder
+{
+public:
+    explicit SmlTextDecoder(const ObisFilter *filter = NULL) : frame(filter)
+    {
+    }
+
+    void reset()
+    {
+        this->frame.reset();
+        this->half = false;
+    }
+
+    size_t feed(const uint8_t *data, size_t len, TelegramEvent &event)
+    {
+        event = TELEGRAM_NONE;
+        for (size_t i = 0; i < len; i++)
+        {
+            int8_t digit = hex_digit(data[i]);
+            if (digit < 0)
+            {
+                // A lone digit is dropped
+                this->half = false;
+                continue;
+            }
+            if (!this->half)
+            {
+                this->high = digit;
+                this->half = true;
+                continue;
+            }
+            this->half = false;
+            uint8_t b = (this->high << 4) | digit;
+            this->frame.feed(&b, 1, event);
+            if (event != TELEGRAM_NONE)
+            {
+                return i + 1;
+            }
+        }
+        return len;
+    }
+
+    const SmlReading *get_readings() const
+    {
+        return this->frame.get_readings();
+    }
+
+    uint8_t get_count() const
+    {
+        return this->frame.get_count();
+    }
+
+private:
+    SmlFrameDecoder frame;
+    uint8_t high = 0;
+    bool half = false;
+
+    static int8_t hex_digit(uint8_t c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef SPILL_FILE_H
+#define SPILL_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#ifdef ARDUINO
+#include <LittleFS.h>
+#endif
+
+// Append-only file the offline queue moves readings to when it runs out of
+// RAM. Lives on LittleFS on the device (which has to be mounted before) and
+// in the host file system in the native build.
+class SpillFile
+{
+public:
+    explicit SpillFile(const char *path)
+    {
+        snprintf(this->path, sizeof(this->path), "%s", path);
+    }
+
+    size_t size()
+    {
+        if (this->cached_size < 0)
+        {
+            this->cached_size = this->stat();
+        }
+        return this->cached_size;
+    }
+
+    bool append(const void *data, size_t len)
+    {
+        size_t written = 0;
+#ifdef ARDUINO
+        File file = LittleFS.open(this->path, "a");
+        if (file)
+        {
+            written = file.write((const uint8_t *)data, len);
+            file.close();
+        }
+#else
+        FILE *file = fopen(this->path, "ab");
+        if (file != NULL)
+        {
+            written = fwrite(data, 1, len, file);
+            fclose(file);
+        }
+#endif
+        this->cached_size = -1;
+        return written == len;
+    }
+
+    size_t read(size_t offset, void *data, size_t len)
+    {
+        size_t read = 0;
+#ifdef ARDUINO
+        File file = LittleFS.open(this->path, "r");
+        if (file)
+        {
+            if (file.seek(offset))
+            {
+                read = file.read((uint8_t *)data, len);
+            }
+            file.close();
+        }
+#else
+        FILE *file = fopen(this->path, "rb");
+        if (file != NULL)
+        {
+            if (fseek(file, offset, SEEK_SET) == 0)
+            {
+                read = fread(data, 1, len, file);
+            }
+            fclose(file);
+        }
+#endif
+        return read;
+    }
+
+    void clear()
+    {
+#ifdef ARDUINO
+        LittleFS.remove(this->path);
+#else
+        remove(this->path);
+#endif
+        this->cached_size = 0;
+    }
+
+private:
+    char path[64];
+    long cached_size = -1;
+
+    size_t stat()
+    {
+        size_t size = 0;
+#ifdef ARDUINO
+        File file;
+        if (LittleFS.exists(this->path) && (file = LittleFS.open(this->path, "r")))
+        {
+            size = file.size();
+            file.close();
+        }
+#else
+        FILE *file = fopen(this->path, "rb");
+        if (file != NULL)
+        {
+            if (fseek(file, 0, SEEK_END) == 0)
+            {
+                long end = ftell(file);
+                size = end > 0 ? end : 0;
+            }
+            fclose(file);
+        }
+#endif
+        return size;
+    }
+};
+
+#endif
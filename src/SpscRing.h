@@ -0,0 +1,98 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+const size_t SPSC_CACHE_LINE = 64; // Keeps the two indices from sharing a line
+
+// Queue of [N] slots between exactly one producing and one consuming
+// thread or task, without locks. Slots are written and read in place:
+// the producer fills the slot of claim() and hands it over with
+// publish(), the consumer reads the slot of peek() and gives it back
+// with release(). The indices run freely and are only wrapped to find
+// a slot, so [N] has to be a power of two.
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing needs a power of two of slots");
+
+public:
+    // Producer: the next free slot, NULL if all of them are taken
+    T *claim()
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head - this->tail.load(std::memory_order_acquire) == N)
+        {
+            return NULL;
+        }
+        return &this->slots[head & (N - 1)];
+    }
+
+    // Producer: hands the slot of claim() over to the consumer
+    void publish()
+    {
+        this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool push(const T &item)
+    {
+        T *slot = this->claim();
+        if (slot == NULL)
+        {
+            return false;
+        }
+        *slot = item;
+        this->publish();
+        return true;
+    }
+
+    // Consumer: the oldest published slot, NULL if there is none
+    T *peek()
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (this->head.load(std::memory_order_acquire) == tail)
+        {
+            return NULL;
+        }
+        return &this->slots[tail & (N - 1)];
+    }
+
+    // Consumer: gives the slot of peek() back to the producer
+    void release()
+    {
+        this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(T &item)
+    {
+        T *slot = this->peek();
+        if (slot == NULL)
+        {
+            return false;
+        }
+        item = *slot;
+        this->release();
+        return true;
+    }
+
+    // Exact for the calling side, a snapshot for the other one
+    size_t size() const
+    {
+        return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+    }
+
+    static size_t capacity()
+    {
+        return N;
+    }
+
+private:
+    T slots[N];
+    std::atomic<size_t> head{0}; // Slots published so far, written by the producer
+    uint8_t padding[SPSC_CACHE_LINE];
+    std::atomic<size_t> tail{0}; // Slots released so far, written by the consumer
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef TELEGRAM_CHANNEL_H
+#define TELEGRAM_CHANNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SmlDecoder.h"
+#include "SmlStreamDecoder.h"
+#include "SpscRing.h"
+
+const size_t TELEGRAM_CHANNEL_LENGTH = 4; // Telegrams a sensor can be ahead of the loop
+const uint8_t TELEGRAM_MAX_READINGS = SML_STREAM_MAX_READINGS;
+const uint8_t TELEGRAM_MAX_OCTETS = 48;  // Room for the public key of a meter
+
+// Readings of one telegram copied out of the decoder or the message
+// buffer, so that they stay valid after the sensor read on. Readings
+// beyond TELEGRAM_MAX_READINGS and octet strings longer than
+// TELEGRAM_MAX_OCTETS are dropped and counted.
+struct ReadingTelegram
+{
+    SmlReading readings[TELEGRAM_MAX_READINGS];
+    uint8_t obis[TELEGRAM_MAX_READINGS][OBIS_LENGTH];
+    uint8_t octets[TELEGRAM_MAX_READINGS][TELEGRAM_MAX_OCTETS];
+    uint8_t count;
+    uint8_t dropped;
+    bool valid; // Decoded completely
+
+    void clear()
+    {
+        this->count = 0;
+        this->dropped = 0;
+        this->valid = true;
+    }
+
+    bool add(const SmlReading &reading)
+    {
+        size_t octets_len = reading.type == SML_READING_OCTET_STRING ? reading.octets_len : 0;
+        if (this->count == TELEGRAM_MAX_READINGS || octets_len > TELEGRAM_MAX_OCTETS)
+        {
+            this->dropped++;
+            return false;
+        }
+        SmlReading &copy = this->readings[this->count];
+        copy = reading;
+        memcpy(this->obis[this->count], reading.obis, OBIS_LENGTH);
+        copy.obis = this->obis[this->count];
+        if (octets_len > 0)
+        {
+            memcpy(this->octets[this->count], reading.octets, octets_len);
+            copy.octets = this->octets[this->count];
+        }
+        this->count++;
+        return true;
+    }
+};
+
+// Telegrams of one sensor on their way from the task reading it to the
+// one publishing them
+class TelegramChannel : public SpscRing<ReadingTelegram, TELEGRAM_CHANNEL_LENGTH>
+{
+};
+
+#endif
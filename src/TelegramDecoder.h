@@ -0,0 +1,88 @@
+#ifndef TELEGRAM_DECODER_H
+#define TELEGRAM_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SmlDecoder.h"
+
+// What a meter speaks
+enum Protocol
+{
+    PROTOCOL_SML,        // SML binary, sent by the meter
+    PROTOCOL_SML_TEXT,   // SML as hexadecimal text, sent by the meter
+    PROTOCOL_D0,         // IEC 62056-21 data sent by the meter (push, mode D)
+    PROTOCOL_D0_MODE_A,  // IEC 62056-21 readout requested at 300 baud
+    PROTOCOL_D0_MODE_C   // IEC 62056-21 readout requested, at the speed offered by the meter
+};
+
+// Character frame of the line
+enum LineFormat
+{
+    LINE_8N1,
+    LINE_7E1
+};
+
+// Sending side of a sensor and its line settings, for protocols that ask
+// the meter for its telegrams
+class TelegramLink
+{
+public:
+    virtual ~TelegramLink() {}
+
+    virtual void set_line(uint32_t baud, LineFormat format) = 0;
+
+    // Takes up to [len] bytes to send, returns how many. Decoders hand over
+    // the rest on their next polls.
+    virtual size_t send(const uint8_t *data, size_t len) = 0;
+};
+
+// What a call of TelegramDecoder::feed() ran into
+enum TelegramEvent
+{
+    TELEGRAM_NONE,
+    TELEGRAM_STARTED,        // The beginning of a telegram has been found
+    TELEGRAM_COMPLETE,       // The telegram is valid, its readings can be taken
+    TELEGRAM_CHECKSUM_ERROR, // Received completely, but the checksum does not match
+    TELEGRAM_UNDECODABLE,    // Received completely with a valid checksum, but malformed
+    TELEGRAM_OVERFLOW,       // Longer than allowed, dropped
+    TELEGRAM_ABORTED         // Broken off before its end
+};
+
+// Turns the bytes of a meter into readings while they arrive, one telegram
+// at a time. Decoders keep their readings in fixed stores, nothing is
+// allocated after construction.
+class TelegramDecoder
+{
+public:
+    virtual ~TelegramDecoder() {}
+
+    // Sets the line up, called once before the first byte
+    virtual void begin(TelegramLink &)
+    {
+    }
+
+    // Sends requests and switches the line as the protocol demands, called
+    // on every loop with the time in milliseconds
+    virtual void poll(TelegramLink &, unsigned long)
+    {
+    }
+
+    // Whether telegrams are requested (and thereby paced) by the decoder
+    virtual bool requests() const
+    {
+        return false;
+    }
+
+    // Drops a telegram in progress and waits for the next one
+    virtual void reset() = 0;
+
+    // Consumes bytes up to the next event, returns how many. After
+    // TELEGRAM_COMPLETE the readings stay valid until the next call.
+    virtual size_t feed(const uint8_t *data, size_t len, TelegramEvent &event) = 0;
+
+    virtual const SmlReading *get_readings() const = 0;
+
+    virtual uint8_t get_count() const = 0;
+};
+
+#endif
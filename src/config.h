@@ -20,8 +20,70 @@ static const SensorConfig SENSOR_CONFIGS[] = {
      .status_led_enabled = true,
      .status_led_inverted = true,
      .status_led_pin = LED_BUILTIN,
-     .interval = 0}};
+     .interval = 0,
+     .streaming = false,
+     .changes_only = false,
+     .heartbeat = 300,
+     .publish_mode = PUBLISH_VALUES,
+     .offline_queue = 0,
+     .capture = CAPTURE_SOFTWARE_SERIAL,
+     // e.g. {OBIS_FILTER_ALLOW, 2, {{0x01, 0x00, 0x01, 0x08, 0x00, 0xFF}, {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF}}}
+     .obis_filter = {OBIS_FILTER_NONE, 0, {}},
+     .aggregation = 0,
+     .protocol = PROTOCOL_SML,
+     .tx_pin = -1,
+     .overrun = OVERRUN_DROP_OLDEST}};
 
 const uint8_t NUM_OF_SENSORS = sizeof(SENSOR_CONFIGS) / sizeof(SensorConfig);
 
+// Seconds between two messages to the stats topics, 0 disables them
+const uint16_t STATS_INTERVAL = 60;
+
+// Publishes the events that are not routine (dropped messages, checksum
+// errors, timeouts) to <topic>log as they happen. All events are kept for
+// /log and the serial console either way.
+const bool EVENT_LOG_MQTT = false;
+
+// Bytes of each of the two buffers per sensor holding its latest readings
+// for /api/readings, taken on the first request, 0 disables it
+const size_t READINGS_SNAPSHOT_SIZE = 1024;
+
+// Bytes of the frame pool per buffered SML sensor, cut into buffers as long
+// as the longest message so far plus a quarter: two messages of 400 bytes.
+// Allocated once a sensor reads into it.
+const size_t FRAME_POOL_SIZE_PER_SENSOR = 1024;
+
+// What a sensor does when the pool has no room for its message, a buffer
+// taken from the heap is kept for the next time
+const FramePoolFallback FRAME_POOL_FALLBACK = FRAME_POOL_ALLOCATE;
+
+// Bytes of LittleFS per sensor taking readings that do not fit into the
+// offline queue, 0 keeps them in RAM only
+const size_t OFFLINE_SPILL_SIZE = 0;
+
+// Used by sensors with .changes_only, values of other OBIS codes are
+// published on every change
+static const DeadbandConfig DEADBAND_CONFIGS[] = {
+    {.obis = {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF}, // 1-0:16.7.0*255, current power
+     .absolute = 5,
+     .relative = 0}};
+
+const uint8_t NUM_OF_DEADBANDS = sizeof(DEADBAND_CONFIGS) / sizeof(DeadbandConfig);
+
+#ifdef USE_OBIS_TABLE
+// With -DUSE_OBIS_TABLE only these OBIS codes are decoded, by all sensors
+// and on top of their own filters. Has to be sorted.
+constexpr uint64_t OBIS_TABLE_CODES[] = {
+    obis_code(1, 0, 1, 8, 0, 255),  // Energy in
+    obis_code(1, 0, 2, 8, 0, 255),  // Energy out
+    obis_code(1, 0, 16, 7, 0, 255), // Current power
+    obis_code(1, 0, 36, 7, 0, 255), // L1
+    obis_code(1, 0, 56, 7, 0, 255), // L2
+    obis_code(1, 0, 76, 7, 0, 255)  // L3
+};
+static_assert(obis_table_sorted(OBIS_TABLE_CODES, sizeof(OBIS_TABLE_CODES) / sizeof(uint64_t)),
+              "OBIS_TABLE_CODES has to be sorted");
+constexpr ObisTable<sizeof(OBIS_TABLE_CODES) / sizeof(uint64_t)> OBIS_TABLE(OBIS_TABLE_CODES);
+#endif
+
 #endif
\ No newline at end of file
@@ -1,24 +1,45 @@
-#include <list>
 #include "config.h"
 #include "debug.h"
-#include <sml/sml_file.h>
+#include "SmlDecoder.h"
 #include "Sensor.h"
+#include "SensorConfigStore.h"
+#include "SensorSettings.h"
+#include "SensorScheduler.h"
 #include <IotWebConf.h>
 #include <IotWebConfUsing.h>
 #include "MqttPublisher.h"
+#include "MessagePipeline.h"
 #include "EEPROM.h"
-#include <ESP8266WiFi.h>
 
 #ifdef ESP8266
+# include <ESP8266WiFi.h>
 # include <ESP8266HTTPUpdateServer.h>
 #elif defined(ESP32)
+# include <WiFi.h>
 # include <IotWebConfESP32HTTPUpdateServer.h>
+// Every sensor is read by a task of its own on the other core
+# define USE_CAPTURE_TASKS
+# include "CaptureTask.h"
 #endif
 
-std::list<Sensor*> *sensors = new std::list<Sensor*>();
+// Sensors are set up from the stored configurations, or SENSOR_CONFIGS if
+// there are none yet
+SensorConfig sensorConfigs[MAX_SENSORS];
+Sensor *sensors[MAX_SENSORS];
+uint8_t numOfSensors = 0;
+SensorConfigStore sensorConfigStore("/sensors.bin");
+SensorSettings *sensorSettings[MAX_SENSORS];
+SensorScheduler scheduler;
+#ifdef USE_CAPTURE_TASKS
+CaptureTask *captureTasks[MAX_SENSORS];
+FramePool framePool(0, FRAME_POOL_FALLBACK); // Buffers are not shared across tasks
+#else
+FramePool framePool(FRAME_POOL_SIZE_PER_SENSOR, FRAME_POOL_FALLBACK);
+#endif
 
 void wifiConnected();
 void configSaved();
+size_t copy_system_settings(char *out, size_t size);
 
 DNSServer dnsServer;
 WebServer server(80);
@@ -46,22 +67,331 @@ iotwebconf::TextParameter paramMqttTopic ("Topic", "mqttTopic", mqttConfig.topic
 
 
 boolean needReset = false;
+boolean needSensorUpdate = false;
 boolean connected = false;
+MqttConfig appliedMqttConfig;
+// Values of IotWebConf's own parameters applied at boot
+const size_t SYSTEM_SETTINGS_SIZE = 256;
+char appliedSystemSettings[SYSTEM_SETTINGS_SIZE];
+size_t appliedSystemSettingsLength = 0;
+unsigned long lastStats = 0;
+MessagePipeline<MicrosClock> pipeline(publisher, connected);
 
 
+// Listeners of the sensors
 void process_message(byte *buffer, size_t len, Sensor *sensor)
 {
-	// Parse
+	pipeline.process_message(buffer, len, sensor);
+}
+
+void process_readings(const SmlReading *readings, size_t count, Sensor *sensor)
+{
+	pipeline.process_readings(readings, count, sensor);
+}
+
+#ifdef USE_CAPTURE_TASKS
+// Listeners of the sensors, called by their tasks: the readings are copied
+// into the channel of the sensor, which has room (see CaptureTask)
+void capture_message(byte *buffer, size_t len, Sensor *sensor)
+{
+	// The loop cannot forward frames yet, raw sensors publish their values
+	if (sensor->config->publish_mode == PUBLISH_RAW)
+	{
+		len = sml_unescape(buffer, len);
+	}
+	ReadingTelegram *telegram = sensor->channel->claim();
+	telegram->clear();
+#ifdef USE_OBIS_TABLE
+	ObisFilterPair<ObisFilter, decltype(OBIS_TABLE)> filter(sensor->config->obis_filter, OBIS_TABLE);
+#else
+	const ObisFilter &filter = sensor->config->obis_filter;
+#endif
+	unsigned long started = micros();
+#ifdef USE_LIBSML_PARSER
 	sml_file *file = sml_file_parse(buffer + 8, len - 16);
+	sml_file_readings(file, filter, [telegram](const SmlReading &reading) { telegram->add(reading); });
+	telegram->valid = file->messages_len > 0;
+	sml_file_free(file);
+#else
+	telegram->valid = SmlDecoder::decode(buffer + 8, len - 16, filter, [telegram](const SmlReading &reading) {
+		telegram->add(reading);
+	});
+#endif
+	sensor->metrics.parse.observe(micros() - started);
+	sensor->channel->publish();
+}
 
-	DEBUG_SML_FILE(file);
+void capture_readings(const SmlReading *readings, size_t count, Sensor *sensor)
+{
+	ReadingTelegram *telegram = sensor->channel->claim();
+	telegram->clear();
+	for (size_t i = 0; i < count; i++)
+	{
+#ifdef USE_OBIS_TABLE
+		if (!OBIS_TABLE.accepts(readings[i].obis))
+		{
+			continue;
+		}
+#endif
+		telegram->add(readings[i]);
+	}
+	sensor->channel->publish();
+}
 
-	if (connected) {
-		publisher.publish(sensor, file);
+// Publishes what the tasks read
+void publish_telegrams()
+{
+	for (uint8_t i = 0; i < numOfSensors; i++)
+	{
+		Sensor *sensor = sensors[i];
+		for (ReadingTelegram *telegram; (telegram = sensor->channel->peek()) != NULL; sensor->channel->release())
+		{
+			if (telegram->dropped > 0)
+			{
+				DEBUG("Dropped %d readings of sensor %s that did not fit.", telegram->dropped, sensor->config->name);
+			}
+			pipeline.process_readings(telegram->readings, telegram->count, sensor, telegram->valid);
+		}
 	}
+}
+#endif
 
-	// free the malloc'd memory
-	sml_file_free(file);
+void collect_metrics(DeviceMetrics &device)
+{
+	device.uptime = millis() / 1000;
+	device.free_heap = ESP.getFreeHeap();
+#ifdef ESP32
+	device.max_free_block = ESP.getMaxAllocHeap();
+	device.fragmentation = device.free_heap > 0 ? 100 - (uint64_t)device.max_free_block * 100 / device.free_heap : 0;
+#else
+	device.max_free_block = ESP.getMaxFreeBlockSize();
+	device.fragmentation = ESP.getHeapFragmentation();
+#endif
+	publisher.getMetrics(device);
+	device.frame_pool_size = framePool.get_size();
+	device.frame_pool_peak = framePool.get_peak();
+	device.frame_max_length = framePool.get_max_length();
+	device.frame_allocations = framePool.get_allocations();
+}
+
+// Prometheus text format, sent in chunks of a small buffer
+void handle_metrics()
+{
+	DeviceMetrics device;
+	collect_metrics(device);
+	const SensorMetrics *metrics[MAX_SENSORS];
+	const char *names[MAX_SENSORS];
+	for (uint8_t i = 0; i < numOfSensors; i++)
+	{
+		metrics[i] = &sensors[i]->metrics;
+		names[i] = sensorConfigs[i].name;
+	}
+
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain; version=0.0.4", "");
+	char buffer[512];
+	PrometheusWriter writer(buffer, sizeof(buffer), [](const char *data, size_t len, void *) {
+		server.sendContent_P(data, len);
+	}, NULL);
+	write_metrics(writer, device, metrics, names, numOfSensors);
+	server.sendContent("");
+}
+
+#if EVENT_LOG_SIZE > 0
+// Events still in the log as text, oldest first
+void handle_log()
+{
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain", "");
+	uint32_t recorded = event_log().recorded();
+	uint32_t cursor = recorded > EVENT_LOG_SIZE ? recorded - EVENT_LOG_SIZE : 0;
+	uint32_t lost = 0;
+	event_log().drain(cursor, lost, EVENT_LOG_SIZE, [](const LogEvent &event) {
+		char line[EVENT_LOG_LINE + 1];
+		size_t len = render_event(event, line, sizeof(line) - 1);
+		line[len++] = '\n';
+		server.sendContent_P(line, len);
+		return true;
+	});
+	server.sendContent("");
+}
+
+#if (defined(SERIAL_DEBUG) && SERIAL_DEBUG)
+uint32_t printCursor = 0;
+uint32_t printLost = 0;
+
+// Prints recorded events as far as the transmit FIFO takes them without
+// waiting, the rest follow in later turns of the loop
+void print_events()
+{
+	event_log().drain(printCursor, printLost, EVENT_LOG_SIZE, [](const LogEvent &event) {
+		char line[EVENT_LOG_LINE + 2];
+		size_t len = render_event(event, line, sizeof(line) - 2);
+		line[len++] = '\r';
+		line[len++] = '\n';
+		if ((size_t)SERIAL_DEBUG_IMPL.availableForWrite() < len)
+		{
+			return false;
+		}
+		SERIAL_DEBUG_IMPL.write((const uint8_t *)line, len);
+		return true;
+	});
+	if (printLost > 0)
+	{
+		DEBUG("%lu events were overwritten before they were printed.", (unsigned long)printLost);
+		printLost = 0;
+	}
+}
+#endif
+#endif
+
+// Latest readings of all sensors as JSON, the snapshots are sent as they are
+void handle_readings()
+{
+	const ReadingSnapshot *snapshots[MAX_SENSORS];
+	const char *names[MAX_SENSORS];
+	for (uint8_t i = 0; i < numOfSensors; i++)
+	{
+		if (sensors[i]->snapshot != NULL)
+		{
+			// Takes the buffers on the first request
+			sensors[i]->snapshot->request();
+		}
+		snapshots[i] = sensors[i]->snapshot;
+		names[i] = sensorConfigs[i].name;
+	}
+	unsigned long now = millis();
+	size_t length = write_readings(snapshots, names, numOfSensors, now, [](const char *, size_t) {});
+
+	server.sendHeader("Cache-Control", "no-cache");
+	server.sendHeader("Access-Control-Allow-Origin", "*");
+	server.setContentLength(length);
+	server.send(200, "application/json", "");
+	write_readings(snapshots, names, numOfSensors, now, [](const char *data, size_t len) {
+		server.sendContent_P(data, len);
+	});
+}
+
+Sensor *create_sensor(uint8_t index)
+{
+	const SensorConfig *config = &sensorConfigs[index];
+#ifdef USE_CAPTURE_TASKS
+	Sensor *sensor = new Sensor(config, capture_message, capture_readings);
+	if (config->publish_mode == PUBLISH_RAW)
+	{
+		DEBUG("Sensor %s is read by a task and publishes its values instead of raw messages.", config->name);
+	}
+#else
+	Sensor *sensor = new Sensor(config, process_message, process_readings, &framePool);
+#endif
+	if (config->publish_mode == PUBLISH_RAW && (config->protocol != PROTOCOL_SML || config->streaming))
+	{
+		DEBUG("Sensor %s does not keep its messages and publishes its values instead of raw messages.", config->name);
+	}
+	if (config->changes_only)
+	{
+		sensor->change_filter = new ChangeFilter(DEADBAND_CONFIGS, NUM_OF_DEADBANDS, config->heartbeat);
+	}
+	if (config->offline_queue > 0)
+	{
+		SpillFile *spill = NULL;
+		if (OFFLINE_SPILL_SIZE > 0)
+		{
+			char path[16];
+			snprintf(path, sizeof(path), "/queue%u.bin", index);
+			spill = new SpillFile(path);
+		}
+		sensor->queue = new ReadingQueue(config->offline_queue, spill, OFFLINE_SPILL_SIZE);
+	}
+	if (config->aggregation > 0)
+	{
+		sensor->aggregator = new Aggregator(config->aggregation);
+	}
+	if (READINGS_SNAPSHOT_SIZE > 0)
+	{
+		sensor->snapshot = new ReadingSnapshot(READINGS_SNAPSHOT_SIZE);
+	}
+#ifdef USE_CAPTURE_TASKS
+	captureTasks[index] = new CaptureTask(sensor);
+	if (!captureTasks[index]->start())
+	{
+		DEBUG("Unable to start the task of sensor %s.", config->name);
+	}
+#endif
+	return sensor;
+}
+
+void remove_sensor(uint8_t index)
+{
+#ifdef USE_CAPTURE_TASKS
+	captureTasks[index]->stop();
+	delete captureTasks[index];
+#endif
+	delete sensors[index];
+}
+
+// The loop reads the sensors itself unless they have tasks of their own
+void schedule_sensors()
+{
+#ifdef USE_CAPTURE_TASKS
+	scheduler.set_sensors(sensors, 0);
+#else
+	scheduler.set_sensors(sensors, numOfSensors);
+#endif
+}
+
+// Applies the sensor settings of the web interface: only sensors whose
+// configuration changed are set up again, the others keep running
+void update_sensors()
+{
+	SensorConfig configs[MAX_SENSORS];
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < MAX_SENSORS; i++)
+	{
+		// Settings not in the form are kept, new sensors get the defaults
+		memcpy(&configs[count], i < numOfSensors ? &sensorConfigs[i] : &SENSOR_CONFIGS[0], sizeof(SensorConfig));
+		if (sensorSettings[i]->apply(configs[count]))
+		{
+			count++;
+		}
+	}
+	if (count == numOfSensors && memcmp(configs, sensorConfigs, count * sizeof(SensorConfig)) == 0)
+	{
+		return;
+	}
+	if (!sensorConfigStore.save(configs, count))
+	{
+		DEBUG("Unable to store the sensor configuration.");
+	}
+
+	// All of the old ones go first, so that no two sensors share a pin
+	bool changed[MAX_SENSORS];
+	for (uint8_t i = 0; i < MAX_SENSORS; i++)
+	{
+		changed[i] = i >= count || i >= numOfSensors ||
+					 memcmp(&configs[i], &sensorConfigs[i], sizeof(SensorConfig)) != 0;
+		if (i < numOfSensors && changed[i])
+		{
+			DEBUG("Removing sensor %s.", sensorConfigs[i].name);
+			remove_sensor(i);
+		}
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (changed[i])
+		{
+			memcpy(&sensorConfigs[i], &configs[i], sizeof(SensorConfig));
+			sensors[i] = create_sensor(i);
+		}
+	}
+	numOfSensors = count;
+	schedule_sensors();
+	publisher.sensorsChanged();
+	for (uint8_t i = 0; i < MAX_SENSORS; i++)
+	{
+		sensorSettings[i]->show(i < numOfSensors ? &sensorConfigs[i] : NULL);
+	}
+	DEBUG("Sensors updated, %d configured.", numOfSensors);
 }
 
 void setup()
@@ -77,13 +407,22 @@ void setup()
 
 
 	// Setup reading heads
-	DEBUG("Setting up %d configured sensors...", NUM_OF_SENSORS);
-	const SensorConfig *config  = SENSOR_CONFIGS;
-	for (uint8_t i = 0; i < NUM_OF_SENSORS; i++, config++)
+	if (!LittleFS.begin())
+	{
+		DEBUG("Unable to mount LittleFS, using the default sensors and keeping offline queues in RAM only.");
+	}
+	numOfSensors = sensorConfigStore.load(sensorConfigs, MAX_SENSORS);
+	if (numOfSensors == 0)
 	{
-		Sensor *sensor = new Sensor(config, process_message);
-		sensors->push_back(sensor);
+		numOfSensors = NUM_OF_SENSORS < MAX_SENSORS ? NUM_OF_SENSORS : MAX_SENSORS;
+		memcpy(sensorConfigs, SENSOR_CONFIGS, numOfSensors * sizeof(SensorConfig));
 	}
+	DEBUG("Setting up %d configured sensors...", numOfSensors);
+	for (uint8_t i = 0; i < numOfSensors; i++)
+	{
+		sensors[i] = create_sensor(i);
+	}
+	schedule_sensors();
 	DEBUG("Sensor setup done.");
 
 	// Initialize publisher
@@ -95,6 +434,11 @@ void setup()
 	paramgMqtt.addItem(&paramMqttUsername);
 	paramgMqtt.addItem(&paramMqttPassword);
 	iotWebConf.addParameterGroup(&paramgMqtt);
+	for (uint8_t i = 0; i < MAX_SENSORS; i++)
+	{
+		sensorSettings[i] = new SensorSettings(i);
+		iotWebConf.addParameterGroup(sensorSettings[i]->get_group());
+	}
 
 	iotWebConf.setConfigSavedCallback(&configSaved);
 	iotWebConf.setWifiConnectionCallback(&wifiConnected);
@@ -123,8 +467,20 @@ void setup()
 		// Setup MQTT publisher
 		publisher.setup(mqttConfig);
 	}
+	appliedMqttConfig = mqttConfig;
+	appliedSystemSettingsLength = copy_system_settings(appliedSystemSettings, sizeof(appliedSystemSettings));
+	// The stored sensors take precedence over what the form last held
+	for (uint8_t i = 0; i < MAX_SENSORS; i++)
+	{
+		sensorSettings[i]->show(i < numOfSensors ? &sensorConfigs[i] : NULL);
+	}
 
 	server.on("/", [] { iotWebConf.handleConfig(); });
+	server.on("/metrics", handle_metrics);
+	server.on("/api/readings", handle_readings);
+#if EVENT_LOG_SIZE > 0
+	server.on("/log", handle_log);
+#endif
 	server.onNotFound([]() { iotWebConf.handleNotFound(); });
 
 	DEBUG("Setup done.");
@@ -132,10 +488,13 @@ void setup()
 
 void loop()
 {
+	// Receive buffers are emptied before and after every slow step
+	scheduler.capture();
+
 	// Publisher
 	if (connected) {
 		publisher.loop();
-		yield();
+		scheduler.capture();
 	}
 
 	if (needReset)
@@ -146,18 +505,74 @@ void loop()
 		ESP.restart();
 	}
 
-	// Execute sensor state machines
-	for (std::list<Sensor*>::iterator it = sensors->begin(); it != sensors->end(); ++it){
-		(*it)->loop();
+	if (needSensorUpdate)
+	{
+		needSensorUpdate = false;
+		update_sensors();
 	}
+
+	// Complete messages are decoded and published once all sensors were read
+	scheduler.process();
+#ifdef USE_CAPTURE_TASKS
+	publish_telegrams();
+#endif
+	if (connected) {
+		for (uint8_t i = 0; i < numOfSensors; i++)
+		{
+			publisher.drain(sensors[i]);
+			publisher.summarize(sensors[i]);
+			scheduler.capture();
+		}
+	}
+
+	if (connected && STATS_INTERVAL > 0 && millis() - lastStats >= STATS_INTERVAL * 1000UL)
+	{
+		lastStats = millis();
+		DeviceMetrics device;
+		collect_metrics(device);
+		publisher.publishStats(device, sensors, numOfSensors);
+		scheduler.capture();
+	}
+#if EVENT_LOG_SIZE > 0
+	if (connected && EVENT_LOG_MQTT)
+	{
+		publisher.publishEvents();
+	}
+#endif
+#if EVENT_LOG_SIZE > 0 && (defined(SERIAL_DEBUG) && SERIAL_DEBUG)
+	print_events();
+#endif
 	iotWebConf.doLoop();
 	yield();
 }
 
+// Copies the thing name, the AP password, the WiFi credentials and the AP
+// timeout into [out], they are only applied on boot
+size_t copy_system_settings(char *out, size_t size)
+{
+	iotwebconf::Parameter *parameters[] = {
+		iotWebConf.getThingNameParameter(), iotWebConf.getApPasswordParameter(), iotWebConf.getWifiSsidParameter(),
+		iotWebConf.getWifiPasswordParameter(), iotWebConf.getApTimeoutParameter()};
+	size_t len = 0;
+	for (iotwebconf::Parameter *parameter : parameters)
+	{
+		size_t n = parameter->getLength();
+		n = n < size - len ? n : size - len;
+		memcpy(out + len, parameter->valueBuffer, n);
+		len += n;
+	}
+	return len;
+}
+
 void configSaved()
 {
 	DEBUG("Configuration was updated.");
-	needReset = true;
+	// Sensors are updated in place, any other change needs a restart
+	needSensorUpdate = true;
+	char systemSettings[SYSTEM_SETTINGS_SIZE];
+	size_t len = copy_system_settings(systemSettings, sizeof(systemSettings));
+	needReset = memcmp(&appliedMqttConfig, &mqttConfig, sizeof(MqttConfig)) != 0 ||
+				len != appliedSystemSettingsLength || memcmp(appliedSystemSettings, systemSettings, len) != 0;
 }
 
 void wifiConnected()
@@ -0,0 +1,164 @@
+/**
+ * Compares publishing a sampled telegram per interval with aggregating all
+ * telegrams per window on a synthetic day of a meter sending every second:
+ * what reaches the broker, which power peaks survive and whether the energy
+ * deltas add up. Also measures adding a reading to the aggregator.
+ */
+#include "harness.h"
+#include "Aggregator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const uint8_t ENERGY[OBIS_LENGTH] = {1, 0, 1, 8, 0, 255};  // 0.1 Wh
+    const uint8_t POWER[OBIS_LENGTH] = {1, 0, 16, 7, 0, 255};  // W
+    const uint8_t PHASES[3][OBIS_LENGTH] = {{1, 0, 36, 7, 0, 255}, {1, 0, 56, 7, 0, 255}, {1, 0, 76, 7, 0, 255}};
+    const uint32_t SECONDS = 86400;
+
+    struct Telegram
+    {
+        int64_t energy;
+        int64_t power;
+    };
+
+    SmlReading reading(const uint8_t *obis, int64_t value, int8_t scaler, uint8_t unit, uint32_t time)
+    {
+        SmlReading r;
+        memset(&r, 0, sizeof(r));
+        r.obis = obis;
+        r.type = SML_READING_INTEGER;
+        r.value = value;
+        r.scaler = scaler;
+        r.unit = unit;
+        r.time = time;
+        return r;
+    }
+
+    // A base load with a kettle or similar switched on for a few seconds now
+    // and then
+    void make_day(std::vector<Telegram> &telegrams)
+    {
+        uint32_t seed = 7;
+        int64_t energy = 35462459; // 0.1 Wh
+        int64_t remainder = 0;
+        for (uint32_t t = 0; t < SECONDS; t++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            int64_t power = 250 + (seed >> 16) % 100;
+            if (t % 431 < 4)
+            {
+                power += 2000 + (int64_t)((seed >> 8) % 1000);
+            }
+            // W for one second in 0.1 Wh, without losing the fractions
+            remainder += power * 10;
+            energy += remainder / 3600;
+            remainder %= 3600;
+            Telegram telegram = {energy, power};
+            telegrams.push_back(telegram);
+        }
+    }
+
+    void add_telegram(Aggregator &aggregator, const Telegram &telegram, uint32_t t)
+    {
+        aggregator.add(reading(ENERGY, telegram.energy, -1, 30, t));
+        aggregator.add(reading(POWER, telegram.power, 0, 27, t));
+        for (uint8_t p = 0; p < 3; p++)
+        {
+            aggregator.add(reading(PHASES[p], telegram.power / 3, 0, 27, t));
+        }
+        aggregator.end_telegram(t * 1000UL);
+    }
+}
+
+int aggregate_main(int argc, char **argv)
+{
+    uint16_t window = 60;
+    if (argc == 3 && strcmp(argv[1], "--window") == 0)
+    {
+        window = (uint16_t)atol(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: aggregate [--window SECONDS]\n");
+        return 2;
+    }
+    if (window == 0)
+    {
+        fprintf(stderr, "The window has to be at least a second.\n");
+        return 2;
+    }
+
+    std::vector<Telegram> telegrams;
+    make_day(telegrams);
+    int64_t peak = 0, power_sum = 0;
+    for (size_t t = 0; t < telegrams.size(); t++)
+    {
+        peak = telegrams[t].power > peak ? telegrams[t].power : peak;
+        power_sum += telegrams[t].power;
+    }
+
+    // Sampling as with the interval: the first telegram after it elapsed
+    unsigned long sampled = 0;
+    int64_t sampled_peak = 0;
+    for (uint32_t t = 0; t < SECONDS; t += window)
+    {
+        sampled++;
+        sampled_peak = telegrams[t].power > sampled_peak ? telegrams[t].power : sampled_peak;
+    }
+
+    // Aggregating, with the summaries checked against the telegrams
+    Aggregator aggregator(window);
+    unsigned long summaries = 0;
+    size_t summary_bytes = 0;
+    int64_t aggregated_peak = 0, delta_sum = 0, weighted_mean = 0;
+    uint64_t started = harness::wall_ns();
+    for (uint32_t t = 0; t < SECONDS; t++)
+    {
+        add_telegram(aggregator, telegrams[t], t);
+        if (aggregator.due((t + 1) * 1000UL) || t + 1 == SECONDS)
+        {
+            for (uint8_t i = 0; i < aggregator.size(); i++)
+            {
+                const Aggregate &aggregate = aggregator.get(i);
+                char entry[192];
+                summary_bytes += format_aggregate(aggregate, aggregate.unit == 30 ? "Wh" : "W", entry, sizeof(entry));
+                if (memcmp(aggregate.obis, POWER, OBIS_LENGTH) == 0)
+                {
+                    aggregated_peak = aggregate.max > aggregated_peak ? aggregate.max : aggregated_peak;
+                    weighted_mean += aggregate.sum;
+                }
+                else if (aggregate.is_counter())
+                {
+                    delta_sum += aggregate.last - aggregate.first;
+                }
+            }
+            summaries++;
+            aggregator.reset();
+        }
+    }
+    double add_ns = (harness::wall_ns() - started) / (double)(SECONDS * 5);
+
+    int64_t energy_delta = telegrams.back().energy - telegrams.front().energy;
+    // The first telegram is the start of the very first delta
+    bool ok = aggregated_peak == peak && delta_sum == energy_delta && weighted_mean == power_sum;
+
+    printf("One day of telegrams every second (5 values each), windows of %u s\n\n", window);
+    printf("  %-30s %12s %12s %14s\n", "", "telegrams", "messages", "peak power");
+    printf("  %-30s %12u %12lu %12lld W\n", "every telegram", SECONDS, (unsigned long)SECONDS * 5, (long long)peak);
+    printf("  %-30s %12lu %12lu %12lld W\n", "sampled (interval)", sampled, sampled * 5, (long long)sampled_peak);
+    printf("  %-30s %12u %12lu %12lld W\n", "aggregated (one summary)", SECONDS, summaries,
+           (long long)aggregated_peak);
+    printf("\n  summaries      %zu bytes of entries, %.0f per window\n", summary_bytes,
+           summary_bytes / (double)summaries);
+    printf("  energy         %lld of %lld (0.1 Wh) accounted for by the deltas\n", (long long)delta_sum,
+           (long long)energy_delta);
+    printf("  mean power     %.2f W over the day\n", power_sum / (double)SECONDS);
+    printf("  add            %.1f ns per reading\n", add_ns);
+    printf("  memory         %zu bytes per sensor (%u OBIS codes)\n", sizeof(Aggregator), AGGREGATOR_SIZE);
+    printf("\n  %s\n", ok ? "Summaries keep every peak, the whole energy and the mean."
+                          : "MISMATCH between the summaries and the telegrams!");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/**
+ * Benchmarks getting SML frames from the receive buffer: the former
+ * byte-by-byte reading with a yield() after every byte against the chunked
+ * reads of Sensor, from both the SoftwareSerial and the UART stand-in, and
+ * checks all of them find the same frames.
+ */
+#include "harness.h"
+#include "Sensor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const int8_t SOFTWARE_PIN = D2;
+    const int8_t UART_PIN = D7;
+
+    struct Result
+    {
+        unsigned long frames = 0;
+        uint32_t hash = 2166136261u; // FNV-1a over all frames
+        unsigned long overflows = 0;
+        double ns_per_byte = 0;
+        double yields_per_frame = 0;
+
+        void add_frame(const byte *buffer, size_t len)
+        {
+            this->frames++;
+            for (size_t i = 0; i < len; i++)
+            {
+                this->hash = (this->hash ^ buffer[i]) * 16777619u;
+            }
+        }
+    };
+
+    Result *current = NULL;
+
+    void on_frame(byte *buffer, size_t len, Sensor *)
+    {
+        current->add_frame(buffer, len);
+    }
+
+    // Sensor as it was, polling the serial byte by byte with a yield()
+    // after every byte (framing as it is now, so frames can be compared)
+    class PerByteReader
+    {
+    public:
+        PerByteReader(SoftwareSerial &serial, Result &result) : serial(serial), result(result) {}
+
+        void loop()
+        {
+            switch (this->state)
+            {
+            case WAIT_FOR_START_SEQUENCE:
+                while (this->serial.available())
+                {
+                    byte b = this->serial.read();
+                    yield();
+                    this->start_matcher.scan(&b, 1);
+                    if (this->start_matcher.found())
+                    {
+                        memcpy(this->buffer, START_SEQUENCE, sizeof(START_SEQUENCE));
+                        this->position = sizeof(START_SEQUENCE);
+                        this->scanner.reset();
+                        this->state = READ_MESSAGE;
+                        return;
+                    }
+                }
+                break;
+            case READ_MESSAGE:
+                while (this->serial.available())
+                {
+                    if ((this->position + 3) == BUFFER_SIZE)
+                    {
+                        this->reset();
+                        return;
+                    }
+                    byte b = this->serial.read();
+                    this->buffer[this->position++] = b;
+                    yield();
+                    SmlScanResult result;
+                    this->scanner.scan(&b, 1, result);
+                    if (result == SML_SCAN_END)
+                    {
+                        this->bytes_until_checksum = 3;
+                        this->state = READ_CHECKSUM;
+                        return;
+                    }
+                    if (result != SML_SCAN_MORE)
+                    {
+                        this->reset();
+                        if (result == SML_SCAN_RESTART)
+                        {
+                            this->start_matcher.reset(SML_START_LENGTH);
+                        }
+                        return;
+                    }
+                }
+                break;
+            case READ_CHECKSUM:
+                while (this->bytes_until_checksum > 0 && this->serial.available())
+                {
+                    this->buffer[this->position++] = this->serial.read();
+                    this->bytes_until_checksum--;
+                    yield();
+                }
+                if (this->bytes_until_checksum == 0)
+                {
+                    if (sml_crc16_check(this->buffer, this->position))
+                    {
+                        this->result.add_frame(this->buffer, sml_unescape(this->buffer, this->position));
+                    }
+                    this->reset();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        size_t available()
+        {
+            return this->serial.available();
+        }
+
+    private:
+        SoftwareSerial &serial;
+        Result &result;
+        byte buffer[BUFFER_SIZE];
+        size_t position = 0;
+        uint8_t bytes_until_checksum = 0;
+        State state = WAIT_FOR_START_SEQUENCE;
+        SmlStartMatcher start_matcher;
+        SmlEscapeScanner scanner;
+
+        void reset()
+        {
+            this->position = 0;
+            this->start_matcher.reset();
+            this->state = WAIT_FOR_START_SEQUENCE;
+        }
+    };
+
+    // Hands the data over in pieces of [chunk] bytes and keeps the reader
+    // looping until it took everything, like the device loop would
+    template <typename Reader, typename Input>
+    void run(Reader &reader, Input &input, const std::vector<uint8_t> &data, size_t chunk, Result &result)
+    {
+        unsigned long yields = harness::yields();
+        uint64_t started = harness::wall_ns();
+        for (size_t offset = 0; offset < data.size();)
+        {
+            size_t n = std::min(chunk, data.size() - offset);
+            input.inject(&data[offset], n);
+            offset += n;
+            do
+            {
+                reader.loop();
+            } while (reader.available() > 0);
+        }
+        // Let the reader process the last frame
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            reader.loop();
+        }
+        result.ns_per_byte = (harness::wall_ns() - started) / (double)data.size();
+        result.yields_per_frame = result.frames > 0 ? (harness::yields() - yields) / (double)result.frames : 0;
+        result.overflows = input.overflows;
+    }
+
+    void print(const char *label, const Result &result, const Result &baseline)
+    {
+        printf("  %-22s %8.2f ns/byte %8.1f yields/frame %8lu frames %6lu lost bytes", label, result.ns_per_byte,
+               result.yields_per_frame, result.frames, result.overflows);
+        if (&result != &baseline)
+        {
+            printf("  (%.1fx)", baseline.ns_per_byte / result.ns_per_byte);
+        }
+        printf("\n");
+    }
+}
+
+int capture_main(int argc, char **argv)
+{
+    unsigned long repeat = 100;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: capture [--repeat N] <capture.bin>...\n");
+            return 2;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || repeat == 0)
+    {
+        fprintf(stderr, "Usage: capture [--repeat N] <capture.bin>...\n");
+        return 2;
+    }
+
+    bool same = true;
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        std::vector<uint8_t> capture;
+        if (!harness::read_file(files[f], capture) || capture.empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", files[f]);
+            return 1;
+        }
+        std::vector<uint8_t> data;
+        data.reserve(capture.size() * repeat);
+        for (unsigned long r = 0; r < repeat; r++)
+        {
+            data.insert(data.end(), capture.begin(), capture.end());
+        }
+
+        // Every reader gets as much at once as the software serial buffer holds
+        const size_t chunk = SoftwareSerial::BUFFER_CAPACITY;
+        Result per_byte, software, hardware;
+        {
+            SoftwareSerial serial;
+            serial.begin(9600, SWSERIAL_8N1, SOFTWARE_PIN, -1, false);
+            PerByteReader reader(serial, per_byte);
+            run(reader, serial, data, chunk, per_byte);
+        }
+        {
+            SensorConfig config = harness::make_config(SOFTWARE_PIN, "bench");
+            Sensor sensor(&config, on_frame);
+            current = &software;
+            run(sensor, *SoftwareSerial::find(SOFTWARE_PIN), data, chunk, software);
+        }
+        {
+            SensorConfig config = harness::make_config(UART_PIN, "bench");
+            config.capture = CAPTURE_HARDWARE_SERIAL;
+            Sensor sensor(&config, on_frame);
+            current = &hardware;
+            Serial.overflows = 0;
+            run(sensor, Serial, data, chunk, hardware);
+        }
+
+        printf("%s: %zu bytes (%lu rounds)\n\n", harness::basename(files[f]).c_str(), data.size(), repeat);
+        print("per byte", per_byte, per_byte);
+        print("chunked SoftwareSerial", software, per_byte);
+        print("chunked UART", hardware, per_byte);
+        bool match = software.frames == per_byte.frames && software.hash == per_byte.hash &&
+                     hardware.frames == per_byte.frames && hardware.hash == per_byte.hash;
+        printf("\n  %s\n\n", match ? "All readers find the same frames." : "MISMATCH between the readers!");
+        same = same && match;
+    }
+    return same ? 0 : 1;
+}
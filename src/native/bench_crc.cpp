@@ -0,0 +1,103 @@
+/**
+ * Benchmarks the table driven SML CRC16 kernel against a bitwise
+ * reference implementation and checks that both agree.
+ */
+#include "harness.h"
+#include "SmlCrc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    uint16_t crc16_bitwise(uint16_t crc, const uint8_t *buffer, size_t len)
+    {
+        while (len--)
+        {
+            crc ^= *buffer++;
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+            }
+        }
+        return crc;
+    }
+
+    uint16_t crc16_table(uint16_t crc, const uint8_t *buffer, size_t len)
+    {
+        return sml_crc16_update(crc, buffer, len);
+    }
+
+    typedef uint16_t (*Kernel)(uint16_t crc, const uint8_t *buffer, size_t len);
+
+    // Runs the kernel over frame sized chunks, like the sensor does
+    double run(Kernel kernel, const std::vector<uint8_t> &data, size_t frame, unsigned rounds, uint16_t &result)
+    {
+        uint64_t started = harness::wall_ns();
+        uint16_t sum = 0;
+        for (unsigned r = 0; r < rounds; r++)
+        {
+            for (size_t offset = 0; offset < data.size(); offset += frame)
+            {
+                size_t n = std::min(frame, data.size() - offset);
+                sum ^= sml_crc16_final(kernel(SML_CRC16_INIT, &data[offset], n));
+            }
+        }
+        result = sum;
+        return (harness::wall_ns() - started) / (double)(data.size() * rounds);
+    }
+}
+
+int crc_main(int argc, char **argv)
+{
+    size_t size = 16 * 1024 * 1024;
+    size_t frame = 400;
+    unsigned rounds = 4;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            size = (size_t)atol(argv[++i]) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc)
+        {
+            frame = (size_t)atol(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: crc [--size MiB] [--frame bytes]\n");
+            return 2;
+        }
+    }
+    if (size == 0 || frame == 0)
+    {
+        return 2;
+    }
+
+    // CRC-16/X.25 check value
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    uint16_t expected = 0x906E;
+    bool ok = sml_crc16_final(crc16_bitwise(SML_CRC16_INIT, check, sizeof(check))) == expected &&
+              sml_crc16_final(crc16_table(SML_CRC16_INIT, check, sizeof(check))) == expected;
+
+    std::vector<uint8_t> data(size);
+    srand(4711);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)rand();
+    }
+
+    uint16_t bitwise_result, table_result;
+    double bitwise_ns = run(crc16_bitwise, data, frame, rounds, bitwise_result);
+    double table_ns = run(crc16_table, data, frame, rounds, table_result);
+    ok = ok && bitwise_result == table_result;
+
+    printf("CRC16 over %zu MiB in %zu byte frames\n\n", size / 1024 / 1024, frame);
+    printf("  %-10s %8.3f ns/byte %10.1f MiB/s\n", "bitwise", bitwise_ns, 1e9 / bitwise_ns / 1024 / 1024);
+    printf("  %-10s %8.3f ns/byte %10.1f MiB/s  (%.1fx)\n", "table", table_ns, 1e9 / table_ns / 1024 / 1024,
+           bitwise_ns / table_ns);
+    printf("\n  %s\n", ok ? "Kernels agree, check value 0x906E matches." : "MISMATCH between kernels!");
+    return ok ? 0 : 1;
+}
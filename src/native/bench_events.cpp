@@ -0,0 +1,254 @@
+/**
+ * Compares recording events in the event log with formatting the debug
+ * messages they replace, counts what a sensor records per message of a
+ * capture and what printing that on a 115200 baud console costs, and
+ * stresses the log with threads recording while another one drains it:
+ * every event has to arrive whole and in order, or be counted as lost.
+ */
+#include "harness.h"
+#include "EventLog.h"
+#include "Sensor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const int8_t PIN = D2;
+    const double CONSOLE_BYTES_PER_SECOND = 115200 / 10.0; // 8N1
+    const size_t CONSOLE_FIFO = 128;                       // Taken without waiting
+
+    // Checks what is rendered for a known event
+    bool renders()
+    {
+        LogEvent event;
+        event.index = 0;
+        event.time = 12345678;
+        event.subject = "meter";
+        event.id = EVENT_MESSAGE_READ;
+        event.value = 412;
+        char line[EVENT_LOG_LINE];
+        size_t len = render_event(event, line, sizeof(line));
+        const char *expected = "[   12.345678] meter: message of 412 bytes read";
+        printf("  %s\n", line);
+        return len == strlen(expected) && strcmp(line, expected) == 0;
+    }
+
+    double record_ns(unsigned long count)
+    {
+        EventRing<64> *ring = new EventRing<64>();
+        uint64_t started = harness::wall_ns();
+        for (unsigned long i = 0; i < count; i++)
+        {
+            ring->record(EVENT_MESSAGE_READ, "meter", (uint32_t)i);
+        }
+        double ns = (double)(harness::wall_ns() - started) / count;
+        delete ring;
+        return ns;
+    }
+
+    // What DEBUG did with the same event before the characters go out
+    double format_ns(unsigned long count, FILE *out)
+    {
+        char line[128];
+        uint64_t started = harness::wall_ns();
+        for (unsigned long i = 0; i < count; i++)
+        {
+            int len = snprintf(line, sizeof(line), "State of sensor %s is '%s'.\n", "meter", "READ_MESSAGE");
+            fwrite(line, 1, (size_t)len, out);
+        }
+        return (double)(harness::wall_ns() - started) / count;
+    }
+
+    struct Capture
+    {
+        unsigned long messages = 0;
+        unsigned long events = 0;
+        unsigned long bytes = 0;   // Rendered
+        unsigned long unusual = 0; // Not routine, published with EVENT_LOG_MQTT
+    };
+
+    void count_message(byte *, size_t, Sensor *)
+    {
+    }
+
+    // Events a sensor records while it reads [data], rendered as they
+    // would be printed
+    void capture(const std::vector<uint8_t> &data, Capture &result)
+    {
+        SensorConfig config = harness::make_config(PIN, "meter");
+        Sensor sensor(&config, count_message);
+        uint32_t cursor = event_log().recorded();
+        uint32_t lost = 0;
+        SoftwareSerial *serial = SoftwareSerial::find(PIN);
+        for (size_t offset = 0; offset < data.size() || serial->available() > 0 || sensor.ready();)
+        {
+            size_t n = std::min(data.size() - offset, serial->space());
+            serial->inject(&data[offset], n);
+            offset += n;
+            sensor.loop();
+            event_log().drain(cursor, lost, EVENT_LOG_SIZE, [&result](const LogEvent &event) {
+                char line[EVENT_LOG_LINE];
+                result.events++;
+                result.unusual += event_is_routine(event.id) ? 0 : 1;
+                result.bytes += render_event(event, line, sizeof(line)) + 2;
+                return true;
+            });
+        }
+        result.messages = sensor.metrics.frames_completed;
+        result.events += lost;
+    }
+
+    struct Writer
+    {
+        const char *name;
+        unsigned long recorded = 0;
+        unsigned long seen = 0;
+        uint32_t last = 0;
+    };
+
+    // [threads] record [count] events each into a small ring, one more
+    // thread drains it
+    bool threaded(int threads, unsigned long count, unsigned long &drained, unsigned long &lost_events, double &seconds)
+    {
+        static const char *const NAMES[] = {"one", "two", "three", "four"};
+        EventRing<64> *ring = new EventRing<64>();
+        std::vector<Writer> writers(threads);
+        std::atomic<int> running(threads);
+        bool ok = true;
+        uint64_t started = harness::wall_us();
+        std::thread reader([ring, &writers, &running, &ok, &drained, &lost_events]() {
+            uint32_t cursor = 0;
+            uint32_t lost = 0;
+            for (;;)
+            {
+                bool last = running == 0;
+                size_t n = ring->drain(cursor, lost, 64, [&writers, &ok](const LogEvent &event) {
+                    // The value carries the writer and its count of events
+                    size_t w = event.value >> 24;
+                    uint32_t n = event.value & 0xFFFFFF;
+                    if (w >= writers.size() || event.subject != writers[w].name || event.id != EVENT_MESSAGE_READ ||
+                        (writers[w].seen > 0 && n <= writers[w].last))
+                    {
+                        ok = false;
+                        return true;
+                    }
+                    writers[w].seen++;
+                    writers[w].last = n;
+                    return true;
+                });
+                drained += n;
+                if (last && cursor == ring->recorded())
+                {
+                    break;
+                }
+                if (n == 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            lost_events = lost;
+        });
+        std::vector<std::thread> recorders;
+        for (int t = 0; t < threads; t++)
+        {
+            writers[t].name = NAMES[t];
+            recorders.push_back(std::thread([ring, &writers, &running, t, count]() {
+                for (unsigned long i = 1; i <= count; i++)
+                {
+                    ring->record(EVENT_MESSAGE_READ, writers[t].name, (uint32_t)t << 24 | (uint32_t)i);
+                    if (i % 32 == 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                writers[t].recorded = count;
+                running--;
+            }));
+        }
+        for (size_t t = 0; t < recorders.size(); t++)
+        {
+            recorders[t].join();
+        }
+        reader.join();
+        seconds = (harness::wall_us() - started) / 1e6;
+        delete ring;
+        return ok && drained + lost_events == (unsigned long)threads * count;
+    }
+}
+
+int events_main(int argc, char **argv)
+{
+    unsigned long count = 5000000;
+    const char *path = "doc/samples/captures/ed300l.bin";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: events [--count N] [capture.bin]\n");
+            return 2;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    std::vector<uint8_t> data;
+    if (count == 0 || !harness::read_file(path, data) || data.empty())
+    {
+        fprintf(stderr, "Usage: events [--count N] [capture.bin]\n");
+        return 2;
+    }
+
+    bool ok = renders();
+    printf("  %s\n\n", ok ? "rendered as expected" : "RENDERED WRONG");
+
+    FILE *null = fopen("/dev/null", "w");
+    if (null == NULL)
+    {
+        perror("/dev/null");
+        return 1;
+    }
+    double recorded = record_ns(count);
+    double formatted = format_ns(count / 10, null);
+    fclose(null);
+    printf("Per event, %lu of them\n\n", count);
+    printf("  %-34s %8.1f ns\n", "recorded into the ring", recorded);
+    printf("  %-34s %8.1f ns  %.0fx\n", "formatted and written (no UART)", formatted, formatted / recorded);
+
+    Capture result;
+    capture(data, result);
+    if (result.messages == 0)
+    {
+        fprintf(stderr, "%s: no messages\n", path);
+        return 1;
+    }
+    double bytes = (double)result.bytes / result.messages;
+    double blocked = bytes > CONSOLE_FIFO ? (bytes - CONSOLE_FIFO) / CONSOLE_BYTES_PER_SECOND * 1e6 : 0;
+    printf("\n%s: %lu messages, per message\n\n", harness::basename(path).c_str(), result.messages);
+    printf("  %-34s %8.1f\n", "events", (double)result.events / result.messages);
+    printf("  %-34s %8.2f\n", "not routine (published to MQTT)", (double)result.unusual / result.messages);
+    printf("  %-34s %8.1f\n", "bytes as printed", bytes);
+    printf("  %-34s %8.0f us\n", "waiting for a 115200 baud console", blocked);
+    printf("  %-34s %8.2f us\n", "recording instead", recorded * result.events / result.messages / 1000);
+
+    printf("\nThreads recording into 64 slots while one drains them\n\n");
+    for (int threads = 1; threads <= 3; threads++)
+    {
+        unsigned long drained = 0, lost = 0;
+        double seconds;
+        bool same = threaded(threads, count / 10, drained, lost, seconds);
+        printf("  %d threads %10lu drained %10lu lost  %.2f s  %s\n", threads, drained, lost, seconds,
+               same ? "whole and in order" : "TORN OR MISSING");
+        ok = ok && same;
+    }
+
+    printf("\n%s\n", ok ? "Events recorded, drained and rendered correctly" : "The event log lost or tore events");
+    return ok ? 0 : 1;
+}
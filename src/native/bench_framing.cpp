@@ -0,0 +1,231 @@
+/**
+ * Benchmarks finding SML frames in a multi-megabyte stream: the former
+ * byte-by-byte start and end sequence matching against the escape-aware
+ * automaton with memchr skipping (SmlFraming.h). Frames are taken from
+ * memory and the time spent checking the frames found is left out, so only
+ * the framing is measured.
+ */
+#include "harness.h"
+#include "SmlCrc.h"
+#include "SmlDecoder.h"
+#include "SmlFraming.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const uint8_t START_SEQUENCE[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
+    const uint8_t END_SEQUENCE[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x1A};
+    const size_t FRAME_SIZE = 3840;
+
+    struct Result
+    {
+        unsigned long frames = 0;
+        unsigned long crc_errors = 0;
+        unsigned long undecodable = 0;
+        double ns_per_byte = 0;
+        uint64_t checking_ns = 0; // Not part of the framing
+    };
+
+    void check(uint8_t *frame, size_t len, bool unescape, Result &result)
+    {
+        if (!sml_crc16_check(frame, len))
+        {
+            result.crc_errors++;
+            return;
+        }
+        if (unescape)
+        {
+            len = sml_unescape(frame, len);
+        }
+        result.frames++;
+        size_t readings = 0;
+        if (!SmlDecoder::decode(frame + 8, len - 16, [&readings](const SmlReading &) { readings++; }) ||
+            readings == 0)
+        {
+            result.undecodable++;
+        }
+    }
+
+    void complete(uint8_t *frame, size_t len, bool unescape, Result &result)
+    {
+        uint64_t started = harness::wall_ns();
+        check(frame, len, unescape, result);
+        result.checking_ns += harness::wall_ns() - started;
+    }
+
+    // The matching as it was: the start sequence restarts from scratch on
+    // every mismatch, the end sequence is compared after every byte and
+    // escaped payload is taken as it is
+    void scan_bytewise(const std::vector<uint8_t> &data, uint8_t *frame, Result &result)
+    {
+        size_t position = 0;
+        bool in_message = false;
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            if (!in_message)
+            {
+                frame[position] = data[i];
+                position = (frame[position] == START_SEQUENCE[position]) ? position + 1 : 0;
+                in_message = position == sizeof(START_SEQUENCE);
+                continue;
+            }
+            if (position + 3 == FRAME_SIZE)
+            {
+                position = 0;
+                in_message = false;
+                continue;
+            }
+            frame[position++] = data[i];
+            int last = sizeof(END_SEQUENCE) - 1;
+            for (int k = 0; k <= last; k++)
+            {
+                if (END_SEQUENCE[last - k] != frame[position - (k + 1)])
+                {
+                    break;
+                }
+                if (k == last)
+                {
+                    size_t n = std::min<size_t>(3, data.size() - i - 1);
+                    memcpy(frame + position, &data[i + 1], n);
+                    i += n;
+                    complete(frame, position + n, false, result);
+                    position = 0;
+                    in_message = false;
+                }
+            }
+        }
+    }
+
+    // As the sensor does it, on chunks of [chunk] bytes
+    void scan_automaton(const std::vector<uint8_t> &data, size_t chunk, uint8_t *frame, Result &result)
+    {
+        SmlStartMatcher start_matcher;
+        SmlEscapeScanner scanner;
+        size_t position = 0;
+        bool in_message = false;
+        for (size_t offset = 0; offset < data.size();)
+        {
+            size_t end = std::min(offset + chunk, data.size());
+            while (offset < end)
+            {
+                const uint8_t *p = &data[offset];
+                if (!in_message)
+                {
+                    offset += start_matcher.scan(p, end - offset);
+                    if (start_matcher.found())
+                    {
+                        memcpy(frame, START_SEQUENCE, sizeof(START_SEQUENCE));
+                        position = sizeof(START_SEQUENCE);
+                        start_matcher.reset();
+                        scanner.reset();
+                        in_message = true;
+                    }
+                    continue;
+                }
+                size_t space = FRAME_SIZE - 3 - position;
+                if (space == 0)
+                {
+                    in_message = false;
+                    continue;
+                }
+                SmlScanResult status;
+                size_t n = scanner.scan(p, std::min(end - offset, space), status);
+                memcpy(frame + position, p, n);
+                position += n;
+                offset += n;
+                if (status == SML_SCAN_END)
+                {
+                    size_t tail = std::min<size_t>(3, data.size() - offset);
+                    memcpy(frame + position, &data[offset], tail);
+                    offset += tail;
+                    end = std::max(end, offset);
+                    complete(frame, position + tail, true, result);
+                    in_message = false;
+                }
+                else if (status != SML_SCAN_MORE)
+                {
+                    in_message = false;
+                    start_matcher.reset(status == SML_SCAN_RESTART ? SML_START_LENGTH : 0);
+                }
+            }
+        }
+    }
+
+    void print(const char *label, const Result &result, const Result &baseline)
+    {
+        printf("  %-18s %7.2f ns/byte %8.1f MB/s %8lu frames %6lu crc errors %6lu undecodable", label,
+               result.ns_per_byte, 1000.0 / result.ns_per_byte, result.frames, result.crc_errors,
+               result.undecodable);
+        if (&result != &baseline)
+        {
+            printf("  (%.1fx)", baseline.ns_per_byte / result.ns_per_byte);
+        }
+        printf("\n");
+    }
+}
+
+int frames_main(int argc, char **argv)
+{
+    size_t megabytes = 16;
+    size_t chunk = 64;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            megabytes = (size_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc)
+        {
+            chunk = (size_t)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            files.clear();
+            break;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || megabytes == 0 || chunk == 0)
+    {
+        fprintf(stderr, "Usage: frames [--size MB] [--chunk N] <capture.bin>...\n");
+        return 2;
+    }
+
+    std::vector<uint8_t> frame(FRAME_SIZE);
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        std::vector<uint8_t> capture;
+        if (!harness::read_file(files[f], capture) || capture.empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", files[f]);
+            return 1;
+        }
+        std::vector<uint8_t> data;
+        data.reserve(megabytes << 20);
+        while (data.size() + capture.size() <= megabytes << 20)
+        {
+            data.insert(data.end(), capture.begin(), capture.end());
+        }
+
+        Result bytewise, automaton;
+        uint64_t started = harness::wall_ns();
+        scan_bytewise(data, &frame[0], bytewise);
+        bytewise.ns_per_byte = (harness::wall_ns() - started - bytewise.checking_ns) / (double)data.size();
+        started = harness::wall_ns();
+        scan_automaton(data, chunk, &frame[0], automaton);
+        automaton.ns_per_byte = (harness::wall_ns() - started - automaton.checking_ns) / (double)data.size();
+
+        printf("%s: %.1f MB\n\n", harness::basename(files[f]).c_str(), data.size() / 1048576.0);
+        print("byte by byte", bytewise, bytewise);
+        print("automaton", automaton, bytewise);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * Measures what the metrics cost: recording a frame (counters and two
+ * histogram observations) and rendering the Prometheus page and the stats
+ * documents for up to MAX_SENSORS sensors through the small buffer the web
+ * server uses. Checks that the page is well formed and allocates nothing.
+ */
+#include "harness.h"
+#include "Metrics.h"
+#include "SensorConfigStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const size_t JSON_BUFFER_SIZE = 1024; // As in MqttPublisher.h, which is part of the replay only
+
+    struct Page
+    {
+        std::string text;
+        unsigned long flushes = 0;
+    };
+
+    void collect(const char *data, size_t len, void *context)
+    {
+        Page *page = (Page *)context;
+        page->text.append(data, len);
+        page->flushes++;
+    }
+
+    void discard(const char *, size_t, void *)
+    {
+    }
+
+    // Every sample line is "name[{labels}] value", buckets are cumulative
+    // and end with the count
+    bool well_formed(const std::string &text)
+    {
+        size_t start = 0;
+        unsigned long last_bucket = 0;
+        while (start < text.size())
+        {
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos)
+            {
+                return false;
+            }
+            std::string line = text.substr(start, end - start);
+            start = end + 1;
+            if (line.compare(0, 2, "# ") == 0)
+            {
+                continue;
+            }
+            size_t space = line.rfind(' ');
+            if (space == std::string::npos || space + 1 == line.size() ||
+                line.find_first_not_of("0123456789.", space + 1) != std::string::npos)
+            {
+                return false;
+            }
+            unsigned long value = strtoul(line.c_str() + space + 1, NULL, 10);
+            if (line.find("_bucket{") != std::string::npos)
+            {
+                bool first = line.find("le=\"0.00025\"") != std::string::npos;
+                if (!first && value < last_bucket)
+                {
+                    return false;
+                }
+                last_bucket = value;
+            }
+            else if (line.find("_count{") != std::string::npos && value != last_bucket)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int metrics_main(int argc, char **)
+{
+    unsigned long rounds = 1000;
+    if (argc > 1)
+    {
+        fprintf(stderr, "Usage: metrics\n");
+        return 2;
+    }
+
+    // Durations spread over all buckets
+    std::vector<uint32_t> durations(1 << 16);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < durations.size(); i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        durations[i] = (seed >> 8) % 2000000;
+    }
+    SensorMetrics metrics[MAX_SENSORS];
+    memset(metrics, 0, sizeof(metrics));
+    uint64_t started = harness::wall_ns();
+    for (unsigned long r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < durations.size(); i++)
+        {
+            SensorMetrics &m = metrics[i % MAX_SENSORS];
+            m.frames_started++;
+            m.frames_completed++;
+            m.bytes_read += 400;
+            m.frame_to_publish.observe(durations[i]);
+            m.parse.observe(durations[i] >> 4);
+        }
+    }
+    double record_ns = (harness::wall_ns() - started) / (double)(rounds * durations.size());
+    printf("Recording a frame (4 counters, 2 histograms): %.1f ns\n\n", record_ns);
+
+    bool ok = true;
+    const char *names[MAX_SENSORS] = {"1", "2", "3", "mains", "heat \"pump\"", "pv"};
+    const SensorMetrics *pointers[MAX_SENSORS];
+    for (uint8_t i = 0; i < MAX_SENSORS; i++)
+    {
+        pointers[i] = &metrics[i];
+    }
+    DeviceMetrics device;
+    memset(&device, 0, sizeof(device));
+    device.uptime = 86400;
+
+    printf("  %-8s %10s %8s %14s %12s %16s\n", "sensors", "page", "chunks", "render", "allocations", "stats document");
+    for (uint8_t count = 1; count <= MAX_SENSORS; count++)
+    {
+        char buffer[512];
+        Page page;
+        PrometheusWriter writer(buffer, sizeof(buffer), collect, &page);
+        write_metrics(writer, device, pointers, names, count);
+        ok = ok && well_formed(page.text);
+
+        PrometheusWriter timed(buffer, sizeof(buffer), discard, NULL);
+        unsigned long allocations = harness::heap_allocations();
+        started = harness::wall_ns();
+        for (unsigned long r = 0; r < rounds; r++)
+        {
+            write_metrics(timed, device, pointers, names, count);
+        }
+        double render_us = (harness::wall_ns() - started) / 1000.0 / rounds;
+        allocations = harness::heap_allocations() - allocations;
+        ok = ok && allocations == 0;
+
+        char json[JSON_BUFFER_SIZE];
+        size_t stats = write_stats_json(json, sizeof(json), metrics[count - 1]);
+        ok = ok && stats > 0;
+        printf("  %-8u %8zu B %8lu %11.1f us %12lu %14zu B\n", count, page.text.size(), page.flushes, render_us,
+               allocations, stats);
+    }
+
+    printf("\n  %s\n", ok ? "Pages are well formed and rendered without allocations."
+                          : "MALFORMED page, allocations or stats not fitting!");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/**
+ * Benchmarks decoding telegrams of which only a few OBIS codes are wanted:
+ * decoding and formatting every entry and dropping the unwanted ones
+ * afterwards, as it used to be done, against skipping them in the decoder
+ * with the per sensor ObisFilter and with a constexpr ObisTable. Checks that
+ * all of them hand over the same readings.
+ */
+#include "harness.h"
+#include "ObisFilter.h"
+#include "SmlCrc.h"
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+#include "SmlFraming.h"
+#include "SmlStreamDecoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    // 1-0:1.8.0, 1-0:2.8.0 and 1-0:16.7.0
+    constexpr uint64_t TABLE_CODES[] = {obis_code(1, 0, 1, 8, 0, 255), obis_code(1, 0, 2, 8, 0, 255),
+                                        obis_code(1, 0, 16, 7, 0, 255)};
+    static_assert(obis_table_sorted(TABLE_CODES, 3), "TABLE_CODES has to be sorted");
+    constexpr ObisTable<3> TABLE(TABLE_CODES);
+    const char *CODES = "1.8.0, 2.8.0, 16.7.0";
+    volatile char sink; // Keeps the formatting of dropped readings from being optimized away
+
+    struct Result
+    {
+        unsigned long readings = 0;
+        uint32_t hash = 2166136261u; // FNV-1a over the formatted readings
+        double ns_per_frame = 0;
+    };
+
+    // What the publisher does with a reading: format its topic and value
+    void consume(const SmlReading &reading, Result &result)
+    {
+        char text[64];
+        size_t len = sml_format_obis(reading.obis, '/', text, sizeof(text));
+        if (reading.is_numeric())
+        {
+            len += sml_format_value(reading, text + len, sizeof(text) - len);
+        }
+        else if (reading.type == SML_READING_OCTET_STRING)
+        {
+            len += sml_octets_to_hex(reading.octets, reading.octets_len, text + len, sizeof(text) - len);
+        }
+        result.readings++;
+        for (size_t i = 0; i < len; i++)
+        {
+            result.hash = (result.hash ^ (uint8_t)text[i]) * 16777619u;
+        }
+    }
+
+    template <typename Decode>
+    void run(const std::vector<std::vector<uint8_t> > &frames, unsigned long rounds, Result &result, Decode decode)
+    {
+        uint64_t started = harness::wall_ns();
+        for (unsigned long r = 0; r < rounds; r++)
+        {
+            for (size_t f = 0; f < frames.size(); f++)
+            {
+                decode(&frames[f][0], frames[f].size());
+            }
+        }
+        result.ns_per_frame = (harness::wall_ns() - started) / (double)(rounds * frames.size());
+    }
+
+    void print(const char *label, const Result &result, const Result &baseline)
+    {
+        printf("  %-24s %8.1f ns/frame %8lu readings", label, result.ns_per_frame, result.readings);
+        if (&result != &baseline)
+        {
+            printf("  (%.1fx)", baseline.ns_per_frame / result.ns_per_frame);
+        }
+        printf("\n");
+    }
+}
+
+int obis_main(int argc, char **argv)
+{
+    unsigned long rounds = 2000;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+        {
+            rounds = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            files.clear();
+            break;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || rounds == 0)
+    {
+        fprintf(stderr, "Usage: obis [--rounds N] <capture.bin>...\n");
+        return 2;
+    }
+
+    ObisFilter filter = {OBIS_FILTER_ALLOW, 0, {}};
+    filter.parse(CODES);
+    bool same = true;
+    printf("Wanted OBIS codes: %s\n\n", CODES);
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        std::vector<uint8_t> capture;
+        if (!harness::read_file(files[f], capture) || capture.empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", files[f]);
+            return 1;
+        }
+        std::vector<std::vector<uint8_t> > frames;
+        harness::collect_frames(capture, frames);
+        if (frames.empty())
+        {
+            fprintf(stderr, "No valid frames in '%s'.\n", files[f]);
+            return 1;
+        }
+
+        Result everything, runtime, table, stream_everything, streamed;
+        run(frames, rounds, everything, [&everything, &filter](const uint8_t *frame, size_t len) {
+            SmlDecoder::decode(frame + 8, len - 16, [&everything, &filter](const SmlReading &reading) {
+                // Formatted for publishing and dropped after all
+                char value[128] = "";
+                if (reading.type == SML_READING_OCTET_STRING)
+                {
+                    sml_octets_to_hex(reading.octets, reading.octets_len, value, sizeof(value));
+                }
+                else if (reading.is_numeric())
+                {
+                    sml_format_value(reading, value, sizeof(value));
+                }
+                sink = value[0];
+                if (filter.accepts(reading.obis))
+                {
+                    consume(reading, everything);
+                }
+            });
+        });
+        run(frames, rounds, runtime, [&runtime, &filter](const uint8_t *frame, size_t len) {
+            SmlDecoder::decode(frame + 8, len - 16, filter,
+                               [&runtime](const SmlReading &reading) { consume(reading, runtime); });
+        });
+        run(frames, rounds, table, [&table](const uint8_t *frame, size_t len) {
+            SmlDecoder::decode(frame + 8, len - 16, TABLE,
+                               [&table](const SmlReading &reading) { consume(reading, table); });
+        });
+        // Streaming sensors, fed byte by byte
+        SmlStreamDecoder decoder;
+        run(frames, rounds, stream_everything, [&stream_everything, &decoder, &filter](const uint8_t *frame, size_t len) {
+            decoder.reset();
+            for (size_t i = 8; i < len - 8; i++)
+            {
+                decoder.feed(frame[i]);
+            }
+            for (uint8_t i = 0; i < decoder.get_count(); i++)
+            {
+                if (filter.accepts(decoder.get_readings()[i].obis))
+                {
+                    consume(decoder.get_readings()[i], stream_everything);
+                }
+            }
+        });
+        decoder.set_filter(&filter);
+        run(frames, rounds, streamed, [&streamed, &decoder](const uint8_t *frame, size_t len) {
+            decoder.reset();
+            for (size_t i = 8; i < len - 8; i++)
+            {
+                decoder.feed(frame[i]);
+            }
+            for (uint8_t i = 0; i < decoder.get_count(); i++)
+            {
+                consume(decoder.get_readings()[i], streamed);
+            }
+        });
+
+        printf("%s: %zu frames (%lu rounds)\n\n", harness::basename(files[f]).c_str(), frames.size(), rounds);
+        print("decode all, then drop", everything, everything);
+        print("ObisFilter", runtime, everything);
+        print("constexpr ObisTable", table, everything);
+        print("streaming, then drop", stream_everything, stream_everything);
+        print("streaming ObisFilter", streamed, stream_everything);
+        bool match = runtime.readings == everything.readings && runtime.hash == everything.hash &&
+                     table.readings == everything.readings && table.hash == everything.hash &&
+                     stream_everything.hash == everything.hash && streamed.readings == everything.readings &&
+                     streamed.hash == everything.hash;
+        printf("\n  %s\n\n", match ? "All of them hand over the same readings." : "MISMATCH between the filters!");
+        same = same && match;
+    }
+    return same ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+/**
+ * Checks the telegram decoders on the captures of doc/samples/captures/protocols:
+ * SML as hexadecimal text has to give the same readings as the binary
+ * telegrams it was made of, D0 telegrams have to give the expected
+ * readings, and the mode A and C readouts are run against a simulated
+ * meter answering requests. Also measures decoding and checks that it
+ * allocates nothing and does not depend on how the bytes are chunked.
+ */
+#include "harness.h"
+#include "D0Decoder.h"
+#include "SmlFormat.h"
+#include "SmlFrameDecoder.h"
+#include "SmlTextDecoder.h"
+#include "unit.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Run
+    {
+        unsigned long events[TELEGRAM_ABORTED + 1] = {};
+        uint32_t hash = 2166136261u;
+        std::vector<std::string> first; // Readings of the first complete telegram
+        unsigned long allocations = 0;
+        double ns_per_byte = 0;
+    };
+
+    void hash_bytes(uint32_t &hash, const void *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+        }
+    }
+
+    // As published: 1-0:1.8.0*255=12345.6 Wh
+    std::string format(const SmlReading &reading)
+    {
+        char obis[24];
+        char value[48];
+        sml_format_obis(reading.obis, '*', obis, sizeof(obis));
+        if (reading.is_numeric())
+        {
+            sml_format_value(reading, value, sizeof(value));
+        }
+        else
+        {
+            snprintf(value, sizeof(value), "%.*s", (int)reading.octets_len, (const char *)reading.octets);
+        }
+        std::string text = std::string(obis) + "=" + value;
+        if (reading.unit != 0)
+        {
+            text += std::string(" ") + dlms_get_unit(reading.unit);
+        }
+        return text;
+    }
+
+    void record(Run &run, TelegramEvent event, const TelegramDecoder &decoder)
+    {
+        run.events[event]++;
+        if (event != TELEGRAM_COMPLETE)
+        {
+            return;
+        }
+        for (uint8_t i = 0; i < decoder.get_count(); i++)
+        {
+            const SmlReading &r = decoder.get_readings()[i];
+            hash_bytes(run.hash, r.obis, OBIS_LENGTH);
+            hash_bytes(run.hash, &r.type, sizeof(r.type));
+            hash_bytes(run.hash, &r.value, sizeof(r.value));
+            hash_bytes(run.hash, &r.scaler, sizeof(r.scaler));
+            hash_bytes(run.hash, &r.unit, sizeof(r.unit));
+            hash_bytes(run.hash, r.octets, r.type == SML_READING_OCTET_STRING ? r.octets_len : 0);
+            if (run.events[TELEGRAM_COMPLETE] == 1)
+            {
+                run.first.push_back(format(r));
+            }
+        }
+    }
+
+    // Feeds [data] in pieces of [chunk] bytes, as the sensor does, and
+    // records the telegrams in [run] unless it is NULL
+    void feed(TelegramDecoder &decoder, const std::vector<uint8_t> &data, size_t chunk, Run *run)
+    {
+        decoder.reset();
+        for (size_t offset = 0; offset < data.size();)
+        {
+            size_t end = offset + chunk < data.size() ? offset + chunk : data.size();
+            while (offset < end)
+            {
+                TelegramEvent event;
+                offset += decoder.feed(&data[offset], end - offset, event);
+                if (event != TELEGRAM_NONE && run != NULL)
+                {
+                    record(*run, event, decoder);
+                }
+            }
+        }
+    }
+
+    Run decode(TelegramDecoder &decoder, const std::vector<uint8_t> &data, size_t chunk, unsigned long rounds)
+    {
+        Run run;
+        feed(decoder, data, chunk, &run);
+        unsigned long allocations = harness::heap_allocations();
+        uint64_t started = harness::wall_ns();
+        for (unsigned long r = 0; r < rounds; r++)
+        {
+            feed(decoder, data, chunk, NULL);
+        }
+        run.ns_per_byte = (harness::wall_ns() - started) / (double)(rounds * data.size());
+        run.allocations = harness::heap_allocations() - allocations;
+        return run;
+    }
+
+    bool same(const Run &a, const Run &b)
+    {
+        return memcmp(a.events, b.events, sizeof(a.events)) == 0 && a.hash == b.hash && a.first == b.first;
+    }
+
+    bool contains(const Run &run, const char *reading)
+    {
+        for (size_t i = 0; i < run.first.size(); i++)
+        {
+            if (run.first[i] == reading)
+            {
+                return true;
+            }
+        }
+        printf("    missing %s\n", reading);
+        return false;
+    }
+
+    void print(const char *label, const Run &run, bool timed)
+    {
+        printf("  %-26s %6lu %6lu %6lu %6lu", label, run.events[TELEGRAM_COMPLETE], run.events[TELEGRAM_CHECKSUM_ERROR],
+               run.events[TELEGRAM_ABORTED], run.events[TELEGRAM_UNDECODABLE] + run.events[TELEGRAM_OVERFLOW]);
+        if (timed)
+        {
+            printf(" %8.2f ns/byte %6lu allocations", run.ns_per_byte, run.allocations);
+        }
+        printf("\n");
+    }
+
+    // Answers requests with the readouts of a capture: the identification
+    // at 300 baud, the data block in mode C only after the acknowledgement
+    // and at the speed it offered
+    class Meter : public TelegramLink
+    {
+    public:
+        explicit Meter(const std::vector<uint8_t> &capture)
+        {
+            size_t start = 0;
+            for (size_t i = 1; i <= capture.size(); i++)
+            {
+                if (i == capture.size() || capture[i] == '/')
+                {
+                    this->readouts.push_back(std::vector<uint8_t>(capture.begin() + start, capture.begin() + i));
+                    start = i;
+                }
+            }
+        }
+
+        void set_line(uint32_t baud, LineFormat format)
+        {
+            this->baud = baud;
+            this->format = format;
+            if (this->acknowledged && baud == 9600)
+            {
+                this->send_data();
+            }
+        }
+
+        // One byte per call like a software serial, lines are answered once
+        // they are complete
+        size_t send(const uint8_t *data, size_t len)
+        {
+            if (len == 0)
+            {
+                return 0;
+            }
+            this->line.push_back((char)data[0]);
+            if (data[0] != '\n')
+            {
+                return 1;
+            }
+            std::string sent;
+            sent.swap(this->line);
+            if (sent == "/?!\r\n" && this->baud == 300 && this->format == LINE_7E1 && this->next < this->readouts.size())
+            {
+                this->requests++;
+                const std::vector<uint8_t> &readout = this->readouts[this->next];
+                this->identification_len = std::find(readout.begin(), readout.end(), '\n') - readout.begin() + 1;
+                this->pending.insert(this->pending.end(), readout.begin(), readout.begin() + this->identification_len);
+                if (!this->mode_c)
+                {
+                    this->send_data();
+                }
+            }
+            else if (sent == std::string("\x06" "050\r\n") && this->baud == 300)
+            {
+                this->acknowledged = true;
+            }
+            else
+            {
+                this->unexpected++;
+            }
+            return 1;
+        }
+
+        void send_data()
+        {
+            const std::vector<uint8_t> &readout = this->readouts[this->next++];
+            this->pending.insert(this->pending.end(), readout.begin() + this->identification_len, readout.end());
+            this->acknowledged = false;
+        }
+
+        bool mode_c = false;
+        uint32_t baud = 0;
+        LineFormat format = LINE_8N1;
+        std::vector<std::vector<uint8_t> > readouts;
+        size_t next = 0;
+        std::vector<uint8_t> pending;
+        unsigned long requests = 0;
+        unsigned long unexpected = 0;
+
+    private:
+        bool acknowledged = false;
+        size_t identification_len = 0;
+        std::string line; // Sent so far
+    };
+
+    // Runs the exchange in steps of 10 ms until every readout was asked for
+    Run read_out(Protocol protocol, Meter &meter)
+    {
+        D0Decoder decoder(protocol);
+        meter.mode_c = protocol == PROTOCOL_D0_MODE_C;
+        decoder.begin(meter);
+        Run run;
+        for (unsigned long now = 0; now < 600000; now += 10)
+        {
+            decoder.poll(meter, now);
+            // A few bytes per step, as they would trickle in
+            size_t n = meter.pending.size() < 12 ? meter.pending.size() : 12;
+            for (size_t offset = 0; offset < n;)
+            {
+                TelegramEvent event;
+                offset += decoder.feed(&meter.pending[offset], n - offset, event);
+                if (event != TELEGRAM_NONE)
+                {
+                    record(run, event, decoder);
+                }
+            }
+            meter.pending.erase(meter.pending.begin(), meter.pending.begin() + n);
+            if (meter.next == meter.readouts.size() && meter.pending.empty())
+            {
+                decoder.poll(meter, now + 10);
+                break;
+            }
+        }
+        return run;
+    }
+}
+
+int protocols_main(int argc, char **argv)
+{
+    unsigned long rounds = 200;
+    std::string directory = "doc/samples/captures";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+        {
+            rounds = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            rounds = 0;
+            break;
+        }
+        else
+        {
+            directory = argv[i];
+        }
+    }
+    if (rounds == 0)
+    {
+        fprintf(stderr, "Usage: protocols [--rounds N] [captures directory]\n");
+        return 2;
+    }
+    const char *names[] = {"ed300l_corrupt.bin", "protocols/ed300l_text.txt", "protocols/q3d_d0.txt",
+                           "protocols/mt174_mode_c.txt"};
+    std::vector<uint8_t> captures[4];
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        std::string path = directory + "/" + names[i];
+        if (!harness::read_file(path.c_str(), captures[i]) || captures[i].empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", path.c_str());
+            return 1;
+        }
+    }
+    bool ok = true;
+    printf("  %-26s %6s %6s %6s %6s\n", "", "valid", "crc", "broken", "other");
+
+    // SML as text against the binary telegrams it was made of
+    SmlFrameDecoder binary_decoder;
+    SmlTextDecoder text_decoder;
+    Run binary = decode(binary_decoder, captures[0], 64, rounds);
+    Run text = decode(text_decoder, captures[1], 64, rounds);
+    Run text_bytes = decode(text_decoder, captures[1], 1, 1);
+    print("SML binary", binary, true);
+    print("SML text", text, true);
+    ok = ok && same(binary, text) && same(text, text_bytes) && binary.events[TELEGRAM_COMPLETE] == 12 &&
+         binary.events[TELEGRAM_CHECKSUM_ERROR] == 4;
+
+    // D0 sent by the meter, one telegram broken off by the next
+    D0Decoder push_decoder(PROTOCOL_D0);
+    Run push = decode(push_decoder, captures[2], 64, rounds);
+    Run push_bytes = decode(push_decoder, captures[2], 1, 1);
+    print("D0 (sent by the meter)", push, true);
+    ok = ok && same(push, push_bytes) && push.events[TELEGRAM_COMPLETE] == 15 && push.events[TELEGRAM_ABORTED] == 1 &&
+         contains(push, "1-0:1.8.0*255=12345678.9012 Wh") && contains(push, "1-0:2.8.0*255=0.0000 Wh") &&
+         contains(push, "1-0:21.7.255*255=123.45 W") && contains(push, "1-0:1.7.255*255=248.02 W") &&
+         contains(push, "1-0:96.5.5*255=82") && contains(push, "0-0:96.1.255*255=1ESY1160123456");
+
+    // Readouts, one of them with a wrong BCC
+    Run readouts[2];
+    Protocol modes[2] = {PROTOCOL_D0_MODE_A, PROTOCOL_D0_MODE_C};
+    for (uint8_t m = 0; m < 2; m++)
+    {
+        Meter meter(captures[3]);
+        readouts[m] = read_out(modes[m], meter);
+        print(m == 0 ? "D0 mode A (300 baud)" : "D0 mode C (300/9600 baud)", readouts[m], false);
+        printf("    %lu requests, %lu unexpected, line left at %u baud\n", meter.requests, meter.unexpected, meter.baud);
+        ok = ok && meter.requests == 8 && meter.unexpected == 0 && meter.baud == 300 &&
+             readouts[m].events[TELEGRAM_COMPLETE] == 7 && readouts[m].events[TELEGRAM_CHECKSUM_ERROR] == 1 &&
+             contains(readouts[m], "1-0:1.8.0*255=12345678 Wh") && contains(readouts[m], "1-0:2.8.0*255=123456 Wh") &&
+             contains(readouts[m], "0-0:96.1.0*255=12345678") && contains(readouts[m], "0-0:97.97.0*255=0");
+    }
+    ok = ok && binary.allocations == 0 && text.allocations == 0 && push.allocations == 0;
+
+    printf("\n  %s\n", ok ? "All protocols give the expected readings, in any chunks and without allocations."
+                          : "MISMATCH in the readings, events or exchanges!");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/**
+ * Benchmarks building the MQTT topic and payload of a single reading: the
+ * former String/sprintf/pow path against the fixed buffer and integer
+ * formatting MqttPublisher uses now, and checks both produce the same.
+ */
+#include "harness.h"
+#include "Arduino.h"
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const char *BASE_TOPIC = "iot/smartmeter/";
+    const char *SENSOR_NAME = "1";
+
+    struct Entry
+    {
+        uint8_t obis[OBIS_LENGTH];
+        SmlReading reading;
+    };
+
+    // What the publisher hands to the MQTT client
+    struct Sink
+    {
+        unsigned long bytes = 0;
+        std::string last_topic;
+        std::string last_payload;
+        bool record = false;
+
+        void publish(const char *topic, const char *payload)
+        {
+            this->bytes += strlen(topic) + strlen(payload);
+            if (this->record)
+            {
+                this->last_topic = topic;
+                this->last_payload = payload;
+            }
+        }
+    };
+
+    // The publish path as it was: String topics, sprintf and pow
+    void publish_legacy(Sink &sink, const String &baseTopic, const SmlReading &reading)
+    {
+        const uint8_t *obis = reading.obis;
+        char obisIdentifier[32];
+        char buffer[255];
+
+        sprintf(obisIdentifier, "%d-%d:%d.%d.%d/%d",
+                obis[0], obis[1], obis[2], obis[3], obis[4], obis[5]);
+
+        String entryTopic = baseTopic + "sensor/" + SENSOR_NAME + "/obis/" + obisIdentifier + "/";
+
+        double value = reading.to_double();
+        int scaler = reading.scaler;
+        int prec = -scaler;
+        if (prec < 0)
+            prec = 0;
+        value = value * pow(10, scaler);
+        sprintf(buffer, "%.*f", prec, value);
+        String topic = entryTopic + "value";
+        sink.publish(topic.c_str(), buffer);
+    }
+
+    // The current path, with the sensor prefix built once
+    void publish_fixed(Sink &sink, char *topic, size_t prefix, size_t size, const SmlReading &reading)
+    {
+        static const char OBIS_TOPIC[] = "obis/";
+        static const char VALUE_TOPIC[] = "/value";
+        char *end = topic + prefix;
+        memcpy(end, OBIS_TOPIC, sizeof(OBIS_TOPIC) - 1);
+        end += sizeof(OBIS_TOPIC) - 1;
+        size_t len = sml_format_obis(reading.obis, '/', end, topic + size - end - (sizeof(VALUE_TOPIC) - 1));
+        memcpy(end + len, VALUE_TOPIC, sizeof(VALUE_TOPIC));
+
+        char buffer[255];
+        sml_format_value(reading, buffer, sizeof(buffer));
+        sink.publish(topic, buffer);
+    }
+
+    // Typical OBIS codes with random values and scalers
+    std::vector<Entry> make_entries(size_t count)
+    {
+        static const uint8_t CODES[][OBIS_LENGTH] = {
+            {1, 0, 1, 8, 0, 255}, {1, 0, 2, 8, 0, 255}, {1, 0, 1, 8, 1, 255}, {1, 0, 1, 8, 2, 255},
+            {1, 0, 16, 7, 0, 255}, {1, 0, 36, 7, 0, 255}, {1, 0, 56, 7, 0, 255}, {1, 0, 76, 7, 0, 255}};
+        std::vector<Entry> entries(count);
+        srand(4711);
+        for (size_t i = 0; i < count; i++)
+        {
+            Entry &e = entries[i];
+            memcpy(e.obis, CODES[i % (sizeof(CODES) / sizeof(CODES[0]))], OBIS_LENGTH);
+            SmlReading &r = e.reading;
+            r.obis = e.obis;
+            r.unit = 30;
+            r.octets = NULL;
+            r.octets_len = 0;
+            r.time = 0;
+            r.scaler = (int8_t)(rand() % 7 - 4);
+            // Small enough for the scaled double to still be exact
+            int64_t value = ((int64_t)rand() << 20 | (rand() & 0xFFFFF)) % ((int64_t)1 << (rand() % 41));
+            if (rand() % 2)
+            {
+                r.type = SML_READING_UNSIGNED;
+                r.value = value;
+            }
+            else
+            {
+                r.type = SML_READING_INTEGER;
+                r.value = (rand() % 3 == 0) ? -value : value;
+            }
+        }
+        return entries;
+    }
+}
+
+int publish_main(int argc, char **argv)
+{
+    size_t count = 100000;
+    unsigned rounds = 10;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc)
+        {
+            count = (size_t)atol(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: publish [--entries N]\n");
+            return 2;
+        }
+    }
+    if (count == 0)
+    {
+        return 2;
+    }
+
+    std::vector<Entry> entries = make_entries(count);
+    String baseTopic = BASE_TOPIC;
+    char topic[256];
+    size_t prefix = snprintf(topic, sizeof(topic), "%ssensor/%s/", BASE_TOPIC, SENSOR_NAME);
+
+    // Both paths have to publish exactly the same
+    Sink legacy_sink, fixed_sink;
+    legacy_sink.record = fixed_sink.record = true;
+    unsigned long mismatches = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        publish_legacy(legacy_sink, baseTopic, entries[i].reading);
+        publish_fixed(fixed_sink, topic, prefix, sizeof(topic), entries[i].reading);
+        if (legacy_sink.last_topic != fixed_sink.last_topic || legacy_sink.last_payload != fixed_sink.last_payload)
+        {
+            if (mismatches++ < 5)
+            {
+                printf("  mismatch: '%s %s' vs '%s %s'\n", legacy_sink.last_topic.c_str(),
+                       legacy_sink.last_payload.c_str(), fixed_sink.last_topic.c_str(),
+                       fixed_sink.last_payload.c_str());
+            }
+        }
+    }
+
+    Sink sink;
+    unsigned long allocations = harness::heap_allocations();
+    uint64_t started = harness::wall_ns();
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            publish_legacy(sink, baseTopic, entries[i].reading);
+        }
+    }
+    double legacy_ns = (harness::wall_ns() - started) / (double)(count * rounds);
+    double legacy_allocations = (harness::heap_allocations() - allocations) / (double)(count * rounds);
+
+    allocations = harness::heap_allocations();
+    started = harness::wall_ns();
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            publish_fixed(sink, topic, prefix, sizeof(topic), entries[i].reading);
+        }
+    }
+    double fixed_ns = (harness::wall_ns() - started) / (double)(count * rounds);
+    double fixed_allocations = (harness::heap_allocations() - allocations) / (double)(count * rounds);
+
+    printf("Topic and payload of %zu numeric readings, %u rounds\n\n", count, rounds);
+    printf("  %-22s %8.1f ns/entry %6.2f allocations/entry\n", "String/sprintf/pow", legacy_ns, legacy_allocations);
+    printf("  %-22s %8.1f ns/entry %6.2f allocations/entry  (%.1fx)\n", "fixed buffer/integer", fixed_ns,
+           fixed_allocations, legacy_ns / fixed_ns);
+    printf("\n  %s\n", mismatches == 0 ? "Both paths publish the same topics and payloads."
+                                       : "MISMATCH between the paths!");
+    return mismatches == 0 ? 0 : 1;
+}
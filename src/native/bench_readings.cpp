@@ -0,0 +1,238 @@
+/**
+ * Measures serving /api/readings from the snapshots written by the sensor
+ * path against formatting the latest message again for every request, with
+ * SmlDecoder and with libsml. Checks that both give the same document and
+ * that serving allocates nothing.
+ */
+#include "harness.h"
+#include "ReadingSnapshot.h"
+#include "SmlCrc.h"
+#include "SmlDecoder.h"
+#include "SmlFileReadings.h"
+#include "SmlFraming.h"
+#include "unit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const uint8_t START_SEQUENCE[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
+    const size_t SNAPSHOT_SIZE = 1024; // READINGS_SNAPSHOT_SIZE of config.h
+
+    struct Sink
+    {
+        size_t bytes = 0;
+        uint32_t hash = 2166136261u;
+
+        void add(const char *data, size_t len)
+        {
+            this->bytes += len;
+            for (size_t i = 0; i < len; i++)
+            {
+                this->hash = (this->hash ^ (uint8_t)data[i]) * 16777619u;
+            }
+        }
+    };
+
+    const char *unit_of(const SmlReading &reading)
+    {
+        return reading.unit ? dlms_get_unit(reading.unit) : NULL;
+    }
+
+    void write_snapshot(ReadingSnapshot &snapshot, const std::vector<uint8_t> &frame, unsigned long now)
+    {
+        snapshot.begin();
+        SmlDecoder::decode(&frame[8], frame.size() - 16,
+                           [&snapshot](const SmlReading &reading) { snapshot.add(reading, unit_of(reading)); });
+        snapshot.commit(now);
+    }
+
+    // What a request would do without the snapshots: format the latest
+    // message of every sensor, through the same writer
+    template <typename Decode>
+    size_t reformat(const std::vector<const std::vector<uint8_t> *> &latest, const char *const *names,
+                    ReadingSnapshot **scratch, Sink &sink, Decode decode)
+    {
+        for (size_t i = 0; i < latest.size(); i++)
+        {
+            scratch[i]->begin();
+            ReadingSnapshot *snapshot = scratch[i];
+            decode(*latest[i], [snapshot](const SmlReading &reading) { snapshot->add(reading, unit_of(reading)); });
+            scratch[i]->commit(0);
+        }
+        return write_readings(scratch, names, (uint8_t)latest.size(), 0,
+                              [&sink](const char *data, size_t len) { sink.add(data, len); });
+    }
+}
+
+int readings_main(int argc, char **argv)
+{
+    unsigned long rounds = 20000;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+        {
+            rounds = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            files.clear();
+            break;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || files.size() > 6 || rounds == 0)
+    {
+        fprintf(stderr, "Usage: readings [--rounds N] <capture.bin>... (one sensor each, up to 6)\n");
+        return 2;
+    }
+
+    // Every capture is a sensor
+    std::vector<std::vector<std::vector<uint8_t> > > frames(files.size());
+    std::vector<std::string> names(files.size());
+    std::vector<const char *> name_pointers;
+    std::vector<ReadingSnapshot *> snapshots, scratch;
+    size_t telegrams = 0;
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        std::vector<uint8_t> capture;
+        if (!harness::read_file(files[f], capture) || capture.empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", files[f]);
+            return 1;
+        }
+        harness::collect_frames(capture, frames[f]);
+        if (frames[f].empty())
+        {
+            fprintf(stderr, "No valid frames in '%s'.\n", files[f]);
+            return 1;
+        }
+        telegrams += frames[f].size();
+        names[f] = harness::basename(files[f]);
+        snapshots.push_back(new ReadingSnapshot(SNAPSHOT_SIZE));
+        scratch.push_back(new ReadingSnapshot(SNAPSHOT_SIZE));
+        snapshots.back()->request();
+        scratch.back()->request();
+    }
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        name_pointers.push_back(names[f].c_str());
+    }
+    uint8_t count = (uint8_t)files.size();
+
+    // Sensor path: decoding with and without writing the snapshot
+    unsigned long telegram_rounds = rounds / 100 > 0 ? rounds / 100 : 1;
+    volatile size_t decoded = 0;
+    uint64_t started = harness::wall_ns();
+    for (unsigned long r = 0; r < telegram_rounds; r++)
+    {
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            for (size_t i = 0; i < frames[f].size(); i++)
+            {
+                SmlDecoder::decode(&frames[f][i][8], frames[f][i].size() - 16,
+                                   [&decoded](const SmlReading &reading) { decoded = decoded + reading.type; });
+            }
+        }
+    }
+    double decode_ns = (harness::wall_ns() - started) / (double)(telegram_rounds * telegrams);
+    unsigned long allocations = harness::heap_allocations();
+    started = harness::wall_ns();
+    for (unsigned long r = 0; r < telegram_rounds; r++)
+    {
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            for (size_t i = 0; i < frames[f].size(); i++)
+            {
+                write_snapshot(*snapshots[f], frames[f][i], 1000);
+            }
+        }
+    }
+    double snapshot_ns = (harness::wall_ns() - started) / (double)(telegram_rounds * telegrams);
+    bool ok = harness::heap_allocations() == allocations;
+
+    // Requests
+    std::vector<const std::vector<uint8_t> *> latest;
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        latest.push_back(&frames[f].back());
+    }
+    const ReadingSnapshot *const *served = &snapshots[0];
+    Sink page, formatted, parsed;
+    size_t page_len = 0, formatted_len = 0, parsed_len = 0;
+
+    allocations = harness::heap_allocations();
+    started = harness::wall_ns();
+    for (unsigned long r = 0; r < rounds; r++)
+    {
+        page = Sink();
+        size_t length = write_readings(served, &name_pointers[0], count, 1000, [](const char *, size_t) {});
+        page_len = write_readings(served, &name_pointers[0], count, 1000,
+                                  [&page](const char *data, size_t len) { page.add(data, len); });
+        ok = ok && length == page_len;
+    }
+    double serve_us = (harness::wall_ns() - started) / 1000.0 / rounds;
+    unsigned long serve_allocations = harness::heap_allocations() - allocations;
+
+    allocations = harness::heap_allocations();
+    started = harness::wall_ns();
+    for (unsigned long r = 0; r < rounds; r++)
+    {
+        formatted = Sink();
+        formatted_len = reformat(latest, &name_pointers[0], &scratch[0], formatted,
+                                 [](const std::vector<uint8_t> &frame, std::function<void(const SmlReading &)> add) {
+                                     SmlDecoder::decode(&frame[8], frame.size() - 16, add);
+                                 });
+    }
+    double decoder_us = (harness::wall_ns() - started) / 1000.0 / rounds;
+    double decoder_allocations = (harness::heap_allocations() - allocations) / (double)rounds;
+
+    allocations = harness::heap_allocations();
+    started = harness::wall_ns();
+    for (unsigned long r = 0; r < rounds; r++)
+    {
+        parsed = Sink();
+        parsed_len = reformat(latest, &name_pointers[0], &scratch[0], parsed,
+                              [](const std::vector<uint8_t> &frame, std::function<void(const SmlReading &)> add) {
+                                  sml_file *file = sml_file_parse((unsigned char *)&frame[8], frame.size() - 16);
+                                  sml_file_readings(file, add);
+                                  sml_file_free(file);
+                              });
+    }
+    double libsml_us = (harness::wall_ns() - started) / 1000.0 / rounds;
+    double libsml_allocations = (harness::heap_allocations() - allocations) / (double)rounds;
+
+    ok = ok && serve_allocations == 0 && page.hash == formatted.hash && page_len == formatted_len &&
+         page.hash == parsed.hash && page_len == parsed_len;
+
+    printf("%u sensors, %zu telegrams (%lu rounds), /api/readings of %zu bytes\n\n", count, telegrams,
+           telegram_rounds, page_len);
+    printf("Sensor path, per telegram\n");
+    printf("  %-32s %10.2f us\n", "decode", decode_ns / 1000);
+    printf("  %-32s %10.2f us  (+%.2f us)\n", "decode into the snapshot", snapshot_ns / 1000,
+           (snapshot_ns - decode_ns) / 1000);
+    printf("\nRequest, %lu rounds\n", rounds);
+    printf("  %-32s %10.2f us %8.2f allocations\n", "served from the snapshots", serve_us,
+           serve_allocations / (double)rounds);
+    printf("  %-32s %10.2f us %8.2f allocations  (%.1fx)\n", "SmlDecoder and formatting", decoder_us, decoder_allocations,
+           decoder_us / serve_us);
+    printf("  %-32s %10.2f us %8.2f allocations  (%.1fx)\n", "sml_file_parse and formatting", libsml_us,
+           libsml_allocations, libsml_us / serve_us);
+    printf("\n  %s\n", ok ? "All requests give the same document, served without allocations."
+                          : "MISMATCH between the documents or allocations while serving!");
+
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        delete snapshots[f];
+        delete scratch[f];
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+/**
+ * Runs several sensors receiving telegrams at line rate once with the
+ * sensors run to completion one after the other (capture, decode and
+ * publish) and once through SensorScheduler, in virtual time. Publishing a
+ * telegram is given a fixed cost during which bytes keep arriving, and all
+ * but one sensor complete their telegrams at the same time while the last
+ * one is in the middle of its own. Checks that the scheduler loses no bytes.
+ *
+ * Then the telegrams follow each other without a gap, so that a sensor
+ * has to go on reading while its previous telegram waits to be published,
+ * once publishing keeps up and once it is held up for longer than a
+ * telegram takes (as while reconnecting to the broker, with capture passes
+ * going on), with either overrun policy.
+ */
+#include "harness.h"
+#include "Sensor.h"
+#include "SensorScheduler.h"
+#include "SmlDecoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const double BYTE_DURATION_US = 10 * 1000000.0 / 9600; // 8N1
+    const uint64_t LOOP_US = 1000;                          // Rest of the loop
+    const uint8_t SENSORS = 4;
+    const uint64_t HELD_UP_US = 600000; // Longer than a telegram takes
+
+    struct Line
+    {
+        SoftwareSerial *serial;
+        uint64_t phase_us; // When the telegrams start within the period
+        uint64_t sent;     // Bytes of the current period
+        uint64_t period;
+    };
+
+    std::vector<uint8_t> telegram;
+    std::vector<Line> lines;
+    uint64_t period_us = 1000000;
+    uint64_t cost_us = 30000;
+    uint64_t now_us = 0;
+    unsigned long published = 0;
+
+    // Lets time pass, bytes arrive meanwhile
+    void advance(uint64_t us)
+    {
+        now_us += us;
+        harness::set_clock_us(now_us);
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            Line &line = lines[i];
+            if (now_us < line.phase_us)
+            {
+                continue;
+            }
+            uint64_t elapsed = now_us - line.phase_us;
+            uint64_t period = elapsed / period_us;
+            while (period != line.period)
+            {
+                // Whatever was not sent of the previous telegrams goes first
+                size_t rest = telegram.size() - (size_t)line.sent;
+                line.serial->inject(&telegram[(size_t)line.sent], rest);
+                line.period++;
+                line.sent = 0;
+            }
+            uint64_t due = std::min<uint64_t>((uint64_t)((elapsed % period_us) / BYTE_DURATION_US), telegram.size());
+            if (due > line.sent)
+            {
+                line.serial->inject(&telegram[(size_t)line.sent], (size_t)(due - line.sent));
+                line.sent = due;
+            }
+        }
+    }
+
+    void on_frame(byte *buffer, size_t len, Sensor *)
+    {
+        if (SmlDecoder::decode(buffer + 8, len - 16, [](const SmlReading &) {}))
+        {
+            published++;
+        }
+        advance(cost_us);
+    }
+
+    struct Result
+    {
+        unsigned long published;
+        unsigned long crc_errors;
+        unsigned long lost;
+        unsigned long exhausted;
+        unsigned long overruns;
+        double age_ms; // Mean from the end of a telegram until it was published
+    };
+
+    // Messages are processed at most every [process_us] when scheduled
+    Result run(uint8_t count, bool scheduled, uint64_t duration_us, OverrunPolicy overrun = OVERRUN_DROP_OLDEST,
+               uint64_t process_us = 0)
+    {
+        SensorConfig configs[SENSORS];
+        Sensor *sensors[SENSORS];
+        SensorScheduler scheduler;
+        lines.clear();
+        now_us = 0;
+        published = 0;
+        harness::set_clock_us(0);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            char name[SENSOR_NAME_LENGTH];
+            snprintf(name, sizeof(name), "meter%u", i + 1);
+            configs[i] = harness::make_config(i + 1, name);
+            SensorConfig &c = configs[i];
+            c.overrun = overrun;
+            sensors[i] = new Sensor(&c, on_frame);
+            // The last one is half a telegram behind
+            Line line = {SoftwareSerial::find(c.pin), i + 1 < count || count == 1 ? 0 : period_us / 5, 0, 0};
+            lines.push_back(line);
+        }
+        scheduler.set_sensors(sensors, count);
+        uint64_t last_process = 0;
+        while (now_us < duration_us)
+        {
+            advance(LOOP_US);
+            if (scheduled)
+            {
+                scheduler.capture();
+                if (process_us == 0 || now_us - last_process >= process_us)
+                {
+                    last_process = now_us;
+                    scheduler.process();
+                }
+            }
+            else
+            {
+                // As the loop was before: every sensor in turn, to completion
+                for (uint8_t i = 0; i < count; i++)
+                {
+                    sensors[i]->loop();
+                }
+            }
+        }
+        Result result = {published, 0, 0, 0, 0, 0};
+        uint64_t age_us = 0;
+        uint32_t ages = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            result.crc_errors += sensors[i]->get_crc_errors();
+            result.lost += lines[i].serial->overflows;
+            result.exhausted += sensors[i]->metrics.budget_exhausted;
+            result.overruns += sensors[i]->metrics.overruns;
+            age_us += sensors[i]->metrics.frame_to_publish.sum_us;
+            ages += sensors[i]->metrics.frame_to_publish.count();
+            delete sensors[i];
+        }
+        result.age_ms = ages > 0 ? age_us / 1000.0 / ages : 0;
+        return result;
+    }
+}
+
+int scheduler_main(int argc, char **argv)
+{
+    const char *path = "doc/samples/captures/ed300l.bin";
+    unsigned long seconds = 60;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cost") == 0 && i + 1 < argc)
+        {
+            cost_us = (uint64_t)atol(argv[++i]) * 1000;
+        }
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            seconds = 0;
+            break;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    std::vector<uint8_t> data;
+    if (seconds == 0)
+    {
+        fprintf(stderr, "Usage: scheduler [--cost MS] [--seconds N] [capture.bin]\n");
+        return 2;
+    }
+    if (!harness::read_file(path, data) || data.size() < 16)
+    {
+        fprintf(stderr, "Unable to read capture '%s'.\n", path);
+        return 1;
+    }
+    // The first telegram, up to the next start sequence
+    SmlStartMatcher matcher;
+    size_t end = SML_START_LENGTH + matcher.scan(&data[SML_START_LENGTH], data.size() - SML_START_LENGTH);
+    telegram.assign(data.begin(), data.begin() + (matcher.found() ? end - SML_START_LENGTH : data.size()));
+
+    printf("%u byte telegram every %llu ms per sensor, the last sensor %llu ms behind the others,\n"
+           "%llu ms to publish a telegram, %lu s of line time\n\n",
+           (unsigned)telegram.size(), (unsigned long long)(period_us / 1000),
+           (unsigned long long)(period_us / 5000), (unsigned long long)(cost_us / 1000), seconds);
+    printf("  %-8s %-14s %10s %10s %10s %10s\n", "sensors", "loop", "published", "crc errors", "lost bytes",
+           "deferred");
+    bool ok = true;
+    for (uint8_t count = 1; count <= SENSORS; count++)
+    {
+        for (uint8_t scheduled = 0; scheduled < 2; scheduled++)
+        {
+            Result r = run(count, scheduled, seconds * 1000000ULL);
+            printf("  %-8u %-14s %10lu %10lu %10lu %10lu\n", count, scheduled ? "scheduled" : "to completion",
+                   r.published, r.crc_errors, r.lost, r.exhausted);
+            ok = ok && (!scheduled || (r.lost == 0 && r.published == count * seconds));
+        }
+    }
+    printf("\n  (deferred: capture turns ended by the byte budget with bytes left)\n");
+
+    // The telegrams follow each other without a gap
+    uint64_t spaced = period_us;
+    period_us = (uint64_t)(telegram.size() * BYTE_DURATION_US);
+    printf("\nTelegrams back to back, scheduled\n\n");
+    printf("  %-8s %-20s %10s %10s %10s %10s %10s\n", "sensors", "publishing", "published", "crc errors",
+           "lost bytes", "overruns", "age");
+    for (uint8_t held_up = 0; held_up < 2; held_up++)
+    {
+        for (uint8_t overrun = 0; overrun < 2; overrun++)
+        {
+            Result r = run(SENSORS, true, seconds * 1000000ULL, (OverrunPolicy)overrun, held_up ? HELD_UP_US : 0);
+            char label[32];
+            snprintf(label, sizeof(label), "%s, %s", held_up ? "every 600 ms" : "at once",
+                     overrun == OVERRUN_DROP_OLDEST ? "oldest" : "newest");
+            printf("  %-8u %-20s %10lu %10lu %10lu %10lu %7.0f ms\n", SENSORS, label, r.published, r.crc_errors,
+                   r.lost, r.overruns, r.age_ms);
+            // Every telegram gets published as long as publishing keeps up,
+            // otherwise the policy drops some but no bytes are lost
+            ok = ok && r.lost == 0 && r.crc_errors == 0 && (held_up || r.overruns == 0) &&
+                 r.published + r.overruns + SENSORS >= SENSORS * seconds * 1000000ULL / period_us;
+        }
+    }
+    printf("\n  (age: from the end of a telegram until it was published, overruns: dropped by the policy)\n");
+    period_us = spaced;
+    printf("\n%s\n", ok ? "No bytes lost with the scheduler" : "The scheduler lost bytes");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/**
+ * Measures setting up sensors from the binary configuration store against
+ * setting them up from a compile-time array, and checks that damaged or
+ * outdated blobs are rejected. Also compares the heap of sensors with a
+ * message buffer each against that of sensors sharing a frame pool.
+ */
+#include "harness.h"
+#include "Sensor.h"
+#include "SensorConfigStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const char *STORE_PATH = "/tmp/smlreader_sensors.bin";
+    const size_t POOL_SIZE = 1024; // Per sensor, as FRAME_POOL_SIZE_PER_SENSOR in config.h
+
+    void on_frame(byte *, size_t, Sensor *)
+    {
+    }
+
+    void make_configs(SensorConfig *configs, uint8_t count)
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            char name[SENSOR_NAME_LENGTH];
+            snprintf(name, sizeof(name), "meter%u", i + 1);
+            configs[i] = harness::make_config(i + 1, name);
+            SensorConfig &c = configs[i];
+            c.status_led_enabled = true;
+            c.status_led_inverted = true;
+            c.status_led_pin = LED_BUILTIN;
+            c.heartbeat = 300;
+            c.offline_queue = 64;
+            c.obis_filter.mode = OBIS_FILTER_ALLOW;
+            c.obis_filter.parse("1.8.0, 2.8.0, 16.7.0");
+        }
+    }
+
+    // Heap taken by the sensors (and the pool, if any), which are deleted again
+    size_t set_up(const SensorConfig *configs, uint8_t count, bool pooled = false)
+    {
+        size_t before = harness::heap_in_use();
+        FramePool *pool = pooled ? new FramePool(POOL_SIZE, FRAME_POOL_DROP) : NULL;
+        Sensor *sensors[MAX_SENSORS];
+        for (uint8_t i = 0; i < count; i++)
+        {
+            sensors[i] = new Sensor(&configs[i], on_frame, NULL, pool);
+        }
+        if (pool != NULL)
+        {
+            // Allocated for the first message
+            size_t length = 0;
+            pool->release(pool->borrow(length), length);
+        }
+        size_t heap = harness::heap_in_use() - before;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            delete sensors[i];
+        }
+        delete pool;
+        return heap;
+    }
+
+    // Flips a byte of the blob at [offset]
+    void damage(const std::vector<uint8_t> &blob, size_t offset)
+    {
+        std::vector<uint8_t> copy(blob);
+        copy[offset] ^= 0x01;
+        FILE *file = fopen(STORE_PATH, "wb");
+        fwrite(&copy[0], 1, copy.size(), file);
+        fclose(file);
+    }
+}
+
+int sensors_main(int argc, char **)
+{
+    unsigned long rounds = 10000;
+    if (argc > 1)
+    {
+        fprintf(stderr, "Usage: sensors\n");
+        return 2;
+    }
+
+    bool ok = true;
+    printf("Sensor setup from a compiled array and from %s, %lu rounds\n\n", STORE_PATH, rounds);
+    printf("  %-8s %10s %14s %14s %12s %12s\n", "sensors", "blob size", "load", "allocations", "sensor heap",
+           "with pool");
+    for (uint8_t count = 1; count <= MAX_SENSORS; count++)
+    {
+        SensorConfig compiled[MAX_SENSORS];
+        make_configs(compiled, count);
+        SensorConfigStore store(STORE_PATH);
+        remove(STORE_PATH);
+        if (!store.save(compiled, count))
+        {
+            fprintf(stderr, "Unable to write '%s'.\n", STORE_PATH);
+            return 1;
+        }
+
+        SensorConfig loaded[MAX_SENSORS];
+        unsigned long allocations = harness::heap_allocations();
+        uint64_t started = harness::wall_ns();
+        for (unsigned long r = 0; r < rounds; r++)
+        {
+            ok = store.load(loaded, MAX_SENSORS) == count && ok;
+        }
+        double load_us = (harness::wall_ns() - started) / 1000.0 / rounds;
+        double load_allocations = (harness::heap_allocations() - allocations) / (double)rounds;
+        ok = ok && memcmp(loaded, compiled, count * sizeof(SensorConfig)) == 0;
+
+        // Blocks count with their usable size, which depends on what the
+        // allocator has free: one run beforehand leaves both alike
+        set_up(compiled, count);
+        size_t compiled_heap = set_up(compiled, count);
+        size_t loaded_heap = set_up(loaded, count);
+        ok = ok && compiled_heap == loaded_heap;
+        size_t pooled_heap = set_up(loaded, count, true);
+        printf("  %-8u %8zu B %11.2f us %14.2f %10zu B %10zu B\n", count,
+               sizeof(SensorConfigHeader) + count * sizeof(SensorConfig), load_us, load_allocations, loaded_heap,
+               pooled_heap);
+    }
+    printf("\n  (file I/O of the host, LittleFS on the device is slower but also a single read;\n"
+           "   with pool: sensors sharing a frame pool of %zu bytes per sensor, included)\n", POOL_SIZE);
+
+    // Whatever does not match exactly has to be ignored
+    SensorConfig configs[MAX_SENSORS];
+    make_configs(configs, 4);
+    SensorConfigStore store(STORE_PATH);
+    store.save(configs, 4);
+    std::vector<uint8_t> blob;
+    harness::read_file(STORE_PATH, blob);
+    struct Case
+    {
+        const char *name;
+        size_t offset;
+    } cases[] = {
+        {"magic", offsetof(SensorConfigHeader, magic)},
+        {"version", offsetof(SensorConfigHeader, version)},
+        {"record size", offsetof(SensorConfigHeader, record_size)},
+        {"count", offsetof(SensorConfigHeader, count)},
+        {"checksum", offsetof(SensorConfigHeader, crc)},
+        {"record", sizeof(SensorConfigHeader) + 3},
+    };
+    printf("\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        damage(blob, cases[i].offset);
+        bool rejected = store.load(configs, MAX_SENSORS) == 0;
+        printf("  damaged %-12s %s\n", cases[i].name, rejected ? "rejected" : "ACCEPTED");
+        ok = ok && rejected;
+    }
+    remove(STORE_PATH);
+
+    printf("\n  %s\n", ok ? "Stored configurations load unchanged and set up the same sensors."
+                          : "MISMATCH between stored and compiled configurations!");
+    return ok ? 0 : 1;
+}
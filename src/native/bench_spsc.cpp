@@ -0,0 +1,291 @@
+/**
+ * Stress test of SpscRing with a producing and a consuming std::thread:
+ * sequence numbers have to arrive complete and in order, slots written in
+ * place must never be seen half written, and the readings of a capture
+ * read by a sensor in one thread (as by its CaptureTask) and published in
+ * another have to be the same as when both happen in one thread.
+ */
+#include "harness.h"
+#include "CaptureTask.h"
+#include "SmlDecoder.h"
+#include "SpscRing.h"
+#include "TelegramChannel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const int8_t PIN = D2;
+
+    // Fills a whole cache line, a torn write shows in the check bytes
+    struct Block
+    {
+        uint64_t sequence;
+        uint8_t check[56];
+    };
+
+    template <size_t N>
+    bool sequences(uint64_t count, double &per_second)
+    {
+        SpscRing<uint64_t, N> *ring = new SpscRing<uint64_t, N>();
+        bool ok = true;
+        uint64_t started = harness::wall_us();
+        std::thread consumer([ring, count, &ok]() {
+            uint64_t expected = 0;
+            uint64_t value;
+            while (expected < count)
+            {
+                if (ring->pop(value))
+                {
+                    ok = ok && value == expected;
+                    expected++;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (uint64_t i = 0; i < count;)
+        {
+            if (ring->push(i))
+            {
+                i++;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+        per_second = count / ((harness::wall_us() - started) / 1e6);
+        ok = ok && ring->size() == 0;
+        delete ring;
+        return ok;
+    }
+
+    bool blocks(uint64_t count, double &per_second)
+    {
+        SpscRing<Block, 8> *ring = new SpscRing<Block, 8>();
+        bool ok = true;
+        uint64_t started = harness::wall_us();
+        std::thread consumer([ring, count, &ok]() {
+            for (uint64_t expected = 0; expected < count;)
+            {
+                const Block *block = ring->peek();
+                if (block == NULL)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                ok = ok && block->sequence == expected;
+                for (size_t i = 0; i < sizeof(block->check); i++)
+                {
+                    ok = ok && block->check[i] == (uint8_t)(expected + i);
+                }
+                ring->release();
+                expected++;
+            }
+        });
+        for (uint64_t i = 0; i < count;)
+        {
+            Block *block = ring->claim();
+            if (block == NULL)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            block->sequence = i;
+            for (size_t j = 0; j < sizeof(block->check); j++)
+            {
+                block->check[j] = (uint8_t)(i + j);
+            }
+            ring->publish();
+            i++;
+        }
+        consumer.join();
+        per_second = count / ((harness::wall_us() - started) / 1e6);
+        delete ring;
+        return ok;
+    }
+
+    // What the loop published
+    struct Published
+    {
+        unsigned long telegrams = 0;
+        unsigned long readings = 0;
+        unsigned long dropped = 0;
+        uint32_t hash = 2166136261u;
+
+        void add(const SmlReading &r)
+        {
+            const void *parts[] = {r.obis, &r.type, &r.value, &r.scaler, &r.unit};
+            const size_t sizes[] = {OBIS_LENGTH, sizeof(r.type), sizeof(r.value), sizeof(r.scaler), sizeof(r.unit)};
+            for (size_t p = 0; p < 5; p++)
+            {
+                for (size_t i = 0; i < sizes[p]; i++)
+                {
+                    this->hash = (this->hash ^ ((const uint8_t *)parts[p])[i]) * 16777619u;
+                }
+            }
+            this->readings++;
+        }
+
+        void add(const ReadingTelegram &telegram)
+        {
+            this->telegrams++;
+            for (uint8_t r = 0; r < telegram.count; r++)
+            {
+                this->add(telegram.readings[r]);
+            }
+            this->dropped += telegram.dropped;
+        }
+    };
+
+    Published *direct = NULL;
+
+    // Listeners as on the ESP8266: the readings are published right away,
+    // with the limits of a telegram in the channel
+    void publish_message(byte *buffer, size_t len, Sensor *)
+    {
+        static ReadingTelegram telegram;
+        telegram.clear();
+        SmlDecoder::decode(buffer + 8, len - 16, [](const SmlReading &r) { telegram.add(r); });
+        direct->add(telegram);
+    }
+
+    // and as in the capture task: they are copied into the channel
+    void capture_message(byte *buffer, size_t len, Sensor *sensor)
+    {
+        ReadingTelegram *telegram = sensor->channel->claim();
+        telegram->clear();
+        telegram->valid = SmlDecoder::decode(buffer + 8, len - 16, [telegram](const SmlReading &r) {
+            telegram->add(r);
+        });
+        sensor->channel->publish();
+    }
+
+    // Sends [data] to the sensor as the receive buffer takes it
+    template <typename Turn>
+    void feed(Sensor &sensor, const std::vector<uint8_t> &data, Turn turn)
+    {
+        SoftwareSerial *serial = SoftwareSerial::find(PIN);
+        for (size_t offset = 0; offset < data.size() || serial->available() > 0 || sensor.ready();)
+        {
+            size_t n = std::min(data.size() - offset, serial->space());
+            serial->inject(&data[offset], n);
+            offset += n;
+            turn();
+        }
+    }
+
+    bool pipeline(const std::vector<uint8_t> &data, Published &threaded, Published &reference, double &seconds)
+    {
+        SensorConfig config = harness::make_config(PIN, "spsc");
+        {
+            direct = &reference;
+            Sensor sensor(&config, publish_message);
+            feed(sensor, data, [&sensor]() { sensor.loop(); });
+        }
+
+        Sensor sensor(&config, capture_message);
+        CaptureTask *task = new CaptureTask(&sensor);
+        std::atomic<bool> done(false);
+        uint64_t started = harness::wall_us();
+        std::thread loop([task, &threaded, &done]() {
+            for (;;)
+            {
+                bool last = done;
+                for (ReadingTelegram *telegram; (telegram = task->channel.peek()) != NULL; task->channel.release())
+                {
+                    threaded.add(*telegram);
+                }
+                if (last)
+                {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        });
+        feed(sensor, data, [&sensor]() {
+            if (!CaptureTask::turn(&sensor))
+            {
+                std::this_thread::yield();
+            }
+        });
+        done = true;
+        loop.join();
+        seconds = (harness::wall_us() - started) / 1e6;
+        delete task;
+        return threaded.telegrams == reference.telegrams && threaded.readings == reference.readings &&
+               threaded.dropped == reference.dropped && threaded.hash == reference.hash && sensor.metrics.overruns == 0;
+    }
+}
+
+int spsc_main(int argc, char **argv)
+{
+    uint64_t count = 2000000;
+    const char *path = "doc/samples/captures/ed300l.bin";
+    unsigned long repeat = 200;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = (uint64_t)atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = (unsigned long)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: spsc [--count N] [--repeat N] [capture.bin]\n");
+            return 2;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    std::vector<uint8_t> capture;
+    if (count == 0 || repeat == 0 || !harness::read_file(path, capture) || capture.empty())
+    {
+        fprintf(stderr, "Usage: spsc [--count N] [--repeat N] [capture.bin]\n");
+        return 2;
+    }
+
+    printf("Producer and consumer thread, %llu items\n\n", (unsigned long long)count);
+    double rate;
+    bool ok = true;
+    bool same = sequences<2>(count, rate);
+    printf("  %-34s %8.1f M/s  %s\n", "sequence numbers, 2 slots", rate / 1e6, same ? "in order" : "BROKEN");
+    ok = ok && same;
+    same = sequences<1024>(count, rate);
+    printf("  %-34s %8.1f M/s  %s\n", "sequence numbers, 1024 slots", rate / 1e6, same ? "in order" : "BROKEN");
+    ok = ok && same;
+    same = blocks(count / 4, rate);
+    printf("  %-34s %8.1f M/s  %s\n", "64 byte slots in place, 8 slots", rate / 1e6, same ? "never torn" : "TORN");
+    ok = ok && same;
+
+    std::vector<uint8_t> data;
+    for (unsigned long r = 0; r < repeat; r++)
+    {
+        data.insert(data.end(), capture.begin(), capture.end());
+    }
+    Published threaded, reference;
+    double seconds;
+    same = pipeline(data, threaded, reference, seconds);
+    printf("\n%s, %lu rounds: sensor and capture turns in one thread, publishing in another\n\n",
+           harness::basename(path).c_str(), repeat);
+    printf("  %-22s %8lu telegrams %8lu readings %6lu too long\n", "in one thread", reference.telegrams,
+           reference.readings, reference.dropped);
+    printf("  %-22s %8lu telegrams %8lu readings %6lu too long  %.2f s  %s\n", "through the channel",
+           threaded.telegrams, threaded.readings, threaded.dropped, seconds, same ? "same" : "DIFFERENT");
+    ok = ok && same;
+
+    printf("\n%s\n", ok ? "Nothing lost, reordered or torn" : "The ring lost, reordered or tore items");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1027 @@
+/**
+ * Collector decoding the raw SML byte streams of many gateways on a host.
+ *
+ * Every source (a file, stdin, a serial TTY or a TCP connection) is read by
+ * a thread of its own, which finds the messages with the automata of the
+ * sensors (SmlFraming.h) and hands them over in batches. A pool of workers
+ * checks their CRC, decodes them with SmlDecoder and writes the readings as
+ * InfluxDB line protocol or as the JSON documents of PUBLISH_JSON. Every
+ * worker has a queue of its own and takes batches from the queues of the
+ * others when it runs out (work stealing), so that one source sending long
+ * messages does not hold up the rest.
+ *
+ * --bench decodes an in-memory corpus of the given captures with 1, 2, 4 ...
+ * threads, reports frames/s per thread, and checks that every thread count
+ * and the sensor state machine itself find the same readings.
+ */
+#include "harness.h"
+#include "ObisFilter.h"
+#include "Sensor.h"
+#include "SmlCrc.h"
+#include "SmlDecoder.h"
+#include "SmlFormat.h"
+#include "SmlFraming.h"
+#include "SmlJson.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const size_t READ_SIZE = 64 * 1024;
+    const size_t BATCH_FRAMES = 64;        // Messages handed to the pool at once
+    const size_t BATCH_BYTES = 64 * 1024;
+    const size_t BATCHES_PER_WORKER = 4;   // Waiting at most, readers block beyond
+    const size_t JSON_DOCUMENT_SIZE = 4096; // Longer telegrams are split as by the publisher
+
+    enum Format
+    {
+        FORMAT_LINE, // InfluxDB line protocol
+        FORMAT_JSON  // One document per message and line
+    };
+
+    struct Options
+    {
+        Format format = FORMAT_LINE;
+        ObisFilter filter = {OBIS_FILTER_NONE, 0, {}};
+        FILE *output = stdout; // NULL formats the readings and throws them away
+    };
+
+    // Finds the messages in a byte stream as the sensors do, handing each
+    // of them over from the start sequence to the CRC, still escaped
+    class StreamFramer
+    {
+    public:
+        unsigned long overflows = 0;
+
+        template <typename OnFrame>
+        void feed(const uint8_t *data, size_t len, OnFrame on_frame)
+        {
+            size_t offset = 0;
+            while (offset < len)
+            {
+                if (this->state == SEARCHING)
+                {
+                    offset += this->start_matcher.scan(data + offset, len - offset);
+                    if (this->start_matcher.found())
+                    {
+                        memcpy(this->frame, START_SEQUENCE, SML_START_LENGTH);
+                        this->position = SML_START_LENGTH;
+                        this->start_matcher.reset();
+                        this->scanner.reset();
+                        this->state = READING;
+                    }
+                }
+                else if (this->state == READING)
+                {
+                    // Room for the number of fill bytes and the CRC
+                    size_t space = sizeof(this->frame) - 3 - this->position;
+                    if (space == 0)
+                    {
+                        this->overflows++;
+                        this->state = SEARCHING;
+                        continue;
+                    }
+                    SmlScanResult result;
+                    size_t n = this->scanner.scan(data + offset, std::min(len - offset, space), result);
+                    memcpy(this->frame + this->position, data + offset, n);
+                    this->position += n;
+                    offset += n;
+                    if (result == SML_SCAN_END)
+                    {
+                        this->state = TRAILER;
+                        this->trailer = 3;
+                    }
+                    else if (result != SML_SCAN_MORE)
+                    {
+                        this->state = SEARCHING;
+                        this->start_matcher.reset(result == SML_SCAN_RESTART ? SML_START_LENGTH : 0);
+                    }
+                }
+                else
+                {
+                    size_t n = std::min<size_t>(this->trailer, len - offset);
+                    memcpy(this->frame + this->position, data + offset, n);
+                    this->position += n;
+                    offset += n;
+                    this->trailer -= n;
+                    if (this->trailer == 0)
+                    {
+                        on_frame(this->frame, this->position);
+                        this->state = SEARCHING;
+                    }
+                }
+            }
+        }
+
+    private:
+        enum State
+        {
+            SEARCHING,
+            READING,
+            TRAILER
+        } state = SEARCHING;
+        uint8_t frame[SML_MAX_FRAME_LENGTH];
+        size_t position = 0;
+        uint8_t trailer = 0;
+        SmlStartMatcher start_matcher;
+        SmlEscapeScanner scanner;
+    };
+
+    uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    uint32_t hash_reading(uint32_t hash, const SmlReading &r)
+    {
+        hash = hash_bytes(hash, r.obis, OBIS_LENGTH);
+        hash = hash_bytes(hash, &r.type, sizeof(r.type));
+        hash = hash_bytes(hash, &r.value, sizeof(r.value));
+        hash = hash_bytes(hash, &r.scaler, sizeof(r.scaler));
+        hash = hash_bytes(hash, &r.unit, sizeof(r.unit));
+        hash = hash_bytes(hash, &r.time, sizeof(r.time));
+        return r.type == SML_READING_OCTET_STRING ? hash_bytes(hash, r.octets, r.octets_len) : hash;
+    }
+
+    // Readings of a message folded into one number, in order. Messages are
+    // summed up, so that it does not matter which thread decoded which.
+    struct Digest
+    {
+        unsigned long frames = 0;
+        unsigned long readings = 0;
+        unsigned long crc_errors = 0;
+        unsigned long undecodable = 0;
+        uint64_t sum = 0;
+
+        void add(const Digest &o)
+        {
+            this->frames += o.frames;
+            this->readings += o.readings;
+            this->crc_errors += o.crc_errors;
+            this->undecodable += o.undecodable;
+            this->sum += o.sum;
+        }
+
+        bool operator==(const Digest &o) const
+        {
+            return this->frames == o.frames && this->readings == o.readings && this->crc_errors == o.crc_errors &&
+                   this->undecodable == o.undecodable && this->sum == o.sum;
+        }
+    };
+
+    struct Source
+    {
+        std::string name;
+        std::string tag;  // Name escaped for line protocol
+        std::string json; // and for JSON
+        int fd = -1;
+        bool live = false; // Messages get the time they were received
+        const uint8_t *memory = NULL; // Read instead of [fd] by --bench
+        size_t memory_length = 0;
+        unsigned long rounds = 1;
+        uint64_t bytes = 0;
+        unsigned long frames = 0;
+        unsigned long overflows = 0;
+        std::atomic<unsigned long> crc_errors{0};
+    };
+
+    struct Batch
+    {
+        Source *source;
+        std::vector<uint8_t> data;   // Messages one after the other
+        std::vector<uint32_t> ends;  // of every message in [data]
+        std::vector<int64_t> received; // Unix time in ns, of live sources only
+    };
+
+    int64_t unix_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    void append_escaped(std::string &out, const std::string &text, const char *special)
+    {
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            if (strchr(special, text[i]) != NULL)
+            {
+                out += '\\';
+            }
+            out += text[i];
+        }
+    }
+
+    class StealingPool
+    {
+    public:
+        StealingPool(unsigned threads, const Options &options) : options(options)
+        {
+            for (unsigned i = 0; i < threads; i++)
+            {
+                this->workers.push_back(new Worker());
+            }
+            for (unsigned i = 0; i < threads; i++)
+            {
+                this->workers[i]->thread = std::thread(&StealingPool::run, this, i);
+            }
+        }
+
+        ~StealingPool()
+        {
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                delete this->workers[i];
+            }
+        }
+
+        // Queues [batch] with the next worker in turn, blocks while all of
+        // them have enough to do
+        void submit(Batch *batch)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->state_lock);
+                this->room.wait(lock, [this]() {
+                    return this->in_flight < this->workers.size() * BATCHES_PER_WORKER;
+                });
+                this->in_flight++;
+            }
+            Worker *worker = this->workers[this->next++ % this->workers.size()];
+            {
+                std::lock_guard<std::mutex> lock(worker->lock);
+                worker->batches.push_back(batch);
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->state_lock);
+                this->queued++;
+            }
+            this->work.notify_one();
+        }
+
+        // Waits for all batches to be decoded and stops the workers
+        void finish()
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->state_lock);
+                this->room.wait(lock, [this]() { return this->in_flight == 0; });
+                this->stopping = true;
+            }
+            this->work.notify_all();
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                this->workers[i]->thread.join();
+            }
+        }
+
+        Digest digest() const
+        {
+            Digest total;
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                total.add(this->workers[i]->digest);
+            }
+            return total;
+        }
+
+        unsigned long stolen() const
+        {
+            unsigned long total = 0;
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                total += this->workers[i]->stolen;
+            }
+            return total;
+        }
+
+        uint64_t output_bytes() const
+        {
+            uint64_t total = 0;
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                total += this->workers[i]->output_bytes;
+            }
+            return total;
+        }
+
+    private:
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex lock; // Of [batches]
+            std::deque<Batch *> batches;
+            Digest digest;
+            unsigned long stolen = 0;
+            uint64_t output_bytes = 0;
+            std::string output;
+            char document[JSON_DOCUMENT_SIZE];
+        };
+
+        const Options &options;
+        std::vector<Worker *> workers;
+        std::atomic<size_t> next{0};
+        std::mutex state_lock; // Of the counts below
+        std::condition_variable work;
+        std::condition_variable room;
+        size_t queued = 0;     // Batches in the queues
+        size_t in_flight = 0;  // Batches submitted and not decoded yet
+        bool stopping = false;
+
+        void run(unsigned index)
+        {
+            Worker &self = *this->workers[index];
+            for (;;)
+            {
+                Batch *batch = this->take(index);
+                if (batch == NULL)
+                {
+                    std::unique_lock<std::mutex> lock(this->state_lock);
+                    if (this->queued == 0)
+                    {
+                        if (this->stopping)
+                        {
+                            return;
+                        }
+                        this->work.wait(lock);
+                    }
+                    continue;
+                }
+                this->decode(self, *batch);
+                delete batch;
+                {
+                    std::lock_guard<std::mutex> lock(this->state_lock);
+                    this->in_flight--;
+                }
+                this->room.notify_all();
+            }
+        }
+
+        // The oldest batch of the worker's own queue, or else the newest one
+        // of another worker's
+        Batch *take(unsigned index)
+        {
+            size_t count = this->workers.size();
+            for (size_t k = 0; k < count; k++)
+            {
+                Worker &worker = *this->workers[(index + k) % count];
+                Batch *batch;
+                {
+                    std::lock_guard<std::mutex> lock(worker.lock);
+                    if (worker.batches.empty())
+                    {
+                        continue;
+                    }
+                    if (k == 0)
+                    {
+                        batch = worker.batches.front();
+                        worker.batches.pop_front();
+                    }
+                    else
+                    {
+                        batch = worker.batches.back();
+                        worker.batches.pop_back();
+                    }
+                }
+                if (k > 0)
+                {
+                    this->workers[index]->stolen++;
+                }
+                std::lock_guard<std::mutex> lock(this->state_lock);
+                this->queued--;
+                return batch;
+            }
+            return NULL;
+        }
+
+        void decode(Worker &self, Batch &batch)
+        {
+            const Source &source = *batch.source;
+            size_t start = 0;
+            for (size_t i = 0; i < batch.ends.size(); i++)
+            {
+                uint8_t *frame = &batch.data[start];
+                size_t len = batch.ends[i] - start;
+                start = batch.ends[i];
+                self.digest.frames++;
+                // The same steps as Sensor::process_message() and the listener
+                if (len < SML_START_LENGTH + SML_TRAILER_LENGTH || !sml_crc16_check(frame, len))
+                {
+                    self.digest.crc_errors++;
+                    batch.source->crc_errors++;
+                    continue;
+                }
+                len = sml_unescape(frame, len);
+                int64_t received = batch.received.empty() ? -1 : batch.received[i];
+                uint32_t hash = 2166136261u;
+                SmlJsonWriter json(self.document, sizeof(self.document));
+                json.reset();
+                bool valid = SmlDecoder::decode(frame + 8, len - 16, this->options.filter, [&](const SmlReading &r) {
+                    hash = hash_reading(hash, r);
+                    self.digest.readings++;
+                    if (this->options.format == FORMAT_JSON)
+                    {
+                        const char *unit = r.unit ? dlms_get_unit(r.unit) : NULL;
+                        if (!json.add(r, unit))
+                        {
+                            this->write_document(self, source, json, received);
+                            json.reset();
+                            json.add(r, unit);
+                        }
+                    }
+                    else
+                    {
+                        this->write_line(self, source, r, received);
+                    }
+                });
+                if (this->options.format == FORMAT_JSON)
+                {
+                    this->write_document(self, source, json, received);
+                }
+                if (!valid)
+                {
+                    self.digest.undecodable++;
+                }
+                self.digest.sum += hash;
+            }
+            self.output_bytes += self.output.size();
+            if (this->options.output != NULL && !self.output.empty())
+            {
+                std::lock_guard<std::mutex> lock(this->output_lock);
+                fwrite(self.output.data(), 1, self.output.size(), this->options.output);
+            }
+            self.output.clear();
+        }
+
+        // sml,source=<name>,obis=1-0:1.8.0*255 value=3546245.9,unit="Wh" <ns>
+        void write_line(Worker &self, const Source &source, const SmlReading &r, int64_t received)
+        {
+            char text[128];
+            std::string &out = self.output;
+            out += "sml,source=";
+            out += source.tag;
+            out += ",obis=";
+            out.append(text, sml_format_obis(r.obis, '*', text, sizeof(text)));
+            out += " value=";
+            if (r.is_numeric())
+            {
+                out.append(text, sml_format_value(r, text, sizeof(text)));
+            }
+            else if (r.type == SML_READING_BOOLEAN)
+            {
+                out += r.value ? "true" : "false";
+            }
+            else
+            {
+                std::string hex(r.octets_len * 3 + 1, '\0');
+                hex.resize(sml_octets_to_hex(r.octets, r.octets_len, &hex[0], hex.size()));
+                out += '"';
+                out += hex;
+                out += '"';
+            }
+            const char *unit = r.unit ? dlms_get_unit(r.unit) : NULL;
+            if (unit != NULL)
+            {
+                out += ",unit=\"";
+                append_escaped(out, unit, "\"\\");
+                out += '"';
+            }
+            if (received >= 0)
+            {
+                snprintf(text, sizeof(text), " %lld", (long long)received);
+                out += text;
+            }
+            out += '\n';
+        }
+
+        // {"source":"<name>","received":<ms>,"time":..,"values":[..]}
+        void write_document(Worker &self, const Source &source, SmlJsonWriter &json, int64_t received)
+        {
+            if (json.empty())
+            {
+                return;
+            }
+            size_t len = json.finish();
+            std::string &out = self.output;
+            out += "{\"source\":\"";
+            out += source.json;
+            out += "\",";
+            if (received >= 0)
+            {
+                char text[32];
+                snprintf(text, sizeof(text), "\"received\":%lld,", (long long)(received / 1000000));
+                out += text;
+            }
+            out.append(json.get_buffer() + 1, len - 1);
+            out += '\n';
+        }
+
+        std::mutex output_lock;
+    };
+
+    // Frames a source and hands its messages to [pool] in batches
+    void read_source(Source *source, StealingPool *pool)
+    {
+        StreamFramer *framer = new StreamFramer();
+        Batch *batch = NULL;
+        int64_t received = -1;
+        auto on_frame = [&](const uint8_t *frame, size_t len) {
+            if (batch == NULL)
+            {
+                batch = new Batch();
+                batch->source = source;
+                batch->data.reserve(BATCH_BYTES + SML_MAX_FRAME_LENGTH);
+            }
+            batch->data.insert(batch->data.end(), frame, frame + len);
+            batch->ends.push_back((uint32_t)batch->data.size());
+            if (source->live)
+            {
+                batch->received.push_back(received);
+            }
+            source->frames++;
+            if (batch->ends.size() == BATCH_FRAMES || batch->data.size() >= BATCH_BYTES)
+            {
+                pool->submit(batch);
+                batch = NULL;
+            }
+        };
+        if (source->memory != NULL)
+        {
+            for (unsigned long round = 0; round < source->rounds; round++)
+            {
+                for (size_t offset = 0; offset < source->memory_length; offset += READ_SIZE)
+                {
+                    size_t n = std::min(READ_SIZE, source->memory_length - offset);
+                    framer->feed(source->memory + offset, n, on_frame);
+                    source->bytes += n;
+                }
+            }
+        }
+        else
+        {
+            std::vector<uint8_t> buffer(READ_SIZE);
+            for (;;)
+            {
+                ssize_t n = read(source->fd, &buffer[0], buffer.size());
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    if (n < 0)
+                    {
+                        fprintf(stderr, "Reading '%s' failed: %s\n", source->name.c_str(), strerror(errno));
+                    }
+                    break;
+                }
+                received = source->live ? unix_ns() : -1;
+                framer->feed(&buffer[0], (size_t)n, on_frame);
+                source->bytes += n;
+                // Messages of live sources are not held back for a full batch
+                if (source->live && batch != NULL)
+                {
+                    pool->submit(batch);
+                    batch = NULL;
+                }
+            }
+        }
+        if (batch != NULL)
+        {
+            pool->submit(batch);
+        }
+        source->overflows = framer->overflows;
+        delete framer;
+    }
+
+    bool baud_of(unsigned baud, speed_t &speed)
+    {
+        static const struct
+        {
+            unsigned baud;
+            speed_t speed;
+        } SPEEDS[] = {{300, B300},     {1200, B1200},   {2400, B2400},   {4800, B4800},  {9600, B9600},
+                      {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200}};
+        for (size_t i = 0; i < sizeof(SPEEDS) / sizeof(SPEEDS[0]); i++)
+        {
+            if (SPEEDS[i].baud == baud)
+            {
+                speed = SPEEDS[i].speed;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 8N1 without any processing, as a reading head sends it
+    bool configure_tty(int fd, unsigned baud)
+    {
+        struct termios tty;
+        speed_t speed;
+        if (!baud_of(baud, speed) || tcgetattr(fd, &tty) != 0)
+        {
+            return false;
+        }
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~(CSTOPB | PARENB);
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+        return tcsetattr(fd, TCSANOW, &tty) == 0;
+    }
+
+    int connect_tcp(const std::string &address)
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            return -1;
+        }
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *addresses;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+        {
+            return -1;
+        }
+        int fd = -1;
+        for (struct addrinfo *a = addresses; a != NULL && fd < 0; a = a->ai_next)
+        {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+
+    void name_source(Source &source, const std::string &name)
+    {
+        source.name = name;
+        append_escaped(source.tag, name, ", =\\");
+        append_escaped(source.json, name, "\"\\");
+    }
+
+    // "-" is stdin, "tcp:HOST:PORT" a gateway to connect to, anything else
+    // a file or a TTY
+    bool open_source(const char *spec, unsigned baud, Source &source)
+    {
+        if (strcmp(spec, "-") == 0)
+        {
+            name_source(source, "stdin");
+            source.fd = STDIN_FILENO;
+        }
+        else if (strncmp(spec, "tcp:", 4) == 0)
+        {
+            name_source(source, spec + 4);
+            source.fd = connect_tcp(spec + 4);
+            source.live = true;
+            return source.fd >= 0;
+        }
+        else
+        {
+            name_source(source, harness::basename(spec));
+            source.fd = open(spec, O_RDONLY | O_NOCTTY);
+            if (source.fd >= 0 && isatty(source.fd) && !configure_tty(source.fd, baud))
+            {
+                close(source.fd);
+                source.fd = -1;
+            }
+        }
+        struct stat st;
+        if (source.fd < 0 || fstat(source.fd, &st) != 0)
+        {
+            return false;
+        }
+        source.live = !S_ISREG(st.st_mode);
+        return true;
+    }
+
+    double cpu_seconds()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    // Runs [sources] through a pool of [threads]
+    Digest collect(std::vector<Source *> &sources, unsigned threads, const Options &options,
+                   unsigned long *stolen = NULL, uint64_t *output_bytes = NULL)
+    {
+        StealingPool pool(threads, options);
+        std::vector<std::thread> readers;
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            readers.push_back(std::thread(read_source, sources[i], &pool));
+        }
+        for (size_t i = 0; i < readers.size(); i++)
+        {
+            readers[i].join();
+        }
+        pool.finish();
+        if (stolen != NULL)
+        {
+            *stolen = pool.stolen();
+        }
+        if (output_bytes != NULL)
+        {
+            *output_bytes = pool.output_bytes();
+        }
+        return pool.digest();
+    }
+
+    Digest *sensor_digest = NULL;
+
+    void sensor_message(byte *buffer, size_t len, Sensor *)
+    {
+        uint32_t hash = 2166136261u;
+        sensor_digest->frames++;
+        bool valid = SmlDecoder::decode(buffer + 8, len - 16, [&hash](const SmlReading &r) {
+            hash = hash_reading(hash, r);
+            sensor_digest->readings++;
+        });
+        if (!valid)
+        {
+            sensor_digest->undecodable++;
+        }
+        sensor_digest->sum += hash;
+    }
+
+    // What a sensor of the device reads from [data]
+    Digest read_with_sensor(const std::vector<uint8_t> &data)
+    {
+        const int8_t PIN = D2;
+        SensorConfig config = harness::make_config(PIN, "collect");
+        Digest digest;
+        sensor_digest = &digest;
+        Sensor sensor(&config, sensor_message);
+        SoftwareSerial *serial = SoftwareSerial::find(PIN);
+        for (size_t offset = 0; offset < data.size() || serial->available() > 0 || sensor.ready();)
+        {
+            size_t n = std::min(data.size() - offset, serial->space());
+            serial->inject(&data[offset], n);
+            offset += n;
+            sensor.loop();
+        }
+        digest.frames += sensor.get_crc_errors();
+        digest.crc_errors = sensor.get_crc_errors();
+        return digest;
+    }
+
+    void usage()
+    {
+        fprintf(stderr,
+                "Usage: collect [options] <source>...\n"
+                "       collect --bench [--size MB] [--threads N] <capture.bin>...\n"
+                "  <source>       a file or serial TTY, - for stdin, tcp:HOST:PORT for a gateway\n"
+                "  --threads N    decoding threads (default: one per core)\n"
+                "  --format F     line (InfluxDB line protocol, default) or json\n"
+                "  --output FILE  write the readings to FILE instead of stdout\n"
+                "  --baud B       speed of serial TTYs (default 9600)\n"
+                "  --allow CODES  decode only these OBIS codes, e.g. \"1.8.0, 2.8.0, 16.7.0\"\n"
+                "  --deny CODES   decode everything but these OBIS codes\n"
+                "  --bench        decode a corpus of --size MB (default 256) of the captures in memory\n"
+                "                 with 1, 2, 4 ... up to --threads threads\n");
+    }
+
+    int bench(const std::vector<const char *> &files, size_t megabytes, unsigned max_threads,
+              const Options &options)
+    {
+        // The messages of all captures, without what lies between them, so
+        // that the corpus can be cut anywhere between two rounds
+        std::vector<uint8_t> round;
+        printf("Sensor state machine and collector on the captures\n\n");
+        bool same = true;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            std::vector<uint8_t> data;
+            if (!harness::read_file(files[i], data) || data.empty())
+            {
+                fprintf(stderr, "Unable to read capture '%s'.\n", files[i]);
+                return 2;
+            }
+            Digest sensor = read_with_sensor(data);
+            Source source;
+            name_source(source, harness::basename(files[i]));
+            source.memory = &data[0];
+            source.memory_length = data.size();
+            std::vector<Source *> sources(1, &source);
+            Options quiet = options;
+            quiet.output = NULL;
+            Digest collector = collect(sources, 1, quiet);
+            bool match = sensor == collector;
+            same = same && match;
+            printf("  %-24s %6lu frames %7lu readings %4lu crc errors  %s\n", source.name.c_str(),
+                   collector.frames, collector.readings, collector.crc_errors, match ? "same" : "DIFFERENT");
+
+            StreamFramer framer;
+            framer.feed(&data[0], data.size(), [&round](const uint8_t *frame, size_t len) {
+                round.insert(round.end(), frame, frame + len);
+            });
+        }
+        if (round.empty())
+        {
+            fprintf(stderr, "No messages in the captures.\n");
+            return 2;
+        }
+
+        unsigned long rounds = std::max<unsigned long>(1, (unsigned long)(megabytes * 1000000 / round.size()));
+        uint64_t corpus = (uint64_t)rounds * round.size();
+        printf("\nCorpus of %.1f MB (%lu rounds of %zu bytes) decoded in memory, %u cores, formatted as %s\n\n",
+               corpus / 1e6, rounds, round.size(), std::thread::hardware_concurrency(),
+               options.format == FORMAT_JSON ? "JSON" : "line protocol");
+        printf("  %7s %9s %10s %12s %12s %13s %8s %8s\n", "threads", "seconds", "MB/s", "frames/s", "per thread",
+               "per cpu second", "speedup", "stolen");
+
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < max_threads; t *= 2)
+        {
+            counts.push_back(t);
+        }
+        counts.push_back(max_threads);
+        Digest first;
+        double single = 0;
+        for (size_t c = 0; c < counts.size(); c++)
+        {
+            unsigned threads = counts[c];
+            // A reader per thread, so that framing does not hold up decoding
+            std::vector<Source> storage(threads);
+            std::vector<Source *> sources;
+            for (unsigned s = 0; s < threads; s++)
+            {
+                Source &source = storage[s];
+                name_source(source, "gateway" + std::to_string(s));
+                source.memory = &round[0];
+                source.memory_length = round.size();
+                source.rounds = rounds / threads + (s < rounds % threads ? 1 : 0);
+                sources.push_back(&source);
+            }
+            Options formatted = options;
+            formatted.output = NULL;
+            unsigned long stolen = 0;
+            double cpu = cpu_seconds();
+            uint64_t started = harness::wall_us();
+            Digest digest = collect(sources, threads, formatted, &stolen);
+            double seconds = (harness::wall_us() - started) / 1e6;
+            cpu = cpu_seconds() - cpu;
+            if (c == 0)
+            {
+                first = digest;
+                single = seconds;
+            }
+            bool match = digest == first;
+            same = same && match;
+            printf("  %7u %9.2f %10.1f %12.0f %12.0f %13.0f %7.2fx %8lu%s\n", threads, seconds, corpus / seconds / 1e6,
+                   digest.frames / seconds, digest.frames / seconds / threads, digest.frames / cpu, single / seconds,
+                   stolen, match ? "" : "  DIFFERENT");
+        }
+        printf("\n  %lu frames, %lu readings, %lu crc errors, %lu undecodable per run\n", first.frames, first.readings,
+               first.crc_errors, first.undecodable);
+        printf("\n%s\n", same ? "Same readings as the sensor and at every thread count"
+                               : "The readings differ");
+        return same ? 0 : 1;
+    }
+}
+
+int collect_main(int argc, char **argv)
+{
+    Options options;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned baud = 9600;
+    bool benchmark = false;
+    size_t megabytes = 256;
+    const char *output = NULL;
+    std::vector<const char *> specs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = (unsigned)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "json") == 0)
+            {
+                options.format = FORMAT_JSON;
+            }
+            else if (strcmp(argv[i], "line") != 0)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+        {
+            baud = (unsigned)atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--allow") == 0 || strcmp(argv[i], "--deny") == 0) && i + 1 < argc)
+        {
+            options.filter.mode = strcmp(argv[i], "--allow") == 0 ? OBIS_FILTER_ALLOW : OBIS_FILTER_DENY;
+            if (!options.filter.parse(argv[++i]))
+            {
+                fprintf(stderr, "Invalid OBIS codes '%s'.\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            benchmark = true;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            megabytes = (size_t)atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            specs.push_back(argv[i]);
+        }
+    }
+    speed_t speed;
+    if (specs.empty() || threads == 0 || megabytes == 0 || !baud_of(baud, speed))
+    {
+        usage();
+        return 2;
+    }
+    if (benchmark)
+    {
+        return bench(specs, megabytes, threads, options);
+    }
+
+    if (output != NULL && (options.output = fopen(output, "w")) == NULL)
+    {
+        fprintf(stderr, "Unable to write '%s'.\n", output);
+        return 1;
+    }
+    std::vector<Source> storage(specs.size());
+    std::vector<Source *> sources;
+    for (size_t i = 0; i < specs.size(); i++)
+    {
+        if (!open_source(specs[i], baud, storage[i]))
+        {
+            fprintf(stderr, "Unable to open '%s': %s\n", specs[i], strerror(errno));
+            return 1;
+        }
+        sources.push_back(&storage[i]);
+    }
+    uint64_t started = harness::wall_us();
+    Digest digest = collect(sources, threads, options);
+    double seconds = (harness::wall_us() - started) / 1e6;
+    if (options.output != stdout)
+    {
+        fclose(options.output);
+    }
+
+    fprintf(stderr, "%-24s %12s %10s %10s %10s\n", "source", "bytes", "frames", "crc errors", "overflows");
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        Source &s = *sources[i];
+        fprintf(stderr, "%-24s %12llu %10lu %10lu %10lu\n", s.name.c_str(), (unsigned long long)s.bytes, s.frames,
+                s.crc_errors.load(), s.overflows);
+        if (s.fd != STDIN_FILENO)
+        {
+            close(s.fd);
+        }
+    }
+    fprintf(stderr, "%lu frames, %lu readings, %lu undecodable in %.2f s with %u threads (%.0f frames/s)\n",
+            digest.frames, digest.readings, digest.undecodable, seconds, threads, digest.frames / seconds);
+    return 0;
+}
@@ -0,0 +1,517 @@
+/**
+ * Feeds arbitrary bytes through the sensor state machine (buffering SML
+ * sensors with buffers of their own and from a frame pool, streaming SML
+ * sensors and the other protocols) and through the decoders, and checks
+ * what they hand over. Out of bounds accesses and undefined behaviour are
+ * left to the sanitizers of the native_sanitize environment.
+ *
+ * Without files, inputs are generated from a seed: mutated captures, and
+ * the properties that the frames and readings do not depend on how the
+ * bytes are chunked, and that after any noise the sensors find a valid
+ * frame again. With files, every one of them is run once, which is what
+ * afl-fuzz expects. Built with FUZZ_LIBFUZZER, the same target is the
+ * entry point of libFuzzer.
+ */
+#include "harness.h"
+#include "FramePool.h"
+#include "Sensor.h"
+#include "SmlDecoder.h"
+#include "SmlCrc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    const int8_t PIN = D2;
+    const int8_t TX_PIN = D5;
+    const size_t POOL_SIZE = 2 * FRAME_POOL_FIRST_LENGTH; // Two buffers until longer messages turn up, so that it runs full
+
+    // xorshift32, so that a run can be repeated from its seed
+    class Random
+    {
+    public:
+        explicit Random(uint32_t seed) : state(seed != 0 ? seed : 1) {}
+
+        uint32_t next()
+        {
+            this->state ^= this->state << 13;
+            this->state ^= this->state >> 17;
+            this->state ^= this->state << 5;
+            return this->state;
+        }
+
+        // In [0, n)
+        uint32_t below(uint32_t n)
+        {
+            return this->next() % n;
+        }
+
+        // Mostly the bytes the framing and the decoders look for
+        uint8_t byte()
+        {
+            static const uint8_t SPECIAL[] = {SML_ESCAPE, SML_ESCAPE, SML_ESCAPE, SML_START, SML_END,
+                                              0x76, 0x77, 0x01, 0x00, '/', '!', '\r', '\n', '(', ')', '*'};
+            uint32_t r = this->next();
+            return (r & 1) ? SPECIAL[(r >> 1) % sizeof(SPECIAL)] : (uint8_t)(r >> 8);
+        }
+
+    private:
+        uint32_t state;
+    };
+
+    uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    void check(bool condition, const char *property)
+    {
+        if (!condition)
+        {
+            fprintf(stderr, "Violated: %s\n", property);
+            abort();
+        }
+    }
+
+    // What a sensor handed over
+    struct Outcome
+    {
+        unsigned long frames = 0;
+        unsigned long telegrams = 0;
+        unsigned long readings = 0;
+        uint32_t frame_hash = 2166136261u; // FNV-1a over the frames
+        uint32_t hash = 2166136261u;       // and over the readings
+        uint32_t last_hash = 0;            // Readings of the last frame or telegram
+        std::vector<uint8_t> last_frame;
+
+        bool operator==(const Outcome &other) const
+        {
+            return this->frames == other.frames && this->telegrams == other.telegrams &&
+                   this->readings == other.readings && this->frame_hash == other.frame_hash &&
+                   this->hash == other.hash;
+        }
+
+        void add(const SmlReading &r)
+        {
+            uint32_t h = this->last_hash;
+            h = hash_bytes(h, r.obis, OBIS_LENGTH);
+            h = hash_bytes(h, &r.type, sizeof(r.type));
+            h = hash_bytes(h, &r.value, sizeof(r.value));
+            h = hash_bytes(h, &r.scaler, sizeof(r.scaler));
+            h = hash_bytes(h, &r.unit, sizeof(r.unit));
+            h = hash_bytes(h, r.octets, r.type == SML_READING_OCTET_STRING ? r.octets_len : 0);
+            this->last_hash = h;
+            this->hash = hash_bytes(this->hash, &h, sizeof(h));
+            this->readings++;
+        }
+    };
+
+    Outcome *outcome = NULL;
+
+    void on_frame(byte *buffer, size_t len, Sensor *sensor)
+    {
+        check(len >= SML_START_LENGTH + SML_TRAILER_LENGTH, "frames hold a start and an end sequence");
+        check(memcmp(buffer, START_SEQUENCE, SML_START_LENGTH) == 0, "frames begin with the start sequence");
+        const byte *trailer = buffer + len - SML_TRAILER_LENGTH;
+        check(trailer[0] == SML_ESCAPE && trailer[1] == SML_ESCAPE && trailer[2] == SML_ESCAPE &&
+                  trailer[3] == SML_ESCAPE && trailer[4] == SML_END,
+              "frames end with the end sequence");
+        outcome->frames++;
+        outcome->frame_hash = hash_bytes(outcome->frame_hash, buffer, len);
+        outcome->last_frame.assign(buffer, buffer + len);
+        outcome->last_hash = 2166136261u;
+        SmlDecoder::decode(buffer + SML_START_LENGTH, len - SML_START_LENGTH - SML_TRAILER_LENGTH,
+                           sensor->config->obis_filter, [](const SmlReading &r) { outcome->add(r); });
+    }
+
+    void on_readings(const SmlReading *readings, size_t count, Sensor *)
+    {
+        outcome->telegrams++;
+        outcome->last_hash = 2166136261u;
+        for (size_t i = 0; i < count; i++)
+        {
+            outcome->add(readings[i]);
+        }
+    }
+
+    SensorConfig make_config(Protocol protocol, bool streaming)
+    {
+        SensorConfig config = harness::make_config(PIN, "fuzz");
+        config.streaming = streaming;
+        config.protocol = protocol;
+        config.tx_pin = protocol == PROTOCOL_D0_MODE_C ? TX_PIN : -1;
+        return config;
+    }
+
+    // The sensors every input is run through
+    struct Variant
+    {
+        const char *name;
+        Protocol protocol;
+        bool streaming;
+        bool pool;
+        bool filtered;
+    };
+
+    const Variant VARIANTS[] = {
+        {"sml", PROTOCOL_SML, false, false, false},
+        {"sml, pool", PROTOCOL_SML, false, true, false},
+        {"sml, filtered", PROTOCOL_SML, false, false, true},
+        {"sml streaming", PROTOCOL_SML, true, false, false},
+        {"sml-text", PROTOCOL_SML_TEXT, false, false, false},
+        {"d0", PROTOCOL_D0, false, false, false},
+        {"d0 mode C", PROTOCOL_D0_MODE_C, false, false, false},
+    };
+    const size_t VARIANT_COUNT = sizeof(VARIANTS) / sizeof(Variant);
+
+    // Sends [data] to a sensor of [variant] in pieces that fit the receive
+    // buffer, drawn from [random] together with the capture budgets, and
+    // processes what the sensor read as the loop does. With [random] NULL,
+    // the pieces are as large as the buffer and the budget is unlimited.
+    Outcome feed(const Variant &variant, const uint8_t *data, size_t len, Random *random)
+    {
+        SensorConfig config = make_config(variant.protocol, variant.streaming);
+        if (variant.filtered)
+        {
+            // 1-0:1.8.0*255 and 1-0:16.7.0*255
+            static const uint8_t CODES[2][OBIS_LENGTH] = {{0x01, 0x00, 0x01, 0x08, 0x00, 0xFF},
+                                                          {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF}};
+            config.obis_filter.mode = OBIS_FILTER_ALLOW;
+            config.obis_filter.count = 2;
+            memcpy(config.obis_filter.codes, CODES, sizeof(CODES));
+        }
+        Outcome result;
+        outcome = &result;
+        harness::set_clock_us(0);
+        FramePool *pool = variant.pool ? new FramePool(POOL_SIZE, FRAME_POOL_DROP) : NULL;
+        Sensor *sensor = new Sensor(&config, on_frame, on_readings, pool);
+        SoftwareSerial *serial = SoftwareSerial::find(PIN);
+        for (size_t offset = 0; offset < len || serial->available() > 0 || sensor->ready();)
+        {
+            size_t chunk = random != NULL ? 1 + random->below(SoftwareSerial::BUFFER_CAPACITY) : len;
+            size_t n = std::min(std::min(chunk, len - offset), serial->space());
+            serial->inject(data + offset, n);
+            offset += n;
+            harness::set_clock_us(harness::clock_us() + 1000);
+            size_t budget = random != NULL ? 1 + random->below(4 * RX_CHUNK_SIZE) : SIZE_MAX;
+            if (sensor->capture(budget))
+            {
+                sensor->process();
+            }
+        }
+        check(serial->overflows == 0, "the harness never overflows the receive buffer");
+        delete sensor;
+        delete pool;
+        return result;
+    }
+
+    // Runs one input through the decoders and all sensors
+    void fuzz_one(const uint8_t *data, size_t len)
+    {
+        // A copy of its exact length, so that the sanitizers see every byte read beyond
+        std::vector<uint8_t> copy(data, data + len);
+        Outcome decoded;
+        outcome = &decoded;
+        SmlDecoder::decode(copy.data(), len, [](const SmlReading &r) { outcome->add(r); });
+        check(sml_unescape(copy.data(), len) <= len, "unescaping never makes a message longer");
+        sml_crc16_check(data, len);
+
+        Random random(hash_bytes(2166136261u, data, len));
+        for (size_t v = 0; v < VARIANT_COUNT; v++)
+        {
+            feed(VARIANTS[v], data, len, &random);
+        }
+    }
+
+    // A capture changed at a few places, or two of them spliced
+    void mutate(Random &random, const std::vector<std::vector<uint8_t>> &seeds, std::vector<uint8_t> &data)
+    {
+        data = seeds[random.below(seeds.size())];
+        unsigned changes = 1 + random.below(8);
+        for (unsigned c = 0; c < changes && !data.empty(); c++)
+        {
+            size_t at = random.below(data.size());
+            size_t span = std::min<size_t>(1 + random.below(64), data.size() - at);
+            switch (random.below(7))
+            {
+            case 0:
+                data[at] ^= 1 << random.below(8);
+                break;
+            case 1:
+                data[at] = random.byte();
+                break;
+            case 2:
+                data.insert(data.begin() + at, 1 + random.below(12), SML_ESCAPE);
+                break;
+            case 3:
+                data.erase(data.begin() + at, data.begin() + at + span);
+                break;
+            case 4:
+            {
+                std::vector<uint8_t> piece(data.begin() + at, data.begin() + at + span);
+                data.insert(data.begin() + random.below(data.size()), piece.begin(), piece.end());
+                break;
+            }
+            case 5:
+                data.resize(at);
+                break;
+            default:
+            {
+                const std::vector<uint8_t> &other = seeds[random.below(seeds.size())];
+                size_t from = random.below(other.size());
+                data.resize(at);
+                data.insert(data.end(), other.begin() + from, other.end());
+                break;
+            }
+            }
+        }
+    }
+
+    // Random bytes with start sequences, runs of 0x1B and pieces of
+    // [telegram] in between, up to [max_length]
+    void noise(Random &random, const std::vector<uint8_t> &telegram, std::vector<uint8_t> &data, size_t max_length)
+    {
+        size_t length = random.below(max_length + 1);
+        while (data.size() < length)
+        {
+            uint32_t kind = random.below(16);
+            if (kind == 0)
+            {
+                data.insert(data.end(), START_SEQUENCE, START_SEQUENCE + SML_START_LENGTH);
+            }
+            else if (kind == 1)
+            {
+                data.insert(data.end(), 1 + random.below(8), SML_ESCAPE);
+            }
+            else if (kind == 2)
+            {
+                size_t at = random.below(telegram.size());
+                size_t span = std::min<size_t>(1 + random.below(128), telegram.size() - at);
+                data.insert(data.end(), telegram.begin() + at, telegram.begin() + at + span);
+            }
+            else
+            {
+                data.push_back(random.byte());
+            }
+        }
+    }
+
+    // Frames [payload] as a meter does: fill bytes up to a block of four,
+    // blocks of four 0x1B sent twice, the trailer and the CRC
+    std::vector<uint8_t> frame_payload(std::vector<uint8_t> payload)
+    {
+        static const uint8_t ESCAPE_BLOCK[] = {SML_ESCAPE, SML_ESCAPE, SML_ESCAPE, SML_ESCAPE};
+        uint8_t fill = (4 - payload.size() % 4) % 4;
+        payload.resize(payload.size() + fill, 0);
+        std::vector<uint8_t> frame(START_SEQUENCE, START_SEQUENCE + SML_START_LENGTH);
+        for (size_t i = 0; i < payload.size(); i += 4)
+        {
+            frame.insert(frame.end(), payload.begin() + i, payload.begin() + i + 4);
+            if (memcmp(&payload[i], ESCAPE_BLOCK, 4) == 0)
+            {
+                frame.insert(frame.end(), ESCAPE_BLOCK, ESCAPE_BLOCK + 4);
+            }
+        }
+        frame.insert(frame.end(), ESCAPE_BLOCK, ESCAPE_BLOCK + 4);
+        frame.push_back(SML_END);
+        frame.push_back(fill);
+        uint16_t crc = sml_crc16_final(sml_crc16_update(SML_CRC16_INIT, frame.data(), frame.size()));
+        frame.push_back(crc & 0xFF);
+        frame.push_back(crc >> 8);
+        return frame;
+    }
+
+    struct Seed
+    {
+        const char *path;
+        Protocol protocol;
+    };
+
+    const Seed SEEDS[] = {
+        {"doc/samples/captures/ed300l.bin", PROTOCOL_SML},
+        {"doc/samples/captures/mt175.bin", PROTOCOL_SML},
+        {"doc/samples/captures/protocols/ed300l_text.txt", PROTOCOL_SML_TEXT},
+        {"doc/samples/captures/protocols/q3d_d0.txt", PROTOCOL_D0},
+    };
+}
+
+#ifdef FUZZ_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_one(data, size);
+    return 0;
+}
+#endif
+
+int fuzz_main(int argc, char **argv)
+{
+    unsigned long runs = 2000;
+    uint32_t seed = 1;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = (unsigned long)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: fuzz [--runs N] [--seed S] [input]...\n");
+            return 2;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+
+    // Inputs of afl-fuzz or crashes to reproduce
+    if (!files.empty())
+    {
+        for (size_t f = 0; f < files.size(); f++)
+        {
+            std::vector<uint8_t> data;
+            if (!harness::read_file(files[f], data))
+            {
+                fprintf(stderr, "Unable to read input '%s'.\n", files[f]);
+                return 1;
+            }
+            fuzz_one(data.data(), data.size());
+        }
+        return 0;
+    }
+
+    const size_t SEED_COUNT = sizeof(SEEDS) / sizeof(Seed);
+    std::vector<std::vector<uint8_t>> seeds(SEED_COUNT);
+    for (size_t s = 0; s < SEED_COUNT; s++)
+    {
+        if (!harness::read_file(SEEDS[s].path, seeds[s]) || seeds[s].empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", SEEDS[s].path);
+            return 1;
+        }
+    }
+    Random random(seed);
+    printf("Seed %u, %lu runs\n\n", seed, runs);
+
+    // How the bytes arrive must not matter
+    bool chunks = true;
+    for (size_t s = 0; s < SEED_COUNT; s++)
+    {
+        for (size_t v = 0; v < VARIANT_COUNT; v++)
+        {
+            const Variant &variant = VARIANTS[v];
+            if (variant.protocol != SEEDS[s].protocol)
+            {
+                continue;
+            }
+            const std::vector<uint8_t> &data = seeds[s];
+            Outcome whole = feed(variant, data.data(), data.size(), NULL);
+            bool same = whole.frames + whole.telegrams > 0;
+            for (unsigned long r = 0; r < runs / 100 + 1 && same; r++)
+            {
+                same = feed(variant, data.data(), data.size(), &random) == whole;
+            }
+            printf("  %-38s %-14s %6lu frames %6lu telegrams %7lu readings  %s\n",
+                   harness::basename(SEEDS[s].path).c_str(), variant.name, whole.frames, whole.telegrams,
+                   whole.readings, same ? "same in any chunks" : "DIFFERENT");
+            chunks = chunks && same;
+        }
+    }
+
+    // After noise, the first telegram of the capture is found again
+    std::vector<uint8_t> &capture = seeds[0];
+    SmlStartMatcher matcher;
+    size_t end = SML_START_LENGTH + matcher.scan(&capture[SML_START_LENGTH], capture.size() - SML_START_LENGTH);
+    std::vector<uint8_t> telegram(capture.begin(), capture.begin() + end - SML_START_LENGTH);
+    Outcome reference = feed(VARIANTS[0], telegram.data(), telegram.size(), NULL);
+    Outcome streamed = feed(VARIANTS[3], telegram.data(), telegram.size(), NULL);
+    unsigned long found = 0, first = 0, streamed_first = 0;
+    for (unsigned long r = 0; r < runs; r++)
+    {
+        std::vector<uint8_t> data;
+        noise(random, telegram, data, 512);
+        data.insert(data.end(), telegram.begin(), telegram.end());
+        data.insert(data.end(), telegram.begin(), telegram.end());
+        Outcome buffered = feed(VARIANTS[0], data.data(), data.size(), &random);
+        Outcome streaming = feed(VARIANTS[3], data.data(), data.size(), &random);
+        first += buffered.frames == 2;
+        streamed_first += streaming.telegrams == 2;
+        found += buffered.frames > 0 && buffered.last_frame == reference.last_frame &&
+                 buffered.last_hash == reference.last_hash && streaming.telegrams > 0 &&
+                 streaming.last_hash == streamed.last_hash;
+    }
+    printf("\n  noise followed by a telegram twice: the second one read in %lu of %lu runs, "
+           "the first one too in %lu (streaming %lu)\n",
+           found, runs, first, streamed_first);
+
+    // Only blocks of four 0x1B are escapes, other 0x1B are payload
+    bool blocks = true;
+    for (unsigned long r = 0; r < runs && blocks; r++)
+    {
+        std::vector<uint8_t> payload(1 + random.below(96));
+        for (size_t i = 0; i < payload.size(); i++)
+        {
+            payload[i] = random.byte();
+        }
+        // A run of 0x1B at any offset
+        payload.insert(payload.begin() + random.below(payload.size()), 4 + random.below(5), SML_ESCAPE);
+        std::vector<uint8_t> frame = frame_payload(payload);
+        SmlEscapeScanner scanner;
+        SmlScanResult result = SML_SCAN_MORE;
+        size_t offset = SML_START_LENGTH;
+        while (result == SML_SCAN_MORE && offset < frame.size())
+        {
+            size_t chunk = std::min<size_t>(1 + random.below(16), frame.size() - offset);
+            offset += scanner.scan(&frame[offset], chunk, result);
+        }
+        std::vector<uint8_t> unescaped(frame);
+        unescaped.resize(sml_unescape(unescaped.data(), unescaped.size()));
+        payload.resize(unescaped.size() - SML_START_LENGTH - SML_TRAILER_LENGTH, 0);
+        Outcome sensor = feed(VARIANTS[0], frame.data(), frame.size(), &random);
+        // Unless the payload happens to hold a start sequence
+        blocks = result == SML_SCAN_RESTART ||
+                 (result == SML_SCAN_END && offset == frame.size() - 3 &&
+                  memcmp(&unescaped[SML_START_LENGTH], payload.data(), payload.size()) == 0 &&
+                  sensor.frames == 1 && sensor.last_frame == unescaped);
+    }
+    printf("  payloads with 0x1B on and off the blocks of four: %s\n", blocks ? "framed and unescaped" : "BROKEN");
+
+    // Anything else must not break the sensors
+    unsigned long frames = 0, readings = 0;
+    uint64_t bytes = 0;
+    uint64_t started = harness::wall_us();
+    for (unsigned long r = 0; r < runs; r++)
+    {
+        std::vector<uint8_t> data;
+        if (r % 4 == 3)
+        {
+            noise(random, seeds[0], data, 4096);
+        }
+        else
+        {
+            mutate(random, seeds, data);
+        }
+        Outcome sensor = feed(VARIANTS[r % VARIANT_COUNT], data.data(), data.size(), &random);
+        fuzz_one(data.data(), data.size());
+        frames += sensor.frames + sensor.telegrams;
+        readings += sensor.readings;
+        bytes += data.size();
+    }
+    printf("  %lu mutated captures and noise (%llu bytes): %lu frames and telegrams, %lu readings, %.1f s\n", runs,
+           (unsigned long long)bytes, frames, readings, (harness::wall_us() - started) / 1e6);
+
+    bool ok = chunks && found == runs && blocks;
+    printf("\n%s\n", ok ? "All properties hold" : "Properties violated");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+#include "harness.h"
+#include "Sensor.h"
+#include "SmlCrc.h"
+#include "SmlFraming.h"
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include <MQTT.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <malloc.h>
+
+// Stand-in globals
+HardwareSerial Serial;
+HostEsp ESP;
+
+bool MQTTClient::broker_available = true;
+unsigned long MQTTClient::connects = 0;
+unsigned long MQTTClient::publishes = 0;
+unsigned long MQTTClient::payload_bytes = 0;
+bool MQTTClient::echo = false;
+unsigned long MQTTClient::connect_timeout = 0;
+long MQTTClient::publishes_left = -1;
+std::vector<std::string> *MQTTClient::sent = NULL;
+
+unsigned long WiFiClient::writes = 0;
+unsigned long WiFiClient::bytes_written = 0;
+bool WiFiClient::record = false;
+std::vector<uint8_t> WiFiClient::sent;
+
+static uint64_t virtual_clock_us = 0;
+static unsigned long yield_count = 0;
+
+static std::atomic<size_t> heap_current(0);
+static std::atomic<size_t> heap_high_water(0);
+static std::atomic<unsigned long> heap_allocation_count(0);
+
+#if defined(__GLIBC__) && !defined(NATIVE_NO_HEAP_TRACKING)
+static void heap_track(void *p, bool allocated)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    size_t size = malloc_usable_size(p);
+    if (!allocated)
+    {
+        heap_current.fetch_sub(size, std::memory_order_relaxed);
+        return;
+    }
+    heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size_t now = heap_current.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = heap_high_water.load(std::memory_order_relaxed);
+    while (now > peak && !heap_high_water.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+    {
+    }
+}
+
+// Interpose the allocator so that every malloc, including the ones inside
+// libsml and operator new, is accounted for. Define NATIVE_NO_HEAP_TRACKING
+// when building with sanitizers, which bring their own allocator.
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *p, size_t size);
+    void __libc_free(void *p);
+    void *__libc_memalign(size_t alignment, size_t size);
+
+    void *malloc(size_t size)
+    {
+        void *p = __libc_malloc(size);
+        heap_track(p, true);
+        return p;
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        void *p = __libc_calloc(n, size);
+        heap_track(p, true);
+        return p;
+    }
+
+    void *realloc(void *p, size_t size)
+    {
+        heap_track(p, false);
+        void *q = __libc_realloc(p, size);
+        if (q != NULL || size != 0)
+        {
+            heap_track(q != NULL ? q : p, true);
+        }
+        return q;
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        void *p = __libc_memalign(alignment, size);
+        heap_track(p, true);
+        return p;
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **p, size_t alignment, size_t size)
+    {
+        *p = memalign(alignment, size);
+        return *p != NULL ? 0 : 12; // ENOMEM
+    }
+
+    void free(void *p)
+    {
+        heap_track(p, false);
+        __libc_free(p);
+    }
+}
+#endif
+
+unsigned long millis()
+{
+    return (unsigned long)(virtual_clock_us / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)virtual_clock_us;
+}
+
+void delay(unsigned long ms)
+{
+    virtual_clock_us += (uint64_t)ms * 1000;
+}
+
+void yield()
+{
+    yield_count++;
+}
+
+static SoftwareSerial *instances[SoftwareSerial::MAX_INSTANCES];
+
+void SoftwareSerial::begin(uint32_t baud, SoftwareSerialConfig config, int8_t rxPin, int8_t, bool)
+{
+    this->baud = baud;
+    this->config = config;
+    this->rx_pin = rxPin;
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] == NULL || instances[i] == this)
+        {
+            instances[i] = this;
+            return;
+        }
+    }
+}
+
+SoftwareSerial::~SoftwareSerial()
+{
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] == this)
+        {
+            instances[i] = NULL;
+        }
+    }
+}
+
+SoftwareSerial *SoftwareSerial::find(int8_t rxPin)
+{
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] != NULL && instances[i]->rx_pin == rxPin)
+        {
+            return instances[i];
+        }
+    }
+    return NULL;
+}
+
+namespace harness
+{
+    void set_clock_us(uint64_t us)
+    {
+        virtual_clock_us = us;
+    }
+
+    uint64_t clock_us()
+    {
+        return virtual_clock_us;
+    }
+
+    unsigned long yields()
+    {
+        return yield_count;
+    }
+
+    uint64_t wall_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    uint64_t wall_us()
+    {
+        return wall_ns() / 1000;
+    }
+
+    size_t heap_in_use()
+    {
+        return heap_current.load(std::memory_order_relaxed);
+    }
+
+    size_t heap_peak()
+    {
+        return heap_high_water.load(std::memory_order_relaxed);
+    }
+
+    void heap_reset_peak()
+    {
+        heap_high_water.store(heap_in_use(), std::memory_order_relaxed);
+    }
+
+    unsigned long heap_allocations()
+    {
+        return heap_allocation_count.load(std::memory_order_relaxed);
+    }
+
+    bool read_file(const char *path, std::vector<uint8_t> &data)
+    {
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL)
+        {
+            return false;
+        }
+        uint8_t chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        {
+            data.insert(data.end(), chunk, chunk + n);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    void collect_frames(const std::vector<uint8_t> &data, std::vector<std::vector<uint8_t> > &frames)
+    {
+        SmlStartMatcher start_matcher;
+        SmlEscapeScanner scanner;
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            offset += start_matcher.scan(&data[offset], data.size() - offset);
+            if (!start_matcher.found())
+            {
+                break;
+            }
+            start_matcher.reset();
+            scanner.reset();
+            SmlScanResult status;
+            size_t n = scanner.scan(&data[offset], data.size() - offset, status);
+            if (status != SML_SCAN_END || offset + n + 3 > data.size())
+            {
+                offset += n;
+                continue;
+            }
+            // The start sequence is what the matcher just went over
+            std::vector<uint8_t> frame(data.begin() + (offset - sizeof(START_SEQUENCE)), data.begin() + (offset + n + 3));
+            offset += n + 3;
+            if (sml_crc16_check(&frame[0], frame.size()))
+            {
+                frame.resize(sml_unescape(&frame[0], frame.size()));
+                frames.push_back(frame);
+            }
+        }
+    }
+
+    SensorConfig make_config(int8_t pin, const char *name)
+    {
+        SensorConfig config;
+        memset(&config, 0, sizeof(config));
+        config.pin = (uint8_t)pin;
+        snprintf(config.name, sizeof(config.name), "%s", name);
+        config.publish_mode = PUBLISH_VALUES;
+        config.capture = CAPTURE_SOFTWARE_SERIAL;
+        config.obis_filter.mode = OBIS_FILTER_NONE;
+        config.protocol = PROTOCOL_SML;
+        config.tx_pin = -1;
+        config.overrun = OVERRUN_DROP_OLDEST;
+        return config;
+    }
+
+    std::string basename(const char *path)
+    {
+        std::string name(path);
+        size_t slash = name.find_last_of('/');
+        if (slash != std::string::npos)
+        {
+            name = name.substr(slash + 1);
+        }
+        size_t dot = name.find_last_of('.');
+        if (dot != std::string::npos && dot > 0)
+        {
+            name = name.substr(0, dot);
+        }
+        return name;
+    }
+
+    double Samples::sum() const
+    {
+        double s = 0;
+        for (size_t i = 0; i < this->values.size(); i++)
+        {
+            s += this->values[i];
+        }
+        return s;
+    }
+
+    double Samples::mean() const
+    {
+        return this->values.empty() ? 0 : this->sum() / this->values.size();
+    }
+
+    void Samples::sort()
+    {
+        if (!this->sorted)
+        {
+            std::sort(this->values.begin(), this->values.end());
+            this->sorted = true;
+        }
+    }
+
+    double Samples::percentile(double p)
+    {
+        if (this->values.empty())
+        {
+            return 0;
+        }
+        this->sort();
+        size_t index = (size_t)(p / 100.0 * (this->values.size() - 1) + 0.5);
+        return this->values[index];
+    }
+
+    double Samples::max()
+    {
+        if (this->values.empty())
+        {
+            return 0;
+        }
+        this->sort();
+        return this->values.back();
+    }
+
+    void Samples::print(const char *label, const char *unit)
+    {
+        printf("  %-14s n=%-8zu mean=%-10.2f p50=%-10.2f p99=%-10.2f max=%-10.2f [%s]\n",
+               label, this->count(), this->mean(), this->percentile(50), this->percentile(99),
+               this->max(), unit);
+    }
+}
@@ -0,0 +1,69 @@
+/**
+ * Shared helpers for the host-native benchmark tools.
+ */
+#ifndef NATIVE_HARNESS_H
+#define NATIVE_HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class SensorConfig;
+
+namespace harness
+{
+    // Virtual clock behind millis()/micros()
+    void set_clock_us(uint64_t us);
+    uint64_t clock_us();
+
+    // Calls of yield() so far
+    unsigned long yields();
+
+    // Monotonic wall clock
+    uint64_t wall_us();
+    uint64_t wall_ns();
+
+    // Bytes currently allocated through malloc/new and the high-water mark
+    // since the last reset, tracked by interposing the libc allocator
+    size_t heap_in_use();
+    size_t heap_peak();
+    void heap_reset_peak();
+    unsigned long heap_allocations(); // Number of allocations so far
+
+    bool read_file(const char *path, std::vector<uint8_t> &data);
+    std::string basename(const char *path);
+
+    // Unescaped SML frames with a valid checksum found in [data]
+    void collect_frames(const std::vector<uint8_t> &data, std::vector<std::vector<uint8_t> > &frames);
+
+    // A sensor reading SML through SoftwareSerial at [pin], with everything
+    // else off
+    SensorConfig make_config(int8_t pin, const char *name);
+
+    // Collects samples and reports their distribution
+    class Samples
+    {
+    public:
+        void add(double v)
+        {
+            this->values.push_back(v);
+            this->sorted = false;
+        }
+        size_t count() const { return this->values.size(); }
+        double sum() const;
+        double mean() const;
+        double percentile(double p);
+        double max();
+        void print(const char *label, const char *unit);
+
+    private:
+        std::vector<double> values;
+        bool sorted = false;
+        void sort();
+    };
+
+    typedef int (*Command)(int argc, char **argv);
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Entry point of the host-native build.
+ *
+ * Usage: program <command> [options]
+ */
+#include "harness.h"
+#include <stdio.h>
+#include <string.h>
+
+int replay_main(int argc, char **argv);
+int crc_main(int argc, char **argv);
+int publish_main(int argc, char **argv);
+int capture_main(int argc, char **argv);
+int frames_main(int argc, char **argv);
+int sensors_main(int argc, char **argv);
+int obis_main(int argc, char **argv);
+int metrics_main(int argc, char **argv);
+int readings_main(int argc, char **argv);
+int aggregate_main(int argc, char **argv);
+int protocols_main(int argc, char **argv);
+int scheduler_main(int argc, char **argv);
+int fuzz_main(int argc, char **argv);
+int spsc_main(int argc, char **argv);
+int collect_main(int argc, char **argv);
+int events_main(int argc, char **argv);
+int publisher_main(int argc, char **argv);
+
+struct CommandEntry
+{
+    const char *name;
+    harness::Command run;
+    const char *help;
+};
+
+static const CommandEntry COMMANDS[] = {
+    {"replay", replay_main, "Replay SML captures through the sensor and publish pipeline"},
+    {"crc", crc_main, "Benchmark the CRC16 kernel against a bitwise reference"},
+    {"publish", publish_main, "Benchmark building the topic and payload of a reading"},
+    {"capture", capture_main, "Benchmark reading frames byte by byte against chunked reads"},
+    {"frames", frames_main, "Benchmark finding frames in a multi-megabyte stream"},
+    {"sensors", sensors_main, "Check and time setting up sensors from the configuration store"},
+    {"obis", obis_main, "Benchmark skipping unwanted OBIS codes in the decoder"},
+    {"metrics", metrics_main, "Check and time recording and rendering the metrics"},
+    {"readings", readings_main, "Benchmark serving /api/readings from the snapshots"},
+    {"aggregate", aggregate_main, "Compare aggregating telegrams per window with sampling them"},
+    {"protocols", protocols_main, "Check the SML text and D0 decoders on captured telegrams"},
+    {"scheduler", scheduler_main, "Check that sensors lose no bytes while others are processed"},
+    {"fuzz", fuzz_main, "Feed arbitrary bytes through the sensors and decoders and check properties"},
+    {"spsc", spsc_main, "Stress the ring between capture tasks and the loop with two threads"},
+    {"collect", collect_main, "Decode SML streams of many gateways with a thread pool, or benchmark it"},
+    {"events", events_main, "Compare recording events with formatting debug messages and stress the log"},
+    {"publisher", publisher_main, "Check that the publisher loses or repeats nothing when the broker goes away"},
+};
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s <command> [options]\n\nCommands:\n", program);
+    for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(CommandEntry); i++)
+    {
+        fprintf(stderr, "  %-10s %s\n", COMMANDS[i].name, COMMANDS[i].help);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(CommandEntry); i++)
+    {
+        if (strcmp(argv[1], COMMANDS[i].name) == 0)
+        {
+            return COMMANDS[i].run(argc - 1, argv + 1);
+        }
+    }
+    usage(argv[0]);
+    return 2;
+}
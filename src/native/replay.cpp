@@ -0,0 +1,918 @@
+/**
+ * Replays recorded SML captures through the unmodified sensor state machine
+ * and the parse/publish pipeline of the firmware (MessagePipeline.h).
+ *
+ * Every capture file is attached to its own sensor, bytes are pushed into
+ * the SoftwareSerial stand-ins (or the UART stand-in) either at line rate (9600 baud, paced in real
+ * time) or as fast as the pipeline can take them. Time seen by the sensors
+ * via millis() is always the virtual line-rate time.
+ *
+ * With --compare every frame is additionally decoded by the other parser
+ * (libsml or SmlDecoder) and mismatching readings are reported. With --raw
+ * the frames are forwarded undecoded, and every packet written is read
+ * back as a backend would and checked against the frame.
+ */
+#include "harness.h"
+#include "config.h"
+#include "debug.h"
+#include "MqttPublisher.h"
+#include "MessagePipeline.h"
+#include "SmlDecoder.h"
+#include "SmlFileReadings.h"
+#include "SensorScheduler.h"
+#include "RawFrame.h"
+#include "SmlCrc.h"
+#include <chrono>
+#include <thread>
+
+namespace
+{
+    const uint32_t BAUD_RATE = 9600;
+    const double BYTE_DURATION_US = 10 * 1000000.0 / BAUD_RATE; // 8N1
+
+    struct Replay
+    {
+        std::string name;
+        std::vector<uint8_t> data;
+        SensorConfig *config;
+        Sensor *sensor;
+        SoftwareSerial *serial; // Either of these two
+        HardwareSerial *uart;
+        size_t offset;
+        unsigned long rounds;
+        unsigned long frames;
+        uint64_t bytes;
+        uint64_t capture_ns;
+    };
+
+    std::vector<Replay> replays;
+    Replay *current = NULL; // Whose message is being processed
+    std::vector<Sensor *> sensors;
+    SensorScheduler scheduler;
+
+    MqttPublisher publisher;
+    uint64_t callback_ns = 0;
+    unsigned long empty_frames = 0;
+
+    harness::Samples capture_us;
+    harness::Samples parse_us;
+    harness::Samples publish_us;
+    harness::Samples free_us;
+    harness::Samples total_us;
+
+    bool compare = false;
+    unsigned long compared_frames = 0;
+    unsigned long mismatched_frames = 0;
+
+    struct RecordedReading
+    {
+        uint8_t obis[OBIS_LENGTH];
+        SmlReadingType type;
+        int64_t value;
+        int8_t scaler;
+        uint8_t unit;
+        std::string octets;
+        uint32_t time;
+
+        explicit RecordedReading(const SmlReading &reading)
+            : type(reading.type), value(reading.value), scaler(reading.scaler), unit(reading.unit),
+              octets((const char *)reading.octets, reading.octets_len), time(reading.time)
+        {
+            memcpy(this->obis, reading.obis, OBIS_LENGTH);
+        }
+
+        bool operator==(const RecordedReading &o) const
+        {
+            return memcmp(this->obis, o.obis, OBIS_LENGTH) == 0 && this->type == o.type &&
+                   this->value == o.value && this->scaler == o.scaler && this->unit == o.unit &&
+                   this->octets == o.octets && this->time == o.time;
+        }
+
+        void print(const char *prefix) const
+        {
+            printf("    %s %d-%d:%d.%d.%d*%d type=%d value=%lld scaler=%d unit=%d octets=%zu time=%u\n", prefix,
+                   obis[0], obis[1], obis[2], obis[3], obis[4], obis[5], type, (long long)value, scaler, unit,
+                   octets.size(), time);
+        }
+    };
+
+    void compare_parsers(byte *buffer, size_t len)
+    {
+        std::vector<RecordedReading> decoded;
+        std::vector<RecordedReading> parsed;
+        SmlDecoder::decode(buffer + 8, len - 16, [&decoded](const SmlReading &reading) {
+            decoded.push_back(RecordedReading(reading));
+        });
+        sml_file *file = sml_file_parse(buffer + 8, len - 16);
+        sml_file_readings(file, [&parsed](const SmlReading &reading) {
+            parsed.push_back(RecordedReading(reading));
+        });
+        sml_file_free(file);
+
+        compared_frames++;
+        if (decoded.size() == parsed.size() && std::equal(decoded.begin(), decoded.end(), parsed.begin()))
+        {
+            return;
+        }
+        mismatched_frames++;
+        printf("  Frame %lu of '%s' decodes differently (SmlDecoder: %zu, libsml: %zu readings)\n",
+               current->frames, current->name.c_str(), decoded.size(), parsed.size());
+        for (size_t i = 0; i < std::max(decoded.size(), parsed.size()); i++)
+        {
+            if (i < decoded.size() && i < parsed.size() && decoded[i] == parsed[i])
+            {
+                continue;
+            }
+            if (i < decoded.size())
+            {
+                decoded[i].print("decoder");
+            }
+            if (i < parsed.size())
+            {
+                parsed[i].print("libsml ");
+            }
+        }
+    }
+
+    unsigned long raw_messages = 0;
+    unsigned long raw_mismatches = 0;
+    unsigned long raw_readings = 0;
+
+    // Reads the MQTT packet written for a raw message back and decodes the
+    // frame in it, as a backend would
+    bool check_raw(const byte *frame, size_t len, const Sensor *sensor)
+    {
+        const std::vector<uint8_t> &sent = WiFiClient::sent;
+        size_t n = 1;
+        size_t remaining = 0;
+        for (unsigned shift = 0; n < sent.size() && n < 5; shift += 7)
+        {
+            remaining |= (size_t)(sent[n] & 0x7F) << shift;
+            if ((sent[n++] & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        if (sent.size() < n + 2 || sent[0] != 0x30 || sent.size() - n != remaining)
+        {
+            return false;
+        }
+        size_t topic_length = sent[n] << 8 | sent[n + 1];
+        n += 2;
+        std::string topic((const char *)&sent[n], std::min(topic_length, sent.size() - n));
+        n += topic_length;
+        RawFrameHeader header;
+        size_t header_length = n < sent.size() ? raw_frame_read_header(&sent[n], sent.size() - n, header) : 0;
+        if (header_length == 0 || topic.size() < 4 || topic.compare(topic.size() - 4, 4, "/raw") != 0 ||
+            std::string(header.name, header.name_length) != sensor->config->name ||
+            header.sequence != sensor->sequence || header.device_id != ESP.getChipId() ||
+            header.frame_length != len || memcmp(&sent[n + header_length], frame, len) != 0 ||
+            !sml_crc16_check(&sent[n + header_length], len))
+        {
+            return false;
+        }
+        std::vector<uint8_t> copy(sent.begin() + n + header_length, sent.end());
+        size_t unescaped = sml_unescape(&copy[0], copy.size());
+        return SmlDecoder::decode(&copy[8], unescaped - 16, [](const SmlReading &) { raw_readings++; });
+    }
+
+    size_t processing_heap = 0;
+
+    // Wall time, micros() is line time here
+    struct WallClock
+    {
+        static const unsigned long TICKS_PER_US = 1000;
+
+        static unsigned long now()
+        {
+            return (unsigned long)harness::wall_ns();
+        }
+    };
+
+    const bool wifi_connected = true;
+    MessagePipeline<WallClock> pipeline(publisher, wifi_connected);
+
+    Replay *replay_of(const Sensor *sensor)
+    {
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            if (replays[i].sensor == sensor)
+            {
+                return &replays[i];
+            }
+        }
+        return NULL;
+    }
+
+    // The stages of the pipeline and the capture before it
+    void add_samples(uint64_t total_ns)
+    {
+        current->frames++;
+        capture_us.add(current->capture_ns / 1000.0);
+        current->capture_ns = 0;
+        parse_us.add(pipeline.parse_ticks / 1000.0);
+        publish_us.add(pipeline.publish_ticks / 1000.0);
+        free_us.add(pipeline.free_ticks / 1000.0);
+        total_us.add(total_ns / 1000.0);
+        callback_ns += total_ns;
+    }
+
+    // The listener of main.cpp, with timing and checks around it
+    void process_message(byte *buffer, size_t len, Sensor *sensor)
+    {
+        current = replay_of(sensor);
+        bool raw = sensor->config->publish_mode == PUBLISH_RAW;
+        if (raw)
+        {
+            WiFiClient::sent.clear();
+        }
+        size_t heap_before = harness::heap_in_use();
+        harness::heap_reset_peak();
+        uint64_t t0 = harness::wall_ns();
+        pipeline.process_message(buffer, len, sensor);
+        uint64_t t1 = harness::wall_ns();
+        processing_heap = std::max(processing_heap, harness::heap_peak() - heap_before);
+        add_samples(t1 - t0);
+        if (!pipeline.valid)
+        {
+            empty_frames++;
+        }
+
+        uint64_t t2 = harness::wall_ns();
+        if (raw && !WiFiClient::sent.empty())
+        {
+            raw_messages++;
+            if (!check_raw(buffer, len, sensor))
+            {
+                raw_mismatches++;
+            }
+        }
+        if (compare && !raw)
+        {
+            compare_parsers(buffer, len);
+        }
+        callback_ns += harness::wall_ns() - t2;
+    }
+
+    // Streaming mode: decoding already happened during capture
+    void process_readings(const SmlReading *readings, size_t count, Sensor *sensor)
+    {
+        current = replay_of(sensor);
+        size_t heap_before = harness::heap_in_use();
+        harness::heap_reset_peak();
+        uint64_t t0 = harness::wall_ns();
+        pipeline.process_readings(readings, count, sensor);
+        uint64_t t1 = harness::wall_ns();
+        processing_heap = std::max(processing_heap, harness::heap_peak() - heap_before);
+        add_samples(t1 - t0);
+    }
+
+    void inject(Replay &r, size_t n)
+    {
+        if (r.uart != NULL)
+        {
+            r.uart->inject(&r.data[r.offset], n);
+        }
+        else
+        {
+            r.serial->inject(&r.data[r.offset], n);
+        }
+    }
+
+    // Runs a step of the scheduler as main.cpp does. The time not spent in
+    // the callbacks is capture time, split by the bytes each sensor read.
+    template <typename Step>
+    void scheduled(Step step)
+    {
+        std::vector<uint32_t> bytes_before(replays.size());
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            bytes_before[i] = replays[i].sensor->metrics.bytes_read;
+        }
+        uint64_t before_callbacks = callback_ns;
+        uint64_t t0 = harness::wall_ns();
+        step();
+        uint64_t capture_ns = harness::wall_ns() - t0 - (callback_ns - before_callbacks);
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            bytes += replays[i].sensor->metrics.bytes_read - bytes_before[i];
+        }
+        for (size_t i = 0; bytes > 0 && i < replays.size(); i++)
+        {
+            replays[i].capture_ns += capture_ns * (replays[i].sensor->metrics.bytes_read - bytes_before[i]) / bytes;
+        }
+    }
+
+    unsigned long lost_bytes(const Replay &r)
+    {
+        return r.uart != NULL ? r.uart->overflows : r.serial->overflows;
+    }
+
+    void usage()
+    {
+        fprintf(stderr,
+                "Usage: replay [options] <capture.bin>...\n"
+                "  --realtime     pace the replay at 9600 baud instead of running as fast as possible\n"
+                "  --repeat N     replay every capture N times (default 100, 1 with --realtime)\n"
+                "  --chunk N      bytes handed to each sensor per loop iteration (default: RX buffer size)\n"
+                "  --pool BYTES   frame pool shared by the sensors, per sensor (default FRAME_POOL_SIZE_PER_SENSOR),\n"
+                "                 0 gives every sensor a buffer of its own\n"
+                "  --streaming    decode while bytes arrive instead of buffering whole messages\n"
+                "  --overrun P    message dropped when the previous one was not processed yet: oldest (default) or newest\n"
+                "  --protocol P   what the captures are: sml (default), sml-text or d0 (sent by the meter)\n"
+                "  --uart         receive the first capture through the hardware UART instead of SoftwareSerial\n"
+                "  --changes S    publish changed values only (deadbands of config.h), all of them every S seconds\n"
+                "  --queue N      keep up to N readings per sensor while the broker is unavailable\n"
+                "  --spill BYTES  move queued readings exceeding the queue to files of up to BYTES in /tmp\n"
+                "  --outage S     make the broker unavailable for the first S seconds of line time\n"
+                "  --connect-timeout MS\n"
+                "                 time an unreachable broker holds a connection attempt up, bounded by\n"
+                "                 MQTT_CONNECT_TIMEOUT (default 0)\n"
+                "  --json         publish one JSON document per telegram instead of one message per value\n"
+                "  --raw          forward the messages undecoded and check what a backend receives\n"
+                "  --aggregate S  publish a summary of every S seconds instead of the telegrams\n"
+                "  --allow CODES  decode only these OBIS codes, e.g. \"1.8.0, 2.8.0, 16.7.0\"\n"
+                "  --deny CODES   decode everything but these OBIS codes\n"
+                "  --echo         print every MQTT publish\n"
+                "  --metrics      print the Prometheus metrics page at the end\n"
+                "  --readings     print the /api/readings document at the end\n"
+                "  --compare      decode every frame with both SmlDecoder and libsml and report differences\n");
+    }
+}
+
+int replay_main(int argc, char **argv)
+{
+    bool realtime = false;
+    bool streaming = false;
+    Protocol protocol = PROTOCOL_SML;
+    OverrunPolicy overrun = OVERRUN_DROP_OLDEST;
+    PublishMode publish_mode = PUBLISH_VALUES;
+    bool uart = false;
+    bool metrics = false;
+    bool readings = false;
+    long heartbeat = -1;
+    uint16_t aggregation = 0;
+    uint16_t queue = 0;
+    size_t spill = 0;
+    double outage = 0;
+    ObisFilter obis_filter = {OBIS_FILTER_NONE, 0, {}};
+    long repeat = -1;
+    size_t chunk = SoftwareSerial::BUFFER_CAPACITY;
+    size_t pool_size = FRAME_POOL_SIZE_PER_SENSOR;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)
+        {
+            realtime = true;
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc)
+        {
+            chunk = (size_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pool") == 0 && i + 1 < argc)
+        {
+            pool_size = (size_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--streaming") == 0)
+        {
+            streaming = true;
+        }
+        else if (strcmp(argv[i], "--protocol") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "sml-text") == 0)
+            {
+                protocol = PROTOCOL_SML_TEXT;
+            }
+            else if (strcmp(argv[i], "d0") == 0)
+            {
+                protocol = PROTOCOL_D0;
+            }
+            else if (strcmp(argv[i], "sml") != 0)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--overrun") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "newest") == 0)
+            {
+                overrun = OVERRUN_DROP_NEWEST;
+            }
+            else if (strcmp(argv[i], "oldest") != 0)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--uart") == 0)
+        {
+            uart = true;
+        }
+        else if (strcmp(argv[i], "--changes") == 0 && i + 1 < argc)
+        {
+            heartbeat = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+        {
+            queue = (uint16_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--spill") == 0 && i + 1 < argc)
+        {
+            spill = (size_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--outage") == 0 && i + 1 < argc)
+        {
+            outage = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--connect-timeout") == 0 && i + 1 < argc)
+        {
+            MQTTClient::connect_timeout = (unsigned long)atol(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--allow") == 0 || strcmp(argv[i], "--deny") == 0) && i + 1 < argc)
+        {
+            obis_filter.mode = strcmp(argv[i], "--allow") == 0 ? OBIS_FILTER_ALLOW : OBIS_FILTER_DENY;
+            if (!obis_filter.parse(argv[++i]))
+            {
+                fprintf(stderr, "Invalid OBIS codes '%s'.\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--aggregate") == 0 && i + 1 < argc)
+        {
+            aggregation = (uint16_t)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            publish_mode = PUBLISH_JSON;
+        }
+        else if (strcmp(argv[i], "--raw") == 0)
+        {
+            publish_mode = PUBLISH_RAW;
+            WiFiClient::record = true;
+        }
+        else if (strcmp(argv[i], "--compare") == 0)
+        {
+            compare = true;
+        }
+        else if (strcmp(argv[i], "--echo") == 0)
+        {
+            MQTTClient::echo = true;
+        }
+        else if (strcmp(argv[i], "--metrics") == 0)
+        {
+            metrics = true;
+        }
+        else if (strcmp(argv[i], "--readings") == 0)
+        {
+            readings = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || chunk == 0 || files.size() > SoftwareSerial::MAX_INSTANCES)
+    {
+        usage();
+        return 2;
+    }
+    if (repeat < 1)
+    {
+        repeat = realtime ? 1 : 100;
+    }
+
+    MqttConfig mqttConfig;
+    publisher.setup(mqttConfig);
+    publisher.connect();
+
+    size_t heap_baseline = harness::heap_in_use();
+    size_t heap_sensors = harness::heap_in_use();
+    FramePool *pool = pool_size > 0 ? new FramePool(pool_size, FRAME_POOL_FALLBACK) : NULL;
+    heap_sensors = harness::heap_in_use() - heap_sensors;
+
+    replays.resize(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Replay &r = replays[i];
+        if (!harness::read_file(files[i], r.data) || r.data.empty())
+        {
+            fprintf(stderr, "Unable to read capture '%s'.\n", files[i]);
+            return 1;
+        }
+        r.name = harness::basename(files[i]);
+        size_t heap_before_sensor = harness::heap_in_use();
+        // The UART receives at D7 with its pins swapped
+        bool hardware = uart && i == 0;
+        r.config = new SensorConfig(harness::make_config(hardware ? D7 : i + 1, r.name.c_str()));
+        r.config->streaming = streaming;
+        r.config->changes_only = heartbeat >= 0;
+        r.config->heartbeat = (uint16_t)(heartbeat >= 0 ? heartbeat : 0);
+        r.config->publish_mode = publish_mode;
+        r.config->offline_queue = queue;
+        r.config->capture = hardware ? CAPTURE_HARDWARE_SERIAL : CAPTURE_SOFTWARE_SERIAL;
+        r.config->obis_filter = obis_filter;
+        r.config->aggregation = aggregation;
+        r.config->protocol = protocol;
+        r.config->overrun = overrun;
+        r.sensor = new Sensor(r.config, process_message, process_readings, pool);
+        if (r.config->changes_only)
+        {
+            r.sensor->change_filter = new ChangeFilter(DEADBAND_CONFIGS, NUM_OF_DEADBANDS, r.config->heartbeat);
+        }
+        if (r.config->offline_queue > 0)
+        {
+            SpillFile *spill_file = NULL;
+            if (spill > 0)
+            {
+                char path[64];
+                snprintf(path, sizeof(path), "/tmp/smlreader_queue%zu.bin", i);
+                remove(path);
+                spill_file = new SpillFile(path);
+            }
+            r.sensor->queue = new ReadingQueue(r.config->offline_queue, spill_file, spill);
+        }
+        r.sensor->snapshot = new ReadingSnapshot(READINGS_SNAPSHOT_SIZE);
+        r.sensor->snapshot->request(); // As if polled from the start
+        if (aggregation > 0)
+        {
+            r.sensor->aggregator = new Aggregator(aggregation);
+        }
+        r.serial = hardware ? NULL : SoftwareSerial::find(r.config->pin);
+        r.uart = hardware ? &Serial : NULL;
+        sensors.push_back(r.sensor);
+        heap_sensors += harness::heap_in_use() - heap_before_sensor;
+        r.offset = 0;
+        r.rounds = 0;
+        r.frames = 0;
+        r.bytes = 0;
+        r.capture_ns = 0;
+    }
+    scheduler.set_sensors(&sensors[0], (uint8_t)sensors.size());
+
+
+    uint64_t started = harness::wall_ns();
+    uint64_t virtual_us = 0;
+    bool pending = true;
+    while (pending)
+    {
+        // Time normally advances by one chunk per iteration, but more when
+        // something blocked (e.g. a connect timing out), and all bytes
+        // arriving meanwhile have to go through the RX buffer
+        virtual_us = std::max(virtual_us + (uint64_t)(chunk * BYTE_DURATION_US), harness::clock_us());
+        uint64_t line_bytes = (uint64_t)(virtual_us / BYTE_DURATION_US);
+        pending = false;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            Replay &r = replays[i];
+            while (r.rounds < (unsigned long)repeat && r.bytes < line_bytes)
+            {
+                size_t n = (size_t)std::min<uint64_t>(line_bytes - r.bytes, r.data.size() - r.offset);
+                inject(r, n);
+                r.offset += n;
+                r.bytes += n;
+                if (r.offset == r.data.size())
+                {
+                    r.offset = 0;
+                    r.rounds++;
+                }
+            }
+            pending = pending || r.rounds < (unsigned long)repeat;
+        }
+
+        harness::set_clock_us(virtual_us);
+        MQTTClient::broker_available = virtual_us >= outage * 1e6;
+        if (realtime)
+        {
+            uint64_t due = started + virtual_us * 1000;
+            uint64_t now = harness::wall_ns();
+            if (due > now)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+            }
+        }
+
+        // Same steps as loop() in main.cpp
+        scheduled([] { scheduler.capture(); });
+        publisher.loop();
+        scheduled([] { scheduler.capture(); });
+        scheduled([] { scheduler.process(); });
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            publisher.drain(replays[i].sensor);
+            publisher.summarize(replays[i].sensor);
+            scheduled([] { scheduler.capture(); });
+        }
+    }
+    // Let the sensors process the message completed by the last bytes
+    scheduled([] {
+        scheduler.capture();
+        scheduler.process();
+    });
+    // Give the queues the time to drain after the captures ended
+    if (queue > 0 && !MQTTClient::broker_available)
+    {
+        MQTTClient::broker_available = true;
+        publisher.connect();
+    }
+    for (uint64_t until = virtual_us + 600 * 1000000ULL; queue > 0 && virtual_us < until;)
+    {
+        bool drained = true;
+        publisher.loop();
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            publisher.drain(replays[i].sensor);
+            drained = drained && replays[i].sensor->queue->empty();
+        }
+        if (drained)
+        {
+            break;
+        }
+        virtual_us = std::max(virtual_us + BACKFILL_INTERVAL * 1000, harness::clock_us());
+        harness::set_clock_us(virtual_us);
+    }
+    double elapsed = (harness::wall_ns() - started) / 1e9;
+
+    unsigned long frames = 0;
+    uint64_t bytes = 0;
+    unsigned long overflows = 0;
+    printf("%sReplayed %zu capture(s) in %.3f s (%s, %.1f s of line time, %s)\n\n",
+           compare ? "\n" : "", replays.size(), elapsed, realtime ? "line rate" : "as fast as possible",
+           virtual_us / 1e6,
+           protocol == PROTOCOL_SML_TEXT ? "SmlTextDecoder" : protocol == PROTOCOL_D0 ? "D0Decoder" :
+           streaming ? "SmlFrameDecoder" :
+#ifdef USE_LIBSML_PARSER
+           "libsml"
+#else
+           "SmlDecoder"
+#endif
+    );
+    printf("  %-24s %12s %10s %10s %10s\n", "capture", "bytes", "frames", "crc errors", "overflows");
+    for (size_t i = 0; i < replays.size(); i++)
+    {
+        Replay &r = replays[i];
+        printf("  %-24s %12llu %10lu %10lu %10lu\n", r.name.c_str(), (unsigned long long)r.bytes, r.frames,
+               r.sensor->get_crc_errors(), lost_bytes(r));
+        frames += r.frames;
+        bytes += r.bytes;
+        overflows += lost_bytes(r);
+    }
+
+    printf("\nThroughput\n");
+    printf("  frames/s       %.1f\n", frames / elapsed);
+    printf("  bytes/s        %.0f (%.1fx line rate per sensor)\n", bytes / elapsed,
+           bytes / elapsed / replays.size() / (BAUD_RATE / 10));
+    printf("  undecodable frames: %lu\n", empty_frames);
+    unsigned long overruns = 0;
+    for (size_t i = 0; i < replays.size(); i++)
+    {
+        overruns += replays[i].sensor->metrics.overruns;
+    }
+    printf("  overruns: %lu frames dropped before they were processed\n", overruns);
+    if (compare)
+    {
+        printf("  parser mismatches: %lu of %lu frames\n", mismatched_frames, compared_frames);
+    }
+
+    printf("\nLatency per frame\n");
+    capture_us.print("capture", "us");
+    parse_us.print("parse", "us");
+    publish_us.print("publish", "us");
+    free_us.print("free", "us");
+    total_us.print("process", "us");
+
+    printf("\nHeap\n");
+    printf("  baseline       %zu bytes\n", heap_baseline);
+    printf("  sensors        %zu bytes (%zu per sensor)\n", heap_sensors, heap_sensors / replays.size());
+    printf("  high-water     %zu bytes allocated at most while processing a frame\n", processing_heap);
+    if (pool != NULL)
+    {
+        printf("  frame pool     %zu bytes, at most %zu lent, longest message %zu bytes, %lu buffers from the heap\n",
+               pool->get_size(), pool->get_peak(), pool->get_max_length(), pool->get_allocations());
+    }
+
+    printf("\nMQTT\n");
+    printf("  publishes      %lu (%lu payload bytes)\n", MQTTClient::publishes, MQTTClient::payload_bytes);
+    if (publish_mode == PUBLISH_RAW)
+    {
+        printf("  raw            %lu messages forwarded (%lu bytes written directly), %lu not as read, "
+               "%lu readings decoded from them\n",
+               raw_messages, WiFiClient::bytes_written, raw_mismatches, raw_readings);
+    }
+    printf("  connects       %lu attempts, %lu failed, %lu ms blocked\n", publisher.getConnectAttempts(),
+           publisher.getConnectFailures(), publisher.getBlockedMillis());
+    if (queue > 0)
+    {
+        unsigned long pushed = 0, dropped = 0, left = 0;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            ReadingQueue *q = replays[i].sensor->queue;
+            pushed += q->get_pushed();
+            dropped += q->get_dropped();
+            left += q->size();
+        }
+        printf("  queued         %lu readings while offline, %lu dropped, %lu not drained\n", pushed, dropped,
+               left);
+    }
+    if (heartbeat >= 0)
+    {
+        unsigned long suppressed = 0;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            suppressed += replays[i].sensor->change_filter->get_suppressed();
+        }
+        printf("  suppressed     %lu unchanged readings\n", suppressed);
+    }
+    if (aggregation > 0)
+    {
+        unsigned long untracked = 0, pending = 0;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            untracked += replays[i].sensor->aggregator->get_untracked();
+            pending += replays[i].sensor->aggregator->get_telegrams();
+        }
+        printf("  aggregated     %lu untracked readings, %lu telegrams of open windows\n", untracked, pending);
+    }
+
+    if (metrics)
+    {
+        // Heap figures of the device have no counterpart on the host
+        DeviceMetrics device;
+        memset(&device, 0, sizeof(device));
+        device.uptime = (uint32_t)(virtual_us / 1000000);
+        publisher.getMetrics(device);
+        if (pool != NULL)
+        {
+            device.frame_pool_size = pool->get_size();
+            device.frame_pool_peak = pool->get_peak();
+            device.frame_max_length = pool->get_max_length();
+            device.frame_allocations = pool->get_allocations();
+        }
+        std::vector<const SensorMetrics *> sensor_metrics;
+        std::vector<const char *> names;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            sensor_metrics.push_back(&replays[i].sensor->metrics);
+            names.push_back(replays[i].config->name);
+        }
+        // As published every STATS_INTERVAL seconds, shown with --echo
+        publisher.publishStats(device, &sensors[0], (uint8_t)sensors.size());
+        char buffer[512];
+        PrometheusWriter writer(buffer, sizeof(buffer), [](const char *data, size_t len, void *) {
+            fwrite(data, 1, len, stdout);
+        }, NULL);
+        printf("\nMetrics (latencies in virtual time, except parsing)\n");
+        write_metrics(writer, device, &sensor_metrics[0], &names[0], (uint8_t)replays.size());
+    }
+
+    if (readings)
+    {
+        std::vector<const ReadingSnapshot *> snapshots;
+        std::vector<const char *> names;
+        for (size_t i = 0; i < replays.size(); i++)
+        {
+            snapshots.push_back(replays[i].sensor->snapshot);
+            names.push_back(replays[i].config->name);
+        }
+        printf("\nReadings (ages in virtual time)\n");
+        write_readings(&snapshots[0], &names[0], (uint8_t)replays.size(), millis(), [](const char *data, size_t len) {
+            fwrite(data, 1, len, stdout);
+        });
+        printf("\n");
+    }
+
+    for (size_t i = 0; i < replays.size(); i++)
+    {
+        delete replays[i].sensor;
+        delete replays[i].config;
+    }
+    delete pool;
+    return overflows == 0 && raw_mismatches == 0 ? 0 : 1;
+}
+
+namespace
+{
+    // Lets the broker go away after [publishes] publishes, runs [step] until
+    // it is back and returns what reached it
+    template <typename F>
+    std::vector<std::string> across_outage(long publishes, F step)
+    {
+        std::vector<std::string> sent;
+        MQTTClient::sent = &sent;
+        MQTTClient::publishes_left = publishes;
+        step();
+        MQTTClient::broker_available = true;
+        MQTTClient::publishes_left = -1;
+        publisher.connect();
+        publisher.loop();
+        step();
+        MQTTClient::sent = NULL;
+        return sent;
+    }
+
+    // Values of the "message of N bytes too short" events in what was sent
+    std::vector<unsigned long> short_messages(const std::vector<std::string> &sent, unsigned long &lines)
+    {
+        std::vector<unsigned long> values;
+        lines = 0;
+        for (size_t i = 0; i < sent.size(); i++)
+        {
+            const char *line = sent[i].c_str();
+            while (line != NULL && *line != '\0')
+            {
+                const char *found = strstr(line, "message of ");
+                const char *end = strchr(line, '\n');
+                if (found != NULL && (end == NULL || found < end))
+                {
+                    values.push_back(strtoul(found + strlen("message of "), NULL, 10));
+                }
+                lines++;
+                line = end != NULL ? end + 1 : NULL;
+            }
+        }
+        return values;
+    }
+}
+
+int publisher_main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    MqttConfig mqttConfig;
+    publisher.setup(mqttConfig);
+    publisher.connect();
+    publisher.loop();
+    bool ok = true;
+
+#if EVENT_LOG_SIZE > 0
+    // More than one message takes, with the broker gone after the first
+    const unsigned long EVENTS = EVENT_LOG_SIZE * 5 / 8;
+    for (unsigned long i = 0; i < EVENTS; i++)
+    {
+        event_log().record(EVENT_MESSAGE_TOO_SHORT, "meter", i);
+    }
+    unsigned long lines;
+    std::vector<unsigned long> values = short_messages(across_outage(1, [] { publisher.publishEvents(); }), lines);
+    bool events_ok = values.size() == EVENTS && lines == EVENTS;
+    for (size_t i = 0; events_ok && i < values.size(); i++)
+    {
+        events_ok = values[i] == i;
+    }
+    printf("events     %lu of %lu published once, in order: %s\n", (unsigned long)values.size(), EVENTS,
+           events_ok ? "yes" : "no");
+    ok = ok && events_ok;
+#endif
+
+    // A summary of several documents, with the broker gone after the first
+    SensorConfig config = harness::make_config(1, "meter");
+    Sensor sensor(&config, [](byte *, size_t, Sensor *) {});
+    sensor.aggregator = new Aggregator(60);
+    uint8_t obis[AGGREGATOR_SIZE][OBIS_LENGTH];
+    for (uint8_t i = 0; i < AGGREGATOR_SIZE; i++)
+    {
+        const uint8_t code[OBIS_LENGTH] = {1, 0, (uint8_t)(i + 1), 7, 0, 255};
+        memcpy(obis[i], code, OBIS_LENGTH);
+        SmlReading reading;
+        memset(&reading, 0, sizeof(reading));
+        reading.obis = obis[i];
+        reading.type = SML_READING_INTEGER;
+        reading.value = 100 * (i + 1);
+        reading.unit = 27;
+        sensor.aggregator->add(reading);
+    }
+    sensor.aggregator->end_telegram(millis());
+    harness::set_clock_us(harness::clock_us() + 61 * 1000000ULL);
+    std::vector<std::string> sent = across_outage(1, [&sensor] { publisher.summarize(&sensor); });
+    bool summary_ok = sent.size() > 1;
+    for (uint8_t i = 0; i < AGGREGATOR_SIZE; i++)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "\"obis\":\"1-0:%u.7.0*255\"", i + 1);
+        unsigned long found = 0;
+        for (size_t j = 0; j < sent.size(); j++)
+        {
+            found += strstr(sent[j].c_str(), key) != NULL ? 1 : 0;
+        }
+        summary_ok = summary_ok && found == 1;
+    }
+    printf("summary    %lu documents, every OBIS code in one of them: %s\n", (unsigned long)sent.size(),
+           summary_ok ? "yes" : "no");
+    ok = ok && summary_ok;
+
+    printf("\n%s\n", ok ? "Nothing lost or repeated across outages" : "The publisher lost or repeated messages");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/**
+ * Host stand-in for the parts of the Arduino core used by SMLReader.
+ *
+ * Only what the sensor state machine and the MQTT publisher touch is
+ * provided. Time is virtual and driven by the replay harness.
+ */
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define D1 5
+#define D2 4
+#define D5 14
+#define D6 12
+#define D7 13
+#define LED_BUILTIN 2
+
+#define HEX 16
+#define DEC 10
+
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield(); // Counted, see harness::yields()
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall; }
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : s(s ? s : "") {}
+    String(const std::string &s) : s(s) {}
+    String(int v) : s(std::to_string(v)) {}
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.size(); }
+
+    String &operator+=(const String &o)
+    {
+        s += o.s;
+        return *this;
+    }
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s); }
+
+private:
+    std::string s;
+};
+
+enum SerialConfig
+{
+    SERIAL_8N1,
+    SERIAL_7E1
+};
+
+// UART with the receive FIFO of the ESP8266 core (256 bytes unless resized
+// before begin()). Output goes to stderr. The replay harness pushes captured
+// bytes in like the UART interrupt would.
+class HardwareSerial
+{
+public:
+    static const size_t DEFAULT_RX_BUFFER_SIZE = 256;
+
+    void begin(unsigned long baud, SerialConfig config = SERIAL_8N1)
+    {
+        this->baud = baud;
+        this->config = config;
+        this->rx_pin = 3; // Pins are swapped after begin()
+        this->rx.assign(this->rx_buffer_size, 0);
+        this->head = 0;
+        this->count = 0;
+    }
+    void end() { this->rx.clear(); this->count = 0; }
+    size_t setRxBufferSize(size_t size)
+    {
+        this->rx_buffer_size = size;
+        return size;
+    }
+    void swap() { this->rx_pin = this->rx_pin == 3 ? 13 : 3; }
+
+    int available() { return (int)this->count; }
+    size_t read(char *buffer, size_t size)
+    {
+        size_t n = size < this->count ? size : this->count;
+        size_t first = n < this->rx.size() - this->head ? n : this->rx.size() - this->head;
+        memcpy(buffer, &this->rx[this->head], first);
+        memcpy(buffer + first, &this->rx[0], n - first);
+        this->head = (this->head + n) % this->rx.size();
+        this->count -= n;
+        return n;
+    }
+    bool hasOverrun()
+    {
+        bool overrun = this->overrun;
+        this->overrun = false;
+        return overrun;
+    }
+
+    size_t write(const uint8_t *data, size_t len)
+    {
+        this->written.insert(this->written.end(), data, data + len);
+        return len;
+    }
+    void print(const char *s) { fputs(s, stderr); }
+    void print(int v, int base = DEC) { fprintf(stderr, base == HEX ? "%X" : "%d", v); }
+    void println(const char *s = "") { fprintf(stderr, "%s\n", s); }
+
+    // Harness side: queue received bytes, returns how many fit
+    size_t inject(const byte *data, size_t len)
+    {
+        size_t n = 0;
+        for (; n < len && this->count < this->rx.size(); n++)
+        {
+            this->rx[(this->head + this->count) % this->rx.size()] = data[n];
+            this->count++;
+        }
+        if (n < len)
+        {
+            this->overflows += len - n;
+            this->overrun = true;
+        }
+        return n;
+    }
+    size_t space() const { return this->rx.size() - this->count; }
+
+    int8_t rx_pin = 3;
+    unsigned long baud = 0;
+    SerialConfig config = SERIAL_8N1;
+    std::vector<byte> written; // Everything sent
+    unsigned long overflows = 0;
+
+private:
+    std::vector<byte> rx;
+    size_t rx_buffer_size = DEFAULT_RX_BUFFER_SIZE;
+    size_t head = 0;
+    size_t count = 0;
+    bool overrun = false;
+};
+extern HardwareSerial Serial;
+
+class HostEsp
+{
+public:
+    uint32_t getChipId() { return 0x00C0FFEE; }
+    void restart() { exit(0); }
+};
+extern HostEsp ESP;
+
+#endif
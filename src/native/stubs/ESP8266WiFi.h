@@ -0,0 +1,42 @@
+/**
+ * Host stand-in for the ESP8266 WiFi client.
+ *
+ * Only what the publisher writes to the connection itself (raw messages)
+ * arrives here, the MQTT client stand-in does not use it. Written bytes
+ * are counted and, if asked for, kept for the harness to check. The
+ * timeout bounds how long the MQTT client stand-in's connects block.
+ */
+#ifndef NATIVE_ESP8266_WIFI_H
+#define NATIVE_ESP8266_WIFI_H
+
+#include "Arduino.h"
+#include <vector>
+
+class WiFiClient
+{
+public:
+    static unsigned long writes;
+    static unsigned long bytes_written;
+    static bool record;
+    static std::vector<uint8_t> sent; // Written while [record] is set
+
+    size_t write(const uint8_t *data, size_t len)
+    {
+        writes++;
+        bytes_written += len;
+        if (record)
+        {
+            sent.insert(sent.end(), data, data + len);
+        }
+        return len;
+    }
+
+    void stop() {}
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+    unsigned long getTimeout() const { return this->timeout; }
+
+private:
+    unsigned long timeout = 5000; // As the ESP8266 core
+};
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * Host stand-in for MicroDebug, debug output goes to stderr.
+ */
+#ifndef NATIVE_FORMATTING_SERIAL_DEBUG_H
+#define NATIVE_FORMATTING_SERIAL_DEBUG_H
+
+#include "Arduino.h"
+
+#ifndef SERIAL_DEBUG_IMPL
+#define SERIAL_DEBUG_IMPL Serial
+#endif
+
+#if (defined(SERIAL_DEBUG) && SERIAL_DEBUG)
+#define SERIAL_DEBUG_SETUP(speed)
+#define DEBUG(...)                        \
+    do                                    \
+    {                                     \
+        fprintf(stderr, __VA_ARGS__);     \
+        fputc('\n', stderr);              \
+    } while (0)
+#else
+#define SERIAL_DEBUG_SETUP(speed)
+#define DEBUG(...)
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * Host stand-in for arduino-mqtt's MQTTClient.
+ *
+ * Nothing goes over the network. Publishes are counted so the harness can
+ * report what the device would have sent, and the connection state can be
+ * forced by the harness to simulate an unavailable broker, optionally with
+ * connection attempts that take a while to fail, or going away after a
+ * number of publishes.
+ */
+#ifndef NATIVE_MQTT_H
+#define NATIVE_MQTT_H
+
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include <string>
+#include <vector>
+
+class MQTTClient
+{
+public:
+    // Shared by all clients, the harness only ever creates one publisher
+    static bool broker_available;
+    static unsigned long connects;
+    static unsigned long publishes;
+    static unsigned long payload_bytes;
+    static bool echo;
+    static unsigned long connect_timeout; // Milliseconds a failing connect blocks at most
+    static long publishes_left;           // Before the broker goes away, -1 for no limit
+    static std::vector<std::string> *sent; // Gets topic and payload of every publish if set
+
+    explicit MQTTClient(int bufSize = 128) : buffer_size(bufSize) {}
+    // Only the write buffer limits what can be published
+    MQTTClient(int, int writeBufSize) : buffer_size(writeBufSize) {}
+
+    void begin(const char *, int, WiFiClient &net) { this->net = &net; }
+    void setTimeout(int) {}
+    bool connect(const char *, const char *, const char *)
+    {
+        connects++;
+        this->is_connected = broker_available;
+        if (!this->is_connected)
+        {
+            // The unreachable broker holds the connect up until the client
+            // gives up
+            delay(this->net != NULL && this->net->getTimeout() < connect_timeout ? this->net->getTimeout()
+                                                                                   : connect_timeout);
+        }
+        return this->is_connected;
+    }
+    bool connected() { return this->is_connected && broker_available; }
+    bool loop() { return this->connected(); }
+
+    bool publish(const char *topic, const char *payload)
+    {
+        return this->publish(topic, payload, (int)strlen(payload));
+    }
+    bool publish(const char *topic, const char *payload, int length)
+    {
+        if (!this->connected() || (int)(strlen(topic) + length) > this->buffer_size)
+        {
+            return false;
+        }
+        if (publishes_left == 0)
+        {
+            broker_available = false;
+            return false;
+        }
+        if (publishes_left > 0)
+        {
+            publishes_left--;
+        }
+        publishes++;
+        payload_bytes += length;
+        if (echo)
+        {
+            printf("%s %.*s\n", topic, length, payload);
+        }
+        if (sent != NULL)
+        {
+            sent->push_back(std::string(topic) + " " + std::string(payload, length));
+        }
+        return true;
+    }
+
+private:
+    int buffer_size;
+    bool is_connected = false;
+    WiFiClient *net = NULL;
+};
+
+#endif
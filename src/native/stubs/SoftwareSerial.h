@@ -0,0 +1,103 @@
+/**
+ * Host stand-in for EspSoftwareSerial.
+ *
+ * Instances register themselves by RX pin so the replay harness can push
+ * captured bytes into them. The RX buffer has the same default capacity as
+ * the real library and overflows the same way.
+ */
+#ifndef NATIVE_SOFTWARE_SERIAL_H
+#define NATIVE_SOFTWARE_SERIAL_H
+
+#include "Arduino.h"
+
+enum SoftwareSerialConfig
+{
+    SWSERIAL_8N1,
+    SWSERIAL_7E1
+};
+
+class SoftwareSerial
+{
+public:
+    static const size_t BUFFER_CAPACITY = 64;
+    static const uint8_t MAX_INSTANCES = 8;
+
+    ~SoftwareSerial();
+
+    void begin(uint32_t baud, SoftwareSerialConfig config, int8_t rxPin, int8_t txPin, bool invert);
+    void end()
+    {
+        this->head = 0;
+        this->count = 0;
+    }
+    void enableTx(bool) {}
+    size_t write(const uint8_t *data, size_t len)
+    {
+        this->written.insert(this->written.end(), data, data + len);
+        return len;
+    }
+    void enableRx(bool) {}
+
+    int available() { return this->count; }
+    int read()
+    {
+        if (this->count == 0)
+        {
+            return -1;
+        }
+        byte b = this->rx[this->head];
+        this->head = (this->head + 1) % BUFFER_CAPACITY;
+        this->count--;
+        return b;
+    }
+    size_t read(byte *buffer, size_t size)
+    {
+        size_t n = size < this->count ? size : this->count;
+        size_t first = n < BUFFER_CAPACITY - this->head ? n : BUFFER_CAPACITY - this->head;
+        memcpy(buffer, this->rx + this->head, first);
+        memcpy(buffer + first, this->rx, n - first);
+        this->head = (this->head + n) % BUFFER_CAPACITY;
+        this->count -= n;
+        return n;
+    }
+    bool overflow()
+    {
+        bool overflowed = this->overflowed;
+        this->overflowed = false;
+        return overflowed;
+    }
+
+    // Harness side: queue received bytes, returns how many fit
+    size_t inject(const byte *data, size_t len)
+    {
+        size_t n = 0;
+        for (; n < len && this->count < BUFFER_CAPACITY; n++)
+        {
+            this->rx[(this->head + this->count) % BUFFER_CAPACITY] = data[n];
+            this->count++;
+        }
+        if (n < len)
+        {
+            this->overflows += len - n;
+            this->overflowed = true;
+        }
+        return n;
+    }
+    size_t space() const { return BUFFER_CAPACITY - this->count; }
+
+    static SoftwareSerial *find(int8_t rxPin);
+
+    int8_t rx_pin = -1;
+    uint32_t baud = 0;
+    SoftwareSerialConfig config = SWSERIAL_8N1;
+    std::vector<byte> written; // Everything sent
+    unsigned long overflows = 0;
+
+private:
+    byte rx[BUFFER_CAPACITY];
+    size_t head = 0;
+    size_t count = 0;
+    bool overflowed = false;
+};
+
+#endif
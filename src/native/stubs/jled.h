@@ -0,0 +1,19 @@
+/**
+ * Host stand-in for JLed, the status LED does nothing on the host.
+ */
+#ifndef NATIVE_JLED_H
+#define NATIVE_JLED_H
+
+#include "Arduino.h"
+
+class JLed
+{
+public:
+    explicit JLed(uint8_t) {}
+    JLed &LowActive() { return *this; }
+    JLed &Blink(uint16_t, uint16_t) { return *this; }
+    JLed &Repeat(uint16_t) { return *this; }
+    bool Update() { return false; }
+};
+
+#endif
@@ -31,7 +31,7 @@ typedef struct {
 /**
  * Static lookup table
  */
-dlms_unit_t dlms_units[] = {
+static dlms_unit_t dlms_units[] = {
 // code, unit		// Quantity			Unit name		SI definition (comment)
 //=====================================================================================================
 {1, "a"},		// time				year			52*7*24*60*60 s
@@ -103,7 +103,7 @@ dlms_unit_t dlms_units[] = {
 {0, ""}		// stop condition for iterator
 };
 	
-const char * dlms_get_unit(unsigned char code) {
+static inline const char * dlms_get_unit(unsigned char code) {
 	dlms_unit_t *it = dlms_units;
 	do { // linear search
 		if (it->code == code) {